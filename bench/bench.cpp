@@ -0,0 +1,257 @@
+#include "bench.h"
+#include "../common/network_utils.h"
+#include "../common/crypto_utils.h"
+#include "../common/file_transfer.h"
+#include "../common/logger.h"
+#include <iomanip>
+#include <fstream>
+#include <thread>
+#include <filesystem>
+#include <memory>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    struct Benchmark
+    {
+        const char *name;
+        const char *summary;
+        int (*run)(const BenchArgs &args);
+    };
+
+    const Benchmark BENCHMARKS[] = {
+        {"cipher", "cycles/byte of CryptoUtils::aesEncrypt against in-place CipherContext::process", benchCipher},
+        {"chunks", "loopback MB/s of fixed chunk sizes against FileTransfer's adaptive sizing [MB per case]", benchChunks},
+        {"striped", "loopback MB/s of one file striped over 1 to 16 connections [MB]", benchStriped},
+        {"batch", "loopback files/s of a tree of 1 KB files sent as one batch [files]", benchBatch},
+        {"sessions", "session lookups/updates per second, sharded SessionManager against one mutex [threads]", benchSessions},
+        {"slab", "bytes and lookup ns per session at 1M sessions, slab records against strings and vectors [sessions]", benchSlab},
+        {"fileio", "MB/s of the old stream file I/O against reserved positional writes and mapped reads [MB]", benchFileIo},
+    };
+
+    void usage()
+    {
+        Logger::console() << "Usage: bench.exe <benchmark> [options]" << std::endl;
+        for (const Benchmark &benchmark : BENCHMARKS)
+        {
+            Logger::console() << "  " << std::left << std::setw(10) << benchmark.name << benchmark.summary << std::endl;
+        }
+    }
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+uint64_t numberArg(const BenchArgs &args, size_t index, uint64_t fallback)
+{
+    if (index >= args.size())
+    {
+        return fallback;
+    }
+    try
+    {
+        uint64_t value = std::stoull(args[index]);
+        return value > 0 ? value : fallback;
+    }
+    catch (const std::exception &)
+    {
+        return fallback;
+    }
+}
+
+bool loopbackPair(SOCKET &first, SOCKET &second)
+{
+    first = second = INVALID_SOCKET;
+    SOCKET listener = NetworkUtils::createSocket();
+    if (listener == INVALID_SOCKET)
+    {
+        return false;
+    }
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    int addressSize = sizeof(address);
+    if (bind(listener, (sockaddr *)&address, sizeof(address)) == SOCKET_ERROR || listen(listener, 1) == SOCKET_ERROR ||
+        getsockname(listener, (sockaddr *)&address, &addressSize) == SOCKET_ERROR)
+    {
+        closesocket(listener);
+        return false;
+    }
+
+    first = NetworkUtils::createSocket();
+    if (first != INVALID_SOCKET && connect(first, (sockaddr *)&address, sizeof(address)) != SOCKET_ERROR)
+    {
+        second = accept(listener, nullptr, nullptr);
+    }
+    closesocket(listener);
+    if (second == INVALID_SOCKET)
+    {
+        if (first != INVALID_SOCKET)
+        {
+            closesocket(first);
+            first = INVALID_SOCKET;
+        }
+        return false;
+    }
+
+    NetworkUtils::configureSocket(first);
+    NetworkUtils::configureSocket(second);
+    return true;
+}
+
+bool writeTestFile(const std::string &path, uint64_t size)
+{
+    std::vector<BYTE> key, iv;
+    CryptoUtils::generateAESKey(key, iv);
+    CipherContext cipher(key, iv);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    std::vector<BYTE> zeros(1024 * 1024), block(zeros.size());
+    for (uint64_t offset = 0; offset < size && file; offset += block.size())
+    {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(block.size(), size - offset));
+        cipher.process(zeros.data(), block.data(), length, 1, offset);
+        file.write(reinterpret_cast<const char *>(block.data()), length);
+    }
+    return static_cast<bool>(file.flush());
+}
+
+double processCpuSeconds()
+{
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user))
+    {
+        return 0;
+    }
+    // FILETIME counts 100 ns ticks
+    auto seconds = [](const FILETIME &time)
+    {
+        return static_cast<double>(static_cast<uint64_t>(time.dwHighDateTime) << 32 | time.dwLowDateTime) / 1e7;
+    };
+    return seconds(kernel) + seconds(user);
+}
+
+double timeFileTransfer(const std::string &filePath, const std::string &saveDir, unsigned streamCount, bool integrityOnly)
+{
+    std::error_code error;
+    fs::remove_all(saveDir, error);
+
+    // Index 0 is the main connection, the rest are stripes
+    std::vector<SOCKET> senderSockets, receiverSockets;
+    auto closeAll = [&]
+    {
+        for (SOCKET socket : senderSockets)
+        {
+            closesocket(socket);
+        }
+        for (SOCKET socket : receiverSockets)
+        {
+            closesocket(socket);
+        }
+    };
+    for (unsigned i = 0; i < streamCount; i++)
+    {
+        SOCKET senderSocket, receiverSocket;
+        if (!loopbackPair(senderSocket, receiverSocket))
+        {
+            NetworkUtils::printMessage("ERROR", "Cannot open a loopback connection");
+            closeAll();
+            return -1;
+        }
+        senderSockets.push_back(senderSocket);
+        receiverSockets.push_back(receiverSocket);
+    }
+
+    std::vector<BYTE> key, iv;
+    CryptoUtils::generateAESKey(key, iv);
+    CipherContext cipher(key, iv);
+
+    // Unblocks the other side, which would otherwise wait for more data
+    auto abandon = [](const std::vector<SOCKET> &sockets)
+    {
+        for (SOCKET socket : sockets)
+        {
+            shutdown(socket, SD_BOTH);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    bool received = false;
+    std::thread receiver([&]
+                         {
+        std::vector<std::unique_ptr<FrameReader>> readers;
+        std::vector<FrameReader *> stripes;
+        for (SOCKET socket : receiverSockets)
+        {
+            readers.push_back(std::make_unique<FrameReader>(socket));
+        }
+        for (size_t i = 1; i < readers.size(); i++)
+        {
+            stripes.push_back(readers[i].get());
+        }
+        received = FileTransfer::receiveFile(*readers[0], cipher, saveDir, stripes, integrityOnly);
+        if (!received)
+        {
+            abandon(receiverSockets);
+        } });
+
+    std::vector<std::unique_ptr<FrameReader>> readers;
+    std::vector<FrameReader *> stripes;
+    for (SOCKET socket : senderSockets)
+    {
+        readers.push_back(std::make_unique<FrameReader>(socket));
+    }
+    for (size_t i = 1; i < readers.size(); i++)
+    {
+        stripes.push_back(readers[i].get());
+    }
+    bool sent = FileTransfer::sendFile(*readers[0], cipher, filePath, stripes, integrityOnly);
+    if (!sent)
+    {
+        abandon(senderSockets);
+    }
+    receiver.join();
+    double seconds = secondsSince(start);
+
+    readers.clear();
+    closeAll();
+    fs::remove_all(saveDir, error);
+    return sent && received ? seconds : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    const Benchmark *selected = nullptr;
+    for (const Benchmark &benchmark : BENCHMARKS)
+    {
+        if (argc >= 2 && benchmark.name == std::string(argv[1]))
+        {
+            selected = &benchmark;
+        }
+    }
+    if (!selected)
+    {
+        usage();
+        Logger::flush();
+        return 1;
+    }
+
+    // Per-transfer lines would drown the tables
+    Logger::setLevel(LogLevel::Warning);
+    if (!NetworkUtils::initialize() || !CryptoUtils::selfTest())
+    {
+        Logger::console() << "Cannot run benchmarks without Winsock and a working cipher" << std::endl;
+        Logger::flush();
+        return 1;
+    }
+
+    int result = selected->run(BenchArgs(argv + 2, argv + argc));
+    NetworkUtils::cleanup();
+    Logger::flush();
+    return result;
+}
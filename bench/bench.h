@@ -0,0 +1,49 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include "../common/network_utils.h"
+
+// Measurements behind the performance work, one per named benchmark:
+//   bench.exe <benchmark> [options]
+// Each prints a table to the console and needs no server running; the ones
+// that use the network talk to themselves over loopback.
+
+using BenchArgs = std::vector<std::string>;
+
+// Cycles per byte of the vector cipher wrappers against CipherContext
+int benchCipher(const BenchArgs &args);
+// Loopback throughput of fixed chunk sizes against the adaptive sizer
+int benchChunks(const BenchArgs &args);
+// End-to-end scaling of a striped transfer with its stream count
+int benchStriped(const BenchArgs &args);
+// Small files per second through one BatchTransfer
+int benchBatch(const BenchArgs &args);
+// Session table throughput under many threads, sharded against one mutex
+int benchSessions(const BenchArgs &args);
+// Memory and lookup time per session of the slab records against the old layout
+int benchSlab(const BenchArgs &args);
+// Receiver writes and sender reads, the old stream paths against file_io.h
+int benchFileIo(const BenchArgs &args);
+
+double secondsSince(std::chrono::steady_clock::time_point start);
+// args[index] as a number, or `fallback` when it is missing or malformed
+uint64_t numberArg(const BenchArgs &args, size_t index, uint64_t fallback);
+
+// Two ends of a TCP connection over 127.0.0.1, both configured like the
+// client's and server's sockets
+bool loopbackPair(SOCKET &first, SOCKET &second);
+// `size` bytes of keystream, which neither compresses nor dedups
+bool writeTestFile(const std::string &path, uint64_t size);
+// User plus kernel time of every thread in the process so far, so a
+// loopback run charges both ends
+double processCpuSeconds();
+// Seconds for FileTransfer to send `filePath` over `streamCount` fresh
+// loopback connections (the first as the main one, the rest as stripes)
+// into `saveDir`, which is emptied before and after; negative on failure.
+// `integrityOnly` sends the file unencrypted with per-chunk MACs.
+double timeFileTransfer(const std::string &filePath, const std::string &saveDir, unsigned streamCount = 1, bool integrityOnly = false);
+
+#endif
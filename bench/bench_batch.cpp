@@ -0,0 +1,113 @@
+#include "bench.h"
+#include "../common/batch_transfer.h"
+#include "../common/logger.h"
+#include <iomanip>
+#include <fstream>
+#include <thread>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    const uint64_t DEFAULT_FILE_COUNT = 100000;
+    const size_t FILE_SIZE = 1024;
+    const size_t FILES_PER_DIRECTORY = 1000;
+    const double TARGET_FILES_PER_SECOND = 50000;
+    const char *TREE_DIR = "bench_batch_tree";
+    const char *SAVE_DIR = "bench_batch_received";
+
+    bool writeTree(uint64_t fileCount)
+    {
+        std::vector<char> contents(FILE_SIZE);
+        for (uint64_t i = 0; i < fileCount; i++)
+        {
+            std::string directory = std::string(TREE_DIR) + "/d" + std::to_string(i / FILES_PER_DIRECTORY);
+            if (i % FILES_PER_DIRECTORY == 0)
+            {
+                std::error_code error;
+                fs::create_directories(directory, error);
+            }
+            for (size_t j = 0; j < contents.size(); j++)
+            {
+                contents[j] = static_cast<char>(i * 31 + j);
+            }
+            std::ofstream file(directory + "/f" + std::to_string(i) + ".txt", std::ios::binary | std::ios::trunc);
+            if (!file.write(contents.data(), contents.size()))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Seconds for one BatchTransfer of the tree over loopback; negative on failure
+    double timeBatch()
+    {
+        SOCKET senderSocket, receiverSocket;
+        if (!loopbackPair(senderSocket, receiverSocket))
+        {
+            NetworkUtils::printMessage("ERROR", "Cannot open a loopback connection");
+            return -1;
+        }
+
+        std::vector<BYTE> key, iv;
+        CryptoUtils::generateAESKey(key, iv);
+        CipherContext cipher(key, iv);
+
+        auto start = std::chrono::steady_clock::now();
+        bool received = false;
+        std::thread receiver([&]
+                             {
+            FrameReader reader(receiverSocket);
+            received = BatchTransfer::receive(reader, cipher, SAVE_DIR);
+            if (!received)
+            {
+                shutdown(receiverSocket, SD_BOTH);
+            } });
+
+        FrameReader reader(senderSocket);
+        bool sent = BatchTransfer::send(reader, cipher, TREE_DIR);
+        if (!sent)
+        {
+            shutdown(senderSocket, SD_BOTH);
+        }
+        receiver.join();
+        double seconds = secondsSince(start);
+
+        closesocket(senderSocket);
+        closesocket(receiverSocket);
+        return sent && received ? seconds : -1;
+    }
+}
+
+int benchBatch(const BenchArgs &args)
+{
+    uint64_t fileCount = std::min<uint64_t>(numberArg(args, 0, DEFAULT_FILE_COUNT), BatchTransfer::MAX_FILES);
+
+    std::error_code error;
+    fs::remove_all(TREE_DIR, error);
+    fs::remove_all(SAVE_DIR, error);
+    if (!writeTree(fileCount))
+    {
+        NetworkUtils::printMessage("ERROR", "Cannot write the test tree");
+        fs::remove_all(TREE_DIR, error);
+        return 1;
+    }
+
+    double seconds = timeBatch();
+    fs::remove_all(TREE_DIR, error);
+    fs::remove_all(SAVE_DIR, error);
+    if (seconds < 0)
+    {
+        return 1;
+    }
+
+    double filesPerSecond = fileCount / seconds;
+    Logger::console() << fileCount << " files of " << FILE_SIZE << " bytes over 127.0.0.1, BatchTransfer::send to receive" << std::endl;
+    Logger::console() << std::fixed << std::setprecision(2) << "seconds:  " << seconds << std::endl;
+    Logger::console() << std::fixed << std::setprecision(0) << "files/s:  " << filesPerSecond << " (target " << TARGET_FILES_PER_SECOND << ", "
+                      << (filesPerSecond >= TARGET_FILES_PER_SECOND ? "met" : "missed") << ")" << std::endl;
+    Logger::console() << std::fixed << std::setprecision(1) << "MB/s:     " << fileCount * FILE_SIZE / seconds / (1024 * 1024) << std::endl;
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include "bench.h"
+#include "../common/crypto_utils.h"
+#include "../common/file_transfer.h"
+#include "../common/logger.h"
+#include <iomanip>
+#include <thread>
+#include <cstdio>
+
+namespace
+{
+    const uint64_t DEFAULT_MEGABYTES_PER_CASE = 256;
+    // 4 KB is the old hard-coded CHUNK_SIZE
+    const size_t CHUNK_SIZES[] = {4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024};
+    const char *TEST_FILE = "bench_chunks.bin";
+    const char *SAVE_DIR = "bench_chunks_received";
+
+    struct SweepResult
+    {
+        double seconds = -1;
+        uint64_t frames = 0;
+        uint64_t recvCalls = 0;
+    };
+
+    // Encrypted frames of exactly `chunkSize` from one thread to another,
+    // the way a transfer without an adaptive sizer would frame a file
+    SweepResult sendFixedChunks(const CipherContext &cipher, size_t chunkSize, uint64_t totalBytes)
+    {
+        SweepResult result;
+        SOCKET senderSocket, receiverSocket;
+        if (!loopbackPair(senderSocket, receiverSocket))
+        {
+            NetworkUtils::printMessage("ERROR", "Cannot open a loopback connection");
+            return result;
+        }
+
+        uint64_t frames = (totalBytes + chunkSize - 1) / chunkSize;
+        auto start = std::chrono::steady_clock::now();
+        bool sent = true;
+        std::thread sender([&]
+                           {
+            std::vector<BYTE> plain(chunkSize, 0x5a), encrypted(chunkSize);
+            for (uint64_t i = 0; i < frames && sent; i++)
+            {
+                cipher.process(plain.data(), encrypted.data(), chunkSize, 1, i * chunkSize);
+                FrameView frame{encrypted.data(), chunkSize};
+                sent = NetworkUtils::sendFrames(senderSocket, &frame, 1);
+            }
+            if (!sent)
+            {
+                shutdown(senderSocket, SD_BOTH);
+            } });
+
+        FrameReader reader(receiverSocket);
+        std::vector<BYTE> data;
+        uint64_t received = 0;
+        for (; received < frames; received++)
+        {
+            if (!reader.next(data) || data.size() != chunkSize)
+            {
+                shutdown(receiverSocket, SD_BOTH);
+                break;
+            }
+            cipher.process(data.data(), data.size(), 1, received * chunkSize);
+        }
+        sender.join();
+
+        if (sent && received == frames)
+        {
+            result.seconds = secondsSince(start);
+            result.frames = frames;
+            result.recvCalls = reader.getRecvCalls();
+        }
+        closesocket(senderSocket);
+        closesocket(receiverSocket);
+        return result;
+    }
+
+    // One real sendFile, with the process CPU time it took per GB
+    bool printTransferRow(const char *label, uint64_t totalBytes, bool integrityOnly)
+    {
+        double cpuBefore = processCpuSeconds();
+        double seconds = timeFileTransfer(TEST_FILE, SAVE_DIR, 1, integrityOnly);
+        double cpuSeconds = processCpuSeconds() - cpuBefore;
+        if (seconds < 0)
+        {
+            return false;
+        }
+        double gigabytes = static_cast<double>(totalBytes) / (1024 * 1024 * 1024);
+        Logger::console() << std::left << std::setw(12) << label << std::right << std::fixed << std::setprecision(0)
+                          << std::setw(12) << totalBytes / seconds / (1024 * 1024) << std::setprecision(2) << std::setw(12)
+                          << cpuSeconds / gigabytes << std::endl;
+        return true;
+    }
+
+    void printRow(const std::string &label, uint64_t frames, uint64_t recvCalls, uint64_t totalBytes, double seconds)
+    {
+        Logger::console() << std::left << std::setw(12) << label << std::right << std::setw(12) << frames << std::setw(12) << recvCalls
+                          << std::fixed << std::setprecision(0) << std::setw(12) << totalBytes / seconds / (1024 * 1024) << std::endl;
+    }
+}
+
+int benchChunks(const BenchArgs &args)
+{
+    uint64_t totalBytes = numberArg(args, 0, DEFAULT_MEGABYTES_PER_CASE) * 1024 * 1024;
+
+    std::vector<BYTE> key, iv;
+    CryptoUtils::generateAESKey(key, iv);
+    CipherContext cipher(key, iv);
+
+    Logger::console() << (totalBytes >> 20) << " MB per case over 127.0.0.1, encrypted with AES-CTR" << std::endl;
+    Logger::console() << std::left << std::setw(12) << "chunk" << std::right << std::setw(12) << "frames" << std::setw(12) << "recv calls"
+                      << std::setw(12) << "MB/s" << std::endl;
+
+    for (size_t chunkSize : CHUNK_SIZES)
+    {
+        SweepResult result = sendFixedChunks(cipher, chunkSize, totalBytes);
+        if (result.seconds < 0)
+        {
+            return 1;
+        }
+        printRow(std::to_string(chunkSize / 1024) + " KB", result.frames, result.recvCalls, totalBytes, result.seconds);
+    }
+
+    // The real thing end to end: file reads, the pipeline, the checksum tree
+    // and the receiver's writes all included, so these are floors rather
+    // than like-for-like rows. Integrity-only skips the cipher and sends
+    // from the file cache, which is where its CPU per GB should drop.
+    if (!writeTestFile(TEST_FILE, totalBytes))
+    {
+        NetworkUtils::printMessage("ERROR", "Cannot write the test file");
+        return 1;
+    }
+    Logger::console() << std::endl
+                      << "FileTransfer::sendFile, " << FileTransfer::MIN_CHUNK_SIZE / 1024 << " KB to "
+                      << FileTransfer::MAX_CHUNK_SIZE / (1024 * 1024) << " MB chunks; CPU counts both ends" << std::endl;
+    Logger::console() << std::left << std::setw(12) << "mode" << std::right << std::setw(12) << "MB/s" << std::setw(12) << "CPU s/GB" << std::endl;
+    bool ok = printTransferRow("encrypted", totalBytes, false) && printTransferRow("integrity", totalBytes, true);
+    std::remove(TEST_FILE);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,78 @@
+#include "bench.h"
+#include "../common/crypto_utils.h"
+#include "../common/logger.h"
+#include <iomanip>
+#include <algorithm>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+namespace
+{
+    // Enough bytes per case for frequency steps to average out
+    const uint64_t BYTES_PER_CASE = 256ull * 1024 * 1024;
+    const size_t CHUNK_SIZES[] = {4 * 1024, 64 * 1024, 1024 * 1024, 4 * 1024 * 1024};
+
+    // Keeps the optimizer from dropping the work being timed
+    volatile BYTE sink = 0;
+
+    struct Result
+    {
+        double cyclesPerByte;
+        double megabytesPerSecond;
+    };
+
+    template <typename Encrypt>
+    Result measure(size_t chunkSize, Encrypt encrypt)
+    {
+        uint64_t chunks = std::max<uint64_t>(1, BYTES_PER_CASE / chunkSize);
+        encrypt(0);
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t startCycles = __rdtsc();
+        for (uint64_t i = 0; i < chunks; i++)
+        {
+            encrypt(i);
+        }
+        uint64_t cycles = __rdtsc() - startCycles;
+        double seconds = secondsSince(start);
+
+        double bytes = static_cast<double>(chunks) * chunkSize;
+        return {cycles / bytes, bytes / seconds / (1024 * 1024)};
+    }
+}
+
+int benchCipher(const BenchArgs &)
+{
+    std::vector<BYTE> key, iv;
+    CryptoUtils::generateAESKey(key, iv);
+    CipherContext cipher(key, iv);
+
+    Logger::console() << "AES-CTR kernel: " << AesCtr::implementationName(AesCtr::activeImplementation())
+                      << "; cycles are TSC ticks" << std::endl;
+    Logger::console() << std::left << std::setw(10) << "chunk" << std::right << std::setw(16) << "wrapper c/B" << std::setw(16)
+                      << "wrapper MB/s" << std::setw(16) << "in place c/B" << std::setw(16) << "in place MB/s" << std::endl;
+
+    for (size_t chunkSize : CHUNK_SIZES)
+    {
+        std::vector<BYTE> data(chunkSize, 0x5a);
+
+        // What every chunk used to pay: a key schedule, a nonce and a fresh
+        // result vector per call
+        Result wrapper = measure(chunkSize, [&](uint64_t)
+                                 { sink ^= CryptoUtils::aesEncrypt(key, iv, data).back(); });
+        // One context per session, chunks transformed where they lie
+        Result inPlace = measure(chunkSize, [&](uint64_t i)
+                                 { cipher.process(data.data(), data.size(), 1, i * chunkSize); });
+        sink ^= data.back();
+
+        Logger::console() << std::left << std::setw(10) << (std::to_string(chunkSize / 1024) + " KB") << std::right << std::fixed
+                          << std::setprecision(2) << std::setw(16) << wrapper.cyclesPerByte << std::setprecision(0) << std::setw(16)
+                          << wrapper.megabytesPerSecond << std::setprecision(2) << std::setw(16) << inPlace.cyclesPerByte
+                          << std::setprecision(0) << std::setw(16) << inPlace.megabytesPerSecond << std::endl;
+    }
+    return 0;
+}
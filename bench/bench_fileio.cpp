@@ -0,0 +1,136 @@
+#include "bench.h"
+#include "../common/crypto_utils.h"
+#include "../common/file_io.h"
+#include "../common/logger.h"
+#include <iomanip>
+#include <fstream>
+#include <cstdio>
+
+namespace
+{
+    const uint64_t DEFAULT_MEGABYTES = 1024;
+    // The receiver's chunk size once the adaptive sizer has ramped up
+    const size_t CHUNK_SIZE = 1024 * 1024;
+    const char *TEST_FILE = "bench_fileio.bin";
+
+    // The old receiver: sequential writes through the default stream buffer
+    bool writeStream(const std::vector<BYTE> &chunk, uint64_t totalBytes)
+    {
+        std::ofstream file(TEST_FILE, std::ios::binary | std::ios::trunc);
+        for (uint64_t offset = 0; offset < totalBytes && file; offset += chunk.size())
+        {
+            size_t length = static_cast<size_t>(std::min<uint64_t>(chunk.size(), totalBytes - offset));
+            file.write(reinterpret_cast<const char *>(chunk.data()), length);
+        }
+        file.close();
+        return !file.fail();
+    }
+
+    // The current receiver: the size reserved up front, then positional writes
+    bool writeReserved(const std::vector<BYTE> &chunk, uint64_t totalBytes, bool flush)
+    {
+        FileWriter file;
+        if (!file.open(TEST_FILE, totalBytes, true))
+        {
+            return false;
+        }
+        for (uint64_t offset = 0; offset < totalBytes; offset += chunk.size())
+        {
+            size_t length = static_cast<size_t>(std::min<uint64_t>(chunk.size(), totalBytes - offset));
+            if (!file.writeAt(offset, chunk.data(), length))
+            {
+                return false;
+            }
+        }
+        return !flush || file.flush();
+    }
+
+    // The old sender: each chunk read into a buffer, then encrypted into the
+    // send buffer
+    bool readStream(const CipherContext &cipher, uint64_t totalBytes)
+    {
+        std::ifstream file(TEST_FILE, std::ios::binary);
+        std::vector<BYTE> plain(CHUNK_SIZE), encrypted(CHUNK_SIZE);
+        for (uint64_t offset = 0; offset < totalBytes; offset += CHUNK_SIZE)
+        {
+            size_t length = static_cast<size_t>(std::min<uint64_t>(CHUNK_SIZE, totalBytes - offset));
+            if (!file.read(reinterpret_cast<char *>(plain.data()), length))
+            {
+                return false;
+            }
+            cipher.process(plain.data(), encrypted.data(), length, 1, offset);
+        }
+        return true;
+    }
+
+    // The current sender: chunks encrypted straight out of the mapping, with
+    // the same readahead window FileTransfer keeps
+    bool readMapped(const CipherContext &cipher, uint64_t totalBytes)
+    {
+        MappedFile mapped;
+        if (!mapped.open(TEST_FILE) || mapped.size() != totalBytes)
+        {
+            return false;
+        }
+        std::vector<BYTE> encrypted(CHUNK_SIZE);
+        uint64_t prefetchedTo = 0;
+        for (uint64_t offset = 0; offset < totalBytes; offset += CHUNK_SIZE)
+        {
+            if (offset + MappedFile::PREFETCH_WINDOW / 2 >= prefetchedTo)
+            {
+                mapped.prefetch(prefetchedTo, MappedFile::PREFETCH_WINDOW);
+                prefetchedTo += MappedFile::PREFETCH_WINDOW;
+            }
+            size_t length = static_cast<size_t>(std::min<uint64_t>(CHUNK_SIZE, totalBytes - offset));
+            cipher.process(mapped.data() + offset, encrypted.data(), length, 1, offset);
+        }
+        return true;
+    }
+
+    // MB/s of one case, or a failure message and false
+    template <typename Case>
+    bool runCase(const char *label, uint64_t totalBytes, Case run)
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (!run())
+        {
+            NetworkUtils::printMessage("ERROR", std::string("Cannot run the ") + label + " case");
+            return false;
+        }
+        double seconds = secondsSince(start);
+        Logger::console() << std::left << std::setw(28) << label << std::right << std::fixed << std::setprecision(0)
+                          << std::setw(12) << totalBytes / seconds / (1024 * 1024) << std::endl;
+        return true;
+    }
+}
+
+int benchFileIo(const BenchArgs &args)
+{
+    uint64_t totalBytes = numberArg(args, 0, DEFAULT_MEGABYTES) * 1024 * 1024;
+
+    std::vector<BYTE> key, iv;
+    CryptoUtils::generateAESKey(key, iv);
+    CipherContext cipher(key, iv);
+    std::vector<BYTE> chunk(CHUNK_SIZE, 0x5a);
+
+    Logger::console() << (totalBytes >> 20) << " MB in " << CHUNK_SIZE / 1024 << " KB chunks" << std::endl;
+    Logger::console() << std::left << std::setw(28) << "case" << std::right << std::setw(12) << "MB/s" << std::endl;
+
+    // Each write case replaces the file, so none of them extends an old one
+    bool ok = runCase("write: ofstream", totalBytes, [&]
+                      { return writeStream(chunk, totalBytes); }) &&
+              runCase("write: reserved + writeAt", totalBytes, [&]
+                      { return writeReserved(chunk, totalBytes, false); }) &&
+              runCase("write: same, flushed", totalBytes, [&]
+                      { return writeReserved(chunk, totalBytes, true); });
+
+    // The reads find the file in the page cache the writes just filled, so
+    // they compare the copies and the syscalls rather than the disk
+    ok = ok && runCase("read+encrypt: ifstream", totalBytes, [&]
+                       { return readStream(cipher, totalBytes); }) &&
+         runCase("read+encrypt: mapped", totalBytes, [&]
+                 { return readMapped(cipher, totalBytes); });
+
+    std::remove(TEST_FILE);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include "bench.h"
+#include "global_session_table.h"
+#include "../common/session_manager.h"
+#include "../common/logger.h"
+#include <iomanip>
+#include <thread>
+#include <random>
+
+namespace
+{
+    const uint64_t DEFAULT_THREADS = 64;
+    const size_t SESSION_COUNT = 100000;
+    const std::chrono::seconds RUN_TIME{3};
+    // Per 100 operations: the rest are getSession and validateSession
+    const unsigned UPDATES_PER_100 = 18;
+    const unsigned CHURN_PER_100 = 2; // create plus remove
+
+    // Million operations per second of the read-mostly mix, with every
+    // thread drawing from the same preloaded sessions
+    template <typename Table>
+    double runMix(Table &table, unsigned threadCount)
+    {
+        std::vector<BYTE> key(16, 0x11), iv(16, 0x22);
+        std::vector<std::string> sessionIds;
+        sessionIds.reserve(SESSION_COUNT);
+        for (size_t i = 0; i < SESSION_COUNT; i++)
+        {
+            sessionIds.push_back(table.createSession(CryptoUtils::generateUUID(), key, iv));
+        }
+        std::string clientUUID = CryptoUtils::generateUUID();
+
+        std::atomic<bool> stop{false};
+        std::vector<uint64_t> operations(threadCount);
+        std::vector<std::thread> threads;
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned t = 0; t < threadCount; t++)
+        {
+            threads.emplace_back([&, t]
+                                 {
+                std::minstd_rand random(t + 1);
+                Session session;
+                uint64_t count = 0;
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    const std::string &sessionId = sessionIds[random() % sessionIds.size()];
+                    unsigned kind = random() % 100;
+                    if (kind < CHURN_PER_100)
+                    {
+                        table.removeSession(table.createSession(clientUUID, key, iv));
+                    }
+                    else if (kind < CHURN_PER_100 + UPDATES_PER_100)
+                    {
+                        table.updateActivity(sessionId);
+                    }
+                    else if (kind % 2 == 0)
+                    {
+                        table.getSession(sessionId, session);
+                    }
+                    else
+                    {
+                        table.validateSession(sessionId);
+                    }
+                    count++;
+                }
+                operations[t] = count; });
+        }
+        std::this_thread::sleep_for(RUN_TIME);
+        stop = true;
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+        double seconds = secondsSince(start);
+
+        uint64_t total = 0;
+        for (uint64_t count : operations)
+        {
+            total += count;
+        }
+        return total / seconds / 1e6;
+    }
+}
+
+int benchSessions(const BenchArgs &args)
+{
+    unsigned threadCount = static_cast<unsigned>(std::min<uint64_t>(numberArg(args, 0, DEFAULT_THREADS), 1024));
+
+    Logger::console() << threadCount << " threads for " << RUN_TIME.count() << " s over " << SESSION_COUNT << " sessions; per 100 operations "
+                      << CHURN_PER_100 << " create+remove, " << UPDATES_PER_100 << " updateActivity, the rest getSession/validateSession"
+                      << std::endl;
+
+    double global, sharded;
+    {
+        GlobalSessionTable table;
+        global = runMix(table, threadCount);
+    }
+    {
+        SessionManager table;
+        sharded = runMix(table, threadCount);
+    }
+
+    Logger::console() << std::left << std::setw(28) << "table" << std::right << std::setw(12) << "Mops/s" << std::endl;
+    Logger::console() << std::left << std::setw(28) << "one mutex, unordered_map" << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(12) << global << std::endl;
+    Logger::console() << std::left << std::setw(28) << "SessionManager, sharded" << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(12) << sharded << "  (" << sharded / global << "x)" << std::endl;
+    return 0;
+}
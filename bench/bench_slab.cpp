@@ -0,0 +1,108 @@
+#include "bench.h"
+#include "global_session_table.h"
+#include "../common/session_manager.h"
+#include "../common/logger.h"
+#include <psapi.h>
+#include <iomanip>
+#include <random>
+
+namespace
+{
+    const uint64_t DEFAULT_SESSION_COUNT = 1000000;
+    const size_t LOOKUP_COUNT = 1000000;
+
+    struct LayoutResult
+    {
+        double bytesPerSession = 0;
+        double createNanos = 0;
+        double lookupNanos = 0;
+    };
+
+    // Committed private bytes, so allocator headers and slack count too
+    uint64_t privateBytes()
+    {
+        PROCESS_MEMORY_COUNTERS_EX counters = {};
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS *>(&counters), sizeof(counters)))
+        {
+            return 0;
+        }
+        return counters.PrivateUsage;
+    }
+
+    // Creates `count` sessions and records their IDs in binary, so keeping
+    // them costs nothing while the table's growth is measured
+    template <typename Table>
+    void fill(Table &table, uint64_t count, std::vector<BinaryUuid> &sessionIds, LayoutResult &result)
+    {
+        std::vector<BYTE> key(16, 0x11), iv(16, 0x22);
+        sessionIds.assign(count, BinaryUuid());
+
+        uint64_t before = privateBytes();
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < count; i++)
+        {
+            BinaryUuid::parse(table.createSession(CryptoUtils::generateUUID(), key, iv), sessionIds[i]);
+        }
+        result.createNanos = secondsSince(start) * 1e9 / count;
+        uint64_t after = privateBytes();
+        result.bytesPerSession = after > before ? static_cast<double>(after - before) / count : 0;
+    }
+
+    // Random getSession calls from one thread; negative if any missed
+    template <typename Table>
+    double lookupNanos(Table &table, const std::vector<BinaryUuid> &sessionIds)
+    {
+        std::minstd_rand random(1);
+        std::vector<std::string> lookups;
+        lookups.reserve(LOOKUP_COUNT);
+        for (size_t i = 0; i < LOOKUP_COUNT; i++)
+        {
+            lookups.push_back(sessionIds[random() % sessionIds.size()].toString());
+        }
+
+        Session session;
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const std::string &sessionId : lookups)
+        {
+            found += table.getSession(sessionId, session);
+        }
+        double seconds = secondsSince(start);
+        return found == lookups.size() ? seconds * 1e9 / lookups.size() : -1;
+    }
+
+    void printRow(const char *layout, const LayoutResult &result)
+    {
+        Logger::console() << std::left << std::setw(34) << layout << std::right << std::fixed << std::setprecision(0) << std::setw(10)
+                          << result.bytesPerSession << std::setw(12) << result.createNanos << std::setw(12) << result.lookupNanos << std::endl;
+    }
+}
+
+int benchSlab(const BenchArgs &args)
+{
+    uint64_t sessionCount = numberArg(args, 0, DEFAULT_SESSION_COUNT);
+
+    // Both tables stay alive until the end, so the second one cannot grow
+    // into memory the first one freed
+    SessionManager compact;
+    GlobalSessionTable legacy;
+    std::vector<BinaryUuid> compactIds, legacyIds;
+    LayoutResult compactResult, legacyResult;
+
+    fill(compact, sessionCount, compactIds, compactResult);
+    fill(legacy, sessionCount, legacyIds, legacyResult);
+    compactResult.lookupNanos = lookupNanos(compact, compactIds);
+    legacyResult.lookupNanos = lookupNanos(legacy, legacyIds);
+    if (compactResult.lookupNanos < 0 || legacyResult.lookupNanos < 0)
+    {
+        NetworkUtils::printMessage("ERROR", "A created session could not be found again");
+        return 1;
+    }
+
+    Logger::console() << sessionCount << " sessions, " << LOOKUP_COUNT << " random getSession calls on one thread" << std::endl;
+    Logger::console() << std::left << std::setw(34) << "layout" << std::right << std::setw(10) << "B/session" << std::setw(12)
+                      << "create ns" << std::setw(12) << "lookup ns" << std::endl;
+    printRow("strings and vectors, one map", legacyResult);
+    printRow("records in slabs, sharded index", compactResult);
+    return 0;
+}
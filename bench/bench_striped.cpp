@@ -0,0 +1,53 @@
+#include "bench.h"
+#include "../common/striped_transfer.h"
+#include "../common/logger.h"
+#include <iomanip>
+#include <cstdio>
+
+namespace
+{
+    const uint64_t DEFAULT_MEGABYTES = 1024;
+    const unsigned STREAM_COUNTS[] = {1, 2, 4, 8, 16};
+    const char *TEST_FILE = "bench_striped.bin";
+    const char *SAVE_DIR = "bench_striped_received";
+}
+
+int benchStriped(const BenchArgs &args)
+{
+    uint64_t fileSize = numberArg(args, 0, DEFAULT_MEGABYTES) * 1024 * 1024;
+    if (fileSize < StripedTransfer::MIN_STRIPED_SIZE)
+    {
+        Logger::console() << "Files under " << (StripedTransfer::MIN_STRIPED_SIZE >> 20) << " MB are never striped" << std::endl;
+        return 1;
+    }
+    if (!writeTestFile(TEST_FILE, fileSize))
+    {
+        NetworkUtils::printMessage("ERROR", "Cannot write the test file");
+        return 1;
+    }
+
+    Logger::console() << (fileSize >> 20) << " MB file over 127.0.0.1, sendFile to receiveFile" << std::endl;
+    Logger::console() << std::left << std::setw(10) << "streams" << std::right << std::setw(12) << "seconds" << std::setw(12) << "MB/s"
+                      << std::setw(12) << "speedup" << std::endl;
+
+    double singleStream = 0;
+    int result = 0;
+    for (unsigned streamCount : STREAM_COUNTS)
+    {
+        double seconds = timeFileTransfer(TEST_FILE, SAVE_DIR, streamCount);
+        if (seconds < 0)
+        {
+            result = 1;
+            break;
+        }
+        if (streamCount == 1)
+        {
+            singleStream = seconds;
+        }
+        Logger::console() << std::left << std::setw(10) << streamCount << std::right << std::fixed << std::setprecision(2)
+                          << std::setw(12) << seconds << std::setprecision(0) << std::setw(12) << fileSize / seconds / (1024 * 1024)
+                          << std::setprecision(2) << std::setw(11) << singleStream / seconds << "x" << std::endl;
+    }
+    std::remove(TEST_FILE);
+    return result;
+}
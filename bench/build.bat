@@ -0,0 +1,9 @@
+@echo off
+echo Building Benchmarks...
+g++ -o bench.exe bench.cpp bench_cipher.cpp bench_chunks.cpp bench_striped.cpp bench_batch.cpp bench_sessions.cpp bench_slab.cpp bench_fileio.cpp ../common/crypto_utils.cpp ../common/aes_ctr.cpp ../common/network_utils.cpp ../common/file_transfer.cpp ../common/transfer_pipeline.cpp ../common/transfer_journal.cpp ../common/delta_sync.cpp ../common/striped_transfer.cpp ../common/file_io.cpp ../common/io_engine.cpp ../common/lz_codec.cpp ../common/chunk_store.cpp ../common/merkle_tree.cpp ../common/batch_transfer.cpp ../common/ranged_transfer.cpp ../common/transfer_progress.cpp ../common/logger.cpp ../common/session_ticket.cpp ../common/session_manager.cpp -lws2_32 -lmswsock -lcrypt32 -lpsapi -std=c++17 -static -O2
+if %errorlevel% == 0 (
+    echo Benchmarks built successfully!
+) else (
+    echo Build failed!
+)
+pause
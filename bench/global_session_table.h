@@ -0,0 +1,70 @@
+#ifndef GLOBAL_SESSION_TABLE_H
+#define GLOBAL_SESSION_TABLE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include "../common/session_manager.h"
+
+// The session table before sharding and slabs, kept as the benchmarks'
+// reference: one map behind one mutex, sessions keyed by their UUID string
+// and holding their IDs, key and IV in strings and vectors
+class GlobalSessionTable
+{
+public:
+    std::string createSession(const std::string &clientUUID, const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV)
+    {
+        Session session;
+        session.sessionId = CryptoUtils::generateUUID();
+        session.clientUUID = clientUUID;
+        session.aesKey = aesKey;
+        session.aesIV = aesIV;
+        session.createdAt = session.lastActivity = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        sessions[session.sessionId] = session;
+        return session.sessionId;
+    }
+
+    bool getSession(const std::string &sessionId, Session &session)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = sessions.find(sessionId);
+        if (it == sessions.end())
+        {
+            return false;
+        }
+        session = it->second;
+        return true;
+    }
+
+    bool validateSession(const std::string &sessionId)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = sessions.find(sessionId);
+        return it != sessions.end() && std::chrono::steady_clock::now() - it->second.lastActivity < std::chrono::minutes(30);
+    }
+
+    void updateActivity(const std::string &sessionId)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = sessions.find(sessionId);
+        if (it != sessions.end())
+        {
+            it->second.lastActivity = std::chrono::steady_clock::now();
+        }
+    }
+
+    void removeSession(const std::string &sessionId)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        sessions.erase(sessionId);
+    }
+
+private:
+    std::unordered_map<std::string, Session> sessions;
+    std::mutex mutex;
+};
+
+#endif
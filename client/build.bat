@@ -1,6 +1,6 @@
 @echo off
 echo Building Client...
-g++ -o client.exe client.cpp ../common/crypto_utils.cpp ../common/network_utils.cpp ../common/file_transfer.cpp ../common/session_manager.cpp -lws2_32 -lcrypt32 -std=c++17 -static
+g++ -o client.exe client.cpp ../common/crypto_utils.cpp ../common/aes_ctr.cpp ../common/network_utils.cpp ../common/file_transfer.cpp ../common/transfer_pipeline.cpp ../common/transfer_journal.cpp ../common/delta_sync.cpp ../common/striped_transfer.cpp ../common/file_io.cpp ../common/io_engine.cpp ../common/lz_codec.cpp ../common/chunk_store.cpp ../common/merkle_tree.cpp ../common/batch_transfer.cpp ../common/ranged_transfer.cpp ../common/transfer_progress.cpp ../common/logger.cpp ../common/session_ticket.cpp ../common/session_manager.cpp -lws2_32 -lmswsock -lcrypt32 -std=c++17 -static -O2
 if %errorlevel% == 0 (
     echo Client built successfully!
 ) else (
@@ -1,6 +1,10 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <thread>
+#include <chrono>
 
 // Windows headers - CORRECT ORDER
 #include <winsock2.h>
@@ -14,18 +18,36 @@
 #include "../common/network_utils.h"
 #include "../common/crypto_utils.h"
 #include "../common/file_transfer.h"
+#include "../common/striped_transfer.h"
+#include "../common/session_ticket.h"
+#include "../common/batch_transfer.h"
+#include "../common/ranged_transfer.h"
+#include "../common/io_engine.h"
+#include "../common/logger.h"
+#include "../common/transfer_progress.h"
 
 class SimpleClient
 {
 private:
     SOCKET clientSocket;
+    std::unique_ptr<FrameReader> reader; // every read on clientSocket goes through it
+    std::vector<std::unique_ptr<FrameReader>> stripes; // extra streams for large transfers
+    unsigned streamCount;
+    bool integrityOnly; // file data travels unencrypted, with chunk MACs
     std::vector<BYTE> aesKey;
     std::vector<BYTE> aesIV;
+    CipherContext cipher;
     std::string clientUUID;
+    std::vector<BYTE> ticket; // resumption ticket, empty if the server gave none
+    sockaddr_in serverAddr;
     bool connected;
 
+    static const unsigned RECONNECT_ATTEMPTS = 5;
+    static constexpr std::chrono::milliseconds RECONNECT_PAUSE{500};
+
 public:
-    SimpleClient() : clientSocket(INVALID_SOCKET), connected(false)
+    explicit SimpleClient(unsigned streamCount = 1, bool integrityOnly = false)
+        : clientSocket(INVALID_SOCKET), streamCount(streamCount), integrityOnly(integrityOnly), serverAddr(), connected(false)
     {
         _mkdir("received_files");
         _mkdir("files_to_send");
@@ -38,52 +60,138 @@ public:
 
     bool connectToServer(const std::string &ip, int port)
     {
-        std::cout << "Connecting to " << ip << ":" << port << "..." << std::endl;
+        Logger::console() << "Connecting to " << ip << ":" << port << "..." << std::endl;
 
         if (!NetworkUtils::initialize())
         {
-            std::cout << "Network initialization failed" << std::endl;
+            Logger::console() << "Network initialization failed" << std::endl;
             return false;
         }
 
-        clientSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-        if (clientSocket == INVALID_SOCKET)
+        if (!CryptoUtils::selfTest())
         {
-            std::cout << "Socket creation failed" << std::endl;
+            Logger::console() << "Refusing to connect with a broken cipher" << std::endl;
             return false;
         }
 
-        sockaddr_in serverAddr;
         serverAddr.sin_family = AF_INET;
         serverAddr.sin_port = htons(port);
         inet_pton(AF_INET, ip.c_str(), &serverAddr.sin_addr);
 
+        if (!openSession())
+        {
+            return false;
+        }
+        connected = true;
+        return true;
+    }
+
+    // Connects and answers the server's challenge with a hello that gets a
+    // session: a new one, or the previous one back while holding a
+    // resumption ticket
+    bool openSession()
+    {
+        clientSocket = NetworkUtils::createSocket();
+        if (clientSocket == INVALID_SOCKET)
+        {
+            Logger::console() << "Socket creation failed" << std::endl;
+            return false;
+        }
+
         if (::connect(clientSocket, (sockaddr *)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR)
         {
-            std::cout << "Connection failed! Make sure server is running." << std::endl;
-            closesocket(clientSocket);
+            Logger::console() << "Connection failed! Make sure server is running." << std::endl;
+            closeStreams();
+            return false;
+        }
+
+        NetworkUtils::configureSocket(clientSocket);
+        reader = std::make_unique<FrameReader>(clientSocket);
+        Logger::console() << "Connected to server successfully!" << std::endl;
+
+        std::vector<BYTE> challenge;
+        if (!reader->next(challenge) || challenge.size() != StripedTransfer::CHALLENGE_SIZE)
+        {
+            Logger::console() << "Failed to receive the server's challenge" << std::endl;
+            closeStreams();
             return false;
         }
 
-        std::cout << "Connected to server successfully!" << std::endl;
+        BYTE options = integrityOnly ? StripedTransfer::HELLO_OPTION_INTEGRITY_ONLY : 0;
+        bool resuming = !ticket.empty();
+        std::vector<BYTE> hello = resuming ? SessionTicket::resumeHello(ticket, options, challenge, aesKey, aesIV)
+                                           : std::vector<BYTE>{StripedTransfer::HELLO_NEW_CLIENT, options};
+        if (!NetworkUtils::sendData(clientSocket, hello))
+        {
+            Logger::console() << "Failed to send hello" << std::endl;
+            closeStreams();
+            return false;
+        }
 
         // Receive session keys
         std::vector<BYTE> keyData;
-        std::cout << "Receiving encryption keys..." << std::endl;
+        Logger::console() << (resuming ? "Resuming session..." : "Receiving encryption keys...") << std::endl;
 
-        if (!NetworkUtils::receiveData(clientSocket, keyData))
+        if (!reader->next(keyData))
         {
-            std::cout << "Failed to receive session keys" << std::endl;
-            closesocket(clientSocket);
+            Logger::console() << "Failed to receive session keys" << std::endl;
+            closeStreams();
             return false;
         }
 
-        std::cout << "Received key data size: " << keyData.size() << " bytes" << std::endl;
+        LOG_DEBUG("CLIENT", "Received key data size: " + std::to_string(keyData.size()) + " bytes");
+
+        bool keysValid;
+        if (resuming && !keyData.empty() && keyData[0] == SessionTicket::RESUME_ACCEPTED)
+        {
+            // Same keys and UUID as before, and a renewed ticket
+            keyData.erase(keyData.begin());
+            keysValid = cipher.decryptMessage(keyData);
+            ticket = keyData;
+            Logger::console() << "Session resumed, UUID: " << clientUUID << std::endl;
+        }
+        else
+        {
+            if (resuming && !keyData.empty())
+            {
+                keyData.erase(keyData.begin());
+                Logger::console() << "Server refused to resume the session, starting a new one" << std::endl;
+            }
+            keysValid = applyKeyData(keyData);
+        }
 
+        if (!keysValid)
+        {
+            Logger::console() << "Invalid key data received (size: " << keyData.size() << ")" << std::endl;
+            ticket.clear();
+            closeStreams();
+            return false;
+        }
+
+        Logger::console() << "Secure connection established!" << std::endl;
+
+        // Striping is an optimization: carry on with whatever streams joined
+        for (unsigned i = 1; i < streamCount && !clientUUID.empty(); i++)
+        {
+            if (!joinStream(serverAddr))
+            {
+                Logger::console() << "Stream " << i + 1 << " could not join, continuing with " << i << std::endl;
+                break;
+            }
+        }
+        if (!stripes.empty())
+        {
+            Logger::console() << "Using " << stripes.size() + 1 << " streams for large transfers" << std::endl;
+        }
+        return true;
+    }
+
+    // New session: [16 key][16 IV][u32 uuid size][uuid], then
+    // [u32 ticket size][ticket] when the server issues tickets
+    bool applyKeyData(const std::vector<BYTE> &keyData)
+    {
         if (keyData.size() < 32)
         {
-            std::cout << "Invalid key data received (size: " << keyData.size() << ")" << std::endl;
-            closesocket(clientSocket);
             return false;
         }
 
@@ -91,87 +199,154 @@ public:
         aesKey.assign(keyData.begin(), keyData.begin() + 16);
         aesIV.assign(keyData.begin() + 16, keyData.begin() + 32);
 
-        std::cout << "Key size: " << aesKey.size() << ", IV size: " << aesIV.size() << std::endl;
+        cipher.reset(aesKey, aesIV);
 
-        // Extract UUID if present
-        if (keyData.size() > 32)
+        LOG_DEBUG("CLIENT", "Key size: " + std::to_string(aesKey.size()) + ", IV size: " + std::to_string(aesIV.size()));
+
+        // Extract UUID and ticket if present
+        clientUUID.clear();
+        ticket.clear();
+        size_t offset = 32;
+        if (offset + sizeof(uint32_t) <= keyData.size())
         {
-            size_t offset = 32;
-            if (offset + sizeof(uint32_t) <= keyData.size())
+            uint32_t uuidSize = *(uint32_t *)(keyData.data() + offset);
+            offset += sizeof(uint32_t);
+            if (offset + uuidSize <= keyData.size())
             {
-                uint32_t uuidSize = *(uint32_t *)(keyData.data() + offset);
-                offset += sizeof(uint32_t);
-                if (offset + uuidSize <= keyData.size())
-                {
-                    clientUUID.assign(keyData.begin() + offset, keyData.begin() + offset + uuidSize);
-                    std::cout << "UUID: " << clientUUID << std::endl;
-                }
+                clientUUID.assign(keyData.begin() + offset, keyData.begin() + offset + uuidSize);
+                Logger::console() << "UUID: " << clientUUID << std::endl;
+                offset += uuidSize;
             }
         }
+        if (!clientUUID.empty() && offset + sizeof(uint32_t) <= keyData.size())
+        {
+            uint32_t ticketSize = *(uint32_t *)(keyData.data() + offset);
+            offset += sizeof(uint32_t);
+            if (offset + ticketSize <= keyData.size())
+            {
+                ticket.assign(keyData.begin() + offset, keyData.begin() + offset + ticketSize);
+            }
+        }
+        return true;
+    }
 
-        std::cout << "Secure connection established!" << std::endl;
-        connected = true;
+    // After a dropped connection: a few tries with growing pauses, resuming
+    // the session when the server gave a ticket. Partial downloads pick up
+    // from their journals once the server asks for them again.
+    bool reconnect()
+    {
+        closeStreams();
+        std::chrono::milliseconds pause = RECONNECT_PAUSE;
+        for (unsigned attempt = 1; attempt <= RECONNECT_ATTEMPTS; attempt++)
+        {
+            Logger::console() << "Reconnecting (attempt " << attempt << " of " << RECONNECT_ATTEMPTS << ")..." << std::endl;
+            if (openSession())
+            {
+                return true;
+            }
+            std::this_thread::sleep_for(pause);
+            pause *= 2;
+        }
+        return false;
+    }
+
+    bool joinStream(const sockaddr_in &serverAddr)
+    {
+        SOCKET streamSocket = NetworkUtils::createSocket();
+        if (streamSocket == INVALID_SOCKET)
+        {
+            return false;
+        }
+        if (::connect(streamSocket, (const sockaddr *)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR)
+        {
+            closesocket(streamSocket);
+            return false;
+        }
+        NetworkUtils::configureSocket(streamSocket);
+
+        auto streamReader = std::make_unique<FrameReader>(streamSocket);
+        std::vector<BYTE> challenge, ack;
+        if (!streamReader->next(challenge) || challenge.size() != StripedTransfer::CHALLENGE_SIZE ||
+            !NetworkUtils::sendData(streamSocket, StripedTransfer::joinHello(clientUUID, challenge, aesKey, aesIV)) ||
+            !streamReader->next(ack) || !cipher.decryptMessage(ack))
+        {
+            closesocket(streamSocket);
+            return false;
+        }
+        stripes.push_back(std::move(streamReader));
         return true;
     }
 
     void disconnect()
     {
         connected = false;
+        closeStreams();
+        NetworkUtils::cleanup();
+    }
+
+    void closeStreams()
+    {
         if (clientSocket != INVALID_SOCKET)
         {
             closesocket(clientSocket);
             clientSocket = INVALID_SOCKET;
         }
-        NetworkUtils::cleanup();
+        for (const auto &stripe : stripes)
+        {
+            closesocket(stripe->getSocket());
+        }
+        stripes.clear();
+        reader.reset();
     }
 
     void run()
     {
         if (!connected)
         {
-            std::cout << "Not connected to server!" << std::endl;
+            Logger::console() << "Not connected to server!" << std::endl;
             return;
         }
 
-        std::cout << "\n=== CLIENT READY ===" << std::endl;
-        std::cout << "Waiting for server commands..." << std::endl;
+        Logger::console() << "\n=== CLIENT READY ===" << std::endl;
+        Logger::console() << "Waiting for server commands..." << std::endl;
 
         while (connected)
         {
-            std::vector<BYTE> encryptedCommand;
+            std::vector<BYTE> commandData;
 
-            std::cout << "\n[Waiting for command from server...]" << std::endl;
+            Logger::console() << "\n[Waiting for command from server...]" << std::endl;
 
-            if (!NetworkUtils::receiveData(clientSocket, encryptedCommand))
+            if (!reader->next(commandData))
             {
-                std::cout << "Failed to receive command from server" << std::endl;
+                Logger::console() << "Failed to receive command from server" << std::endl;
+                if (reconnect())
+                    continue;
                 break;
             }
 
-            std::cout << "Received encrypted command, size: " << encryptedCommand.size() << " bytes" << std::endl;
+            LOG_DEBUG("CLIENT", "Received encrypted command, size: " + std::to_string(commandData.size()) + " bytes");
 
-            if (encryptedCommand.empty())
+            if (commandData.empty())
             {
-                std::cout << "ERROR: Received empty command!" << std::endl;
+                Logger::console() << "ERROR: Received empty command!" << std::endl;
                 break;
             }
 
-            // Decrypt the command
-            auto commandData = CryptoUtils::aesDecrypt(aesKey, aesIV, encryptedCommand);
-            if (commandData.empty())
+            // Decrypt the command in place
+            if (!cipher.decryptMessage(commandData))
             {
-                std::cout << "Failed to decrypt command" << std::endl;
+                Logger::console() << "Failed to decrypt command" << std::endl;
                 break;
             }
 
             if (commandData.size() < sizeof(int))
             {
-                std::cout << "Invalid command data size: " << commandData.size() << std::endl;
+                Logger::console() << "Invalid command data size: " << commandData.size() << std::endl;
                 break;
             }
 
             int command = *(int *)commandData.data();
-            std::cout << "Server command: " << command << std::endl;
+            Logger::console() << "Server command: " << command << std::endl;
 
             switch (command)
             {
@@ -181,30 +356,36 @@ public:
             case 2:
                 handleDownload();
                 break;
+            case 7:
+                handleFolderUpload();
+                break;
+            case 8:
+                handleRangedDownload();
+                break;
             case 6:
-                std::cout << "Server requested disconnection. Goodbye!" << std::endl;
+                Logger::console() << "Server requested disconnection. Goodbye!" << std::endl;
                 connected = false;
                 break;
             default:
-                std::cout << "Unknown command: " << command << std::endl;
+                Logger::console() << "Unknown command: " << command << std::endl;
                 break;
             }
         }
 
         disconnect();
-        std::cout << "Client stopped." << std::endl;
+        Logger::console() << "Client stopped." << std::endl;
     }
 
 private:
     void handleUpload()
     {
-        std::cout << "UPLOAD: Enter file path: ";
+        Logger::console() << "UPLOAD: Enter file path: ";
         std::string filePath;
         std::getline(std::cin, filePath);
 
         if (filePath.empty())
         {
-            std::cout << "Upload cancelled" << std::endl;
+            Logger::console() << "Upload cancelled" << std::endl;
             return;
         }
 
@@ -212,54 +393,182 @@ private:
         DWORD attrs = GetFileAttributesA(filePath.c_str());
         if (attrs == INVALID_FILE_ATTRIBUTES)
         {
-            std::cout << "File not found: " << filePath << std::endl;
+            Logger::console() << "File not found: " << filePath << std::endl;
+            return;
+        }
+
+        Logger::console() << "Uploading: " << filePath << std::endl;
+
+        if (FileTransfer::sendFile(*reader, cipher, filePath, stripeReaders(), integrityOnly))
+        {
+            Logger::console() << "Upload successful!" << std::endl;
+        }
+        else
+        {
+            Logger::console() << "Upload failed" << std::endl;
+            connected = reconnect();
+        }
+    }
+
+    void handleFolderUpload()
+    {
+        Logger::console() << "FOLDER UPLOAD: Enter folder path: ";
+        std::string folderPath;
+        std::getline(std::cin, folderPath);
+
+        if (folderPath.empty())
+        {
+            Logger::console() << "Upload cancelled" << std::endl;
             return;
         }
 
-        std::cout << "Uploading: " << filePath << std::endl;
+        DWORD attrs = GetFileAttributesA(folderPath.c_str());
+        if (attrs == INVALID_FILE_ATTRIBUTES || !(attrs & FILE_ATTRIBUTE_DIRECTORY))
+        {
+            Logger::console() << "Folder not found: " << folderPath << std::endl;
+            return;
+        }
+
+        Logger::console() << "Uploading folder: " << folderPath << std::endl;
 
-        if (FileTransfer::sendFile(clientSocket, aesKey, aesIV, filePath))
+        if (BatchTransfer::send(*reader, cipher, folderPath))
         {
-            std::cout << "Upload successful!" << std::endl;
+            Logger::console() << "Folder upload successful!" << std::endl;
         }
         else
         {
-            std::cout << "Upload failed" << std::endl;
-            connected = false;
+            Logger::console() << "Folder upload failed" << std::endl;
+            connected = reconnect();
         }
     }
 
     void handleDownload()
     {
-        std::cout << "DOWNLOAD: Waiting for file..." << std::endl;
+        Logger::console() << "DOWNLOAD: Waiting for file..." << std::endl;
 
-        if (FileTransfer::receiveFile(clientSocket, aesKey, aesIV, "received_files"))
+        if (FileTransfer::receiveFile(*reader, cipher, "received_files", stripeReaders(), integrityOnly))
         {
-            std::cout << "Download successful!" << std::endl;
+            Logger::console() << "Download successful!" << std::endl;
         }
         else
         {
-            std::cout << "Download failed" << std::endl;
-            connected = false;
+            Logger::console() << "Download failed" << std::endl;
+            connected = reconnect();
         }
     }
+
+    void handleRangedDownload()
+    {
+        RangedTransfer::Offer offer;
+        if (!RangedTransfer::receiveOffer(*reader, cipher, offer))
+        {
+            Logger::console() << "Ranged download failed" << std::endl;
+            connected = reconnect();
+            return;
+        }
+
+        Logger::console() << "RANGES: " << offer.fileName << " is " << offer.fileSize << " bytes" << std::endl;
+        Logger::console() << "Enter ranges as offset:length, offset: or -tail, comma separated (Enter for the whole file): ";
+        std::string input;
+        std::getline(std::cin, input);
+        std::vector<RangedTransfer::Span> spans;
+        while (!RangedTransfer::parseSpans(input, spans))
+        {
+            // With no spans the fetch only ends the server's streams
+            Logger::console() << "Invalid ranges, try again: ";
+            if (!std::getline(std::cin, input))
+            {
+                spans.clear();
+                break;
+            }
+        }
+
+        std::vector<FrameReader *> streams(1, reader.get());
+        std::vector<FrameReader *> extra = stripeReaders();
+        streams.insert(streams.end(), extra.begin(), extra.end());
+        if (RangedTransfer::fetch(streams, cipher, offer, spans, "received_files"))
+        {
+            Logger::console() << "Ranged download successful!" << std::endl;
+        }
+        else
+        {
+            Logger::console() << "Ranged download failed" << std::endl;
+            connected = reconnect();
+        }
+    }
+
+    std::vector<FrameReader *> stripeReaders() const
+    {
+        std::vector<FrameReader *> result;
+        for (const auto &stripe : stripes)
+        {
+            result.push_back(stripe.get());
+        }
+        return result;
+    }
 };
 
-int main()
+int main(int argc, char *argv[])
 {
-    std::cout << "=== SECURE FILE TRANSFER CLIENT ===" << std::endl;
+    Logger::console() << "=== SECURE FILE TRANSFER CLIENT ===" << std::endl;
+
+    // --streams N opens N connections per session for striping large files;
+    // --integrity-only skips file encryption for trusted networks;
+    // --compress offers LZ compression on uploads;
+    // --flush none|interval|complete sets when downloads are forced to disk;
+    // --io auto|rio|blocking picks the bulk send engine;
+    // --progress MS sets how often transfer progress is shown
+    unsigned streams = 1;
+    bool integrityOnly = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--streams" && i + 1 < argc)
+        {
+            int requested = atoi(argv[++i]);
+            streams = static_cast<unsigned>(std::max(1, std::min<int>(requested, StripedTransfer::MAX_STREAMS)));
+        }
+        else if (arg == "--integrity-only")
+        {
+            integrityOnly = true;
+        }
+        else if (arg == "--compress")
+        {
+            FileTransfer::setCompression(true);
+        }
+        else if (arg == "--io" && i + 1 < argc)
+        {
+            IoBackend backend;
+            if (SendEngine::parseBackend(argv[++i], backend))
+                SendEngine::setBackend(backend);
+            else
+                Logger::console() << "Unknown I/O backend: " << argv[i] << std::endl;
+        }
+        else if (arg == "--flush" && i + 1 < argc)
+        {
+            FlushPolicy policy;
+            if (parseFlushPolicy(argv[++i], policy))
+                FileTransfer::setFlushPolicy(policy);
+            else
+                Logger::console() << "Unknown flush policy: " << argv[i] << std::endl;
+        }
+        else if (arg == "--progress" && i + 1 < argc)
+        {
+            ProgressMonitor::setRefreshInterval(static_cast<unsigned>(std::max(0, atoi(argv[++i]))));
+        }
+    }
 
-    SimpleClient client;
+    SimpleClient client(streams, integrityOnly);
     if (client.connectToServer("127.0.0.1", 8080))
     {
         client.run();
     }
     else
     {
-        std::cout << "Failed to connect to server" << std::endl;
+        Logger::console() << "Failed to connect to server" << std::endl;
     }
 
-    std::cout << "Press Enter to exit...";
+    Logger::console() << "Press Enter to exit...";
     std::cin.get();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,472 @@
+#include "aes_ctr.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define AES_X86 1
+#include <wmmintrin.h>
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define AESNI_TARGET __attribute__((target("aes,sse2")))
+#else
+#define AESNI_TARGET
+#endif
+
+namespace
+{
+    typedef void (*CtrKernel)(const AesKeySchedule &schedule, uint64_t prefix, uint64_t counter,
+                              const uint8_t *in, uint8_t *out, size_t blocks);
+
+    inline uint64_t byteSwap64(uint64_t v)
+    {
+#if defined(_MSC_VER)
+        return _byteswap_uint64(v);
+#else
+        return __builtin_bswap64(v);
+#endif
+    }
+
+    inline uint32_t load32be(const uint8_t *p)
+    {
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+
+    inline void store32be(uint8_t *p, uint32_t v)
+    {
+        p[0] = uint8_t(v >> 24);
+        p[1] = uint8_t(v >> 16);
+        p[2] = uint8_t(v >> 8);
+        p[3] = uint8_t(v);
+    }
+
+    inline uint8_t xtime(uint8_t x)
+    {
+        return uint8_t((x << 1) ^ ((x & 0x80) ? 0x1b : 0x00));
+    }
+
+    // S-box and T-tables derived at startup from the GF(2^8) definition.
+    // Table lookups are not constant-time; the AES-NI kernel is preferred.
+    struct AesTables
+    {
+        uint8_t sbox[256];
+        uint32_t te[4][256];
+
+        AesTables()
+        {
+            uint8_t p = 1, q = 1;
+            sbox[0] = 0x63;
+            // Walk the multiplicative group with generator 3; q tracks p^-1
+            do
+            {
+                p = uint8_t(p ^ xtime(p));
+                q ^= q << 1;
+                q ^= q << 2;
+                q ^= q << 4;
+                if (q & 0x80)
+                    q ^= 0x09;
+                uint8_t x = uint8_t(q ^ rotl(q, 1) ^ rotl(q, 2) ^ rotl(q, 3) ^ rotl(q, 4));
+                sbox[p] = uint8_t(x ^ 0x63);
+            } while (p != 1);
+
+            for (int i = 0; i < 256; i++)
+            {
+                uint8_t s = sbox[i];
+                uint8_t s2 = xtime(s);
+                uint8_t s3 = uint8_t(s2 ^ s);
+                uint32_t t = (uint32_t(s2) << 24) | (uint32_t(s) << 16) | (uint32_t(s) << 8) | uint32_t(s3);
+                te[0][i] = t;
+                te[1][i] = (t >> 8) | (t << 24);
+                te[2][i] = (t >> 16) | (t << 16);
+                te[3][i] = (t >> 24) | (t << 8);
+            }
+        }
+
+        static uint8_t rotl(uint8_t x, int n)
+        {
+            return uint8_t((x << n) | (x >> (8 - n)));
+        }
+    };
+
+    const AesTables &tables()
+    {
+        static const AesTables instance;
+        return instance;
+    }
+
+    void encryptBlockPortable(const AesKeySchedule &schedule, const uint8_t in[16], uint8_t out[16])
+    {
+        const AesTables &t = tables();
+        const uint8_t *rk = schedule.roundKeys;
+
+        uint32_t s0 = load32be(in) ^ load32be(rk);
+        uint32_t s1 = load32be(in + 4) ^ load32be(rk + 4);
+        uint32_t s2 = load32be(in + 8) ^ load32be(rk + 8);
+        uint32_t s3 = load32be(in + 12) ^ load32be(rk + 12);
+
+        for (int r = 1; r < schedule.rounds; r++)
+        {
+            rk += 16;
+            uint32_t t0 = t.te[0][s0 >> 24] ^ t.te[1][(s1 >> 16) & 0xff] ^ t.te[2][(s2 >> 8) & 0xff] ^ t.te[3][s3 & 0xff] ^ load32be(rk);
+            uint32_t t1 = t.te[0][s1 >> 24] ^ t.te[1][(s2 >> 16) & 0xff] ^ t.te[2][(s3 >> 8) & 0xff] ^ t.te[3][s0 & 0xff] ^ load32be(rk + 4);
+            uint32_t t2 = t.te[0][s2 >> 24] ^ t.te[1][(s3 >> 16) & 0xff] ^ t.te[2][(s0 >> 8) & 0xff] ^ t.te[3][s1 & 0xff] ^ load32be(rk + 8);
+            uint32_t t3 = t.te[0][s3 >> 24] ^ t.te[1][(s0 >> 16) & 0xff] ^ t.te[2][(s1 >> 8) & 0xff] ^ t.te[3][s2 & 0xff] ^ load32be(rk + 12);
+            s0 = t0;
+            s1 = t1;
+            s2 = t2;
+            s3 = t3;
+        }
+
+        rk += 16;
+        const uint8_t *sb = t.sbox;
+        store32be(out, ((uint32_t(sb[s0 >> 24]) << 24) | (uint32_t(sb[(s1 >> 16) & 0xff]) << 16) |
+                        (uint32_t(sb[(s2 >> 8) & 0xff]) << 8) | uint32_t(sb[s3 & 0xff])) ^
+                           load32be(rk));
+        store32be(out + 4, ((uint32_t(sb[s1 >> 24]) << 24) | (uint32_t(sb[(s2 >> 16) & 0xff]) << 16) |
+                            (uint32_t(sb[(s3 >> 8) & 0xff]) << 8) | uint32_t(sb[s0 & 0xff])) ^
+                               load32be(rk + 4));
+        store32be(out + 8, ((uint32_t(sb[s2 >> 24]) << 24) | (uint32_t(sb[(s3 >> 16) & 0xff]) << 16) |
+                            (uint32_t(sb[(s0 >> 8) & 0xff]) << 8) | uint32_t(sb[s1 & 0xff])) ^
+                               load32be(rk + 8));
+        store32be(out + 12, ((uint32_t(sb[s3 >> 24]) << 24) | (uint32_t(sb[(s0 >> 16) & 0xff]) << 16) |
+                             (uint32_t(sb[(s1 >> 8) & 0xff]) << 8) | uint32_t(sb[s2 & 0xff])) ^
+                                load32be(rk + 12));
+    }
+
+    void ctrPortable(const AesKeySchedule &schedule, uint64_t prefix, uint64_t counter,
+                     const uint8_t *in, uint8_t *out, size_t blocks)
+    {
+        uint8_t block[16];
+        uint8_t keystream[16];
+        memcpy(block, &prefix, 8);
+
+        for (size_t i = 0; i < blocks; i++)
+        {
+            uint64_t be = byteSwap64(counter + i);
+            memcpy(block + 8, &be, 8);
+            encryptBlockPortable(schedule, block, keystream);
+            for (int k = 0; k < 16; k++)
+            {
+                out[i * 16 + k] = in[i * 16 + k] ^ keystream[k];
+            }
+        }
+    }
+
+#if defined(AES_X86)
+    AESNI_TARGET inline __m128i counterBlock(uint64_t prefix, uint64_t counter)
+    {
+        return _mm_set_epi64x(static_cast<long long>(byteSwap64(counter)), static_cast<long long>(prefix));
+    }
+
+    // Eight independent blocks in flight hide the aesenc latency; the round
+    // count is a template parameter so the round loop unrolls fully.
+    template <int rounds>
+    AESNI_TARGET void ctrAesNiRounds(const AesKeySchedule &schedule, uint64_t prefix, uint64_t counter,
+                                     const uint8_t *in, uint8_t *out, size_t blocks)
+    {
+        __m128i rk[rounds + 1];
+        for (int r = 0; r <= rounds; r++)
+        {
+            rk[r] = _mm_load_si128(reinterpret_cast<const __m128i *>(schedule.roundKeys + r * 16));
+        }
+
+        size_t i = 0;
+        for (; i + 8 <= blocks; i += 8)
+        {
+            // Named registers rather than an array keep the state out of memory at -O2
+            __m128i b0 = _mm_xor_si128(counterBlock(prefix, counter + i), rk[0]);
+            __m128i b1 = _mm_xor_si128(counterBlock(prefix, counter + i + 1), rk[0]);
+            __m128i b2 = _mm_xor_si128(counterBlock(prefix, counter + i + 2), rk[0]);
+            __m128i b3 = _mm_xor_si128(counterBlock(prefix, counter + i + 3), rk[0]);
+            __m128i b4 = _mm_xor_si128(counterBlock(prefix, counter + i + 4), rk[0]);
+            __m128i b5 = _mm_xor_si128(counterBlock(prefix, counter + i + 5), rk[0]);
+            __m128i b6 = _mm_xor_si128(counterBlock(prefix, counter + i + 6), rk[0]);
+            __m128i b7 = _mm_xor_si128(counterBlock(prefix, counter + i + 7), rk[0]);
+
+            for (int r = 1; r < rounds; r++)
+            {
+                b0 = _mm_aesenc_si128(b0, rk[r]);
+                b1 = _mm_aesenc_si128(b1, rk[r]);
+                b2 = _mm_aesenc_si128(b2, rk[r]);
+                b3 = _mm_aesenc_si128(b3, rk[r]);
+                b4 = _mm_aesenc_si128(b4, rk[r]);
+                b5 = _mm_aesenc_si128(b5, rk[r]);
+                b6 = _mm_aesenc_si128(b6, rk[r]);
+                b7 = _mm_aesenc_si128(b7, rk[r]);
+            }
+
+            const __m128i *src = reinterpret_cast<const __m128i *>(in + i * 16);
+            __m128i *dst = reinterpret_cast<__m128i *>(out + i * 16);
+            _mm_storeu_si128(dst, _mm_xor_si128(_mm_loadu_si128(src), _mm_aesenclast_si128(b0, rk[rounds])));
+            _mm_storeu_si128(dst + 1, _mm_xor_si128(_mm_loadu_si128(src + 1), _mm_aesenclast_si128(b1, rk[rounds])));
+            _mm_storeu_si128(dst + 2, _mm_xor_si128(_mm_loadu_si128(src + 2), _mm_aesenclast_si128(b2, rk[rounds])));
+            _mm_storeu_si128(dst + 3, _mm_xor_si128(_mm_loadu_si128(src + 3), _mm_aesenclast_si128(b3, rk[rounds])));
+            _mm_storeu_si128(dst + 4, _mm_xor_si128(_mm_loadu_si128(src + 4), _mm_aesenclast_si128(b4, rk[rounds])));
+            _mm_storeu_si128(dst + 5, _mm_xor_si128(_mm_loadu_si128(src + 5), _mm_aesenclast_si128(b5, rk[rounds])));
+            _mm_storeu_si128(dst + 6, _mm_xor_si128(_mm_loadu_si128(src + 6), _mm_aesenclast_si128(b6, rk[rounds])));
+            _mm_storeu_si128(dst + 7, _mm_xor_si128(_mm_loadu_si128(src + 7), _mm_aesenclast_si128(b7, rk[rounds])));
+        }
+
+        for (; i < blocks; i++)
+        {
+            __m128i b = _mm_xor_si128(counterBlock(prefix, counter + i), rk[0]);
+            for (int r = 1; r < rounds; r++)
+            {
+                b = _mm_aesenc_si128(b, rk[r]);
+            }
+            b = _mm_aesenclast_si128(b, rk[rounds]);
+            __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 16));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 16), _mm_xor_si128(data, b));
+        }
+    }
+
+    void ctrAesNi(const AesKeySchedule &schedule, uint64_t prefix, uint64_t counter,
+                  const uint8_t *in, uint8_t *out, size_t blocks)
+    {
+        if (schedule.rounds == 14)
+            ctrAesNiRounds<14>(schedule, prefix, counter, in, out, blocks);
+        else
+            ctrAesNiRounds<10>(schedule, prefix, counter, in, out, blocks);
+    }
+#endif
+
+    bool cpuHasAesNi()
+    {
+#if defined(AES_X86)
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 25)) != 0; // CPUID.1:ECX.AES
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("aes");
+#endif
+#else
+        return false;
+#endif
+    }
+
+    CtrKernel kernelFor(AesImplementation impl)
+    {
+#if defined(AES_X86)
+        if (impl == AesImplementation::AesNi)
+            return ctrAesNi;
+#endif
+        return ctrPortable;
+    }
+
+    AesImplementation detectImplementation()
+    {
+        return cpuHasAesNi() ? AesImplementation::AesNi : AesImplementation::Portable;
+    }
+
+    struct KnownAnswer
+    {
+        const char *key;
+        const char *counter;
+        const char *plaintext;
+        const char *ciphertext;
+    };
+
+    // FIPS-197 C.1/C.3 cipher examples (the plaintext block used as the counter,
+    // encrypting zeros) and NIST SP 800-38A F.5.1/F.5.5 CTR-AES128/256.
+    const KnownAnswer KNOWN_ANSWERS[] = {
+        {"000102030405060708090a0b0c0d0e0f",
+         "00112233445566778899aabbccddeeff",
+         "00000000000000000000000000000000",
+         "69c4e0d86a7b0430d8cdb78070b4c55a"},
+        {"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+         "00112233445566778899aabbccddeeff",
+         "00000000000000000000000000000000",
+         "8ea2b7ca516745bfeafc49904b496089"},
+        {"2b7e151628aed2a6abf7158809cf4f3c",
+         "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+         "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+         "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710",
+         "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+         "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee"},
+        {"603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4",
+         "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+         "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+         "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710",
+         "601ec313775789a5b7a7f504bbf3d228f443e3ca4d62b59aca84e990cacaf5c5"
+         "2b0930daa23de94ce87017ba2d84988ddfc9c58db67aada613c2dd08457941a6"},
+    };
+
+    size_t decodeHex(const char *hex, uint8_t *out)
+    {
+        size_t n = 0;
+        for (; hex[0] && hex[1]; hex += 2)
+        {
+            auto nibble = [](char c)
+            { return uint8_t(c <= '9' ? c - '0' : c - 'a' + 10); };
+            out[n++] = uint8_t((nibble(hex[0]) << 4) | nibble(hex[1]));
+        }
+        return n;
+    }
+
+    bool runKnownAnswers(AesImplementation impl)
+    {
+        for (const KnownAnswer &kat : KNOWN_ANSWERS)
+        {
+            uint8_t key[32], counter[16], plain[64], expected[64], actual[64];
+            size_t keySize = decodeHex(kat.key, key);
+            decodeHex(kat.counter, counter);
+            size_t size = decodeHex(kat.plaintext, plain);
+            decodeHex(kat.ciphertext, expected);
+
+            AesKeySchedule schedule;
+            if (!AesCtr::expandKey(key, keySize, schedule))
+                return false;
+
+            uint64_t ctr;
+            memcpy(&ctr, counter + 8, 8);
+            ctr = byteSwap64(ctr);
+
+            // Whole buffer, then byte-by-byte to exercise partial blocks
+            AesCtr::process(impl, schedule, counter, ctr, 0, plain, actual, size);
+            if (memcmp(actual, expected, size) != 0)
+                return false;
+
+            for (size_t i = 0; i < size; i++)
+            {
+                AesCtr::process(impl, schedule, counter, ctr + i / 16, i % 16, plain + i, actual + i, 1);
+            }
+            if (memcmp(actual, expected, size) != 0)
+                return false;
+        }
+
+        // Bulk path: eight-block kernel against the single-block portable path
+        static uint8_t bulk[16 * 19 + 5], viaImpl[sizeof(bulk)], viaPortable[sizeof(bulk)];
+        for (size_t i = 0; i < sizeof(bulk); i++)
+        {
+            bulk[i] = uint8_t(i * 131 + 7);
+        }
+        AesKeySchedule schedule;
+        AesCtr::expandKey(bulk, 16, schedule);
+        const uint8_t prefix[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+        AesCtr::process(impl, schedule, prefix, ~uint64_t(0) - 3, 7, bulk, viaImpl, sizeof(bulk));
+        AesCtr::process(AesImplementation::Portable, schedule, prefix, ~uint64_t(0) - 3, 7, bulk, viaPortable, sizeof(bulk));
+        return memcmp(viaImpl, viaPortable, sizeof(bulk)) == 0;
+    }
+}
+
+bool AesCtr::expandKey(const uint8_t *key, size_t keySize, AesKeySchedule &schedule)
+{
+    if (keySize != 16 && keySize != 32)
+    {
+        return false;
+    }
+
+    const uint8_t *sbox = tables().sbox;
+    const int nk = static_cast<int>(keySize / 4);
+    schedule.rounds = nk + 6;
+    const int totalWords = 4 * (schedule.rounds + 1);
+
+    uint32_t w[60];
+    for (int i = 0; i < nk; i++)
+    {
+        w[i] = load32be(key + 4 * i);
+    }
+
+    uint8_t rcon = 0x01;
+    for (int i = nk; i < totalWords; i++)
+    {
+        uint32_t temp = w[i - 1];
+        if (i % nk == 0)
+        {
+            temp = (temp << 8) | (temp >> 24);
+            temp = (uint32_t(sbox[temp >> 24]) << 24) | (uint32_t(sbox[(temp >> 16) & 0xff]) << 16) |
+                   (uint32_t(sbox[(temp >> 8) & 0xff]) << 8) | uint32_t(sbox[temp & 0xff]);
+            temp ^= uint32_t(rcon) << 24;
+            rcon = xtime(rcon);
+        }
+        else if (nk > 6 && i % nk == 4)
+        {
+            temp = (uint32_t(sbox[temp >> 24]) << 24) | (uint32_t(sbox[(temp >> 16) & 0xff]) << 16) |
+                   (uint32_t(sbox[(temp >> 8) & 0xff]) << 8) | uint32_t(sbox[temp & 0xff]);
+        }
+        w[i] = w[i - nk] ^ temp;
+    }
+
+    for (int i = 0; i < totalWords; i++)
+    {
+        store32be(schedule.roundKeys + 4 * i, w[i]);
+    }
+    return true;
+}
+
+void AesCtr::process(const AesKeySchedule &schedule, const uint8_t prefix[8], uint64_t counter, size_t skip,
+                     const uint8_t *in, uint8_t *out, size_t size)
+{
+    process(activeImplementation(), schedule, prefix, counter, skip, in, out, size);
+}
+
+void AesCtr::process(AesImplementation impl, const AesKeySchedule &schedule, const uint8_t prefix[8], uint64_t counter, size_t skip,
+                     const uint8_t *in, uint8_t *out, size_t size)
+{
+    CtrKernel kernel = kernelFor(impl);
+    uint64_t prefixWord;
+    memcpy(&prefixWord, prefix, 8);
+
+    static const uint8_t zeros[16] = {};
+    uint8_t keystream[16];
+
+    // Leading partial block
+    if (skip != 0 && size != 0)
+    {
+        kernel(schedule, prefixWord, counter, zeros, keystream, 1);
+        size_t n = size < 16 - skip ? size : 16 - skip;
+        for (size_t i = 0; i < n; i++)
+        {
+            out[i] = in[i] ^ keystream[skip + i];
+        }
+        in += n;
+        out += n;
+        size -= n;
+        counter++;
+    }
+
+    size_t blocks = size / 16;
+    if (blocks != 0)
+    {
+        kernel(schedule, prefixWord, counter, in, out, blocks);
+        in += blocks * 16;
+        out += blocks * 16;
+        size -= blocks * 16;
+        counter += blocks;
+    }
+
+    // Trailing partial block
+    if (size != 0)
+    {
+        kernel(schedule, prefixWord, counter, zeros, keystream, 1);
+        for (size_t i = 0; i < size; i++)
+        {
+            out[i] = in[i] ^ keystream[i];
+        }
+    }
+}
+
+AesImplementation AesCtr::activeImplementation()
+{
+    static const AesImplementation impl = detectImplementation();
+    return impl;
+}
+
+const char *AesCtr::implementationName(AesImplementation impl)
+{
+    return impl == AesImplementation::AesNi ? "AES-NI" : "portable";
+}
+
+bool AesCtr::selfTest()
+{
+    if (!runKnownAnswers(AesImplementation::Portable))
+        return false;
+    if (activeImplementation() != AesImplementation::Portable && !runKnownAnswers(activeImplementation()))
+        return false;
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef AES_CTR_H
+#define AES_CTR_H
+
+#include <cstdint>
+#include <cstddef>
+
+// AES round keys in FIPS-197 byte order, shared by every kernel
+struct AesKeySchedule
+{
+    alignas(16) uint8_t roundKeys[15 * 16];
+    int rounds;
+};
+
+enum class AesImplementation
+{
+    Portable,
+    AesNi
+};
+
+// AES-128/256 in counter mode. The counter block is an 8-byte prefix followed
+// by a 64-bit big-endian block counter; the kernel is picked once at runtime.
+class AesCtr
+{
+public:
+    static bool expandKey(const uint8_t *key, size_t keySize, AesKeySchedule &schedule);
+
+    // XORs keystream into `in`, starting `skip` bytes into block `counter`.
+    // in == out is allowed.
+    static void process(const AesKeySchedule &schedule, const uint8_t prefix[8], uint64_t counter, size_t skip,
+                        const uint8_t *in, uint8_t *out, size_t size);
+    static void process(AesImplementation impl, const AesKeySchedule &schedule, const uint8_t prefix[8], uint64_t counter, size_t skip,
+                        const uint8_t *in, uint8_t *out, size_t size);
+
+    static AesImplementation activeImplementation();
+    static const char *implementationName(AesImplementation impl);
+
+    // Known-answer tests (FIPS-197, SP 800-38A) against every available kernel
+    static bool selfTest();
+};
+
+#endif
\ No newline at end of file
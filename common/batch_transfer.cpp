@@ -0,0 +1,431 @@
+#include "batch_transfer.h"
+#include "file_transfer.h"
+#include "transfer_pipeline.h"
+#include "file_io.h"
+#include "io_engine.h"
+#include "merkle_tree.h"
+#include "transfer_progress.h"
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <unordered_set>
+#include <set>
+#include <cctype>
+#include <cstring>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    const size_t HEADER_SIZE = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+    const size_t RECORD_HEADER_SIZE = sizeof(uint64_t) + sizeof(uint16_t);
+
+    // Reply to the manifest: [u32 status]
+    const uint32_t BATCH_ACCEPTED = 0;
+    const uint32_t BATCH_REFUSED = 1;
+
+    std::string rateReport(size_t files, uint64_t bytes, std::chrono::steady_clock::time_point start)
+    {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::ostringstream report;
+        report << files << " files, " << bytes << " bytes in " << std::fixed << std::setprecision(2) << seconds << " s ("
+               << std::setprecision(0) << (seconds > 0 ? files / seconds : 0) << " files/s, "
+               << std::setprecision(1) << (seconds > 0 ? bytes / seconds / (1024 * 1024) : 0) << " MB/s)";
+        return report.str();
+    }
+}
+
+bool BatchTransfer::validPath(const std::string &path)
+{
+    if (path.empty() || path.size() > MAX_PATH_SIZE || path.find_first_of("\\:") != std::string::npos)
+    {
+        return false;
+    }
+    size_t start = 0;
+    while (true)
+    {
+        size_t end = path.find('/', start);
+        std::string component = path.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        // Each component is joined to a local directory just like a single file name
+        if (!FileTransfer::validFileName(component))
+        {
+            return false;
+        }
+        if (end == std::string::npos)
+        {
+            return true;
+        }
+        start = end + 1;
+    }
+}
+
+size_t BatchTransfer::firstEntryAfter(const std::vector<Entry> &entries, uint64_t offset)
+{
+    auto it = std::partition_point(entries.begin(), entries.end(), [offset](const Entry &entry)
+                                   { return entry.offset + entry.size <= offset; });
+    return static_cast<size_t>(it - entries.begin());
+}
+
+bool BatchTransfer::send(FrameReader &reader, const CipherContext &cipher, const std::string &directory)
+{
+    SOCKET socket = reader.getSocket();
+    fs::path root = fs::path(directory).lexically_normal();
+    if (!root.has_filename())
+    {
+        root = root.parent_path();
+    }
+    std::string rootName = root.filename().string();
+    std::error_code ec;
+    if (!fs::is_directory(root, ec) || !validPath(rootName) || rootName.find('/') != std::string::npos)
+    {
+        NetworkUtils::printMessage("ERROR", "Not a directory: " + directory);
+        return false;
+    }
+
+    // Only regular files travel; their order is the packing order
+    std::vector<Entry> entries;
+    uint64_t totalSize = 0;
+    for (fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec), end; !ec && it != end; it.increment(ec))
+    {
+        std::error_code entryError;
+        if (!it->is_regular_file(entryError))
+        {
+            continue;
+        }
+        std::string path = it->path().lexically_relative(root).generic_string();
+        uint64_t size = it->file_size(entryError);
+        if (entryError || !validPath(path))
+        {
+            NetworkUtils::printMessage("WARNING", "Skipping " + it->path().string());
+            continue;
+        }
+        entries.push_back({path, size, totalSize});
+        totalSize += size;
+    }
+    if (ec || entries.size() > MAX_FILES)
+    {
+        NetworkUtils::printMessage("ERROR", "Cannot list " + directory + (ec ? "" : ", more than " + std::to_string(MAX_FILES) + " files"));
+        return false;
+    }
+
+    NetworkUtils::printMessage("BATCH", "Sending " + rootName + ": " + std::to_string(entries.size()) + " files, " + std::to_string(totalSize) + " bytes");
+
+    uint32_t fileCount = static_cast<uint32_t>(entries.size());
+    uint32_t nameSize = static_cast<uint32_t>(rootName.size());
+    std::vector<BYTE> header;
+    header.insert(header.end(), (BYTE *)&fileCount, (BYTE *)&fileCount + sizeof(fileCount));
+    header.insert(header.end(), (BYTE *)&totalSize, (BYTE *)&totalSize + sizeof(totalSize));
+    header.insert(header.end(), (BYTE *)&nameSize, (BYTE *)&nameSize + sizeof(nameSize));
+    header.insert(header.end(), rootName.begin(), rootName.end());
+    uint64_t transferNonce = 0;
+    if (!NetworkUtils::sendData(socket, cipher.encryptMessage(header, &transferNonce)))
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to send batch header");
+        return false;
+    }
+
+    // Records never straddle a frame
+    std::vector<BYTE> batch;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        uint16_t pathSize = static_cast<uint16_t>(entries[i].path.size());
+        batch.insert(batch.end(), (BYTE *)&entries[i].size, (BYTE *)&entries[i].size + sizeof(entries[i].size));
+        batch.insert(batch.end(), (BYTE *)&pathSize, (BYTE *)&pathSize + sizeof(pathSize));
+        batch.insert(batch.end(), entries[i].path.begin(), entries[i].path.end());
+        if (batch.size() < MANIFEST_FRAME_SIZE && i + 1 < entries.size())
+        {
+            continue;
+        }
+        if (!NetworkUtils::sendData(socket, cipher.encryptMessage(batch)))
+        {
+            NetworkUtils::printMessage("ERROR", "Failed to send batch manifest");
+            return false;
+        }
+        batch.clear();
+    }
+
+    std::vector<BYTE> reply;
+    uint32_t status = BATCH_REFUSED;
+    if (!reader.next(reply) || !cipher.decryptMessage(reply) || reply.size() != sizeof(status))
+    {
+        NetworkUtils::printMessage("ERROR", "No answer to batch manifest");
+        return false;
+    }
+    memcpy(&status, reply.data(), sizeof(status));
+    if (status != BATCH_ACCEPTED)
+    {
+        NetworkUtils::printMessage("ERROR", "Receiver refused " + rootName);
+        return false;
+    }
+
+    // Frames are fixed-size slices of the packed stream; the source only
+    // hands out ranges and each worker reads the files inside its own
+    MerkleTree tree(totalSize);
+    SendEngine &engine = reader.sendEngine();
+    engine.begin(FRAME_SIZE);
+    uint64_t streamOffset = 0;
+    TransferProgress progress("Sending " + rootName + " (batch of " + std::to_string(fileCount) + " files)", totalSize);
+    auto start = std::chrono::steady_clock::now();
+    ChunkPipeline pipeline(FRAME_SIZE, ChunkPipeline::defaultWorkerCount(), FileTransfer::pipelineDepth(FRAME_SIZE));
+    pipeline.publishCounters(progress.stages);
+    bool ok = pipeline.run(
+        [&](PipelineChunk &chunk)
+        {
+            if (streamOffset >= totalSize)
+                return PipelineStatus::Done;
+            chunk.data.resize(static_cast<size_t>(std::min<uint64_t>(FRAME_SIZE, totalSize - streamOffset)));
+            chunk.offset = streamOffset;
+            streamOffset += chunk.data.size();
+            return PipelineStatus::Continue;
+        },
+        [&](PipelineChunk &chunk)
+        {
+            uint64_t end = chunk.offset + chunk.data.size();
+            for (size_t i = firstEntryAfter(entries, chunk.offset); i < entries.size() && entries[i].offset < end; i++)
+            {
+                const Entry &entry = entries[i];
+                if (entry.size == 0)
+                    continue;
+                uint64_t from = std::max(chunk.offset, entry.offset);
+                uint64_t to = std::min(end, entry.offset + entry.size);
+                std::ifstream file(root / fs::path(entry.path), std::ios::binary);
+                if (from > entry.offset)
+                {
+                    file.seekg(from - entry.offset);
+                }
+                if (!file.read((char *)chunk.data.data() + (from - chunk.offset), to - from))
+                {
+                    NetworkUtils::printMessage("ERROR", "Failed to read " + entry.path + ", it may have changed");
+                    return false;
+                }
+            }
+            tree.add(chunk.offset, chunk.data.data(), chunk.data.size());
+            cipher.process(chunk.data.data(), chunk.data.size(), transferNonce, FileTransfer::DATA_STREAM_OFFSET + chunk.offset);
+            return true;
+        },
+        [&](PipelineChunk &chunk)
+        {
+            FrameView view = {chunk.data.data(), chunk.data.size()};
+            if (!engine.send(&view, 1))
+            {
+                NetworkUtils::printMessage("ERROR", "Failed to send batch frame " + std::to_string(chunk.index));
+                return false;
+            }
+            progress.add(chunk.data.size());
+            return true;
+        });
+
+    ok = engine.end() && ok;
+    NetworkUtils::printMessage("PIPELINE", pipeline.occupancyReport() + ", " + engine.name() + " sends");
+    if (!ok)
+    {
+        return false;
+    }
+
+    std::vector<uint32_t> leaves = tree.leaves();
+    std::vector<BYTE> trailer((const BYTE *)leaves.data(), (const BYTE *)(leaves.data() + leaves.size()));
+    if (!tree.isComplete() || !NetworkUtils::sendData(socket, cipher.encryptMessage(trailer)))
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to send leaf digests");
+        return false;
+    }
+    NetworkUtils::printMessage("SUCCESS", "Folder sent: " + rateReport(entries.size(), totalSize, start));
+    return true;
+}
+
+bool BatchTransfer::receive(FrameReader &reader, const CipherContext &cipher, const std::string &saveDir)
+{
+    std::vector<BYTE> header;
+    uint64_t transferNonce = 0;
+    if (!reader.next(header) || !cipher.decryptMessage(header, &transferNonce) || header.size() < HEADER_SIZE)
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to receive batch header");
+        return false;
+    }
+    uint32_t fileCount = 0;
+    uint64_t totalSize = 0;
+    uint32_t nameSize = 0;
+    memcpy(&fileCount, header.data(), sizeof(fileCount));
+    memcpy(&totalSize, header.data() + sizeof(fileCount), sizeof(totalSize));
+    memcpy(&nameSize, header.data() + sizeof(fileCount) + sizeof(totalSize), sizeof(nameSize));
+    std::string rootName(header.begin() + HEADER_SIZE, header.end());
+    bool valid = header.size() - HEADER_SIZE == nameSize && fileCount <= MAX_FILES && validPath(rootName) && rootName.find('/') == std::string::npos;
+
+    // Paths must be unique the way NTFS compares them
+    std::vector<Entry> entries;
+    std::unordered_set<std::string> seen;
+    uint64_t packedOffset = 0;
+    std::vector<BYTE> batch;
+    if (valid)
+    {
+        entries.reserve(fileCount);
+        seen.reserve(fileCount);
+    }
+    while (valid && entries.size() < fileCount)
+    {
+        if (!reader.next(batch) || !cipher.decryptMessage(batch))
+        {
+            NetworkUtils::printMessage("ERROR", "Failed to receive batch manifest");
+            return false;
+        }
+        size_t pos = 0;
+        while (valid && pos < batch.size())
+        {
+            uint64_t size = 0;
+            uint16_t pathSize = 0;
+            if (entries.size() == fileCount || batch.size() - pos < RECORD_HEADER_SIZE)
+            {
+                valid = false;
+                break;
+            }
+            memcpy(&size, batch.data() + pos, sizeof(size));
+            memcpy(&pathSize, batch.data() + pos + sizeof(size), sizeof(pathSize));
+            pos += RECORD_HEADER_SIZE;
+            if (batch.size() - pos < pathSize || size > totalSize - packedOffset)
+            {
+                valid = false;
+                break;
+            }
+            std::string path(batch.begin() + pos, batch.begin() + pos + pathSize);
+            pos += pathSize;
+            std::string key = path;
+            std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            valid = validPath(path) && seen.insert(key).second;
+            entries.push_back({path, size, packedOffset});
+            packedOffset += size;
+        }
+    }
+    valid = valid && packedOffset == totalSize;
+
+    // Directories and empty files exist before any data arrives, so workers
+    // only ever create files
+    fs::path target = fs::path(saveDir) / rootName;
+    fs::path staging = fs::path(saveDir) / (rootName + ".part");
+    std::error_code ec;
+    if (valid)
+    {
+        fs::remove_all(staging, ec);
+        std::set<fs::path> directories;
+        for (const Entry &entry : entries)
+        {
+            directories.insert((staging / fs::path(entry.path)).parent_path());
+        }
+        directories.insert(staging);
+        for (const fs::path &directory : directories)
+        {
+            fs::create_directories(directory, ec);
+            valid = valid && !ec;
+        }
+        for (const Entry &entry : entries)
+        {
+            if (valid && entry.size == 0)
+                valid = FileWriter::writeFile((staging / fs::path(entry.path)).string(), nullptr, 0);
+        }
+    }
+
+    uint32_t status = valid ? BATCH_ACCEPTED : BATCH_REFUSED;
+    std::vector<BYTE> reply((BYTE *)&status, (BYTE *)&status + sizeof(status));
+    if (!NetworkUtils::sendData(reader.getSocket(), cipher.encryptMessage(reply)) || !valid)
+    {
+        NetworkUtils::printMessage("ERROR", valid ? "Failed to accept batch " + rootName : "Invalid batch manifest for " + rootName);
+        if (valid)
+            fs::remove_all(staging, ec);
+        return false;
+    }
+    NetworkUtils::printMessage("BATCH", "Receiving " + rootName + ": " + std::to_string(entries.size()) + " files, " + std::to_string(totalSize) + " bytes");
+
+    // Workers write the files that sit wholly inside their frame; the sink
+    // writes files spanning frames through one writer it keeps open
+    MerkleTree tree(totalSize);
+    FileWriter spanning;
+    uint64_t networkOffset = 0;
+    TransferProgress progress("Receiving " + rootName + " (batch of " + std::to_string(fileCount) + " files)", totalSize);
+    auto start = std::chrono::steady_clock::now();
+    ChunkPipeline pipeline(FRAME_SIZE, ChunkPipeline::defaultWorkerCount(), FileTransfer::pipelineDepth(FRAME_SIZE));
+    pipeline.publishCounters(progress.stages);
+    bool ok = pipeline.run(
+        [&](PipelineChunk &chunk)
+        {
+            if (networkOffset >= totalSize)
+                return PipelineStatus::Done;
+            if (!reader.next(chunk.data) || chunk.data.size() != std::min<uint64_t>(FRAME_SIZE, totalSize - networkOffset))
+            {
+                NetworkUtils::printMessage("ERROR", "Failed to receive batch frame at " + std::to_string(networkOffset));
+                return PipelineStatus::Failed;
+            }
+            chunk.offset = networkOffset;
+            networkOffset += chunk.data.size();
+            return PipelineStatus::Continue;
+        },
+        [&](PipelineChunk &chunk)
+        {
+            cipher.process(chunk.data.data(), chunk.data.size(), transferNonce, FileTransfer::DATA_STREAM_OFFSET + chunk.offset);
+            tree.add(chunk.offset, chunk.data.data(), chunk.data.size());
+            uint64_t end = chunk.offset + chunk.data.size();
+            for (size_t i = firstEntryAfter(entries, chunk.offset); i < entries.size() && entries[i].offset < end; i++)
+            {
+                const Entry &entry = entries[i];
+                if (entry.size == 0 || entry.offset < chunk.offset || entry.offset + entry.size > end)
+                    continue;
+                if (!FileWriter::writeFile((staging / fs::path(entry.path)).string(), chunk.data.data() + (entry.offset - chunk.offset),
+                                           static_cast<size_t>(entry.size)))
+                {
+                    NetworkUtils::printMessage("ERROR", "Failed to write " + entry.path);
+                    return false;
+                }
+            }
+            return true;
+        },
+        [&](PipelineChunk &chunk)
+        {
+            uint64_t end = chunk.offset + chunk.data.size();
+            for (size_t i = firstEntryAfter(entries, chunk.offset); i < entries.size() && entries[i].offset < end; i++)
+            {
+                const Entry &entry = entries[i];
+                if (entry.offset >= chunk.offset && entry.offset + entry.size <= end)
+                    continue;
+                uint64_t from = std::max(chunk.offset, entry.offset);
+                uint64_t to = std::min(end, entry.offset + entry.size);
+                bool opened = from > entry.offset || spanning.open((staging / fs::path(entry.path)).string(), entry.size, true);
+                if (!opened || !spanning.writeAt(from - entry.offset, chunk.data.data() + (from - chunk.offset), static_cast<size_t>(to - from)))
+                {
+                    NetworkUtils::printMessage("ERROR", "Failed to write " + entry.path);
+                    return false;
+                }
+                if (to == entry.offset + entry.size)
+                    spanning.close();
+            }
+            progress.add(chunk.data.size());
+            return true;
+        });
+    spanning.close();
+    NetworkUtils::printMessage("PIPELINE", pipeline.occupancyReport());
+
+    std::vector<BYTE> trailer;
+    std::vector<uint32_t> leaves = tree.leaves();
+    if (ok && (!reader.next(trailer) || !cipher.decryptMessage(trailer) || !tree.isComplete() || trailer.size() != leaves.size() * MerkleTree::DIGEST_SIZE ||
+               (!leaves.empty() && memcmp(trailer.data(), leaves.data(), trailer.size()) != 0)))
+    {
+        NetworkUtils::printMessage("ERROR", "Checksum tree of batch " + rootName + " does not match the sender's");
+        ok = false;
+    }
+    if (ok)
+    {
+        // The finished tree replaces any earlier copy in one rename
+        fs::remove_all(target, ec);
+        fs::rename(staging, target, ec);
+        ok = !ec;
+        if (ec)
+            NetworkUtils::printMessage("ERROR", "Cannot rename " + staging.string() + " to " + target.string());
+    }
+    if (!ok)
+    {
+        fs::remove_all(staging, ec);
+        return false;
+    }
+    NetworkUtils::printMessage("SUCCESS", "Folder received: " + target.string() + ", " + rateReport(entries.size(), totalSize, start));
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef BATCH_TRANSFER_H
+#define BATCH_TRANSFER_H
+
+#include <string>
+#include <vector>
+#include "network_utils.h"
+#include "crypto_utils.h"
+
+// Sends a directory tree as one stream, for trees of many small files where a
+// file-info round trip per file would dominate. A manifest of relative paths
+// and sizes comes first; once the receiver accepts it, every file body
+// follows back to back in manifest order, cut into large frames regardless of
+// file boundaries and encrypted like a single file's data stream. Pipeline
+// workers own the files that fit inside one frame, so the sender's open and
+// read them and the receiver's create and write them in parallel; files that
+// span frames are written by the in-order sink. Checksum tree leaf digests of
+// the packed stream trail the data. The tree is built in a staging directory
+// that replaces the target only once everything checked out.
+class BatchTransfer
+{
+public:
+    static const uint32_t MAX_FILES = 1 << 20;
+    static const size_t MAX_PATH_SIZE = 1024;
+    static const uint32_t FRAME_SIZE = 4 * 1024 * 1024;
+    static const size_t MANIFEST_FRAME_SIZE = 1024 * 1024;
+
+    // Header: [u32 file count][u64 packed size][u32 name size][directory name];
+    // manifest records: [u64 size][u16 path size][path, '/'-separated]
+    static bool send(FrameReader &reader, const CipherContext &cipher, const std::string &directory);
+    static bool receive(FrameReader &reader, const CipherContext &cipher, const std::string &saveDir = "received_files");
+
+private:
+    struct Entry
+    {
+        std::string path;
+        uint64_t size;
+        uint64_t offset; // in the packed stream
+    };
+
+    // Relative and '/'-separated, each component a valid
+    // FileTransfer::validFileName (so no empty, "." or ".." components)
+    static bool validPath(const std::string &path);
+    // First entry that ends after `offset`
+    static size_t firstEntryAfter(const std::vector<Entry> &entries, uint64_t offset);
+};
+
+#endif
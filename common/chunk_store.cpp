@@ -0,0 +1,533 @@
+#include "chunk_store.h"
+#include "crypto_utils.h"
+#include "network_utils.h"
+#include "file_transfer.h"
+#include <array>
+#include <fstream>
+#include <cstring>
+#include <filesystem>
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    const uint32_t MANIFEST_MAGIC = 0x314D5446; // "FTM1"
+    const uint32_t MAX_MANIFEST_CHUNKS = 1 << 24;
+    const char *MANIFEST_SUFFIX = ".manifest";
+    const size_t SPLIT_BUFFER_SIZE = 4 * 1024 * 1024;
+
+    // Normalized chunking around a 2^16 average: two bits stricter before
+    // it, two bits looser after
+    const uint64_t MASK_STRICT = ~0ull << (64 - 18);
+    const uint64_t MASK_LOOSE = ~0ull << (64 - 14);
+
+    // Fixed seed: both ends must cut in the same places
+    const uint64_t *gearTable()
+    {
+        static const std::array<uint64_t, 256> table = []
+        {
+            std::array<uint64_t, 256> values;
+            uint64_t state = 0x5346544744454455ull;
+            for (uint64_t &value : values)
+            {
+                // splitmix64
+                uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+                value = z ^ (z >> 31);
+            }
+            return values;
+        }();
+        return table.data();
+    }
+
+    std::string toHex(const BYTE *data, size_t size)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex(2 * size, '0');
+        for (size_t i = 0; i < size; i++)
+        {
+            hex[2 * i] = digits[data[i] >> 4];
+            hex[2 * i + 1] = digits[data[i] & 0x0f];
+        }
+        return hex;
+    }
+
+    bool fromHex(const std::string &hex, BYTE *data, size_t size)
+    {
+        if (hex.size() != 2 * size)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < hex.size(); i++)
+        {
+            char c = hex[i];
+            int nibble = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+            if (nibble < 0)
+            {
+                return false;
+            }
+            data[i / 2] = static_cast<BYTE>(i % 2 == 0 ? nibble << 4 : data[i / 2] | nibble);
+        }
+        return true;
+    }
+
+    std::string keyOf(const StoredChunk &chunk)
+    {
+        return std::string(reinterpret_cast<const char *>(chunk.hash), sizeof(chunk.hash));
+    }
+}
+
+size_t ContentChunker::cut(const BYTE *data, size_t size)
+{
+    if (size <= MIN_SIZE)
+    {
+        return size;
+    }
+
+    // Bytes before MIN_SIZE cannot end a chunk, so they are not hashed either
+    const uint64_t *gear = gearTable();
+    size_t limit = std::min<size_t>(size, MAX_SIZE);
+    size_t normal = std::min<size_t>(limit, AVERAGE_SIZE);
+    uint64_t hash = 0;
+    size_t i = MIN_SIZE;
+    for (; i < normal; i++)
+    {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & MASK_STRICT) == 0)
+            return i + 1;
+    }
+    for (; i < limit; i++)
+    {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & MASK_LOOSE) == 0)
+            return i + 1;
+    }
+    return limit;
+}
+
+bool ContentChunker::split(std::istream &file, uint64_t fileSize, std::vector<StoredChunk> &chunks)
+{
+    chunks.clear();
+    file.clear();
+    file.seekg(0);
+
+    Sha256 hasher;
+    std::vector<BYTE> digest;
+    std::vector<BYTE> buffer(SPLIT_BUFFER_SIZE);
+    size_t begin = 0;
+    size_t end = 0;
+    uint64_t unread = fileSize;
+    while (true)
+    {
+        // Keep a whole maximum-size chunk in view until the file runs out
+        if (end - begin < MAX_SIZE && unread > 0)
+        {
+            memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+            size_t wanted = static_cast<size_t>(std::min<uint64_t>(buffer.size() - end, unread));
+            if (!file.read((char *)buffer.data() + end, wanted))
+            {
+                return false;
+            }
+            end += wanted;
+            unread -= wanted;
+        }
+        if (begin == end)
+        {
+            return true;
+        }
+
+        StoredChunk chunk;
+        chunk.size = static_cast<uint32_t>(cut(buffer.data() + begin, end - begin));
+        if (!hasher.update(buffer.data() + begin, chunk.size) || !hasher.finish(digest) || !hasher.reset())
+        {
+            return false;
+        }
+        memcpy(chunk.hash, digest.data(), sizeof(chunk.hash));
+        chunks.push_back(chunk);
+        begin += chunk.size;
+    }
+}
+
+bool ChunkStore::open(const std::string &rootDir)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::error_code ec;
+    fs::create_directories(fs::path(rootDir) / "chunks", ec);
+    fs::create_directories(fs::path(rootDir) / "manifests", ec);
+    if (ec)
+    {
+        return false;
+    }
+    root = rootDir;
+    entries.clear();
+
+    // Every chunk file on disk, minus writes that never finished
+    for (const auto &entry : fs::recursive_directory_iterator(fs::path(root) / "chunks", ec))
+    {
+        if (!entry.is_regular_file())
+            continue;
+        StoredChunk chunk;
+        if (entry.path().extension() == ".tmp" || !fromHex(entry.path().filename().string(), chunk.hash, sizeof(chunk.hash)))
+        {
+            fs::remove(entry.path(), ec);
+            continue;
+        }
+        Entry &stored = entries[keyOf(chunk)];
+        stored.stored = true;
+        stored.size = static_cast<uint32_t>(entry.file_size());
+    }
+
+    // Manifests are the only source of references
+    for (const auto &entry : fs::directory_iterator(fs::path(root) / "manifests", ec))
+    {
+        if (!entry.is_regular_file() || entry.path().extension() != MANIFEST_SUFFIX)
+            continue;
+        uint64_t fileSize = 0;
+        std::vector<StoredChunk> chunks;
+        if (!readManifest(entry.path().string(), fileSize, chunks))
+        {
+            NetworkUtils::printMessage("WARNING", "Unreadable manifest " + entry.path().string());
+            continue;
+        }
+        for (const StoredChunk &chunk : chunks)
+        {
+            Entry &listed = entries[keyOf(chunk)];
+            listed.refs++;
+            if (!listed.stored)
+            {
+                NetworkUtils::printMessage("WARNING", "Manifest " + entry.path().filename().string() + " lists a missing chunk");
+            }
+        }
+    }
+
+    // Leftovers of failed uploads
+    size_t swept = 0;
+    for (auto it = entries.begin(); it != entries.end();)
+    {
+        if (it->second.refs == 0)
+        {
+            fs::remove(chunkPath(it->first), ec);
+            it = entries.erase(it);
+            swept++;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    if (swept > 0)
+    {
+        NetworkUtils::printMessage("STORE", "Removed " + std::to_string(swept) + " unreferenced chunks");
+    }
+    return true;
+}
+
+std::string ChunkStore::chunkPath(const std::string &key) const
+{
+    std::string hex = toHex(reinterpret_cast<const BYTE *>(key.data()), key.size());
+    return (fs::path(root) / "chunks" / hex.substr(0, 2) / hex).string();
+}
+
+std::string ChunkStore::manifestPath(const std::string &name) const
+{
+    return (fs::path(root) / "manifests" / (name + MANIFEST_SUFFIX)).string();
+}
+
+bool ChunkStore::readManifest(const std::string &path, uint64_t &fileSize, std::vector<StoredChunk> &chunks)
+{
+    std::ifstream in(path, std::ios::binary);
+    uint32_t magic = 0;
+    uint32_t count = 0;
+    in.read((char *)&magic, sizeof(magic));
+    in.read((char *)&fileSize, sizeof(fileSize));
+    in.read((char *)&count, sizeof(count));
+    if (!in || magic != MANIFEST_MAGIC || count > MAX_MANIFEST_CHUNKS)
+    {
+        return false;
+    }
+    chunks.resize(count);
+    uint64_t total = 0;
+    for (StoredChunk &chunk : chunks)
+    {
+        in.read((char *)chunk.hash, sizeof(chunk.hash));
+        in.read((char *)&chunk.size, sizeof(chunk.size));
+        total += chunk.size;
+    }
+    return in && total == fileSize;
+}
+
+void ChunkStore::pin(const std::vector<StoredChunk> &chunks, std::vector<bool> &present)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    present.assign(chunks.size(), false);
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        Entry &entry = entries[keyOf(chunks[i])];
+        entry.pins++;
+        present[i] = entry.stored && entry.size == chunks[i].size;
+    }
+}
+
+void ChunkStore::unpin(const std::vector<StoredChunk> &chunks)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const StoredChunk &chunk : chunks)
+    {
+        auto it = entries.find(keyOf(chunk));
+        if (it == entries.end() || it->second.pins == 0)
+            continue;
+        it->second.pins--;
+        // Stored chunks outlive a failed upload so its retry finds them
+        if (it->second.pins == 0 && it->second.refs == 0 && !it->second.stored)
+        {
+            entries.erase(it);
+        }
+    }
+}
+
+bool ChunkStore::put(const StoredChunk &chunk, const BYTE *data)
+{
+    std::string key = keyOf(chunk);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end() && it->second.stored)
+        {
+            return true;
+        }
+    }
+
+    Sha256 hasher;
+    std::vector<BYTE> digest;
+    if (!hasher.update(data, chunk.size) || !hasher.finish(digest) || memcmp(digest.data(), chunk.hash, sizeof(chunk.hash)) != 0)
+    {
+        return false;
+    }
+
+    // Written under a private name outside the lock; the rename publishes it
+    std::string path = chunkPath(key);
+    std::string tempPath = path + "." + std::to_string(tempCounter++) + ".tmp";
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out.write((const char *)data, chunk.size) || !out.flush())
+        {
+            out.close();
+            fs::remove(tempPath, ec);
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &entry = entries[key];
+    if (entry.stored)
+    {
+        fs::remove(tempPath, ec);
+        return true;
+    }
+    if (!MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        fs::remove(tempPath, ec);
+        return false;
+    }
+    entry.stored = true;
+    entry.size = chunk.size;
+    return true;
+}
+
+bool ChunkStore::commit(const std::string &name, uint64_t fileSize, const std::vector<StoredChunk> &chunks)
+{
+    // The name becomes a manifest path
+    if (!FileTransfer::validFileName(name))
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const StoredChunk &chunk : chunks)
+    {
+        auto it = entries.find(keyOf(chunk));
+        if (it == entries.end() || !it->second.stored)
+        {
+            return false;
+        }
+    }
+
+    std::string path = manifestPath(name);
+    uint64_t oldSize = 0;
+    std::vector<StoredChunk> oldChunks;
+    bool replacing = readManifest(path, oldSize, oldChunks);
+
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        uint32_t count = static_cast<uint32_t>(chunks.size());
+        out.write((const char *)&MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+        out.write((const char *)&fileSize, sizeof(fileSize));
+        out.write((const char *)&count, sizeof(count));
+        for (const StoredChunk &chunk : chunks)
+        {
+            out.write((const char *)chunk.hash, sizeof(chunk.hash));
+            out.write((const char *)&chunk.size, sizeof(chunk.size));
+        }
+        if (!out.flush())
+        {
+            return false;
+        }
+    }
+    if (!MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        return false;
+    }
+
+    // New references first, so chunks shared with the old file never hit zero
+    for (const StoredChunk &chunk : chunks)
+    {
+        entries[keyOf(chunk)].refs++;
+    }
+    if (replacing)
+    {
+        for (const StoredChunk &chunk : oldChunks)
+        {
+            auto it = entries.find(keyOf(chunk));
+            if (it != entries.end() && it->second.refs > 0)
+            {
+                it->second.refs--;
+                releaseLocked(it->first);
+            }
+        }
+    }
+    return true;
+}
+
+void ChunkStore::releaseLocked(const std::string &key)
+{
+    auto it = entries.find(key);
+    if (it == entries.end() || it->second.refs > 0 || it->second.pins > 0)
+    {
+        return;
+    }
+    if (it->second.stored)
+    {
+        std::error_code ec;
+        fs::remove(chunkPath(key), ec);
+    }
+    entries.erase(it);
+}
+
+bool ChunkStore::restore(const std::string &name, const std::string &path)
+{
+    if (!FileTransfer::validFileName(name))
+    {
+        return false;
+    }
+    uint64_t fileSize = 0;
+    std::vector<StoredChunk> chunks;
+    {
+        // Read and pin together so a concurrent replace cannot delete them
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!readManifest(manifestPath(name), fileSize, chunks))
+        {
+            return false;
+        }
+        for (const StoredChunk &chunk : chunks)
+        {
+            entries[keyOf(chunk)].pins++;
+        }
+    }
+
+    bool ok = true;
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        std::vector<BYTE> buffer;
+        for (size_t i = 0; ok && i < chunks.size(); i++)
+        {
+            std::ifstream in(chunkPath(keyOf(chunks[i])), std::ios::binary);
+            buffer.resize(chunks[i].size);
+            ok = in.read((char *)buffer.data(), buffer.size()) && out.write((const char *)buffer.data(), buffer.size());
+        }
+        ok = ok && out.flush();
+    }
+    unpin(chunks);
+    if (!ok)
+    {
+        std::error_code ec;
+        fs::remove(path, ec);
+    }
+    return ok;
+}
+
+std::vector<ChunkStore::StoredFile> ChunkStore::list() const
+{
+    std::vector<StoredFile> files;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(fs::path(root) / "manifests", ec))
+    {
+        uint64_t fileSize = 0;
+        std::vector<StoredChunk> chunks;
+        if (entry.path().extension() == MANIFEST_SUFFIX && readManifest(entry.path().string(), fileSize, chunks))
+        {
+            files.push_back({entry.path().stem().string(), fileSize, static_cast<uint32_t>(chunks.size())});
+        }
+    }
+    return files;
+}
+
+uint64_t ChunkStore::storedBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t total = 0;
+    for (const auto &entry : entries)
+    {
+        if (entry.second.stored)
+            total += entry.second.size;
+    }
+    return total;
+}
+
+ChunkPins::ChunkPins(ChunkStore &store, const std::vector<StoredChunk> &chunks, std::vector<bool> &present) : store(store), chunks(chunks)
+{
+    store.pin(chunks, present);
+}
+
+ChunkPins::~ChunkPins()
+{
+    store.unpin(chunks);
+}
+
+ChunkAssembler::ChunkAssembler(ChunkStore *store, const std::vector<StoredChunk> &missing) : store(store), missing(missing), next(0)
+{
+}
+
+bool ChunkAssembler::apply(const BYTE *data, size_t size)
+{
+    while (size > 0)
+    {
+        if (next >= missing.size())
+        {
+            return false;
+        }
+        size_t wanted = missing[next].size - pending.size();
+        size_t taken = std::min(wanted, size);
+        pending.insert(pending.end(), data, data + taken);
+        data += taken;
+        size -= taken;
+
+        if (pending.size() == missing[next].size)
+        {
+            if (!store->put(missing[next], pending.data()))
+            {
+                NetworkUtils::printMessage("ERROR", "Chunk " + std::to_string(next) + " does not match its hash");
+                return false;
+            }
+            pending.clear();
+            next++;
+        }
+    }
+    return true;
+}
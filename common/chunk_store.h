@@ -0,0 +1,132 @@
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <istream>
+#include <unordered_map>
+
+struct StoredChunk
+{
+    BYTE hash[32]; // SHA-256 of the chunk
+    uint32_t size;
+};
+
+// Content-defined chunking (FastCDC). A gear hash rolls over the data and a
+// boundary falls where its top bits are all zero, with a stricter mask before
+// the average size and a looser one after it so sizes cluster around the
+// average. Boundaries depend only on the last 64 bytes, so an insertion
+// changes the chunks around it and nothing further on.
+class ContentChunker
+{
+public:
+    static const uint32_t MIN_SIZE = 16 * 1024;
+    static const uint32_t AVERAGE_SIZE = 64 * 1024;
+    static const uint32_t MAX_SIZE = 256 * 1024;
+    // On the wire a chunk is [SHA-256][u32 size]
+    static const size_t RECORD_WIRE_SIZE = 32 + sizeof(uint32_t);
+
+    // Length of the chunk starting at `data`. Pass at least MAX_SIZE bytes
+    // unless `size` runs to the end of the file.
+    static size_t cut(const BYTE *data, size_t size);
+
+    // Chunks and hashes `fileSize` bytes from the start of `file`
+    static bool split(std::istream &file, uint64_t fileSize, std::vector<StoredChunk> &chunks);
+};
+
+// Server-side content-addressed store. Every distinct chunk is kept once,
+// under chunks/<first 2 hex digits>/<hash>, and every stored file is a
+// manifest under manifests/ listing its chunks in order. A chunk counts one
+// reference per manifest entry and one pin per entry of an upload in
+// progress; it is deleted once a manifest swap drops both to zero. Chunks of
+// failed uploads are kept so a retry can reuse them, and swept on open().
+// Safe to use from several transfers at once.
+class ChunkStore
+{
+public:
+    struct StoredFile
+    {
+        std::string name;
+        uint64_t size;
+        uint32_t chunkCount;
+    };
+
+    // Rebuilds reference counts from the manifests and deletes chunks no
+    // manifest lists
+    bool open(const std::string &rootDir);
+    bool isOpen() const { return !root.empty(); }
+
+    // Pins each listed chunk; present[i] says whether chunk i is stored
+    void pin(const std::vector<StoredChunk> &chunks, std::vector<bool> &present);
+    void unpin(const std::vector<StoredChunk> &chunks);
+
+    // Checks the data against the chunk's hash, then stores it unless it is
+    // already there
+    bool put(const StoredChunk &chunk, const BYTE *data);
+
+    // Records `chunks` as the file `name`, replacing any earlier file of that
+    // name. Every chunk must be stored and pinned by the caller.
+    bool commit(const std::string &name, uint64_t fileSize, const std::vector<StoredChunk> &chunks);
+
+    // Rebuilds a stored file at `path`
+    bool restore(const std::string &name, const std::string &path);
+    std::vector<StoredFile> list() const;
+    // Total size of the distinct stored chunks
+    uint64_t storedBytes() const;
+
+private:
+    struct Entry
+    {
+        uint32_t refs = 0;
+        uint32_t pins = 0;
+        uint32_t size = 0;
+        bool stored = false;
+    };
+
+    std::string root;
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries; // keyed by the raw hash
+    std::atomic<uint64_t> tempCounter{0};
+
+    std::string chunkPath(const std::string &key) const;
+    std::string manifestPath(const std::string &name) const;
+    static bool readManifest(const std::string &path, uint64_t &fileSize, std::vector<StoredChunk> &chunks);
+    // Deletes the chunk once nothing references or pins it; mutex held
+    void releaseLocked(const std::string &key);
+};
+
+// Keeps an upload's chunks pinned for its whole lifetime, committed or not
+class ChunkPins
+{
+public:
+    ChunkPins(ChunkStore &store, const std::vector<StoredChunk> &chunks, std::vector<bool> &present);
+    ~ChunkPins();
+    ChunkPins(const ChunkPins &) = delete;
+    ChunkPins &operator=(const ChunkPins &) = delete;
+
+private:
+    ChunkStore &store;
+    std::vector<StoredChunk> chunks;
+};
+
+// Cuts the receiver's stream of missing chunks, sent back to back in list
+// order, into chunks again and stores each as it completes
+class ChunkAssembler
+{
+public:
+    ChunkAssembler(ChunkStore *store, const std::vector<StoredChunk> &missing);
+
+    bool apply(const BYTE *data, size_t size);
+    bool complete() const { return next == missing.size() && pending.empty(); }
+
+private:
+    ChunkStore *store;
+    const std::vector<StoredChunk> &missing;
+    size_t next;
+    std::vector<BYTE> pending;
+};
+
+#endif
@@ -1,18 +1,166 @@
 #include "crypto_utils.h"
+#include "merkle_tree.h"
+#include "logger.h"
 #include <iostream>
-#include <wincrypt.h>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 
 #pragma comment(lib, "crypt32.lib")
 
-// Simple XOR encryption (always works)
-std::vector<BYTE> xorEncryptDecrypt(const std::vector<BYTE> &key, const std::vector<BYTE> &data)
+CipherContext::CipherContext() : schedule{}, iv{}, ivCounter(0), valid(false)
 {
-    std::vector<BYTE> result(data.size());
-    for (size_t i = 0; i < data.size(); i++)
+}
+
+CipherContext::CipherContext(const std::vector<BYTE> &key, const std::vector<BYTE> &iv) : schedule{}, iv{}, ivCounter(0), valid(false)
+{
+    reset(key, iv);
+}
+
+void CipherContext::reset(const std::vector<BYTE> &key, const std::vector<BYTE> &initVector)
+{
+    valid = initVector.size() == sizeof(iv) && AesCtr::expandKey(key.data(), key.size(), schedule);
+    if (!valid)
+    {
+        return;
+    }
+
+    memcpy(iv, initVector.data(), sizeof(iv));
+    ivCounter = 0;
+    for (int i = 8; i < 16; i++)
+    {
+        ivCounter = (ivCounter << 8) | iv[i];
+    }
+}
+
+void CipherContext::process(BYTE *data, size_t size, uint64_t nonce, uint64_t offset) const
+{
+    process(data, data, size, nonce, offset);
+}
+
+void CipherContext::process(const BYTE *in, BYTE *out, size_t size, uint64_t nonce, uint64_t offset) const
+{
+    BYTE prefix[8];
+    for (int i = 0; i < 8; i++)
+    {
+        prefix[i] = iv[i] ^ static_cast<BYTE>(nonce >> (56 - 8 * i));
+    }
+    AesCtr::process(schedule, prefix, ivCounter + offset / 16, offset % 16, in, out, size);
+}
+
+std::vector<BYTE> CipherContext::encryptMessage(const std::vector<BYTE> &data, uint64_t *nonceOut) const
+{
+    uint64_t nonce = CryptoUtils::generateNonce();
+    std::vector<BYTE> message(NONCE_SIZE + data.size());
+    memcpy(message.data(), &nonce, NONCE_SIZE);
+    process(data.data(), message.data() + NONCE_SIZE, data.size(), nonce);
+
+    if (nonceOut)
+        *nonceOut = nonce;
+    return message;
+}
+
+bool CipherContext::decryptMessage(std::vector<BYTE> &message, uint64_t *nonceOut) const
+{
+    if (message.size() < NONCE_SIZE)
     {
-        result[i] = data[i] ^ key[i % key.size()];
+        return false;
     }
-    return result;
+
+    uint64_t nonce;
+    memcpy(&nonce, message.data(), NONCE_SIZE);
+    message.erase(message.begin(), message.begin() + NONCE_SIZE);
+    process(message.data(), message.size(), nonce);
+
+    if (nonceOut)
+        *nonceOut = nonce;
+    return true;
+}
+
+Sha256::Sha256() : provider(0), hash(0)
+{
+    if (!CryptAcquireContext(&provider, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT))
+    {
+        provider = 0;
+        return;
+    }
+    reset();
+}
+
+bool Sha256::reset()
+{
+    if (hash)
+    {
+        CryptDestroyHash(hash);
+        hash = 0;
+    }
+    if (!provider || !CryptCreateHash(provider, CALG_SHA_256, 0, 0, &hash))
+    {
+        hash = 0;
+        return false;
+    }
+    return true;
+}
+
+Sha256::~Sha256()
+{
+    if (hash)
+        CryptDestroyHash(hash);
+    if (provider)
+        CryptReleaseContext(provider, 0);
+}
+
+bool Sha256::update(const BYTE *data, size_t size)
+{
+    // CryptHashData takes a DWORD length
+    while (hash && size > 0)
+    {
+        DWORD part = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+        if (!CryptHashData(hash, data, part, 0))
+            return false;
+        data += part;
+        size -= part;
+    }
+    return hash != 0;
+}
+
+bool Sha256::finish(std::vector<BYTE> &digest)
+{
+    DWORD size = DIGEST_SIZE;
+    digest.resize(DIGEST_SIZE);
+    return hash && CryptGetHashParam(hash, HP_HASHVAL, digest.data(), &size, 0) && size == DIGEST_SIZE;
+}
+
+HmacSha256::HmacSha256(const std::vector<BYTE> &key)
+{
+    // Keys longer than a block are hashed first
+    std::vector<BYTE> blockKey = key;
+    if (blockKey.size() > BLOCK_SIZE)
+    {
+        Sha256 keyHasher;
+        keyHasher.update(key.data(), key.size());
+        keyHasher.finish(blockKey);
+    }
+    blockKey.resize(BLOCK_SIZE, 0);
+
+    BYTE innerPad[BLOCK_SIZE];
+    for (size_t i = 0; i < BLOCK_SIZE; i++)
+    {
+        innerPad[i] = blockKey[i] ^ 0x36;
+        outerPad[i] = blockKey[i] ^ 0x5c;
+    }
+    inner.update(innerPad, BLOCK_SIZE);
+    SecureZeroMemory(innerPad, sizeof(innerPad));
+    SecureZeroMemory(blockKey.data(), blockKey.size());
+}
+
+bool HmacSha256::finish(std::vector<BYTE> &mac)
+{
+    std::vector<BYTE> innerDigest;
+    Sha256 outer;
+    return inner.finish(innerDigest) && outer.update(outerPad, BLOCK_SIZE) && outer.update(innerDigest.data(), innerDigest.size()) &&
+           outer.finish(mac);
 }
 
 bool CryptoUtils::generateAESKey(std::vector<BYTE> &key, std::vector<BYTE> &iv)
@@ -40,43 +188,97 @@ bool CryptoUtils::generateAESKey(std::vector<BYTE> &key, std::vector<BYTE> &iv)
     return true;
 }
 
-std::vector<BYTE> CryptoUtils::aesEncrypt(const std::vector<BYTE> &key, const std::vector<BYTE> &iv, const std::vector<BYTE> &data)
+bool CryptoUtils::randomBytes(BYTE *buffer, size_t size)
 {
-    std::cout << "Encrypting " << data.size() << " bytes with XOR" << std::endl;
-
-    // Combine key and IV for stronger XOR
-    std::vector<BYTE> combinedKey(key);
-    combinedKey.insert(combinedKey.end(), iv.begin(), iv.end());
+    HCRYPTPROV hProv;
+    if (!CryptAcquireContext(&hProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT))
+    {
+        return false;
+    }
+    bool ok = CryptGenRandom(hProv, static_cast<DWORD>(size), buffer) != FALSE;
+    CryptReleaseContext(hProv, 0);
+    return ok;
+}
 
-    return xorEncryptDecrypt(combinedKey, data);
+std::vector<BYTE> CryptoUtils::aesEncrypt(const std::vector<BYTE> &key, const std::vector<BYTE> &iv, const std::vector<BYTE> &data)
+{
+    return CipherContext(key, iv).encryptMessage(data);
 }
 
 std::vector<BYTE> CryptoUtils::aesDecrypt(const std::vector<BYTE> &key, const std::vector<BYTE> &iv, const std::vector<BYTE> &encrypted)
 {
-    std::cout << "Decrypting " << encrypted.size() << " bytes with XOR" << std::endl;
+    std::vector<BYTE> message(encrypted);
+    if (!CipherContext(key, iv).decryptMessage(message))
+    {
+        return {};
+    }
+    return message;
+}
 
-    // Combine key and IV for stronger XOR
-    std::vector<BYTE> combinedKey(key);
-    combinedKey.insert(combinedKey.end(), iv.begin(), iv.end());
+uint64_t CryptoUtils::generateNonce()
+{
+    // A repeated nonce under one key repeats keystream, and keys such as the
+    // ticket key are shared by threads and server processes, so nonces come
+    // from the system CSPRNG like UUIDs do. Drawn a batch at a time to keep
+    // CryptoAPI off the per-message path.
+    static const size_t NONCE_BATCH = 64;
+    static thread_local uint64_t batch[NONCE_BATCH];
+    static thread_local size_t next = NONCE_BATCH;
+    if (next == NONCE_BATCH)
+    {
+        if (!randomBytes(reinterpret_cast<BYTE *>(batch), sizeof(batch)))
+        {
+            // Without CryptoAPI, mix the clock and a process-wide counter
+            // into random_device, which may be deterministic on its own
+            static std::atomic<uint64_t> counter{0};
+            std::random_device rd;
+            for (uint64_t &nonce : batch)
+            {
+                uint64_t ticks = static_cast<uint64_t>(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+                nonce = ((static_cast<uint64_t>(rd()) << 32) ^ rd()) ^ (ticks * 0x9E3779B97F4A7C15ull) ^ counter.fetch_add(1);
+            }
+        }
+        next = 0;
+    }
+    return batch[next++];
+}
 
-    return xorEncryptDecrypt(combinedKey, encrypted);
+bool CryptoUtils::selfTest()
+{
+    bool ok = AesCtr::selfTest();
+    Logger::console() << "AES-CTR self-test " << (ok ? "passed" : "FAILED") << " ("
+                      << AesCtr::implementationName(AesCtr::activeImplementation()) << ")" << std::endl;
+    bool crcOk = Crc32c::selfTest();
+    Logger::console() << "CRC-32C self-test " << (crcOk ? "passed" : "FAILED") << " (" << Crc32c::implementationName() << ")" << std::endl;
+    return ok && crcOk;
 }
 
+// 128 random bits in the 8-4-4-4-12 hex form. UUIDs name sessions and
+// clients, so they must neither repeat nor be guessable.
 std::string CryptoUtils::generateUUID()
 {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 15);
+    BYTE bits[16];
+    if (!randomBytes(bits, sizeof(bits)))
+    {
+        std::random_device rd;
+        for (size_t i = 0; i < sizeof(bits); i += sizeof(unsigned int))
+        {
+            unsigned int value = rd();
+            memcpy(bits + i, &value, sizeof(value));
+        }
+    }
 
-    std::stringstream ss;
-    ss << std::hex;
-    for (int i = 0; i < 32; i++)
+    static const char HEX[] = "0123456789abcdef";
+    std::string uuid;
+    uuid.reserve(36);
+    for (size_t i = 0; i < sizeof(bits); i++)
     {
-        if (i == 8 || i == 12 || i == 16 || i == 20)
-            ss << "-";
-        ss << dis(gen);
+        if (i == 4 || i == 6 || i == 8 || i == 10)
+            uuid += '-';
+        uuid += HEX[bits[i] >> 4];
+        uuid += HEX[bits[i] & 0xF];
     }
-    return ss.str();
+    return uuid;
 }
 
 std::string CryptoUtils::base64Encode(const std::vector<BYTE> &data)
@@ -2,29 +2,101 @@
 #define CRYPTO_UTILS_H
 
 #include <windows.h>
-#include <bcrypt.h>
+#include <wincrypt.h>
 #include <string>
 #include <vector>
 #include <random>
 #include <sstream>
 #include <iomanip>
+#include "aes_ctr.h"
 
-#pragma comment(lib, "bcrypt.lib")
+// Per-session AES-CTR state. Built once from the session key/IV and then
+// applied to caller-owned buffers in place, without allocating or logging.
+//
+// The keystream is addressed by (nonce, byte offset): the nonce is mixed into
+// the first half of the IV and the offset selects the counter block. Callers
+// must never reuse a nonce/offset range under the same session key.
+class CipherContext
+{
+public:
+    static const size_t NONCE_SIZE = sizeof(uint64_t);
+
+    CipherContext();
+    CipherContext(const std::vector<BYTE> &key, const std::vector<BYTE> &iv);
+
+    void reset(const std::vector<BYTE> &key, const std::vector<BYTE> &iv);
+    bool isValid() const { return valid; }
+
+    // Encryption and decryption are the same transform
+    void process(BYTE *data, size_t size, uint64_t nonce, uint64_t offset = 0) const;
+    void process(const BYTE *in, BYTE *out, size_t size, uint64_t nonce, uint64_t offset = 0) const;
+
+    // Self-contained messages: a fresh random nonce followed by the ciphertext
+    std::vector<BYTE> encryptMessage(const std::vector<BYTE> &data, uint64_t *nonceOut = nullptr) const;
+    bool decryptMessage(std::vector<BYTE> &message, uint64_t *nonceOut = nullptr) const;
+
+private:
+    AesKeySchedule schedule;
+    BYTE iv[16];
+    uint64_t ivCounter;
+    bool valid;
+};
+
+// Incremental SHA-256 on the Windows CryptoAPI provider
+class Sha256
+{
+public:
+    static const size_t DIGEST_SIZE = 32;
+
+    Sha256();
+    ~Sha256();
+    Sha256(const Sha256 &) = delete;
+    Sha256 &operator=(const Sha256 &) = delete;
+
+    bool isValid() const { return hash != 0; }
+    bool update(const BYTE *data, size_t size);
+    bool finish(std::vector<BYTE> &digest);
+    // Starts a new digest on the same provider; needed after finish()
+    bool reset();
+
+private:
+    HCRYPTPROV provider;
+    HCRYPTHASH hash;
+};
+
+// HMAC-SHA256 (RFC 2104); one instance per message
+class HmacSha256
+{
+public:
+    static const size_t MAC_SIZE = Sha256::DIGEST_SIZE;
+
+    explicit HmacSha256(const std::vector<BYTE> &key);
+
+    bool update(const BYTE *data, size_t size) { return inner.update(data, size); }
+    bool finish(std::vector<BYTE> &mac);
+
+private:
+    static const size_t BLOCK_SIZE = 64;
+
+    Sha256 inner;
+    BYTE outerPad[BLOCK_SIZE];
+};
 
 class CryptoUtils
 {
 public:
     static bool generateAESKey(std::vector<BYTE> &key, std::vector<BYTE> &iv);
+    // Fills `buffer` from the system CSPRNG; false if it is unavailable
+    static bool randomBytes(BYTE *buffer, size_t size);
     static std::vector<BYTE> aesEncrypt(const std::vector<BYTE> &key, const std::vector<BYTE> &iv, const std::vector<BYTE> &data);
     static std::vector<BYTE> aesDecrypt(const std::vector<BYTE> &key, const std::vector<BYTE> &iv, const std::vector<BYTE> &encrypted);
+    static uint64_t generateNonce();
+    static bool selfTest();
     static std::string generateUUID();
     static std::string base64Encode(const std::vector<BYTE> &data);
     static std::vector<BYTE> base64Decode(const std::string &data);
     static std::vector<BYTE> stringToVector(const std::string &str);
     static std::string vectorToString(const std::vector<BYTE> &data);
-
-private:
-    static bool initializeBCrypt();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,402 @@
+#include "delta_sync.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define DELTA_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    const size_t COPY_HEADER_SIZE = 1 + 2 * sizeof(uint32_t);
+    const size_t LITERAL_HEADER_SIZE = 1 + sizeof(uint32_t);
+
+    size_t headerSize(const DeltaOp &op)
+    {
+        return op.type == DeltaOpType::Copy ? COPY_HEADER_SIZE : LITERAL_HEADER_SIZE;
+    }
+
+    void encodeHeader(const DeltaOp &op, BYTE *header)
+    {
+        header[0] = static_cast<BYTE>(op.type);
+        uint32_t first = static_cast<uint32_t>(op.type == DeltaOpType::Copy ? op.position : op.count);
+        memcpy(header + 1, &first, sizeof(first));
+        if (op.type == DeltaOpType::Copy)
+        {
+            uint32_t count = static_cast<uint32_t>(op.count);
+            memcpy(header + 1 + sizeof(first), &count, sizeof(count));
+        }
+    }
+
+    uint16_t weakTag(uint32_t weak)
+    {
+        return static_cast<uint16_t>(weak ^ (weak >> 16));
+    }
+
+    void appendLiteral(std::vector<DeltaOp> &ops, uint64_t start, uint64_t end)
+    {
+        while (start < end)
+        {
+            uint64_t length = std::min<uint64_t>(end - start, DeltaSync::MAX_LITERAL);
+            ops.push_back({DeltaOpType::Literal, start, length});
+            start += length;
+        }
+    }
+}
+
+uint32_t DeltaSync::chooseBlockSize(uint64_t basisSize)
+{
+    uint64_t size = static_cast<uint64_t>(std::sqrt(static_cast<double>(basisSize)));
+    size -= size % 1024;
+    size = std::min<uint64_t>(std::max<uint64_t>(size, MIN_BLOCK_SIZE), MAX_BLOCK_SIZE);
+    return static_cast<uint32_t>(size);
+}
+
+uint32_t DeltaSync::weakChecksum(const BYTE *data, size_t size)
+{
+    // Iteratively a += x, b += a, so b weights byte i by (size - i)
+    uint32_t a = 0;
+    uint32_t b = 0;
+    size_t i = 0;
+
+#if defined(DELTA_SSE2)
+    // Per 16 bytes: b += 16 * a_before + sum((16 - j) * x_j), a += sum(x_j).
+    // Lanes may wrap; only the low 16 bits of each sum are kept.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weightsLo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i weightsHi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+    __m128i sums = zero;    // running a, two 64-bit lanes
+    __m128i prefixes = zero; // sum of a before each 16-byte step
+    __m128i weighted = zero;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        prefixes = _mm_add_epi32(prefixes, sums);
+        sums = _mm_add_epi32(sums, _mm_sad_epu8(x, zero));
+        __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(x, zero), weightsLo);
+        __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(x, zero), weightsHi);
+        weighted = _mm_add_epi32(weighted, _mm_add_epi32(lo, hi));
+    }
+
+    alignas(16) uint32_t lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), sums);
+    a = lanes[0] + lanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), prefixes);
+    b = 16 * (lanes[0] + lanes[2]);
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), weighted);
+    b += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+
+    for (; i < size; i++)
+    {
+        a += data[i];
+        b += a;
+    }
+    return (a & 0xffff) | ((b & 0xffff) << 16);
+}
+
+bool DeltaSync::strongChecksum(Sha256 &hasher, const BYTE *data, size_t size, BYTE strong[16])
+{
+    std::vector<BYTE> digest;
+    if (!hasher.reset() || !hasher.update(data, size) || !hasher.finish(digest))
+    {
+        return false;
+    }
+    memcpy(strong, digest.data(), 16);
+    return true;
+}
+
+bool DeltaSync::computeSignatures(std::istream &basis, uint64_t basisSize, uint32_t blockSize, std::vector<BlockSignature> &signatures)
+{
+    uint64_t blockCount = basisSize / blockSize;
+    if (blockCount > MAX_BLOCKS)
+    {
+        return false;
+    }
+
+    Sha256 hasher;
+    std::vector<BYTE> block(blockSize);
+    signatures.resize(static_cast<size_t>(blockCount));
+    basis.clear();
+    basis.seekg(0);
+    for (auto &signature : signatures)
+    {
+        basis.read((char *)block.data(), blockSize);
+        if (static_cast<size_t>(basis.gcount()) != blockSize)
+        {
+            return false;
+        }
+        signature.weak = weakChecksum(block.data(), blockSize);
+        if (!strongChecksum(hasher, block.data(), blockSize, signature.strong))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DeltaSync::plan(std::istream &source, uint64_t sourceSize, uint32_t blockSize, const std::vector<BlockSignature> &signatures,
+                     std::vector<DeltaOp> &ops, std::vector<BYTE> &sourceDigest)
+{
+    ops.clear();
+
+    // Sorted (weak, block) index behind a 64K-entry tag filter that rejects
+    // most positions without a search
+    std::vector<std::pair<uint32_t, uint32_t>> index;
+    std::vector<BYTE> tags(1 << 16, 0);
+    index.reserve(signatures.size());
+    for (uint32_t i = 0; i < signatures.size(); i++)
+    {
+        index.push_back(std::make_pair(signatures[i].weak, i));
+        tags[weakTag(signatures[i].weak)] = 1;
+    }
+    std::sort(index.begin(), index.end());
+
+    Sha256 fileHasher;
+    Sha256 blockHasher;
+    std::vector<BYTE> buffer(std::max<size_t>(4 * 1024 * 1024, 4 * static_cast<size_t>(blockSize)));
+    uint64_t bufferStart = 0; // file offset of buffer[0]
+    size_t bufferFill = 0;
+    uint64_t pos = 0;
+    uint64_t literalStart = 0;
+    source.clear();
+    source.seekg(0);
+
+    // Makes [pos, end) resident, sliding the buffer forward; every byte is
+    // read exactly once and in order, so the file digest comes for free
+    auto ensure = [&](uint64_t end)
+    {
+        if (end <= bufferStart + bufferFill)
+            return true;
+        size_t keep = static_cast<size_t>(bufferStart + bufferFill - pos);
+        memmove(buffer.data(), buffer.data() + (pos - bufferStart), keep);
+        bufferStart = pos;
+        bufferFill = keep;
+
+        size_t wanted = static_cast<size_t>(std::min<uint64_t>(buffer.size() - keep, sourceSize - (bufferStart + bufferFill)));
+        source.read((char *)buffer.data() + bufferFill, wanted);
+        if (static_cast<size_t>(source.gcount()) != wanted || !fileHasher.update(buffer.data() + bufferFill, wanted))
+            return false;
+        bufferFill += wanted;
+        return end <= bufferStart + bufferFill;
+    };
+
+    bool haveWeak = false;
+    uint32_t weak = 0;
+    BYTE strong[16];
+    while (pos + blockSize <= sourceSize)
+    {
+        if (!ensure(pos + blockSize))
+        {
+            return false;
+        }
+        const BYTE *window = buffer.data() + (pos - bufferStart);
+        if (!haveWeak)
+        {
+            weak = weakChecksum(window, blockSize);
+            haveWeak = true;
+        }
+
+        int64_t match = -1;
+        if (tags[weakTag(weak)])
+        {
+            auto range = std::equal_range(index.begin(), index.end(), std::make_pair(weak, 0u),
+                                          [](const std::pair<uint32_t, uint32_t> &l, const std::pair<uint32_t, uint32_t> &r)
+                                          { return l.first < r.first; });
+            if (range.first != range.second)
+            {
+                if (!strongChecksum(blockHasher, window, blockSize, strong))
+                {
+                    return false;
+                }
+
+                // Prefer the block right after the previous copy so runs merge
+                uint64_t preferred = !ops.empty() && ops.back().type == DeltaOpType::Copy ? ops.back().position + ops.back().count : UINT64_MAX;
+                for (auto it = range.first; it != range.second; ++it)
+                {
+                    if (memcmp(signatures[it->second].strong, strong, sizeof(strong)) == 0)
+                    {
+                        if (match < 0 || it->second == preferred)
+                            match = it->second;
+                        if (it->second == preferred)
+                            break;
+                    }
+                }
+            }
+        }
+
+        if (match >= 0)
+        {
+            appendLiteral(ops, literalStart, pos);
+            if (!ops.empty() && ops.back().type == DeltaOpType::Copy && ops.back().position + ops.back().count == static_cast<uint64_t>(match))
+            {
+                ops.back().count++;
+            }
+            else
+            {
+                ops.push_back({DeltaOpType::Copy, static_cast<uint64_t>(match), 1});
+            }
+            pos += blockSize;
+            literalStart = pos;
+            haveWeak = false;
+            continue;
+        }
+
+        if (pos + blockSize < sourceSize)
+        {
+            if (!ensure(pos + blockSize + 1))
+            {
+                return false;
+            }
+            window = buffer.data() + (pos - bufferStart);
+            weak = rollChecksum(weak, window[0], window[blockSize], blockSize);
+        }
+        pos++;
+    }
+
+    if (!ensure(sourceSize))
+    {
+        return false;
+    }
+    appendLiteral(ops, literalStart, sourceSize);
+    return fileHasher.finish(sourceDigest);
+}
+
+uint64_t DeltaSync::encodedSize(const std::vector<DeltaOp> &ops)
+{
+    uint64_t size = 0;
+    for (const auto &op : ops)
+    {
+        size += headerSize(op) + (op.type == DeltaOpType::Literal ? op.count : 0);
+    }
+    return size;
+}
+
+DeltaEncoder::DeltaEncoder(const std::vector<DeltaOp> &ops, std::istream &source)
+    : ops(ops), source(source), opIndex(0), opProgress(0)
+{
+}
+
+bool DeltaEncoder::read(BYTE *out, size_t capacity, size_t &produced)
+{
+    produced = 0;
+    while (produced < capacity && opIndex < ops.size())
+    {
+        const DeltaOp &op = ops[opIndex];
+        size_t opHeaderSize = headerSize(op);
+        if (opProgress < opHeaderSize)
+        {
+            BYTE header[COPY_HEADER_SIZE];
+            encodeHeader(op, header);
+            size_t n = std::min<size_t>(opHeaderSize - static_cast<size_t>(opProgress), capacity - produced);
+            memcpy(out + produced, header + opProgress, n);
+            produced += n;
+            opProgress += n;
+            continue;
+        }
+
+        uint64_t payload = op.type == DeltaOpType::Literal ? op.count : 0;
+        uint64_t done = opProgress - opHeaderSize;
+        if (done < payload)
+        {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(payload - done, capacity - produced));
+            source.clear();
+            source.seekg(op.position + done);
+            source.read((char *)out + produced, n);
+            if (static_cast<size_t>(source.gcount()) != n)
+            {
+                return false;
+            }
+            produced += n;
+            opProgress += n;
+            continue;
+        }
+
+        opIndex++;
+        opProgress = 0;
+    }
+    return true;
+}
+
+DeltaDecoder::DeltaDecoder(std::istream &basis, uint64_t basisSize, uint32_t blockSize, uint32_t blockCount, Writer writer)
+    : basis(basis), basisSize(basisSize), blockSize(blockSize), blockCount(blockCount), writer(std::move(writer)),
+      header{}, headerFill(0), literalRemaining(0)
+{
+}
+
+bool DeltaDecoder::apply(const BYTE *data, size_t size)
+{
+    while (size > 0)
+    {
+        if (literalRemaining > 0)
+        {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(literalRemaining, size));
+            if (!writer(data, n))
+            {
+                return false;
+            }
+            literalRemaining -= n;
+            data += n;
+            size -= n;
+            continue;
+        }
+
+        header[headerFill++] = *data++;
+        size--;
+        size_t needed = header[0] == static_cast<BYTE>(DeltaOpType::Copy)      ? COPY_HEADER_SIZE
+                        : header[0] == static_cast<BYTE>(DeltaOpType::Literal) ? LITERAL_HEADER_SIZE
+                                                                               : 0;
+        if (needed == 0)
+        {
+            return false;
+        }
+        if (headerFill < needed)
+        {
+            continue;
+        }
+        headerFill = 0;
+
+        uint32_t first = 0;
+        memcpy(&first, header + 1, sizeof(first));
+        if (header[0] == static_cast<BYTE>(DeltaOpType::Literal))
+        {
+            if (first == 0 || first > DeltaSync::MAX_LITERAL)
+            {
+                return false;
+            }
+            literalRemaining = first;
+            continue;
+        }
+
+        uint32_t count = 0;
+        memcpy(&count, header + 1 + sizeof(first), sizeof(count));
+        if (count == 0 || first >= blockCount || count > blockCount - first || !copyBlocks(first, count))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DeltaDecoder::copyBlocks(uint32_t first, uint32_t count)
+{
+    uint64_t start = static_cast<uint64_t>(first) * blockSize;
+    uint64_t remaining = std::min<uint64_t>(static_cast<uint64_t>(count) * blockSize, basisSize - start);
+    copyBuffer.resize(std::max<size_t>(blockSize, 1024 * 1024));
+
+    basis.clear();
+    basis.seekg(start);
+    while (remaining > 0)
+    {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(remaining, copyBuffer.size()));
+        basis.read((char *)copyBuffer.data(), n);
+        if (static_cast<size_t>(basis.gcount()) != n || !writer(copyBuffer.data(), n))
+        {
+            return false;
+        }
+        remaining -= n;
+    }
+    return true;
+}
@@ -0,0 +1,110 @@
+#ifndef DELTA_SYNC_H
+#define DELTA_SYNC_H
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <istream>
+#include <functional>
+#include "crypto_utils.h"
+
+struct BlockSignature
+{
+    uint32_t weak;   // rolling checksum of the block
+    BYTE strong[16]; // truncated SHA-256 of the block
+};
+
+enum class DeltaOpType : BYTE
+{
+    Copy = 1,   // reuse whole blocks of the receiver's copy
+    Literal = 2 // bytes carried in the stream
+};
+
+struct DeltaOp
+{
+    DeltaOpType type;
+    uint64_t position; // first basis block (Copy) or source file offset (Literal)
+    uint64_t count;    // block count (Copy) or byte count (Literal)
+};
+
+// rsync-style block matching. The receiver signs fixed-size blocks of its
+// existing copy; the sender slides a rolling checksum over its file and turns
+// it into copy and literal operations. On the wire a copy is
+// [type][u32 first block][u32 block count] and a literal [type][u32 length]
+// followed by the bytes; operations may straddle frame boundaries.
+class DeltaSync
+{
+public:
+    static const uint32_t MIN_BLOCK_SIZE = 2 * 1024;
+    static const uint32_t MAX_BLOCK_SIZE = 128 * 1024;
+    static const uint32_t MAX_BLOCKS = 1 << 22;
+    static const uint32_t MAX_LITERAL = 16 * 1024 * 1024;
+    static const size_t SIGNATURE_WIRE_SIZE = sizeof(uint32_t) + 16;
+
+    // About sqrt(size), so signatures and per-block overhead stay balanced
+    static uint32_t chooseBlockSize(uint64_t basisSize);
+
+    // Weak checksum: low half is the byte sum, high half the position-weighted
+    // sum, both mod 2^16. Vectorized where SSE2 is part of the target.
+    static uint32_t weakChecksum(const BYTE *data, size_t size);
+    static uint32_t rollChecksum(uint32_t weak, BYTE out, BYTE in, uint32_t blockSize)
+    {
+        uint32_t a = ((weak & 0xffff) - out + in) & 0xffff;
+        uint32_t b = ((weak >> 16) - blockSize * out + a) & 0xffff;
+        return a | (b << 16);
+    }
+    static bool strongChecksum(Sha256 &hasher, const BYTE *data, size_t size, BYTE strong[16]);
+
+    // Signatures for every whole block of the basis; a short tail is not signed
+    static bool computeSignatures(std::istream &basis, uint64_t basisSize, uint32_t blockSize, std::vector<BlockSignature> &signatures);
+
+    // One sequential pass over the source; also produces its SHA-256
+    static bool plan(std::istream &source, uint64_t sourceSize, uint32_t blockSize, const std::vector<BlockSignature> &signatures,
+                     std::vector<DeltaOp> &ops, std::vector<BYTE> &sourceDigest);
+    static uint64_t encodedSize(const std::vector<DeltaOp> &ops);
+};
+
+// Serializes a plan into the delta byte stream, reading literals from the source
+class DeltaEncoder
+{
+public:
+    DeltaEncoder(const std::vector<DeltaOp> &ops, std::istream &source);
+
+    // Fills up to `capacity` bytes; `produced` is 0 once the stream is finished
+    bool read(BYTE *out, size_t capacity, size_t &produced);
+
+private:
+    const std::vector<DeltaOp> &ops;
+    std::istream &source;
+    size_t opIndex;
+    uint64_t opProgress; // bytes of the current op already emitted, header included
+};
+
+// Rebuilds the file from the delta byte stream, fed in stream order
+class DeltaDecoder
+{
+public:
+    using Writer = std::function<bool(const BYTE *data, size_t size)>;
+
+    DeltaDecoder(std::istream &basis, uint64_t basisSize, uint32_t blockSize, uint32_t blockCount, Writer writer);
+
+    bool apply(const BYTE *data, size_t size);
+    // True between operations, i.e. when the stream may legally end
+    bool atBoundary() const { return headerFill == 0 && literalRemaining == 0; }
+
+private:
+    std::istream &basis;
+    uint64_t basisSize;
+    uint32_t blockSize;
+    uint32_t blockCount;
+    Writer writer;
+
+    BYTE header[9];
+    size_t headerFill;
+    uint64_t literalRemaining;
+    std::vector<BYTE> copyBuffer;
+
+    bool copyBlocks(uint32_t first, uint32_t count);
+};
+
+#endif
@@ -0,0 +1,250 @@
+#include "file_io.h"
+#include <winioctl.h>
+#include <algorithm>
+
+MappedFile::MappedFile() : handle(INVALID_HANDLE_VALUE), mapping(NULL), view(nullptr), fileSize(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string &path)
+{
+    close();
+    handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size) || static_cast<uint64_t>(size.QuadPart) > SIZE_MAX)
+    {
+        close();
+        return false;
+    }
+    fileSize = static_cast<uint64_t>(size.QuadPart);
+
+    // Empty files cannot be mapped and need no view
+    if (fileSize == 0)
+    {
+        return true;
+    }
+
+    mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping != NULL)
+    {
+        view = static_cast<const BYTE *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (view == nullptr)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (view)
+    {
+        UnmapViewOfFile(view);
+        view = nullptr;
+    }
+    if (mapping != NULL)
+    {
+        CloseHandle(mapping);
+        mapping = NULL;
+    }
+    if (handle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(handle);
+        handle = INVALID_HANDLE_VALUE;
+    }
+    fileSize = 0;
+}
+
+void MappedFile::prefetch(uint64_t offset, uint64_t length) const
+{
+    if (!view || offset >= fileSize)
+    {
+        return;
+    }
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = const_cast<BYTE *>(view + offset);
+    range.NumberOfBytes = static_cast<SIZE_T>(length < fileSize - offset ? length : fileSize - offset);
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+bool queryDataRanges(const std::string &path, uint64_t fileSize, std::vector<std::pair<uint64_t, uint64_t>> &ranges)
+{
+    ranges.clear();
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    // Answers come in batches; ERROR_MORE_DATA asks for the next one,
+    // starting where the last range ended
+    FILE_ALLOCATED_RANGE_BUFFER query;
+    query.FileOffset.QuadPart = 0;
+    query.Length.QuadPart = static_cast<LONGLONG>(fileSize);
+    FILE_ALLOCATED_RANGE_BUFFER answer[256];
+    bool ok = true;
+    while (fileSize > 0)
+    {
+        DWORD returned = 0;
+        BOOL done = DeviceIoControl(handle, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query), answer, sizeof(answer), &returned, NULL);
+        if (!done && GetLastError() != ERROR_MORE_DATA)
+        {
+            // Not a filesystem that knows about holes
+            ranges.assign(1, {0, fileSize});
+            break;
+        }
+        size_t count = returned / sizeof(answer[0]);
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t start = static_cast<uint64_t>(answer[i].FileOffset.QuadPart);
+            uint64_t end = std::min<uint64_t>(start + static_cast<uint64_t>(answer[i].Length.QuadPart), fileSize);
+            if (start >= end)
+                continue;
+            if (!ranges.empty() && ranges.back().first + ranges.back().second >= start)
+                ranges.back().second = std::max(ranges.back().second, end - ranges.back().first);
+            else
+                ranges.push_back(std::make_pair(start, end - start));
+        }
+        if (done)
+        {
+            break;
+        }
+        if (count == 0)
+        {
+            ok = false;
+            break;
+        }
+        uint64_t next = static_cast<uint64_t>(answer[count - 1].FileOffset.QuadPart + answer[count - 1].Length.QuadPart);
+        query.Length.QuadPart -= static_cast<LONGLONG>(next) - query.FileOffset.QuadPart;
+        query.FileOffset.QuadPart = static_cast<LONGLONG>(next);
+    }
+    CloseHandle(handle);
+    return ok;
+}
+
+bool parseFlushPolicy(const std::string &name, FlushPolicy &policy)
+{
+    if (name == "none")
+        policy = FlushPolicy::None;
+    else if (name == "interval")
+        policy = FlushPolicy::Interval;
+    else if (name == "complete")
+        policy = FlushPolicy::Complete;
+    else
+        return false;
+    return true;
+}
+
+FileWriter::FileWriter() : handle(INVALID_HANDLE_VALUE)
+{
+}
+
+FileWriter::~FileWriter()
+{
+    close();
+}
+
+bool FileWriter::open(const std::string &path, uint64_t size, bool truncate, bool sparse)
+{
+    close();
+    handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, truncate ? CREATE_ALWAYS : OPEN_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    // Reserve the clusters first, then move end-of-file; writes inside the
+    // file no longer touch allocation metadata. A sparse file instead only
+    // allocates what gets written.
+    if (sparse)
+    {
+        FILE_SET_SPARSE_BUFFER setSparse;
+        setSparse.SetSparse = TRUE;
+        DWORD returned = 0;
+        if (!DeviceIoControl(handle, FSCTL_SET_SPARSE, &setSparse, sizeof(setSparse), NULL, 0, &returned, NULL))
+        {
+            close();
+            return false;
+        }
+    }
+    else
+    {
+        FILE_ALLOCATION_INFO allocation;
+        allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+        SetFileInformationByHandle(handle, FileAllocationInfo, &allocation, sizeof(allocation));
+    }
+
+    FILE_END_OF_FILE_INFO endOfFile;
+    endOfFile.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+    if (!SetFileInformationByHandle(handle, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile)))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void FileWriter::close()
+{
+    if (handle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(handle);
+        handle = INVALID_HANDLE_VALUE;
+    }
+}
+
+bool FileWriter::writeAt(uint64_t offset, const BYTE *data, size_t size)
+{
+    // A synchronous handle still honours the OVERLAPPED offset, which makes
+    // this a positional write that is safe from several threads
+    while (size > 0)
+    {
+        OVERLAPPED position = {};
+        position.Offset = static_cast<DWORD>(offset);
+        position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD part = static_cast<DWORD>(size < (1u << 30) ? size : (1u << 30));
+        DWORD written = 0;
+        if (!WriteFile(handle, data, part, &written, &position) || written == 0)
+        {
+            return false;
+        }
+        offset += written;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool FileWriter::writeFile(const std::string &path, const BYTE *data, size_t size)
+{
+    FileWriter writer;
+    writer.handle = CreateFileA(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    return writer.isOpen() && writer.writeAt(0, data, size);
+}
+
+bool FileWriter::flush()
+{
+    return FlushFileBuffers(handle) != 0;
+}
+
+bool FileWriter::punchHole(uint64_t offset, uint64_t size)
+{
+    FILE_ZERO_DATA_INFORMATION zero;
+    zero.FileOffset.QuadPart = static_cast<LONGLONG>(offset);
+    zero.BeyondFinalZero.QuadPart = static_cast<LONGLONG>(offset + size);
+    DWORD returned = 0;
+    return size == 0 || DeviceIoControl(handle, FSCTL_SET_ZERO_DATA, &zero, sizeof(zero), NULL, 0, &returned, NULL) != 0;
+}
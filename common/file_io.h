@@ -0,0 +1,90 @@
+#ifndef FILE_IO_H
+#define FILE_IO_H
+
+#include <windows.h>
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <utility>
+
+// Read-only view of a whole file. Chunks are encrypted straight out of the
+// mapping, so file data is never copied into a read buffer first. The handle
+// is opened for sequential scan and prefetch() asks the memory manager to
+// read ahead of the sender.
+class MappedFile
+{
+public:
+    // Readahead window kept in front of the reader
+    static const uint64_t PREFETCH_WINDOW = 32 * 1024 * 1024;
+
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // False when the file cannot be mapped, e.g. when it does not fit the
+    // address space; callers then fall back to stream reads
+    bool open(const std::string &path);
+    void close();
+
+    bool isOpen() const { return handle != INVALID_HANDLE_VALUE; }
+    const BYTE *data() const { return view; }
+    uint64_t size() const { return fileSize; }
+
+    // Hint only; failures are ignored
+    void prefetch(uint64_t offset, uint64_t length) const;
+
+private:
+    HANDLE handle;
+    HANDLE mapping;
+    const BYTE *view;
+    uint64_t fileSize;
+};
+
+// [offset, length) ranges of the file that hold data, in order; the holes
+// between them read as zeros. Filesystems without sparse files report the
+// whole file.
+bool queryDataRanges(const std::string &path, uint64_t fileSize, std::vector<std::pair<uint64_t, uint64_t>> &ranges);
+
+// How often received data is forced to stable storage
+enum class FlushPolicy
+{
+    None,     // leave write-back to the OS
+    Interval, // before every journal save, so the journal never runs ahead of the disk
+    Complete  // once, before the finished file is renamed into place
+};
+
+// Accepts "none", "interval" and "complete"
+bool parseFlushPolicy(const std::string &name, FlushPolicy &policy);
+
+// Output file written at explicit offsets. The full size is reserved up front
+// so the filesystem allocates once instead of extending the file on every
+// write, unless the file is opened sparse, where ranges never written stay
+// unallocated. writeAt is safe from several threads.
+class FileWriter
+{
+public:
+    FileWriter();
+    ~FileWriter();
+    FileWriter(const FileWriter &) = delete;
+    FileWriter &operator=(const FileWriter &) = delete;
+
+    // `truncate` discards existing contents; otherwise they are kept for resume
+    bool open(const std::string &path, uint64_t size, bool truncate, bool sparse = false);
+    void close();
+
+    bool isOpen() const { return handle != INVALID_HANDLE_VALUE; }
+    bool writeAt(uint64_t offset, const BYTE *data, size_t size);
+    bool flush();
+    // Zeros [offset, offset + size); a sparse file gives the clusters back
+    bool punchHole(uint64_t offset, uint64_t size);
+
+    // Creates or replaces `path` with `size` bytes in one write, skipping the
+    // reservation, which costs more than it saves on small files
+    static bool writeFile(const std::string &path, const BYTE *data, size_t size);
+
+private:
+    HANDLE handle;
+};
+
+#endif
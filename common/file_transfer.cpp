@@ -1,10 +1,533 @@
 #include "file_transfer.h"
+#include "transfer_journal.h"
+#include "striped_transfer.h"
+#include "io_engine.h"
+#include "lz_codec.h"
+#include "transfer_progress.h"
 #include <filesystem>
+#include <cstring>
+#include <thread>
+#include <sstream>
+#include <iomanip>
+#include <unordered_set>
+#include <cctype>
 
 namespace fs = std::filesystem;
 
+namespace
+{
+    typedef std::vector<std::pair<uint64_t, uint64_t>> RangeList;
+
+    // Windows opens these devices in any directory, with or without an
+    // extension ("NUL.txt"), so they can never name a received file
+    bool reservedDeviceName(const std::string &fileName)
+    {
+        static const char *const DEVICE_NAMES[] = {
+            "CON", "PRN", "AUX", "NUL", "CONIN$", "CONOUT$",
+            "COM1", "COM2", "COM3", "COM4", "COM5", "COM6", "COM7", "COM8", "COM9",
+            "LPT1", "LPT2", "LPT3", "LPT4", "LPT5", "LPT6", "LPT7", "LPT8", "LPT9"};
+
+        std::string stem = fileName.substr(0, fileName.find('.'));
+        while (!stem.empty() && stem.back() == ' ')
+        {
+            stem.pop_back();
+        }
+        for (char &c : stem)
+        {
+            c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        }
+        for (const char *device : DEVICE_NAMES)
+        {
+            if (stem == device)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // First stream byte of each range when the ranges travel back to back
+    std::vector<uint64_t> rangeStreamStarts(const RangeList &ranges)
+    {
+        std::vector<uint64_t> starts;
+        starts.reserve(ranges.size());
+        uint64_t position = 0;
+        for (const auto &range : ranges)
+        {
+            starts.push_back(position);
+            position += range.second;
+        }
+        return starts;
+    }
+
+    // Calls visit(file offset, offset into the piece, size) for each range's
+    // share of stream bytes [streamOffset, streamOffset + size), stopping at
+    // the first false
+    template <typename Visit>
+    bool forEachRangePart(const RangeList &ranges, const std::vector<uint64_t> &starts, uint64_t streamOffset, size_t size, Visit visit)
+    {
+        size_t index = static_cast<size_t>(std::upper_bound(starts.begin(), starts.end(), streamOffset) - starts.begin());
+        size_t done = 0;
+        for (index = index > 0 ? index - 1 : 0; done < size && index < ranges.size(); index++)
+        {
+            uint64_t within = streamOffset + done - starts[index];
+            size_t part = static_cast<size_t>(std::min<uint64_t>(size - done, ranges[index].second - within));
+            if (!visit(ranges[index].first + within, done, part))
+                return false;
+            done += part;
+        }
+        return done == size;
+    }
+
+    // Hashes the gaps between the ranges within [start, end) as zeros
+    void addHoles(MerkleTree &tree, const RangeList &ranges, uint64_t start, uint64_t end)
+    {
+        for (const auto &range : ranges)
+        {
+            if (range.first > start)
+                tree.addZeros(start, range.first - start);
+            start = range.first + range.second;
+        }
+        if (end > start)
+            tree.addZeros(start, end - start);
+    }
+}
+
+std::atomic<FlushPolicy> FileTransfer::flushPolicy{FlushPolicy::None};
+std::atomic<bool> FileTransfer::compression{false};
+std::atomic<ChunkStore *> FileTransfer::chunkStore{nullptr};
+
+size_t FileTransfer::pipelineDepth(uint32_t maxChunkSize)
+{
+    size_t byWorkers = 2 * ChunkPipeline::defaultWorkerCount() + 4;
+    size_t byMemory = MAX_BUFFERED_BYTES / maxChunkSize;
+    return std::max<size_t>(4, std::min(byWorkers, byMemory));
+}
+
+uint64_t FileTransfer::sourceStamp(const std::string &filePath)
+{
+    std::error_code ec;
+    auto stamp = fs::last_write_time(filePath, ec);
+    return ec ? 0 : static_cast<uint64_t>(stamp.time_since_epoch().count());
+}
+
+bool FileTransfer::validFileName(const std::string &fileName)
+{
+    if (fileName.empty() || fileName.size() > MAX_FILE_NAME_SIZE || fileName.back() == '.' || fileName.back() == ' ')
+    {
+        return false;
+    }
+    for (char c : fileName)
+    {
+        if (static_cast<unsigned char>(c) < 0x20 || c == '\\' || c == '/' || c == ':')
+        {
+            return false;
+        }
+    }
+    return !reservedDeviceName(fileName);
+}
+
+bool FileTransfer::hashPrefix(const std::string &filePath, uint64_t length, MerkleTree &tree, std::vector<BYTE> &digest)
+{
+    Sha256 hasher;
+
+    // Leaves hash independently, so a mapped file is handed out a leaf at a
+    // time to the other cores while this thread runs the SHA-256, which
+    // cannot be split, and then joins in on the leaves
+    MappedFile mapped;
+    if (mapped.open(filePath) && mapped.size() >= length)
+    {
+        uint64_t leafCount = MerkleTree::leafCountFor(length);
+        unsigned threadCount = static_cast<unsigned>(std::min<uint64_t>(std::max(1u, std::thread::hardware_concurrency()), leafCount));
+        std::atomic<uint64_t> nextLeaf{0};
+        auto hashLeaves = [&]
+        {
+            for (uint64_t leaf = nextLeaf++; leaf < leafCount; leaf = nextLeaf++)
+            {
+                uint64_t offset = leaf * MerkleTree::LEAF_SIZE;
+                tree.add(offset, mapped.data() + offset, static_cast<size_t>(std::min<uint64_t>(MerkleTree::LEAF_SIZE, length - offset)));
+            }
+        };
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < threadCount; i++)
+        {
+            threads.emplace_back(hashLeaves);
+        }
+        bool hashed = true;
+        for (uint64_t offset = 0; offset < length && hashed; offset += MerkleTree::LEAF_SIZE)
+        {
+            hashed = hasher.update(mapped.data() + offset, static_cast<size_t>(std::min<uint64_t>(MerkleTree::LEAF_SIZE, length - offset)));
+        }
+        hashLeaves();
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+        return hashed && hasher.finish(digest);
+    }
+
+    std::ifstream file(filePath, std::ios::binary);
+    std::vector<BYTE> block(MerkleTree::LEAF_SIZE);
+    for (uint64_t offset = 0; offset < length;)
+    {
+        size_t blockSize = static_cast<size_t>(std::min<uint64_t>(block.size(), length - offset));
+        file.read((char *)block.data(), blockSize);
+        if (static_cast<size_t>(file.gcount()) != blockSize || !hasher.update(block.data(), blockSize))
+        {
+            return false;
+        }
+        tree.add(offset, block.data(), blockSize);
+        offset += blockSize;
+    }
+    return hasher.finish(digest);
+}
+
+bool FileTransfer::sendLeafDigests(SOCKET socket, const CipherContext &cipher, const MerkleTree &tree)
+{
+    if (!tree.isComplete())
+    {
+        return false;
+    }
+    std::vector<uint32_t> leaves = tree.leaves();
+    std::vector<BYTE> trailer((const BYTE *)leaves.data(), (const BYTE *)(leaves.data() + leaves.size()));
+    return NetworkUtils::sendData(socket, cipher.encryptMessage(trailer));
+}
+
+bool FileTransfer::checkLeafDigests(FrameReader &reader, const CipherContext &cipher, const MerkleTree &tree, TransferJournal &journal,
+                                    const std::string &fileName)
+{
+    std::vector<BYTE> trailer;
+    if (!reader.next(trailer) || !cipher.decryptMessage(trailer))
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to receive leaf digests for " + fileName);
+        journal.save();
+        return false;
+    }
+
+    std::vector<uint32_t> leaves = tree.leaves();
+    size_t badLeaf = 0;
+    if (tree.isComplete() && trailer.size() == leaves.size() * MerkleTree::DIGEST_SIZE)
+    {
+        while (badLeaf < leaves.size() && memcmp(&leaves[badLeaf], trailer.data() + badLeaf * MerkleTree::DIGEST_SIZE, MerkleTree::DIGEST_SIZE) == 0)
+        {
+            badLeaf++;
+        }
+        if (badLeaf == leaves.size())
+        {
+            std::ostringstream report;
+            report << "Verified " << fileName << ", root " << std::hex << std::setw(8) << std::setfill('0')
+                   << MerkleTree::rootOf(leaves.data(), leaves.size()) << std::dec << " over " << leaves.size() << " leaves ("
+                   << Crc32c::implementationName() << " CRC-32C)";
+            NetworkUtils::printMessage("MERKLE", report.str());
+            return true;
+        }
+    }
+
+    // Leaves in front of the first mismatch are good; a retry resumes there
+    NetworkUtils::printMessage("ERROR", "Checksum tree of " + fileName + " does not match the sender's from leaf " + std::to_string(badLeaf));
+    journal.truncate(static_cast<uint64_t>(badLeaf) * MerkleTree::LEAF_SIZE);
+    if (journal.save())
+    {
+        NetworkUtils::printMessage("RESUME", "Partial file kept, next transfer resumes at byte " + std::to_string(journal.committedPrefix()));
+    }
+    return false;
+}
+
+bool FileTransfer::sendSignatures(SOCKET socket, const CipherContext &cipher, const std::vector<BlockSignature> &signatures)
+{
+    // Fixed 20-byte records, batched so a large basis costs few frames
+    std::vector<BYTE> batch;
+    for (size_t first = 0; first < signatures.size(); first += SIGNATURES_PER_FRAME)
+    {
+        size_t count = signatures.size() - first;
+        if (count > SIGNATURES_PER_FRAME)
+            count = SIGNATURES_PER_FRAME;
+        batch.clear();
+        for (size_t i = first; i < first + count; i++)
+        {
+            batch.insert(batch.end(), (const BYTE *)&signatures[i].weak, (const BYTE *)&signatures[i].weak + sizeof(uint32_t));
+            batch.insert(batch.end(), signatures[i].strong, signatures[i].strong + sizeof(signatures[i].strong));
+        }
+        if (!NetworkUtils::sendData(socket, cipher.encryptMessage(batch)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FileTransfer::receiveSignatures(FrameReader &reader, const CipherContext &cipher, uint32_t blockSize, uint32_t blockCount,
+                                     std::vector<BlockSignature> &signatures)
+{
+    if (blockSize < DeltaSync::MIN_BLOCK_SIZE || blockSize > DeltaSync::MAX_BLOCK_SIZE || blockCount > DeltaSync::MAX_BLOCKS)
+    {
+        return false;
+    }
+
+    signatures.resize(blockCount);
+    std::vector<BYTE> batch;
+    for (size_t first = 0; first < blockCount; first += SIGNATURES_PER_FRAME)
+    {
+        size_t count = blockCount - first;
+        if (count > SIGNATURES_PER_FRAME)
+            count = SIGNATURES_PER_FRAME;
+        if (!reader.next(batch) || !cipher.decryptMessage(batch) || batch.size() != count * DeltaSync::SIGNATURE_WIRE_SIZE)
+        {
+            return false;
+        }
+        const BYTE *record = batch.data();
+        for (size_t i = first; i < first + count; i++, record += DeltaSync::SIGNATURE_WIRE_SIZE)
+        {
+            memcpy(&signatures[i].weak, record, sizeof(uint32_t));
+            memcpy(signatures[i].strong, record + sizeof(uint32_t), sizeof(signatures[i].strong));
+        }
+    }
+    return true;
+}
+
+bool FileTransfer::offerChunks(FrameReader &reader, const CipherContext &cipher, std::istream &file, uint64_t fileSize,
+                               std::vector<std::pair<uint64_t, uint64_t>> &missingRanges, uint64_t &missingBytes)
+{
+    std::vector<StoredChunk> chunks;
+    if (!ContentChunker::split(file, fileSize, chunks) || chunks.size() > MAX_STORE_CHUNKS)
+    {
+        return false;
+    }
+
+    // [u32 count], then fixed 36-byte records batched like signatures
+    uint32_t count = static_cast<uint32_t>(chunks.size());
+    std::vector<BYTE> batch((BYTE *)&count, (BYTE *)&count + sizeof(count));
+    if (!NetworkUtils::sendData(reader.getSocket(), cipher.encryptMessage(batch)))
+    {
+        return false;
+    }
+    for (size_t first = 0; first < chunks.size(); first += SIGNATURES_PER_FRAME)
+    {
+        size_t end = std::min<size_t>(chunks.size(), first + SIGNATURES_PER_FRAME);
+        batch.clear();
+        for (size_t i = first; i < end; i++)
+        {
+            batch.insert(batch.end(), chunks[i].hash, chunks[i].hash + sizeof(chunks[i].hash));
+            batch.insert(batch.end(), (BYTE *)&chunks[i].size, (BYTE *)&chunks[i].size + sizeof(chunks[i].size));
+        }
+        if (!NetworkUtils::sendData(reader.getSocket(), cipher.encryptMessage(batch)))
+        {
+            return false;
+        }
+    }
+
+    // Bit i of the answer asks for chunk i; neighbouring requests merge into one range
+    std::vector<BYTE> wanted;
+    if (!reader.next(wanted) || !cipher.decryptMessage(wanted) || wanted.size() != (chunks.size() + 7) / 8)
+    {
+        return false;
+    }
+    missingRanges.clear();
+    missingBytes = 0;
+    size_t requested = 0;
+    uint64_t offset = 0;
+    for (size_t i = 0; i < chunks.size(); offset += chunks[i].size, i++)
+    {
+        if (!((wanted[i / 8] >> (i % 8)) & 1))
+            continue;
+        if (!missingRanges.empty() && missingRanges.back().first + missingRanges.back().second == offset)
+            missingRanges.back().second += chunks[i].size;
+        else
+            missingRanges.emplace_back(offset, chunks[i].size);
+        missingBytes += chunks[i].size;
+        requested++;
+    }
+    NetworkUtils::printMessage("DEDUP", "Receiver lacks " + std::to_string(requested) + " of " + std::to_string(chunks.size()) + " chunks, sending " +
+                                            std::to_string(missingBytes) + " of " + std::to_string(fileSize) + " bytes");
+    return true;
+}
+
+bool FileTransfer::receiveChunkList(FrameReader &reader, const CipherContext &cipher, uint64_t fileSize, std::vector<StoredChunk> &chunks)
+{
+    std::vector<BYTE> batch;
+    uint32_t count = 0;
+    if (!reader.next(batch) || !cipher.decryptMessage(batch) || batch.size() != sizeof(count))
+    {
+        return false;
+    }
+    memcpy(&count, batch.data(), sizeof(count));
+    if (count > MAX_STORE_CHUNKS)
+    {
+        return false;
+    }
+
+    chunks.resize(count);
+    uint64_t total = 0;
+    for (size_t first = 0; first < count; first += SIGNATURES_PER_FRAME)
+    {
+        size_t end = std::min<size_t>(count, first + SIGNATURES_PER_FRAME);
+        if (!reader.next(batch) || !cipher.decryptMessage(batch) || batch.size() != (end - first) * ContentChunker::RECORD_WIRE_SIZE)
+        {
+            return false;
+        }
+        const BYTE *record = batch.data();
+        for (size_t i = first; i < end; i++, record += ContentChunker::RECORD_WIRE_SIZE)
+        {
+            memcpy(chunks[i].hash, record, sizeof(chunks[i].hash));
+            memcpy(&chunks[i].size, record + sizeof(chunks[i].hash), sizeof(chunks[i].size));
+            if (chunks[i].size == 0 || chunks[i].size > ContentChunker::MAX_SIZE)
+            {
+                return false;
+            }
+            total += chunks[i].size;
+        }
+    }
+    return total == fileSize;
+}
+
+std::vector<BYTE> FileTransfer::transferMacKey(const CipherContext &cipher, uint64_t nonce)
+{
+    // Keystream nothing else in the transfer uses, so the key is unique per transfer
+    std::vector<BYTE> key(HmacSha256::MAC_SIZE, 0);
+    cipher.process(key.data(), key.size(), nonce, MAC_KEY_OFFSET);
+    return key;
+}
+
+bool FileTransfer::chunkMac(const std::vector<BYTE> &key, uint64_t offset, const BYTE *data, size_t size, BYTE *mac)
+{
+    // Binding the file offset stops chunks from being replayed elsewhere
+    HmacSha256 hmac(key);
+    std::vector<BYTE> result;
+    if (!hmac.update((const BYTE *)&offset, sizeof(offset)) || !hmac.update(data, size) || !hmac.finish(result))
+    {
+        return false;
+    }
+    memcpy(mac, result.data(), HmacSha256::MAC_SIZE);
+    return true;
+}
+
+bool FileTransfer::computeChunkMacs(const std::string &filePath, const std::vector<BYTE> &key, uint64_t startOffset, uint64_t fileSize,
+                                    const std::atomic<bool> &cancelled, std::vector<BYTE> &macs)
+{
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    file.seekg(startOffset);
+
+    const uint64_t chunkSize = INTEGRITY_CHUNK_SIZE;
+    macs.assign((fileSize - startOffset + chunkSize - 1) / chunkSize * HmacSha256::MAC_SIZE, 0);
+    uint64_t readOffset = startOffset;
+
+    // Read in order, MAC on every worker; each chunk owns its slot in `macs`
+    ChunkPipeline pipeline(INTEGRITY_CHUNK_SIZE, ChunkPipeline::defaultWorkerCount(), pipelineDepth(INTEGRITY_CHUNK_SIZE));
+    return pipeline.run(
+        [&](PipelineChunk &chunk)
+        {
+            if (cancelled)
+                return PipelineStatus::Failed;
+            if (readOffset >= fileSize)
+                return PipelineStatus::Done;
+
+            size_t size = static_cast<size_t>(std::min(chunkSize, fileSize - readOffset));
+            chunk.data.resize(size);
+            if (!file.read((char *)chunk.data.data(), size))
+                return PipelineStatus::Failed;
+            chunk.offset = readOffset;
+            readOffset += size;
+            return PipelineStatus::Continue;
+        },
+        [&](PipelineChunk &chunk)
+        {
+            return chunkMac(key, chunk.offset, chunk.data.data(), chunk.data.size(), macs.data() + chunk.index * HmacSha256::MAC_SIZE);
+        },
+        [](PipelineChunk &)
+        {
+            return true;
+        });
+}
+
+bool FileTransfer::sendIntegrityOnly(SOCKET socket, const CipherContext &cipher, uint64_t nonce, const std::string &filePath,
+                                     const std::vector<BYTE> &startMessage, uint64_t startOffset, uint64_t fileSize)
+{
+    HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        NetworkUtils::printMessage("ERROR", "Cannot open file: " + filePath);
+        return false;
+    }
+
+    // The MACs need the bytes in user space; that pass reads the file cache on
+    // other cores while the kernel sends, and its result trails the data
+    std::vector<BYTE> macs;
+    std::atomic<bool> cancelled{false};
+    bool macsReady = false;
+    std::thread macThread([&]
+                          { macsReady = computeChunkMacs(filePath, transferMacKey(cipher, nonce), startOffset, fileSize, cancelled, macs); });
+
+    const uint64_t chunkSize = INTEGRITY_CHUNK_SIZE;
+    FrameView start = {startMessage.data(), startMessage.size()};
+    bool startSent = false;
+    bool ok = true;
+    uint64_t offset = startOffset;
+    TransferProgress progress("Sending " + fs::path(filePath).filename().string() + " (zero-copy)", fileSize, startOffset);
+    while (offset < fileSize)
+    {
+        uint32_t size = static_cast<uint32_t>(std::min(chunkSize, fileSize - offset));
+        if (!NetworkUtils::sendFileFrame(socket, file, offset, size, startSent ? nullptr : &start, startSent ? 0 : 1))
+        {
+            NetworkUtils::printMessage("ERROR", "Failed to send chunk at offset " + std::to_string(offset));
+            ok = false;
+            break;
+        }
+        startSent = true;
+        offset += size;
+        progress.add(size);
+    }
+    CloseHandle(file);
+
+    cancelled = !ok;
+    macThread.join();
+    if (!ok)
+    {
+        return false;
+    }
+    if (!macsReady)
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to authenticate " + filePath);
+        return false;
+    }
+
+    // Empty or fully resumed files have no data frame to carry the start frame
+    if (!startSent && !NetworkUtils::sendData(socket, startMessage))
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to send resume offset");
+        return false;
+    }
+    if (!NetworkUtils::sendData(socket, cipher.encryptMessage(macs)))
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to send chunk MACs");
+        return false;
+    }
+    return true;
+}
+
 bool FileTransfer::sendFile(SOCKET socket, const std::vector<BYTE> &key, const std::vector<BYTE> &iv, const std::string &filePath)
 {
+    return sendFile(socket, CipherContext(key, iv), filePath);
+}
+
+bool FileTransfer::receiveFile(SOCKET socket, const std::vector<BYTE> &key, const std::vector<BYTE> &iv, const std::string &saveDir)
+{
+    return receiveFile(socket, CipherContext(key, iv), saveDir);
+}
+
+bool FileTransfer::sendFile(SOCKET socket, const CipherContext &cipher, const std::string &filePath)
+{
+    FrameReader reader(socket);
+    return sendFile(reader, cipher, filePath);
+}
+
+bool FileTransfer::sendFile(FrameReader &reader, const CipherContext &cipher, const std::string &filePath, const std::vector<FrameReader *> &stripes,
+                            bool integrityOnly)
+{
+    SOCKET socket = reader.getSocket();
     std::ifstream file(filePath, std::ios::binary | std::ios::ate);
     if (!file.is_open())
     {
@@ -24,38 +547,419 @@ bool FileTransfer::sendFile(SOCKET socket, const std::vector<BYTE> &key, const s
     fileInfo.insert(fileInfo.end(), (BYTE *)&nameSize, (BYTE *)&nameSize + sizeof(nameSize));
     fileInfo.insert(fileInfo.end(), fileName.begin(), fileName.end());
     fileInfo.insert(fileInfo.end(), (BYTE *)&fileSize, (BYTE *)&fileSize + sizeof(fileSize));
+    uint32_t maxChunkSize = MAX_CHUNK_SIZE;
+    fileInfo.insert(fileInfo.end(), (BYTE *)&maxChunkSize, (BYTE *)&maxChunkSize + sizeof(maxChunkSize));
+    uint64_t stamp = sourceStamp(filePath);
+    fileInfo.insert(fileInfo.end(), (BYTE *)&stamp, (BYTE *)&stamp + sizeof(stamp));
+    BYTE codec = getCompression() ? CODEC_LZ : CODEC_NONE;
+    fileInfo.push_back(codec);
 
-    auto encryptedInfo = CryptoUtils::aesEncrypt(key, iv, fileInfo);
-    if (!NetworkUtils::sendData(socket, encryptedInfo))
+    uint64_t transferNonce = 0;
+    if (!NetworkUtils::sendData(socket, cipher.encryptMessage(fileInfo, &transferNonce)))
     {
         NetworkUtils::printMessage("ERROR", "Failed to send file info");
         return false;
     }
 
-    // Send file data in chunks
-    const uint32_t CHUNK_SIZE = 4096;
-    uint32_t totalChunks = (fileSize + CHUNK_SIZE - 1) / CHUNK_SIZE;
-    uint32_t chunksSent = 0;
+    // The receiver answers with its committed prefix and that prefix's
+    // SHA-256; we only skip it if our own copy hashes the same. The checksum
+    // tree is too weak to vouch for a prefix and only locates bad leaves
+    // after the transfer. Without a prefix the receiver may offer an older
+    // copy as a delta basis, whose signatures follow.
+    std::vector<BYTE> resumeInfo;
+    if (!reader.next(resumeInfo) || !cipher.decryptMessage(resumeInfo) || resumeInfo.size() < RESUME_REPLY_SIZE)
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to receive resume offset");
+        return false;
+    }
+
+    uint64_t resumeOffset = *(uint64_t *)resumeInfo.data();
+    uint32_t blockSize = *(uint32_t *)(resumeInfo.data() + sizeof(uint64_t));
+    uint32_t blockCount = *(uint32_t *)(resumeInfo.data() + sizeof(uint64_t) + sizeof(uint32_t));
+    uint32_t replyFlags = *(uint32_t *)(resumeInfo.data() + sizeof(uint64_t) + 2 * sizeof(uint32_t));
+    uint64_t startOffset = 0;
+    MerkleTree tree(fileSize);
+    if (resumeOffset > 0 && resumeOffset <= fileSize && resumeInfo.size() == RESUME_REPLY_SIZE + Sha256::DIGEST_SIZE)
+    {
+        // The prefix's leaves stay in the tree, so the rest of the file only
+        // has to be hashed as it is sent
+        std::vector<BYTE> digest;
+        if (hashPrefix(filePath, resumeOffset, tree, digest) && std::equal(digest.begin(), digest.end(), resumeInfo.begin() + RESUME_REPLY_SIZE))
+        {
+            startOffset = resumeOffset;
+            NetworkUtils::printMessage("RESUME", "Resuming " + fileName + " at byte " + std::to_string(startOffset));
+        }
+        else
+        {
+            tree.reset(fileSize);
+            NetworkUtils::printMessage("RESUME", "Partial copy of " + fileName + " does not match, restarting from byte 0");
+        }
+    }
 
-    for (uint32_t i = 0; i < totalChunks; i++)
+    // A receiver with a chunk store is sent only the chunks it lacks; it
+    // offers neither a resume prefix nor a delta basis. Those chunks, or a
+    // sparse file's data ranges, travel back to back as the data stream.
+    bool dedup = (replyFlags & RESUME_OFFER_DEDUP) != 0;
+    RangeList streamRanges;
+    uint64_t rangeBytes = 0;
+    if (dedup && !offerChunks(reader, cipher, file, fileSize, streamRanges, rangeBytes))
     {
-        std::vector<BYTE> chunk(CHUNK_SIZE);
-        file.read((char *)chunk.data(), CHUNK_SIZE);
-        std::streamsize bytesRead = file.gcount();
-        chunk.resize(bytesRead);
+        NetworkUtils::printMessage("ERROR", "Failed to negotiate chunks of " + fileName);
+        return false;
+    }
 
-        auto encryptedChunk = CryptoUtils::aesEncrypt(key, iv, chunk);
-        if (!NetworkUtils::sendData(socket, encryptedChunk))
+    // Delta mode streams copy/literal operations instead of file bytes, but
+    // only when that is actually smaller
+    std::vector<DeltaOp> deltaOps;
+    std::vector<BYTE> fileDigest;
+    uint64_t deltaSize = 0;
+    if (blockCount > 0)
+    {
+        std::vector<BlockSignature> signatures;
+        if (!receiveSignatures(reader, cipher, blockSize, blockCount, signatures))
         {
-            NetworkUtils::printMessage("ERROR", "Failed to send chunk " + std::to_string(i));
+            NetworkUtils::printMessage("ERROR", "Failed to receive block signatures");
             return false;
         }
+        if (startOffset == 0 && DeltaSync::plan(file, fileSize, blockSize, signatures, deltaOps, fileDigest))
+        {
+            deltaSize = DeltaSync::encodedSize(deltaOps);
+            if (deltaSize >= fileSize)
+            {
+                NetworkUtils::printMessage("DELTA", "Delta (" + std::to_string(deltaSize) + " bytes) is not smaller than " + fileName + ", sending in full");
+                deltaSize = 0;
+            }
+            else
+            {
+                NetworkUtils::printMessage("DELTA", "Sending " + fileName + " as a " + std::to_string(deltaSize) + " byte delta against " +
+                                                        std::to_string(blockCount) + " basis blocks");
+            }
+        }
+    }
+    file.clear();
+    file.seekg(startOffset);
 
-        chunksSent++;
-        if (chunksSent % 10 == 0 || chunksSent == totalChunks)
+    // Full sends of a file with holes skip them; small holes are not worth
+    // a range list
+    bool sparse = false;
+    RangeList dataRanges;
+    if (!dedup && deltaSize == 0 && !integrityOnly && queryDataRanges(filePath, fileSize, dataRanges))
+    {
+        uint64_t dataBytes = 0;
+        for (const auto &range : dataRanges)
+        {
+            uint64_t start = std::max(range.first, startOffset);
+            if (start < range.first + range.second)
+            {
+                streamRanges.push_back(std::make_pair(start, range.first + range.second - start));
+                dataBytes += streamRanges.back().second;
+            }
+        }
+        if (fileSize - startOffset - dataBytes >= MIN_CHUNK_SIZE && streamRanges.size() <= MAX_SPARSE_RANGES)
+        {
+            sparse = true;
+            rangeBytes = dataBytes;
+            NetworkUtils::printMessage("SPARSE", "Sending " + std::to_string(dataBytes) + " of " + std::to_string(fileSize - startOffset) +
+                                                     " bytes of " + fileName + " in " + std::to_string(streamRanges.size()) + " data ranges");
+        }
+        else
+        {
+            streamRanges.clear();
+        }
+    }
+
+    // Large full sends fan out over every stream of the session; a delta,
+    // chunk or sparse stream is decoded in order and stays on the main
+    // connection.
+    // Integrity-only sessions send full files zero-copy on the main
+    // connection instead.
+    uint32_t streamCount = 1;
+    uint32_t startFlags = 0;
+    if (dedup)
+    {
+        startFlags |= START_DEDUP;
+    }
+    else if (deltaSize == 0 && integrityOnly)
+    {
+        startFlags |= START_INTEGRITY_ONLY;
+    }
+    else if (sparse)
+    {
+        startFlags |= START_SPARSE;
+    }
+    else if (deltaSize == 0 && !stripes.empty() && fileSize - startOffset >= StripedTransfer::MIN_STRIPED_SIZE)
+    {
+        streamCount = static_cast<uint32_t>(1 + stripes.size());
+    }
+
+    // The start frame is held back and leaves together with the first chunk:
+    // [u64 start offset][u64 delta, chunk or sparse stream size][u32 streams][u32 flags]
+    // [file SHA-256 in delta mode][data ranges in sparse mode]
+    uint64_t encodedSize = dedup || sparse ? rangeBytes : deltaSize;
+    std::vector<BYTE> startInfo((BYTE *)&startOffset, (BYTE *)&startOffset + sizeof(startOffset));
+    startInfo.insert(startInfo.end(), (BYTE *)&encodedSize, (BYTE *)&encodedSize + sizeof(encodedSize));
+    startInfo.insert(startInfo.end(), (BYTE *)&streamCount, (BYTE *)&streamCount + sizeof(streamCount));
+    startInfo.insert(startInfo.end(), (BYTE *)&startFlags, (BYTE *)&startFlags + sizeof(startFlags));
+    if (deltaSize > 0)
+    {
+        startInfo.insert(startInfo.end(), fileDigest.begin(), fileDigest.end());
+    }
+    if (sparse)
+    {
+        uint32_t rangeCount = static_cast<uint32_t>(streamRanges.size());
+        startInfo.insert(startInfo.end(), (BYTE *)&rangeCount, (BYTE *)&rangeCount + sizeof(rangeCount));
+        startInfo.insert(startInfo.end(), (BYTE *)streamRanges.data(), (BYTE *)(streamRanges.data() + streamRanges.size()));
+    }
+    std::vector<BYTE> startMessage = cipher.encryptMessage(startInfo);
+    bool startSent = false;
+    bool checksummed = !dedup && deltaSize == 0;
+
+    if (startFlags & START_INTEGRITY_ONLY)
+    {
+        file.close();
+        NetworkUtils::printMessage("INTEGRITY", "Sending " + fileName + " unencrypted with per-chunk MACs");
+        if (!sendIntegrityOnly(socket, cipher, transferNonce, filePath, startMessage, startOffset, fileSize))
+        {
+            return false;
+        }
+        NetworkUtils::printMessage("SUCCESS", "File sent successfully: " + fileName);
+        return true;
+    }
+
+    if (streamCount > 1)
+    {
+        std::vector<FrameReader *> streams(1, &reader);
+        streams.insert(streams.end(), stripes.begin(), stripes.end());
+        NetworkUtils::printMessage("STRIPED", "Sending " + fileName + " over " + std::to_string(streamCount) + " streams");
+        if (!NetworkUtils::sendData(socket, startMessage) ||
+            !StripedTransfer::send(streams, cipher, transferNonce, filePath, tree, startOffset, fileSize, maxChunkSize))
+        {
+            return false;
+        }
+        if (!sendLeafDigests(socket, cipher, tree))
         {
-            NetworkUtils::printMessage("PROGRESS", "Sent " + std::to_string(chunksSent) + "/" + std::to_string(totalChunks) + " chunks");
+            NetworkUtils::printMessage("ERROR", "Failed to send leaf digests");
+            return false;
         }
+        NetworkUtils::printMessage("SUCCESS", "File sent successfully: " + fileName);
+        return true;
+    }
+    DeltaEncoder deltaEncoder(deltaOps, file);
+    bool ranged = dedup || sparse;
+    uint64_t streamSize = ranged ? rangeBytes : deltaSize > 0 ? deltaSize : fileSize;
+    uint64_t streamStart = ranged ? 0 : startOffset;
+    size_t rangeIndex = 0;
+    uint64_t rangeOffset = 0;
+    std::vector<uint64_t> rangeStarts = rangeStreamStarts(streamRanges);
+    if (sparse)
+    {
+        addHoles(tree, streamRanges, startOffset, fileSize);
+    }
+
+    // Full sends encrypt straight out of a file mapping; stream reads remain
+    // the fallback when the file cannot be mapped
+    MappedFile mapped;
+    if (deltaSize == 0 && mapped.open(filePath) && mapped.size() != fileSize)
+    {
+        mapped.close();
+    }
+    uint64_t prefetchedTo = startOffset;
+
+    // Send file data in chunks sized from observed throughput and RTT
+    AdaptiveChunkSizer sizer(MIN_CHUNK_SIZE, maxChunkSize, 4 * MIN_CHUNK_SIZE);
+    uint64_t totalSent = streamStart;
+    uint32_t chunksSent = 0;
+    uint64_t streamOffset = streamStart;
+    uint64_t rttMicros = 0;
+    TransferProgress progress("Sending " + fileName, streamSize, streamStart);
+    uint64_t wireBytes = 0;
+    std::atomic<uint64_t> compressedChunks{0};
+
+    // Read -> compress and encrypt (N workers) -> send in order; stages
+    // overlap, and the send engine may keep several frames in flight behind
+    // the sink. Compressing chunks carry a second buffer, so the pool shrinks.
+    SendEngine &engine = reader.sendEngine();
+    engine.begin(CODEC_HEADER_SIZE + maxChunkSize);
+    ChunkPipeline pipeline(sizer.nextSize(), ChunkPipeline::defaultWorkerCount(), pipelineDepth(codec == CODEC_LZ ? 2 * maxChunkSize : maxChunkSize));
+    pipeline.publishCounters(progress.stages);
+    auto pipelineStart = std::chrono::steady_clock::now();
+    bool ok = pipeline.run(
+        [&](PipelineChunk &chunk)
+        {
+            if (streamOffset >= streamSize)
+                return PipelineStatus::Done;
+
+            size_t chunkSize = static_cast<size_t>(std::min<uint64_t>(sizer.nextSize(), streamSize - streamOffset));
+            chunk.data.resize(chunkSize);
+            chunk.source = nullptr;
+            size_t bytesRead = 0;
+            if (deltaSize > 0)
+            {
+                if (!deltaEncoder.read(chunk.data.data(), chunkSize, bytesRead))
+                    bytesRead = 0;
+            }
+            else if (ranged)
+            {
+                // Requested chunks or data ranges back to back, in file order
+                while (bytesRead < chunkSize && rangeIndex < streamRanges.size())
+                {
+                    const auto &range = streamRanges[rangeIndex];
+                    size_t part = static_cast<size_t>(std::min<uint64_t>(chunkSize - bytesRead, range.second - rangeOffset));
+                    if (mapped.isOpen())
+                    {
+                        memcpy(chunk.data.data() + bytesRead, mapped.data() + range.first + rangeOffset, part);
+                    }
+                    else
+                    {
+                        file.seekg(range.first + rangeOffset);
+                        if (!file.read((char *)chunk.data.data() + bytesRead, part))
+                            break;
+                    }
+                    bytesRead += part;
+                    rangeOffset += part;
+                    if (rangeOffset == range.second)
+                    {
+                        rangeIndex++;
+                        rangeOffset = 0;
+                    }
+                }
+                if (bytesRead != chunkSize)
+                    bytesRead = 0;
+            }
+            else if (mapped.isOpen())
+            {
+                // Keep a window of readahead in front of the workers
+                if (streamOffset + MappedFile::PREFETCH_WINDOW / 2 >= prefetchedTo)
+                {
+                    mapped.prefetch(prefetchedTo, MappedFile::PREFETCH_WINDOW);
+                    prefetchedTo += MappedFile::PREFETCH_WINDOW;
+                }
+                chunk.source = mapped.data() + streamOffset;
+                bytesRead = chunkSize;
+            }
+            else
+            {
+                file.read((char *)chunk.data.data(), chunkSize);
+                bytesRead = static_cast<size_t>(file.gcount());
+            }
+            if (bytesRead == 0)
+            {
+                NetworkUtils::printMessage("ERROR", "Failed to read " + fileName + " at offset " + std::to_string(streamOffset));
+                return PipelineStatus::Failed;
+            }
+            chunk.data.resize(bytesRead);
+            chunk.offset = streamOffset;
+            streamOffset += bytesRead;
+            return PipelineStatus::Continue;
+        },
+        [&](PipelineChunk &chunk)
+        {
+            // Leaves are hashed from the plain bytes on the same worker
+            const BYTE *plain = chunk.source ? chunk.source : chunk.data.data();
+            if (sparse)
+            {
+                forEachRangePart(streamRanges, rangeStarts, chunk.offset, chunk.data.size(),
+                                 [&](uint64_t fileOffset, size_t at, size_t part)
+                                 {
+                                     tree.add(fileOffset, plain + at, part);
+                                     return true;
+                                 });
+            }
+            else if (checksummed)
+            {
+                tree.add(chunk.offset, plain, chunk.data.size());
+            }
+            if (codec == CODEC_NONE)
+            {
+                if (chunk.source)
+                    cipher.process(chunk.source, chunk.data.data(), chunk.data.size(), transferNonce, DATA_STREAM_OFFSET + chunk.offset);
+                else
+                    cipher.process(chunk.data.data(), chunk.data.size(), transferNonce, DATA_STREAM_OFFSET + chunk.offset);
+                return true;
+            }
+
+            // The payload is encrypted with the chunk's own keystream range,
+            // so a shorter compressed payload never reaches the next chunk's
+            uint32_t plainSize = static_cast<uint32_t>(chunk.data.size());
+            chunk.scratch.resize(CODEC_HEADER_SIZE + plainSize);
+            BYTE *payload = chunk.scratch.data() + CODEC_HEADER_SIZE;
+            size_t payloadSize = LzCodec::looksCompressible(plain, plainSize) ? LzCodec::compress(plain, plainSize, payload, plainSize - 1) : 0;
+            if (payloadSize > 0)
+            {
+                cipher.process(payload, payloadSize, transferNonce, DATA_STREAM_OFFSET + chunk.offset);
+                compressedChunks++;
+            }
+            else
+            {
+                cipher.process(plain, payload, plainSize, transferNonce, DATA_STREAM_OFFSET + chunk.offset);
+                payloadSize = plainSize;
+            }
+            memcpy(chunk.scratch.data(), &plainSize, CODEC_HEADER_SIZE);
+            chunk.scratch.resize(CODEC_HEADER_SIZE + payloadSize);
+            chunk.data.swap(chunk.scratch);
+            return true;
+        },
+        [&](PipelineChunk &chunk)
+        {
+            FrameView frames[2] = {{startMessage.data(), startMessage.size()}, {chunk.data.data(), chunk.data.size()}};
+            const FrameView *first = startSent ? &frames[1] : &frames[0];
+            size_t frameCount = startSent ? 1 : 2;
+            uint32_t plainSize = static_cast<uint32_t>(chunk.data.size());
+            if (codec != CODEC_NONE)
+            {
+                memcpy(&plainSize, chunk.data.data(), CODEC_HEADER_SIZE);
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            if (!engine.send(first, frameCount))
+            {
+                NetworkUtils::printMessage("ERROR", "Failed to send chunk " + std::to_string(chunk.index));
+                return false;
+            }
+            startSent = true;
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+            if (chunksSent % 16 == 0)
+            {
+                rttMicros = NetworkUtils::getRoundTripMicros(socket);
+            }
+            // Sized by plain bytes, so compression lets chunks grow
+            sizer.recordSend(plainSize, elapsed.count(), rttMicros);
+
+            totalSent += plainSize;
+            wireBytes += chunk.data.size();
+            chunksSent++;
+            progress.add(plainSize);
+            return true;
+        });
+
+    ok = engine.end() && ok;
+    NetworkUtils::printMessage("PIPELINE", pipeline.occupancyReport() + ", " + engine.name() + " sends");
+    if (!ok)
+    {
+        return false;
+    }
+    if (codec != CODEC_NONE && wireBytes > 0)
+    {
+        // Effective throughput counts plain bytes delivered per second
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - pipelineStart).count();
+        std::ostringstream report;
+        report << std::fixed << std::setprecision(2) << totalSent - streamStart << " -> " << wireBytes << " bytes (ratio "
+               << static_cast<double>(totalSent - streamStart) / wireBytes << ", " << compressedChunks.load() << " of " << chunksSent
+               << " chunks compressed), effective " << (seconds > 0 ? (totalSent - streamStart) / seconds / (1024 * 1024) : 0) << " MB/s";
+        NetworkUtils::printMessage("COMPRESSION", report.str());
+    }
+
+    // Empty or fully resumed files never reach the sink
+    if (!startSent && !NetworkUtils::sendData(socket, startMessage))
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to send resume offset");
+        return false;
+    }
+    if (checksummed && !sendLeafDigests(socket, cipher, tree))
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to send leaf digests");
+        return false;
     }
 
     file.close();
@@ -63,18 +967,25 @@ bool FileTransfer::sendFile(SOCKET socket, const std::vector<BYTE> &key, const s
     return true;
 }
 
-bool FileTransfer::receiveFile(SOCKET socket, const std::vector<BYTE> &key, const std::vector<BYTE> &iv, const std::string &saveDir)
+bool FileTransfer::receiveFile(SOCKET socket, const CipherContext &cipher, const std::string &saveDir)
+{
+    FrameReader reader(socket);
+    return receiveFile(reader, cipher, saveDir);
+}
+
+bool FileTransfer::receiveFile(FrameReader &reader, const CipherContext &cipher, const std::string &saveDir, const std::vector<FrameReader *> &stripes,
+                               bool integrityOnly)
 {
     // Receive file info
-    std::vector<BYTE> encryptedInfo;
-    if (!NetworkUtils::receiveData(socket, encryptedInfo))
+    std::vector<BYTE> fileInfo;
+    if (!reader.next(fileInfo))
     {
         NetworkUtils::printMessage("ERROR", "Failed to receive file info");
         return false;
     }
 
-    auto fileInfo = CryptoUtils::aesDecrypt(key, iv, encryptedInfo);
-    if (fileInfo.empty())
+    uint64_t transferNonce = 0;
+    if (!cipher.decryptMessage(fileInfo, &transferNonce) || fileInfo.size() < sizeof(uint32_t))
     {
         NetworkUtils::printMessage("ERROR", "Failed to decrypt file info");
         return false;
@@ -84,10 +995,51 @@ bool FileTransfer::receiveFile(SOCKET socket, const std::vector<BYTE> &key, cons
     uint32_t nameSize = *(uint32_t *)fileInfo.data();
     offset += sizeof(nameSize);
 
+    if (fileInfo.size() < offset + nameSize + sizeof(uint64_t))
+    {
+        NetworkUtils::printMessage("ERROR", "Invalid file info");
+        return false;
+    }
+
     std::string fileName(fileInfo.begin() + offset, fileInfo.begin() + offset + nameSize);
     offset += nameSize;
+    if (!validFileName(fileName))
+    {
+        NetworkUtils::printMessage("ERROR", "Refusing offered file name " + fileName);
+        return false;
+    }
 
     uint64_t fileSize = *(uint64_t *)(fileInfo.data() + offset);
+    offset += sizeof(fileSize);
+
+    uint32_t maxChunkSize = MAX_CHUNK_SIZE;
+    if (fileInfo.size() >= offset + sizeof(maxChunkSize))
+    {
+        maxChunkSize = *(uint32_t *)(fileInfo.data() + offset);
+        offset += sizeof(maxChunkSize);
+    }
+    uint64_t stamp = 0;
+    if (fileInfo.size() >= offset + sizeof(stamp))
+    {
+        stamp = *(uint64_t *)(fileInfo.data() + offset);
+        offset += sizeof(stamp);
+    }
+    BYTE codec = CODEC_NONE;
+    if (fileInfo.size() > offset)
+    {
+        codec = fileInfo[offset];
+        offset += sizeof(codec);
+    }
+    if (maxChunkSize == 0 || maxChunkSize > MAX_CHUNK_SIZE)
+    {
+        NetworkUtils::printMessage("ERROR", "Unsupported chunk size: " + std::to_string(maxChunkSize));
+        return false;
+    }
+    if (codec != CODEC_NONE && codec != CODEC_LZ)
+    {
+        NetworkUtils::printMessage("ERROR", "Unsupported codec: " + std::to_string(codec));
+        return false;
+    }
 
     NetworkUtils::printMessage("RECEIVING", "File: " + fileName + " (" + std::to_string(fileSize) + " bytes)");
 
@@ -95,48 +1047,510 @@ bool FileTransfer::receiveFile(SOCKET socket, const std::vector<BYTE> &key, cons
     fs::create_directories(saveDir);
     std::string savePath = saveDir + "\\" + fileName;
 
-    std::ofstream file(savePath, std::ios::binary);
-    if (!file.is_open())
+    // Offer the committed prefix of an earlier attempt, with its digest:
+    // [u64 resume offset][u32 block size][u32 block count][u32 flags][32 SHA-256].
+    // A chunk store offers deduplication instead; chunks that reached it in
+    // an earlier attempt are simply not asked for again.
+    ChunkStore *store = getChunkStore();
+    TransferJournal journal(savePath);
+    MerkleTree tree(fileSize);
+    uint64_t resumeOffset = 0;
+    std::vector<BYTE> resumeInfo(RESUME_REPLY_SIZE, 0);
+    if (store != nullptr)
+    {
+        uint32_t replyFlags = RESUME_OFFER_DEDUP;
+        memcpy(resumeInfo.data() + sizeof(uint64_t) + 2 * sizeof(uint32_t), &replyFlags, sizeof(replyFlags));
+    }
+    else if (journal.load(fileSize, stamp) && journal.committedPrefix() > 0)
+    {
+        std::vector<BYTE> digest;
+        if (hashPrefix(journal.getPartPath(), journal.committedPrefix(), tree, digest))
+        {
+            resumeOffset = journal.committedPrefix();
+            resumeInfo.insert(resumeInfo.end(), digest.begin(), digest.end());
+        }
+        else
+        {
+            tree.reset(fileSize);
+        }
+    }
+    memcpy(resumeInfo.data(), &resumeOffset, sizeof(resumeOffset));
+
+    // Otherwise an existing copy of the file becomes the delta basis
+    std::ifstream basis;
+    uint64_t basisSize = 0;
+    uint32_t blockSize = 0;
+    std::vector<BlockSignature> signatures;
+    if (store == nullptr && resumeOffset == 0 && fileSize > 0)
+    {
+        basis.open(savePath, std::ios::binary | std::ios::ate);
+        basisSize = basis.is_open() ? static_cast<uint64_t>(basis.tellg()) : 0;
+        blockSize = DeltaSync::chooseBlockSize(basisSize);
+        if (basisSize < blockSize || !DeltaSync::computeSignatures(basis, basisSize, blockSize, signatures))
+        {
+            signatures.clear();
+        }
+        uint32_t blockCount = static_cast<uint32_t>(signatures.size());
+        memcpy(resumeInfo.data() + sizeof(uint64_t), &blockSize, sizeof(blockSize));
+        memcpy(resumeInfo.data() + sizeof(uint64_t) + sizeof(uint32_t), &blockCount, sizeof(blockCount));
+    }
+
+    if (!NetworkUtils::sendData(reader.getSocket(), cipher.encryptMessage(resumeInfo)) ||
+        (!signatures.empty() && !sendSignatures(reader.getSocket(), cipher, signatures)))
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to send resume offset");
+        return false;
+    }
+
+    // Ask for each chunk the store lacks, once; everything listed stays
+    // pinned until this receive returns
+    std::vector<StoredChunk> storeChunks;
+    std::vector<StoredChunk> missingChunks;
+    std::unique_ptr<ChunkPins> pins;
+    if (store != nullptr)
+    {
+        if (!receiveChunkList(reader, cipher, fileSize, storeChunks))
+        {
+            NetworkUtils::printMessage("ERROR", "Failed to receive chunk list for " + fileName);
+            return false;
+        }
+        std::vector<bool> present;
+        pins.reset(new ChunkPins(*store, storeChunks, present));
+
+        std::vector<BYTE> wanted((storeChunks.size() + 7) / 8, 0);
+        std::unordered_set<std::string> requested;
+        for (size_t i = 0; i < storeChunks.size(); i++)
+        {
+            if (!present[i] && requested.insert(std::string((const char *)storeChunks[i].hash, sizeof(storeChunks[i].hash))).second)
+            {
+                wanted[i / 8] |= static_cast<BYTE>(1 << (i % 8));
+                missingChunks.push_back(storeChunks[i]);
+            }
+        }
+        if (!NetworkUtils::sendData(reader.getSocket(), cipher.encryptMessage(wanted)))
+        {
+            NetworkUtils::printMessage("ERROR", "Failed to request chunks of " + fileName);
+            return false;
+        }
+    }
+
+    std::vector<BYTE> startInfo;
+    const size_t startHeaderSize = 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+    if (!reader.next(startInfo) || !cipher.decryptMessage(startInfo) || startInfo.size() < startHeaderSize)
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to receive start offset");
+        return false;
+    }
+    uint64_t startOffset = *(uint64_t *)startInfo.data();
+    uint64_t encodedSize = *(uint64_t *)(startInfo.data() + sizeof(uint64_t));
+    uint32_t streamCount = *(uint32_t *)(startInfo.data() + 2 * sizeof(uint64_t));
+    uint32_t startFlags = *(uint32_t *)(startInfo.data() + 2 * sizeof(uint64_t) + sizeof(uint32_t));
+    bool macChecked = (startFlags & START_INTEGRITY_ONLY) != 0;
+    bool deduped = (startFlags & START_DEDUP) != 0;
+    bool sparse = (startFlags & START_SPARSE) != 0;
+    uint64_t deltaSize = deduped || sparse ? 0 : encodedSize;
+    uint64_t missingBytes = 0;
+    for (const StoredChunk &chunk : missingChunks)
+    {
+        missingBytes += chunk.size;
+    }
+    if (deduped != (store != nullptr) || (deduped && (startOffset != 0 || streamCount != 1 || macChecked || encodedSize != missingBytes)))
+    {
+        NetworkUtils::printMessage("ERROR", "Unexpected chunk store transfer");
+        return false;
+    }
+    if (startOffset != 0 && startOffset != resumeOffset)
+    {
+        NetworkUtils::printMessage("ERROR", "Invalid start offset: " + std::to_string(startOffset));
+        return false;
+    }
+    if (deltaSize > 0 && (startOffset != 0 || signatures.empty() || streamCount != 1 || startInfo.size() != startHeaderSize + Sha256::DIGEST_SIZE))
+    {
+        NetworkUtils::printMessage("ERROR", "Unexpected delta transfer");
+        return false;
+    }
+    // Plaintext data is only acceptable on a session that opted into it
+    if (macChecked && (!integrityOnly || deltaSize > 0 || streamCount != 1))
+    {
+        NetworkUtils::printMessage("ERROR", "Unexpected integrity-only transfer");
+        return false;
+    }
+    if (streamCount == 0 || streamCount > 1 + stripes.size())
+    {
+        NetworkUtils::printMessage("ERROR", "Sender asked for " + std::to_string(streamCount) + " streams, " +
+                                                std::to_string(1 + stripes.size()) + " available");
+        return false;
+    }
+    RangeList dataRanges;
+    if (sparse && (deduped || macChecked || streamCount != 1 ||
+                   !parseDataRanges(startInfo, startHeaderSize, startOffset, fileSize, encodedSize, dataRanges)))
+    {
+        NetworkUtils::printMessage("ERROR", "Unexpected sparse transfer");
+        return false;
+    }
+    std::vector<BYTE> expectedDigest(startInfo.begin() + startHeaderSize, startInfo.end());
+    bool checksummed = !deduped && deltaSize == 0 && !macChecked;
+    if (startOffset == 0)
+    {
+        tree.reset(fileSize);
+    }
+    if (sparse)
+    {
+        addHoles(tree, dataRanges, startOffset, fileSize);
+        NetworkUtils::printMessage("SPARSE", "Receiving " + std::to_string(encodedSize) + " of " + std::to_string(fileSize - startOffset) +
+                                                 " bytes of " + fileName + " in " + std::to_string(dataRanges.size()) + " data ranges");
+    }
+
+    if (deduped)
+    {
+        NetworkUtils::printMessage("DEDUP", "Storing " + fileName + ", " + std::to_string(missingChunks.size()) + " of " +
+                                                std::to_string(storeChunks.size()) + " chunks needed");
+    }
+    else if (startOffset == 0)
+    {
+        // Record the fresh start before truncating, so a stale journal never
+        // describes new data
+        journal.reset(fileSize, stamp);
+        if (!journal.save())
+        {
+            NetworkUtils::printMessage("WARNING", "Cannot write transfer journal for " + savePath);
+        }
+    }
+    else
     {
-        NetworkUtils::printMessage("ERROR", "Cannot create file: " + savePath);
+        NetworkUtils::printMessage("RESUME", "Resuming " + fileName + " at byte " + std::to_string(startOffset));
+    }
+
+    if (streamCount > 1)
+    {
+        std::vector<FrameReader *> streams(1, &reader);
+        streams.insert(streams.end(), stripes.begin(), stripes.begin() + (streamCount - 1));
+        NetworkUtils::printMessage("STRIPED", "Receiving " + fileName + " over " + std::to_string(streamCount) + " streams");
+        if (!StripedTransfer::receive(streams, cipher, transferNonce, journal, tree, startOffset, fileSize, maxChunkSize))
+        {
+            if (journal.save())
+            {
+                NetworkUtils::printMessage("RESUME", "Partial file kept, next transfer resumes at byte " + std::to_string(journal.committedPrefix()));
+            }
+            return false;
+        }
+        basis.close();
+        if (!checkLeafDigests(reader, cipher, tree, journal, fileName))
+        {
+            return false;
+        }
+        return commitReceivedFile(journal, savePath);
+    }
+
+    // A sparse file only allocates its data ranges. Past the start offset a
+    // resumed file may still hold an earlier attempt's bytes where the holes
+    // now are, so that part is punched out first.
+    FileWriter output;
+    if (!deduped && !output.open(journal.getPartPath(), fileSize, startOffset == 0, sparse))
+    {
+        NetworkUtils::printMessage("ERROR", "Cannot create file: " + journal.getPartPath());
+        return false;
+    }
+    if (sparse && startOffset > 0 && !output.punchHole(startOffset, fileSize - startOffset))
+    {
+        NetworkUtils::printMessage("ERROR", "Cannot clear " + journal.getPartPath() + " past byte " + std::to_string(startOffset));
         return false;
     }
+    FlushPolicy flush = getFlushPolicy();
+
+    // Receive file data; progress is tracked in stream bytes since chunk sizes vary
+    uint64_t streamSize = deduped ? missingBytes : sparse ? encodedSize : deltaSize > 0 ? deltaSize : fileSize;
+    uint64_t streamStart = deduped || sparse ? 0 : startOffset;
+    uint64_t totalReceived = streamStart;
+    uint64_t networkOffset = streamStart;
+    uint64_t outputOffset = startOffset;
+    uint64_t unjournaledBytes = 0;
+    TransferProgress progress("Receiving " + fileName, streamSize, streamStart);
+    if (deltaSize > 0)
+    {
+        NetworkUtils::printMessage("DELTA", "Rebuilding " + fileName + " from a " + std::to_string(deltaSize) + " byte delta");
+    }
+
+    // Every output byte lands here, whether it came off the wire or from the basis
+    Sha256 outputHasher;
+    auto writeOutput = [&](const BYTE *data, size_t size)
+    {
+        if (outputOffset > fileSize || size > fileSize - outputOffset || !output.writeAt(outputOffset, data, size))
+        {
+            NetworkUtils::printMessage("ERROR", "Failed to write " + savePath);
+            return false;
+        }
+        if (deltaSize > 0)
+        {
+            outputHasher.update(data, size);
+        }
+
+        // Written ranges are with the OS; the policy decides whether the
+        // journal also waits for the disk
+        journal.commit(outputOffset, size);
+        outputOffset += size;
+        unjournaledBytes += size;
+        if (unjournaledBytes >= JOURNAL_INTERVAL)
+        {
+            unjournaledBytes = 0;
+            if (flush != FlushPolicy::Interval || output.flush())
+            {
+                journal.save();
+            }
+        }
+        return true;
+    };
+    DeltaDecoder deltaDecoder(basis, basisSize, blockSize, static_cast<uint32_t>(signatures.size()), writeOutput);
+
+    // Sparse data lands at its ranges; the holes in front of it are already
+    // zeros and count as written
+    std::vector<uint64_t> rangeStarts = rangeStreamStarts(dataRanges);
+    auto writeRanges = [&](const PipelineChunk &chunk)
+    {
+        return forEachRangePart(dataRanges, rangeStarts, chunk.offset, chunk.data.size(),
+                                [&](uint64_t fileOffset, size_t at, size_t part)
+                                {
+                                    journal.commit(outputOffset, fileOffset - outputOffset);
+                                    outputOffset = fileOffset;
+                                    return writeOutput(chunk.data.data() + at, part);
+                                });
+    };
+    ChunkAssembler assembler(store, missingChunks);
+
+    // Integrity-only chunks have fixed sizes, so chunk N owns MAC slot N
+    const uint64_t macChunkSize = INTEGRITY_CHUNK_SIZE;
+    std::vector<BYTE> macKey;
+    std::vector<BYTE> receivedMacs;
+    if (macChecked)
+    {
+        macKey = transferMacKey(cipher, transferNonce);
+        receivedMacs.assign((fileSize - startOffset + macChunkSize - 1) / macChunkSize * HmacSha256::MAC_SIZE, 0);
+        NetworkUtils::printMessage("INTEGRITY", "Receiving " + fileName + " unencrypted with per-chunk MACs");
+    }
 
-    // Receive file data
-    uint64_t totalReceived = 0;
-    uint32_t chunksReceived = 0;
-    uint32_t expectedChunks = (fileSize + 4096 - 1) / 4096;
+    // Pipelined frames carry a codec header; integrity-only data never does
+    bool packed = codec == CODEC_LZ && !macChecked;
 
-    while (totalReceived < fileSize)
+    // Receive -> decrypt and decompress (N workers) -> write in order; chunk
+    // buffers are pooled and keep their capacity across frames; the reader
+    // receives large chunks straight into them
+    ChunkPipeline pipeline(MIN_CHUNK_SIZE, ChunkPipeline::defaultWorkerCount(), pipelineDepth(packed ? 2 * maxChunkSize : maxChunkSize));
+    pipeline.publishCounters(progress.stages);
+    bool ok = pipeline.run(
+        [&](PipelineChunk &chunk)
+        {
+            if (networkOffset >= streamSize)
+                return PipelineStatus::Done;
+
+            if (!reader.next(chunk.data))
+            {
+                NetworkUtils::printMessage("ERROR", "Failed to receive chunk");
+                return PipelineStatus::Failed;
+            }
+            // Offsets advance by plain bytes; a payload never outgrows its plain size
+            uint64_t plainSize = chunk.data.size();
+            if (packed)
+            {
+                uint32_t header = 0;
+                plainSize = 0;
+                if (chunk.data.size() > CODEC_HEADER_SIZE)
+                {
+                    memcpy(&header, chunk.data.data(), CODEC_HEADER_SIZE);
+                    if (chunk.data.size() - CODEC_HEADER_SIZE <= header)
+                        plainSize = header;
+                }
+            }
+            if (plainSize == 0 || plainSize > maxChunkSize || plainSize > streamSize - networkOffset ||
+                (macChecked && plainSize != std::min(macChunkSize, streamSize - networkOffset)))
+            {
+                NetworkUtils::printMessage("ERROR", "Invalid chunk size: " + std::to_string(chunk.data.size()));
+                return PipelineStatus::Failed;
+            }
+            chunk.offset = networkOffset;
+            networkOffset += plainSize;
+            return PipelineStatus::Continue;
+        },
+        [&](PipelineChunk &chunk)
+        {
+            if (macChecked)
+            {
+                return chunkMac(macKey, chunk.offset, chunk.data.data(), chunk.data.size(), receivedMacs.data() + chunk.index * HmacSha256::MAC_SIZE);
+            }
+            if (!packed)
+            {
+                cipher.process(chunk.data.data(), chunk.data.size(), transferNonce, DATA_STREAM_OFFSET + chunk.offset);
+            }
+            else
+            {
+                uint32_t plainSize = 0;
+                memcpy(&plainSize, chunk.data.data(), CODEC_HEADER_SIZE);
+                BYTE *payload = chunk.data.data() + CODEC_HEADER_SIZE;
+                size_t payloadSize = chunk.data.size() - CODEC_HEADER_SIZE;
+                chunk.scratch.resize(plainSize);
+                if (payloadSize == plainSize)
+                {
+                    cipher.process(payload, chunk.scratch.data(), plainSize, transferNonce, DATA_STREAM_OFFSET + chunk.offset);
+                }
+                else
+                {
+                    cipher.process(payload, payloadSize, transferNonce, DATA_STREAM_OFFSET + chunk.offset);
+                    if (!LzCodec::decompress(payload, payloadSize, chunk.scratch.data(), plainSize))
+                    {
+                        NetworkUtils::printMessage("ERROR", "Corrupt compressed chunk at offset " + std::to_string(chunk.offset));
+                        return false;
+                    }
+                }
+                chunk.data.swap(chunk.scratch);
+            }
+            if (sparse)
+            {
+                forEachRangePart(dataRanges, rangeStarts, chunk.offset, chunk.data.size(),
+                                 [&](uint64_t fileOffset, size_t at, size_t part)
+                                 {
+                                     tree.add(fileOffset, chunk.data.data() + at, part);
+                                     return true;
+                                 });
+            }
+            else if (checksummed)
+            {
+                tree.add(chunk.offset, chunk.data.data(), chunk.data.size());
+            }
+            return true;
+        },
+        [&](PipelineChunk &chunk)
+        {
+            bool written = deduped       ? assembler.apply(chunk.data.data(), chunk.data.size())
+                           : sparse        ? writeRanges(chunk)
+                           : deltaSize > 0 ? deltaDecoder.apply(chunk.data.data(), chunk.data.size())
+                                           : writeOutput(chunk.data.data(), chunk.data.size());
+            if (!written)
+            {
+                NetworkUtils::printMessage("ERROR", "Failed to apply chunk " + std::to_string(chunk.index));
+                return false;
+            }
+            totalReceived += chunk.data.size();
+            progress.add(chunk.data.size());
+            return true;
+        });
+
+    NetworkUtils::printMessage("PIPELINE", pipeline.occupancyReport());
+    if (deduped)
     {
-        std::vector<BYTE> encryptedChunk;
-        if (!NetworkUtils::receiveData(socket, encryptedChunk))
+        // Chunks that arrived stay in the store for a retry even on failure
+        if (!ok || !assembler.complete() || !store->commit(fileName, fileSize, storeChunks))
         {
-            NetworkUtils::printMessage("ERROR", "Failed to receive chunk");
+            NetworkUtils::printMessage("ERROR", "Failed to store " + fileName);
             return false;
         }
+        NetworkUtils::printMessage("SUCCESS", "File stored: " + fileName + " (" + std::to_string(storeChunks.size()) + " chunks, " +
+                                                  std::to_string(missingChunks.size()) + " new, store holds " +
+                                                  std::to_string(store->storedBytes()) + " bytes)");
+        return true;
+    }
+    if (!ok)
+    {
+        // Keep what arrived for the next attempt
+        if ((flush != FlushPolicy::Interval || output.flush()) && journal.save())
+        {
+            NetworkUtils::printMessage("RESUME", "Partial file kept, next transfer resumes at byte " + std::to_string(journal.committedPrefix()));
+        }
+        return false;
+    }
 
-        auto chunk = CryptoUtils::aesDecrypt(key, iv, encryptedChunk);
-        if (chunk.empty())
+    if (sparse)
+    {
+        journal.commit(outputOffset, fileSize - outputOffset);
+    }
+    if (flush != FlushPolicy::None && !output.flush())
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to flush " + journal.getPartPath());
+        return false;
+    }
+    output.close();
+    basis.close();
+    if (checksummed && !checkLeafDigests(reader, cipher, tree, journal, fileName))
+    {
+        return false;
+    }
+    if (macChecked)
+    {
+        // The sender's MACs trail the data; any difference discards the file
+        std::vector<BYTE> expectedMacs;
+        if (!reader.next(expectedMacs))
+        {
+            NetworkUtils::printMessage("ERROR", "Failed to receive chunk MACs for " + fileName);
+            journal.save();
+            return false;
+        }
+        if (!cipher.decryptMessage(expectedMacs) || expectedMacs != receivedMacs)
         {
-            NetworkUtils::printMessage("ERROR", "Failed to decrypt chunk");
+            NetworkUtils::printMessage("ERROR", "Integrity check of " + fileName + " failed");
+            std::error_code ec;
+            fs::remove(journal.getPartPath(), ec);
+            journal.remove();
             return false;
         }
+    }
+    if (deltaSize > 0)
+    {
+        // The rebuilt file must hash to what the sender read
+        std::vector<BYTE> digest;
+        if (outputOffset != fileSize || !deltaDecoder.atBoundary() || !outputHasher.finish(digest) || digest != expectedDigest)
+        {
+            NetworkUtils::printMessage("ERROR", "Delta reconstruction of " + fileName + " does not match the sender's file");
+            std::error_code ec;
+            fs::remove(journal.getPartPath(), ec);
+            journal.remove();
+            return false;
+        }
+    }
 
-        file.write((const char *)chunk.data(), chunk.size());
-        totalReceived += chunk.size();
-        chunksReceived++;
+    return commitReceivedFile(journal, savePath);
+}
 
-        if (chunksReceived % 10 == 0 || chunksReceived == expectedChunks)
+bool FileTransfer::parseDataRanges(const std::vector<BYTE> &startInfo, size_t offset, uint64_t startOffset, uint64_t fileSize, uint64_t streamSize,
+                                   std::vector<std::pair<uint64_t, uint64_t>> &ranges)
+{
+    uint32_t count = 0;
+    const size_t recordSize = 2 * sizeof(uint64_t);
+    if (startInfo.size() < offset + sizeof(count))
+    {
+        return false;
+    }
+    memcpy(&count, startInfo.data() + offset, sizeof(count));
+    offset += sizeof(count);
+    if (count > MAX_SPARSE_RANGES || startInfo.size() != offset + static_cast<size_t>(count) * recordSize)
+    {
+        return false;
+    }
+
+    // In order, disjoint, non-empty and inside the part still to come. The
+    // start is checked first, so neither the length check nor the end can wrap.
+    ranges.resize(count);
+    uint64_t position = startOffset;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < count; i++, offset += recordSize)
+    {
+        memcpy(&ranges[i].first, startInfo.data() + offset, sizeof(uint64_t));
+        memcpy(&ranges[i].second, startInfo.data() + offset + sizeof(uint64_t), sizeof(uint64_t));
+        if (ranges[i].first < position || ranges[i].first > fileSize || ranges[i].second == 0 || ranges[i].second > fileSize - ranges[i].first)
         {
-            int progress = (totalReceived * 100) / fileSize;
-            NetworkUtils::printMessage("PROGRESS", "Received " + std::to_string(chunksReceived) +
-                                                       "/" + std::to_string(expectedChunks) + " chunks (" +
-                                                       std::to_string(progress) + "%)");
+            return false;
         }
+        position = ranges[i].first + ranges[i].second;
+        total += ranges[i].second;
     }
+    return total == streamSize;
+}
 
-    file.close();
+bool FileTransfer::commitReceivedFile(TransferJournal &journal, const std::string &savePath)
+{
+    if (!MoveFileExA(journal.getPartPath().c_str(), savePath.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        NetworkUtils::printMessage("ERROR", "Cannot rename " + journal.getPartPath() + " to " + savePath);
+        return false;
+    }
+    journal.remove();
     NetworkUtils::printMessage("SUCCESS", "File received: " + savePath);
     return true;
 }
\ No newline at end of file
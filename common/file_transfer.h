@@ -4,14 +4,145 @@
 #include <string>
 #include <vector>
 #include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
 #include "network_utils.h"
 #include "crypto_utils.h"
+#include "transfer_pipeline.h"
+#include "delta_sync.h"
+#include "transfer_journal.h"
+#include "file_io.h"
+#include "chunk_store.h"
+#include "merkle_tree.h"
 
 class FileTransfer
 {
 public:
+    // Each transfer draws one nonce; the file-info frame is encrypted from
+    // keystream offset 0 and file byte N at DATA_STREAM_OFFSET + N.
+    static const uint64_t DATA_STREAM_OFFSET = 1ull << 62;
+    // Integrity-only transfers key their chunk MACs with the keystream here
+    static const uint64_t MAC_KEY_OFFSET = 1ull << 61;
+
+    // Chunk sizes adapt between these bounds; the sender announces its
+    // maximum in the file-info header so the receiver can size its buffers
+    static const uint32_t MIN_CHUNK_SIZE = 64 * 1024;
+    static const uint32_t MAX_CHUNK_SIZE = 4 * 1024 * 1024;
+    static const size_t MAX_BUFFERED_BYTES = 64 * 1024 * 1024;
+
+    // Receivers flush and journal their progress every this many bytes
+    static const uint64_t JOURNAL_INTERVAL = 32 * 1024 * 1024;
+
+    // Resume reply: [u64 resume offset][u32 block size][u32 block count]
+    // [u32 flags], then the prefix's SHA-256 when resuming; basis signatures
+    // follow in batches
+    static const size_t RESUME_REPLY_SIZE = sizeof(uint64_t) + 3 * sizeof(uint32_t);
+    static const size_t SIGNATURES_PER_FRAME = 8192;
+
+    // Reply flag: the receiver keeps files in a chunk store. The sender then
+    // lists the file's content-defined chunks ([u32 count], then batches of
+    // records) and the receiver answers with a bitmap of the chunks to send;
+    // those follow back to back as the data stream.
+    static const uint32_t RESUME_OFFER_DEDUP = 1;
+    static const uint32_t MAX_STORE_CHUNKS = 1 << 22;
+
+    // Start frame flag: file bytes travel in the clear with one HMAC-SHA256
+    // per fixed-size chunk, sent encrypted after the data
+    static const uint32_t START_INTEGRITY_ONLY = 1;
+    // Start frame flag: the data stream holds only the requested chunks, and
+    // the delta size field carries its length
+    static const uint32_t START_DEDUP = 2;
+    // Start frame flag: the file has holes. The start frame lists the data
+    // ranges past the start offset ([u32 count], then [u64 offset][u64 length]
+    // each), the data stream holds only those back to back, and the delta
+    // size field carries its length. Holes are recreated, not sent.
+    static const uint32_t START_SPARSE = 4;
+    static const uint32_t MAX_SPARSE_RANGES = 1 << 20;
+    static const uint32_t INTEGRITY_CHUNK_SIZE = 1024 * 1024;
+
+    // Full sends, striped or not, end with one encrypted frame of leaf
+    // digests of the file's checksum tree. Delta transfers check a SHA-256 of
+    // the rebuilt file instead, chunk store uploads each chunk's SHA-256 and
+    // integrity-only transfers their MACs.
+
+    // File-info codec byte. With CODEC_LZ every pipelined data frame is
+    // [u32 plain size][payload], the payload LZ-compressed when it is shorter
+    // than the plain size and stored otherwise. Striped and integrity-only
+    // data is never compressed.
+    static const BYTE CODEC_NONE = 0;
+    static const BYTE CODEC_LZ = 1;
+    static const size_t CODEC_HEADER_SIZE = sizeof(uint32_t);
+
+    // Process-wide; applies to every receive that starts afterwards
+    static void setFlushPolicy(FlushPolicy policy) { flushPolicy = policy; }
+    static FlushPolicy getFlushPolicy() { return flushPolicy; }
+    // Process-wide; whether sends that start afterwards offer CODEC_LZ
+    static void setCompression(bool enabled) { compression = enabled; }
+    static bool getCompression() { return compression; }
+    // Process-wide; receives that start afterwards store files in `store`
+    // instead of the save directory. Null turns it off.
+    static void setChunkStore(ChunkStore *store) { chunkStore = store; }
+    static ChunkStore *getChunkStore() { return chunkStore; }
+
+    // Chunk buffers to pool for chunks of up to `maxChunkSize`
+    static size_t pipelineDepth(uint32_t maxChunkSize);
+
+    // Whether a file name from the wire can be joined to a local directory:
+    // a single component of at most MAX_FILE_NAME_SIZE bytes, with no
+    // separator, drive colon or control character, and not ending in a dot
+    // or space, which Windows drops (turning ".. " into ".."). Reserved
+    // device names such as CON or COM1.txt are rejected too.
+    static const size_t MAX_FILE_NAME_SIZE = 255;
+    static bool validFileName(const std::string &fileName);
+
     static bool sendFile(SOCKET socket, const std::vector<BYTE> &key, const std::vector<BYTE> &iv, const std::string &filePath);
     static bool receiveFile(SOCKET socket, const std::vector<BYTE> &key, const std::vector<BYTE> &iv, const std::string &saveDir = "received_files");
+
+    // Session-scoped cipher variants: chunks are transformed in place in a reused buffer
+    static bool sendFile(SOCKET socket, const CipherContext &cipher, const std::string &filePath);
+    static bool receiveFile(SOCKET socket, const CipherContext &cipher, const std::string &saveDir = "received_files");
+
+    // Transfers through the connection's frame reader; both directions read,
+    // since the receiver answers the file info with its resume offset. The
+    // SOCKET overloads use a private reader and are only safe when nothing
+    // follows the transfer.
+    // `stripes` are the session's extra data connections; large transfers are
+    // spread over the main connection plus all of them. `integrityOnly` is the
+    // session's opt-in to zero-copy sends of unencrypted, MAC-checked data.
+    static bool sendFile(FrameReader &reader, const CipherContext &cipher, const std::string &filePath,
+                         const std::vector<FrameReader *> &stripes = {}, bool integrityOnly = false);
+    static bool receiveFile(FrameReader &reader, const CipherContext &cipher, const std::string &saveDir = "received_files",
+                            const std::vector<FrameReader *> &stripes = {}, bool integrityOnly = false);
+
+private:
+    static std::atomic<FlushPolicy> flushPolicy;
+    static std::atomic<bool> compression;
+    static std::atomic<ChunkStore *> chunkStore;
+
+    static uint64_t sourceStamp(const std::string &filePath);
+    static bool commitReceivedFile(TransferJournal &journal, const std::string &savePath);
+    // SHA-256 of the first `length` bytes, which decides whether a prefix is
+    // resumed, while the same bytes' leaves go into `tree`
+    static bool hashPrefix(const std::string &filePath, uint64_t length, MerkleTree &tree, std::vector<BYTE> &digest);
+    static bool sendLeafDigests(SOCKET socket, const CipherContext &cipher, const MerkleTree &tree);
+    static bool checkLeafDigests(FrameReader &reader, const CipherContext &cipher, const MerkleTree &tree, TransferJournal &journal,
+                                 const std::string &fileName);
+    static bool sendSignatures(SOCKET socket, const CipherContext &cipher, const std::vector<BlockSignature> &signatures);
+    static bool receiveSignatures(FrameReader &reader, const CipherContext &cipher, uint32_t blockSize, uint32_t blockCount,
+                                  std::vector<BlockSignature> &signatures);
+    static bool offerChunks(FrameReader &reader, const CipherContext &cipher, std::istream &file, uint64_t fileSize,
+                            std::vector<std::pair<uint64_t, uint64_t>> &missingRanges, uint64_t &missingBytes);
+    static bool receiveChunkList(FrameReader &reader, const CipherContext &cipher, uint64_t fileSize, std::vector<StoredChunk> &chunks);
+    static bool parseDataRanges(const std::vector<BYTE> &startInfo, size_t offset, uint64_t startOffset, uint64_t fileSize, uint64_t streamSize,
+                                std::vector<std::pair<uint64_t, uint64_t>> &ranges);
+
+    static std::vector<BYTE> transferMacKey(const CipherContext &cipher, uint64_t nonce);
+    static bool chunkMac(const std::vector<BYTE> &key, uint64_t offset, const BYTE *data, size_t size, BYTE *mac);
+    static bool computeChunkMacs(const std::string &filePath, const std::vector<BYTE> &key, uint64_t startOffset, uint64_t fileSize,
+                                 const std::atomic<bool> &cancelled, std::vector<BYTE> &macs);
+    static bool sendIntegrityOnly(SOCKET socket, const CipherContext &cipher, uint64_t nonce, const std::string &filePath,
+                                  const std::vector<BYTE> &startMessage, uint64_t startOffset, uint64_t fileSize);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,274 @@
+#include "io_engine.h"
+#include <cstring>
+
+std::atomic<IoBackend> SendEngine::selectedBackend{IoBackend::Auto};
+
+bool SendEngine::parseBackend(const std::string &name, IoBackend &backend)
+{
+    if (name == "auto")
+        backend = IoBackend::Auto;
+    else if (name == "rio")
+        backend = IoBackend::Rio;
+    else if (name == "blocking")
+        backend = IoBackend::Blocking;
+    else
+        return false;
+    return true;
+}
+
+std::unique_ptr<SendEngine> SendEngine::create(SOCKET socket)
+{
+    IoBackend backend = getBackend();
+    if (backend != IoBackend::Blocking)
+    {
+        std::unique_ptr<RioSendEngine> engine = RioSendEngine::open(socket);
+        if (engine)
+        {
+            return engine;
+        }
+        if (backend == IoBackend::Rio)
+        {
+            NetworkUtils::printMessage("WARNING", "Registered I/O unavailable, using blocking sends");
+        }
+    }
+    return std::make_unique<BlockingSendEngine>(socket);
+}
+
+RioSendEngine::RioSendEngine(SOCKET socket)
+    : socket(socket), completionQueue(RIO_INVALID_CQ), completionEvent(NULL), requestQueue(RIO_INVALID_RQ), region(nullptr),
+      slotSize(0), bufferId(RIO_INVALID_BUFFERID), nextSlot(0), inFlight(0), failed(false), stalled(false)
+{
+    memset(&rio, 0, sizeof(rio));
+    memset(slotBusy, 0, sizeof(slotBusy));
+}
+
+RioSendEngine::~RioSendEngine()
+{
+    // The request queue goes away with the socket; sends still in flight
+    // complete into the queue released here
+    end();
+    if (inFlight > 0)
+    {
+        // Stalled sends may still complete into the queue
+        return;
+    }
+    if (completionQueue != RIO_INVALID_CQ)
+    {
+        rio.RIOCloseCompletionQueue(completionQueue);
+    }
+    if (completionEvent)
+    {
+        CloseHandle(completionEvent);
+    }
+}
+
+std::unique_ptr<RioSendEngine> RioSendEngine::open(SOCKET socket)
+{
+    std::unique_ptr<RioSendEngine> engine(new RioSendEngine(socket));
+
+    GUID functionTableId = WSAID_MULTIPLE_RIO;
+    DWORD bytes = 0;
+    if (WSAIoctl(socket, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &functionTableId, sizeof(functionTableId), &engine->rio,
+                 sizeof(engine->rio), &bytes, NULL, NULL) == SOCKET_ERROR)
+    {
+        return nullptr;
+    }
+
+    engine->completionEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (!engine->completionEvent)
+    {
+        return nullptr;
+    }
+    RIO_NOTIFICATION_COMPLETION notification;
+    memset(&notification, 0, sizeof(notification));
+    notification.Type = RIO_EVENT_COMPLETION;
+    notification.Event.EventHandle = engine->completionEvent;
+    notification.Event.NotifyReset = TRUE;
+    engine->completionQueue = engine->rio.RIOCreateCompletionQueue(SLOT_COUNT + 1, &notification);
+    if (engine->completionQueue == RIO_INVALID_CQ)
+    {
+        return nullptr;
+    }
+
+    // Fails unless the socket was created with WSA_FLAG_REGISTERED_IO
+    engine->requestQueue = engine->rio.RIOCreateRequestQueue(socket, 1, 1, SLOT_COUNT, 1, engine->completionQueue,
+                                                              engine->completionQueue, engine.get());
+    if (engine->requestQueue == RIO_INVALID_RQ)
+    {
+        return nullptr;
+    }
+    return engine;
+}
+
+void RioSendEngine::begin(size_t maxFrameSize)
+{
+    // A stalled queue never gets memory again; its sends all fail
+    if (region || stalled || maxFrameSize > NetworkUtils::MAX_FRAME_SIZE)
+    {
+        return;
+    }
+
+    // One frame and a control frame with their length prefixes, in whole
+    // pages so the registered region stays page-aligned per slot
+    const size_t pageSize = 4096;
+    size_t size = (2 * sizeof(uint32_t) + CONTROL_FRAME_SIZE + maxFrameSize + pageSize - 1) / pageSize * pageSize;
+    region = static_cast<BYTE *>(VirtualAlloc(NULL, SLOT_COUNT * size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (!region)
+    {
+        NetworkUtils::printMessage("WARNING", "Cannot allocate registered send buffers, sending synchronously");
+        return;
+    }
+    bufferId = rio.RIORegisterBuffer(reinterpret_cast<PCHAR>(region), static_cast<DWORD>(SLOT_COUNT * size));
+    if (bufferId == RIO_INVALID_BUFFERID)
+    {
+        NetworkUtils::printMessage("WARNING", "Cannot register send buffers, sending synchronously");
+        VirtualFree(region, 0, MEM_RELEASE);
+        region = nullptr;
+        return;
+    }
+    slotSize = size;
+    nextSlot = 0;
+}
+
+bool RioSendEngine::end()
+{
+    bool ok = flush();
+    if (!region)
+    {
+        return ok;
+    }
+    if (inFlight > 0)
+    {
+        // Stalled sends may still read the buffer and complete into the
+        // queue; leaking it is safer than freeing memory under the NIC
+        NetworkUtils::printMessage("WARNING", "Abandoning " + std::to_string(inFlight) + " stalled registered sends");
+    }
+    else
+    {
+        rio.RIODeregisterBuffer(bufferId);
+        VirtualFree(region, 0, MEM_RELEASE);
+    }
+    region = nullptr;
+    slotSize = 0;
+    bufferId = RIO_INVALID_BUFFERID;
+    return ok;
+}
+
+bool RioSendEngine::send(const FrameView *frames, size_t count)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        total += sizeof(uint32_t) + frames[i].size;
+    }
+
+    // Without slots, or with an oversized batch, frames keep their order by
+    // draining the ring first
+    if (!region || total > slotSize)
+    {
+        return flush() && NetworkUtils::sendFrames(socket, frames, count);
+    }
+
+    while (!failed && slotBusy[nextSlot])
+    {
+        if (!reap(true))
+            return false;
+    }
+    if (failed)
+    {
+        return false;
+    }
+
+    // Frames are laid out exactly as the blocking path puts them on the wire
+    size_t slot = nextSlot;
+    BYTE *out = region + slot * slotSize;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t size = static_cast<uint32_t>(frames[i].size);
+        memcpy(out, &size, sizeof(size));
+        out += sizeof(size);
+        if (size > 0)
+        {
+            memcpy(out, frames[i].data, size);
+            out += size;
+        }
+    }
+
+    RIO_BUF buffer;
+    buffer.BufferId = bufferId;
+    buffer.Offset = static_cast<ULONG>(slot * slotSize);
+    buffer.Length = static_cast<ULONG>(total);
+    if (!rio.RIOSend(requestQueue, &buffer, 1, 0, reinterpret_cast<PVOID>(slot)))
+    {
+        NetworkUtils::printMessage("ERROR", "RIOSend failed: " + NetworkUtils::getSocketErrorString(WSAGetLastError()));
+        failed = true;
+        return false;
+    }
+    slotBusy[slot] = true;
+    inFlight++;
+    nextSlot = (nextSlot + 1) % SLOT_COUNT;
+
+    // Retire whatever already finished without waiting
+    return reap(false);
+}
+
+bool RioSendEngine::flush()
+{
+    // After a failed send the others still finish, so their slots can be
+    // reused or freed; only a stalled queue leaves them behind
+    while (inFlight > 0 && !stalled)
+    {
+        reap(true);
+    }
+    return !failed;
+}
+
+bool RioSendEngine::reap(bool wait)
+{
+    RIORESULT results[SLOT_COUNT];
+    while (!stalled)
+    {
+        ULONG count = rio.RIODequeueCompletion(completionQueue, results, SLOT_COUNT);
+        if (count == RIO_CORRUPT_CQ)
+        {
+            NetworkUtils::printMessage("ERROR", "Registered I/O completion queue is corrupt");
+            failed = stalled = true;
+            return false;
+        }
+        for (ULONG i = 0; i < count; i++)
+        {
+            size_t slot = static_cast<size_t>(results[i].RequestContext);
+            if (results[i].Status != 0)
+            {
+                NetworkUtils::printMessage("ERROR", "Registered send failed: " + NetworkUtils::getSocketErrorString(results[i].Status));
+                failed = true;
+            }
+            if (slot < SLOT_COUNT && slotBusy[slot])
+            {
+                slotBusy[slot] = false;
+                inFlight--;
+            }
+        }
+        if (count > 0 || !wait || inFlight == 0)
+        {
+            return !failed;
+        }
+
+        // Arm the queue and sleep until it has completions; a queue that
+        // already has some signals at once, so none are missed in between
+        int notified = rio.RIONotify(completionQueue);
+        if (notified != ERROR_SUCCESS && notified != WSAEALREADY)
+        {
+            NetworkUtils::printMessage("ERROR", "RIONotify failed: " + NetworkUtils::getSocketErrorString(notified));
+            failed = stalled = true;
+            return false;
+        }
+        if (WaitForSingleObject(completionEvent, SEND_TIMEOUT_MS) != WAIT_OBJECT_0)
+        {
+            NetworkUtils::printMessage("ERROR", "Registered send made no progress in " + std::to_string(SEND_TIMEOUT_MS / 1000) + " seconds");
+            failed = stalled = true;
+            return false;
+        }
+    }
+    return false;
+}
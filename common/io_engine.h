@@ -0,0 +1,116 @@
+#ifndef IO_ENGINE_H
+#define IO_ENGINE_H
+
+#include <winsock2.h>
+#include <mswsock.h>
+#include <memory>
+#include <atomic>
+#include "network_utils.h"
+
+enum class IoBackend
+{
+    Auto,    // Registered I/O where the socket and OS support it
+    Rio,     // as Auto, but warn when falling back
+    Blocking // one synchronous WSASend per call
+};
+
+// Sends frames for one connection. The blocking engine is a thin wrapper over
+// NetworkUtils::sendFrames; the RIO engine copies each call into a registered
+// buffer slot and keeps up to SLOT_COUNT sends in flight, so the caller goes
+// back to producing data while the NIC drains earlier frames. Only sends go
+// through an engine: receives and file I/O stay on their blocking paths.
+//
+// A transfer brackets its sends with begin() and end(), which is when the RIO
+// engine holds registered memory. Frames queued by send() may still be in
+// flight when it returns; call flush() or end() before any other write on
+// the socket.
+class SendEngine
+{
+public:
+    virtual ~SendEngine() = default;
+
+    // Sets aside send buffers for frames of up to `maxFrameSize` bytes until
+    // end(); larger frames, and sends outside begin() and end(), go out
+    // synchronously
+    virtual void begin(size_t maxFrameSize) {}
+    virtual bool send(const FrameView *frames, size_t count) = 0;
+    // Waits for every queued frame; false if any of them failed
+    virtual bool flush() = 0;
+    // flush(), then gives back what begin() set aside
+    virtual bool end() { return flush(); }
+    virtual const char *name() const = 0;
+
+    // Process-wide choice for engines and sockets created afterwards
+    static void setBackend(IoBackend backend) { selectedBackend = backend; }
+    static IoBackend getBackend() { return selectedBackend; }
+    static bool parseBackend(const std::string &name, IoBackend &backend);
+
+    // Never fails: falls back to the blocking engine
+    static std::unique_ptr<SendEngine> create(SOCKET socket);
+
+private:
+    static std::atomic<IoBackend> selectedBackend;
+};
+
+class BlockingSendEngine : public SendEngine
+{
+public:
+    explicit BlockingSendEngine(SOCKET socket) : socket(socket) {}
+
+    bool send(const FrameView *frames, size_t count) override { return NetworkUtils::sendFrames(socket, frames, count); }
+    bool flush() override { return true; }
+    const char *name() const override { return "blocking"; }
+
+private:
+    SOCKET socket;
+};
+
+// Registered I/O send path. A socket gets at most one request queue for its
+// lifetime, so the queues live as long as the connection, but the slots are
+// registered per transfer by begin(), each sized to one of its frames, and
+// released by end(); an idle connection pins no buffer memory. The sending
+// thread retires completions itself; when it has to wait for a slot it
+// sleeps on an event the completion queue signals, no extra thread is
+// involved.
+class RioSendEngine : public SendEngine
+{
+public:
+    static const size_t SLOT_COUNT = 4;
+    // Room in each slot for a small control frame sent ahead of a data frame
+    static const size_t CONTROL_FRAME_SIZE = 4096;
+    // A peer that takes none of our sends for this long is treated as gone
+    static const DWORD SEND_TIMEOUT_MS = 60000;
+
+    ~RioSendEngine() override;
+
+    // Null when RIO is unavailable or the socket was not created for it
+    static std::unique_ptr<RioSendEngine> open(SOCKET socket);
+
+    void begin(size_t maxFrameSize) override;
+    bool send(const FrameView *frames, size_t count) override;
+    bool flush() override;
+    bool end() override;
+    const char *name() const override { return "rio"; }
+
+private:
+    SOCKET socket;
+    RIO_EXTENSION_FUNCTION_TABLE rio;
+    RIO_CQ completionQueue;
+    HANDLE completionEvent; // signalled by the queue after RIONotify
+    RIO_RQ requestQueue;
+    BYTE *region; // SLOT_COUNT slots of slotSize bytes between begin() and end()
+    size_t slotSize;
+    RIO_BUFFERID bufferId;
+    bool slotBusy[SLOT_COUNT];
+    size_t nextSlot;
+    size_t inFlight;
+    bool failed;  // a send failed; queued frames are lost
+    bool stalled; // the queue stopped completing; slots still in flight may never retire
+
+    explicit RioSendEngine(SOCKET socket);
+    // Retires finished sends; with `wait`, blocks until at least one retires.
+    // False once any send failed, the queue is corrupt or a wait timed out.
+    bool reap(bool wait);
+};
+
+#endif
@@ -0,0 +1,284 @@
+#include "logger.h"
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <ctime>
+#include <algorithm>
+#include <cstdio>
+
+namespace
+{
+    // Writer pause when every ring is empty; also the clock's resolution
+    const std::chrono::microseconds IDLE_SLEEP(1000);
+
+    struct Record
+    {
+        uint64_t stamp = 0;
+        bool raw = false;
+        std::string tag;
+        std::string text;
+    };
+
+    // Filled by its thread only and drained by the writer only
+    struct Ring
+    {
+        Record slots[Logger::RING_SLOTS];
+        std::atomic<uint64_t> head{0}; // next slot the writer reads
+        std::atomic<uint64_t> tail{0}; // next slot the thread fills
+        std::atomic<bool> retired{false};
+    };
+
+    uint64_t systemNanos()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // "[HH:MM:SS.mmm] TAG: text\n"; the time of day is redone once per second
+    class LineFormatter
+    {
+    public:
+        void append(std::string &out, const Record &record)
+        {
+            if (record.raw)
+            {
+                out += record.text;
+                return;
+            }
+            uint64_t millis = record.stamp / 1000000;
+            time_t seconds = static_cast<time_t>(millis / 1000);
+            if (seconds != cachedSecond)
+            {
+                cachedSecond = seconds;
+                std::strftime(timeOfDay, sizeof(timeOfDay), "%H:%M:%S", std::localtime(&seconds));
+            }
+            char stamp[32];
+            std::snprintf(stamp, sizeof(stamp), "[%s.%03u] ", timeOfDay, static_cast<unsigned>(millis % 1000));
+            out += stamp;
+            out += record.tag;
+            out += ": ";
+            out += record.text;
+            out += '\n';
+        }
+
+    private:
+        time_t cachedSecond = -1;
+        char timeOfDay[16] = {};
+    };
+
+    // Set for good once the writer is destroyed at exit; later lines are
+    // written synchronously
+    std::atomic<bool> writerGone{false};
+
+    class LogWriter
+    {
+    public:
+        LogWriter() : clock(systemNanos())
+        {
+            thread = std::thread([this]
+                                 { run(); });
+        }
+
+        ~LogWriter()
+        {
+            stopping = true;
+            thread.join();
+            writerGone = true;
+        }
+
+        std::atomic<uint64_t> clock;
+
+        void add(const std::shared_ptr<Ring> &ring)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            added.push_back(ring);
+        }
+
+        void flush()
+        {
+            // The second pass to start after this point has seen every
+            // record queued before it
+            uint64_t target = passes.load() + 2;
+            while (passes.load() < target && !stopping)
+            {
+                std::this_thread::sleep_for(IDLE_SLEEP);
+            }
+        }
+
+    private:
+        std::mutex mutex;
+        std::vector<std::shared_ptr<Ring>> added;
+        std::vector<std::shared_ptr<Ring>> rings; // writer thread only
+        std::atomic<bool> stopping{false};
+        std::atomic<uint64_t> passes{0};
+        std::thread thread;
+
+        std::vector<const Record *> batch;
+        std::vector<uint64_t> tails;
+        std::vector<char> finished;
+        std::string out;
+        LineFormatter formatter;
+
+        void run()
+        {
+            while (true)
+            {
+                bool drained = drain();
+                passes++;
+                if (!drained)
+                {
+                    if (stopping)
+                        break;
+                    std::this_thread::sleep_for(IDLE_SLEEP);
+                }
+            }
+        }
+
+        bool drain()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                rings.insert(rings.end(), added.begin(), added.end());
+                added.clear();
+            }
+            clock.store(systemNanos(), std::memory_order_relaxed);
+
+            batch.clear();
+            tails.assign(rings.size(), 0);
+            finished.assign(rings.size(), 0);
+            for (size_t i = 0; i < rings.size(); i++)
+            {
+                Ring &ring = *rings[i];
+                // A retired ring seen before its tail has nothing after it
+                finished[i] = ring.retired.load(std::memory_order_acquire);
+                uint64_t head = ring.head.load(std::memory_order_relaxed);
+                tails[i] = ring.tail.load(std::memory_order_acquire);
+                for (uint64_t slot = head; slot < tails[i]; slot++)
+                {
+                    batch.push_back(&ring.slots[slot % Logger::RING_SLOTS]);
+                }
+            }
+
+            if (!batch.empty())
+            {
+                // Stable, so each thread's lines keep their order within a tick
+                std::stable_sort(batch.begin(), batch.end(), [](const Record *a, const Record *b)
+                                 { return a->stamp < b->stamp; });
+                out.clear();
+                for (const Record *record : batch)
+                {
+                    formatter.append(out, *record);
+                }
+                std::cout.write(out.data(), static_cast<std::streamsize>(out.size()));
+                std::cout.flush();
+            }
+
+            size_t kept = 0;
+            for (size_t i = 0; i < rings.size(); i++)
+            {
+                rings[i]->head.store(tails[i], std::memory_order_release);
+                if (!finished[i])
+                {
+                    rings[kept++] = rings[i];
+                }
+            }
+            rings.resize(kept);
+            return !batch.empty();
+        }
+    };
+
+    LogWriter &writer()
+    {
+        static LogWriter instance;
+        return instance;
+    }
+
+    // Marks the thread's ring retired when the thread exits
+    struct RingOwner
+    {
+        std::shared_ptr<Ring> ring;
+
+        ~RingOwner()
+        {
+            if (ring)
+            {
+                ring->retired.store(true, std::memory_order_release);
+            }
+        }
+    };
+}
+
+std::atomic<LogLevel> Logger::minLevel{LogLevel::Info};
+
+ConsoleLine::~ConsoleLine()
+{
+    Logger::write(text.str());
+}
+
+void Logger::log(LogLevel level, const std::string &tag, const std::string &text)
+{
+    if (enabled(level))
+    {
+        enqueue(false, tag, text);
+    }
+}
+
+void Logger::write(const std::string &text)
+{
+    enqueue(true, std::string(), text);
+}
+
+void Logger::enqueue(bool raw, const std::string &tag, const std::string &text)
+{
+    static thread_local RingOwner owner;
+
+    if (writerGone)
+    {
+        Record record;
+        record.stamp = systemNanos();
+        record.raw = raw;
+        record.tag = tag;
+        record.text = text;
+        std::string line;
+        LineFormatter().append(line, record);
+        std::cout << line << std::flush;
+        return;
+    }
+
+    LogWriter &logWriter = writer();
+    if (!owner.ring)
+    {
+        owner.ring = std::make_shared<Ring>();
+        logWriter.add(owner.ring);
+    }
+
+    Ring &ring = *owner.ring;
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    while (tail - ring.head.load(std::memory_order_acquire) >= RING_SLOTS)
+    {
+        std::this_thread::yield();
+    }
+
+    // Slot buffers keep their capacity, so steady state allocates nothing
+    Record &record = ring.slots[tail % RING_SLOTS];
+    record.stamp = logWriter.clock.load(std::memory_order_relaxed);
+    record.raw = raw;
+    record.tag.assign(tag);
+    record.text.assign(text);
+    ring.tail.store(tail + 1, std::memory_order_release);
+}
+
+void Logger::flush()
+{
+    if (!writerGone)
+    {
+        writer().flush();
+    }
+}
+
+uint64_t Logger::coarseNanos()
+{
+    return writerGone ? systemNanos() : writer().clock.load(std::memory_order_relaxed);
+}
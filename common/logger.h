@@ -0,0 +1,98 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <string>
+#include <sstream>
+#include <atomic>
+#include <cstdint>
+
+enum class LogLevel
+{
+    Debug = 0,
+    Info = 1,
+    Warning = 2,
+    Error = 3
+};
+
+// Levels below this are compiled out of the LOG_* macros; build with
+// -DLOG_COMPILED_LEVEL=0 to keep debug lines
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL 1
+#endif
+
+#define LOG_AT(level, tag, text)                                           \
+    do                                                                     \
+    {                                                                      \
+        if (static_cast<int>(level) >= LOG_COMPILED_LEVEL)                 \
+            Logger::log(level, tag, text);                                 \
+    } while (0)
+#define LOG_DEBUG(tag, text) LOG_AT(LogLevel::Debug, tag, text)
+#define LOG_INFO(tag, text) LOG_AT(LogLevel::Info, tag, text)
+#define LOG_WARNING(tag, text) LOG_AT(LogLevel::Warning, tag, text)
+#define LOG_ERROR(tag, text) LOG_AT(LogLevel::Error, tag, text)
+
+// Text for the console, queued as one record once the statement ends;
+// streams like std::cout, including std::endl
+class ConsoleLine
+{
+public:
+    ConsoleLine() = default;
+    ConsoleLine(const ConsoleLine &) = delete;
+    ConsoleLine &operator=(const ConsoleLine &) = delete;
+    ~ConsoleLine();
+
+    template <typename T>
+    ConsoleLine &operator<<(const T &value)
+    {
+        text << value;
+        return *this;
+    }
+    ConsoleLine &operator<<(std::ostream &(*manipulator)(std::ostream &))
+    {
+        text << manipulator;
+        return *this;
+    }
+
+private:
+    std::ostringstream text;
+};
+
+// Asynchronous console log. Each thread queues records into its own
+// single-producer ring, allocated on its first line and reused for good, so
+// queuing a line is a copy into a slot whose buffers already have the
+// capacity, plus a release store. One writer thread drains every ring, puts
+// the records in time order, formats "[HH:MM:SS.mmm] TAG: text" (the time of
+// day is worked out once per second) and writes whole batches to stdout.
+// A full ring makes its thread wait for the writer rather than drop lines.
+//
+// Records carry a coarse clock the writer refreshes on every pass, so stamps
+// are only as fine as its polling interval, and lines that different threads
+// queue within one tick may come out in either order.
+class Logger
+{
+public:
+    static const size_t RING_SLOTS = 1024;
+
+    static void log(LogLevel level, const std::string &tag, const std::string &text);
+    // Console output as is, with no stamp or tag, never filtered
+    static void write(const std::string &text);
+    static ConsoleLine console() { return ConsoleLine(); }
+
+    // Process-wide; lines below `level` are dropped when queued
+    static void setLevel(LogLevel level) { minLevel = level; }
+    static LogLevel getLevel() { return minLevel; }
+    static bool enabled(LogLevel level) { return level >= minLevel.load(std::memory_order_relaxed); }
+
+    // Blocks until everything queued before the call has been written
+    static void flush();
+
+    // Nanoseconds since the epoch, as of the writer's last pass
+    static uint64_t coarseNanos();
+
+private:
+    static std::atomic<LogLevel> minLevel;
+
+    static void enqueue(bool raw, const std::string &tag, const std::string &text);
+};
+
+#endif
@@ -0,0 +1,264 @@
+#include "lz_codec.h"
+#include <cstring>
+#include <cmath>
+
+namespace
+{
+    const size_t HASH_BITS = 14;
+    // The format ends in literals: a match may not start within the last 12
+    // bytes or cover any of the last 5
+    const size_t MATCH_START_LIMIT = 12;
+    const size_t LAST_LITERALS = 5;
+    // Give up probing faster the longer a stretch has gone without a match
+    const unsigned SKIP_STRENGTH = 6;
+
+    const size_t SAMPLE_COUNT = 8;
+    const size_t SAMPLE_SIZE = 512;
+
+    uint32_t read32(const BYTE *p)
+    {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    uint64_t read64(const BYTE *p)
+    {
+        uint64_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    size_t hashPosition(uint32_t sequence)
+    {
+        return (sequence * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    // Writes a length above 15 as 255-valued extension bytes
+    bool putLength(BYTE *output, size_t capacity, size_t &out, size_t length)
+    {
+        for (; length >= 255; length -= 255)
+        {
+            if (out >= capacity)
+                return false;
+            output[out++] = 255;
+        }
+        if (out >= capacity)
+            return false;
+        output[out++] = static_cast<BYTE>(length);
+        return true;
+    }
+
+    // Literals then, unless this is the last sequence, one match
+    bool putSequence(BYTE *output, size_t capacity, size_t &out, const BYTE *literals, size_t literalCount, size_t offset, size_t matchLength)
+    {
+        if (out >= capacity)
+            return false;
+        size_t tokenAt = out++;
+        BYTE token = static_cast<BYTE>(literalCount < 15 ? literalCount << 4 : 0xf0);
+        if (literalCount >= 15 && !putLength(output, capacity, out, literalCount - 15))
+            return false;
+        if (literalCount > capacity - out)
+            return false;
+        if (literalCount > 0)
+            memcpy(output + out, literals, literalCount);
+        out += literalCount;
+
+        if (matchLength > 0)
+        {
+            if (capacity - out < 2)
+                return false;
+            output[out++] = static_cast<BYTE>(offset);
+            output[out++] = static_cast<BYTE>(offset >> 8);
+            size_t extra = matchLength - LzCodec::MIN_MATCH;
+            token |= static_cast<BYTE>(extra < 15 ? extra : 15);
+            if (extra >= 15 && !putLength(output, capacity, out, extra - 15))
+                return false;
+        }
+        output[tokenAt] = token;
+        return true;
+    }
+
+    // Reads extension bytes after a nibble of 15; false on truncation or a
+    // length beyond `limit`
+    bool getLength(const BYTE *input, size_t size, size_t &in, size_t &length, size_t limit)
+    {
+        BYTE next;
+        do
+        {
+            if (in >= size)
+                return false;
+            next = input[in++];
+            length += next;
+            if (length > limit)
+                return false;
+        } while (next == 255);
+        return true;
+    }
+}
+
+size_t LzCodec::compress(const BYTE *input, size_t size, BYTE *output, size_t capacity)
+{
+    // Chunk-sized inputs only, so positions fit the table entries
+    static thread_local uint32_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    size_t out = 0;
+    size_t anchor = 0;
+    if (size > MATCH_START_LIMIT)
+    {
+        const size_t matchStartLimit = size - MATCH_START_LIMIT;
+        const size_t matchEndLimit = size - LAST_LITERALS;
+        size_t pos = 1;
+        size_t misses = 0;
+        table[hashPosition(read32(input))] = 0;
+
+        while (pos < matchStartLimit)
+        {
+            uint32_t sequence = read32(input + pos);
+            size_t slot = hashPosition(sequence);
+            size_t candidate = table[slot];
+            table[slot] = static_cast<uint32_t>(pos);
+            if (pos - candidate > MAX_OFFSET || read32(input + candidate) != sequence)
+            {
+                pos += 1 + (misses++ >> SKIP_STRENGTH);
+                continue;
+            }
+            misses = 0;
+
+            // Grow the match back into pending literals, then forward a word at a time
+            while (pos > anchor && candidate > 0 && input[pos - 1] == input[candidate - 1])
+            {
+                pos--;
+                candidate--;
+            }
+            size_t length = MIN_MATCH;
+            while (pos + length + sizeof(uint64_t) <= matchEndLimit && read64(input + pos + length) == read64(input + candidate + length))
+            {
+                length += sizeof(uint64_t);
+            }
+            while (pos + length < matchEndLimit && input[pos + length] == input[candidate + length])
+            {
+                length++;
+            }
+
+            if (!putSequence(output, capacity, out, input + anchor, pos - anchor, pos - candidate, length))
+            {
+                return 0;
+            }
+            pos += length;
+            anchor = pos;
+
+            // Index inside the match too, so a run resumes matching right away
+            if (pos - 2 < matchStartLimit)
+            {
+                table[hashPosition(read32(input + pos - 2))] = static_cast<uint32_t>(pos - 2);
+            }
+        }
+    }
+
+    if (!putSequence(output, capacity, out, input + anchor, size - anchor, 0, 0))
+    {
+        return 0;
+    }
+    return out;
+}
+
+bool LzCodec::decompress(const BYTE *input, size_t size, BYTE *output, size_t expectedSize)
+{
+    size_t in = 0;
+    size_t out = 0;
+    while (in < size)
+    {
+        BYTE token = input[in++];
+
+        size_t literalCount = token >> 4;
+        if (literalCount == 15 && !getLength(input, size, in, literalCount, expectedSize))
+        {
+            return false;
+        }
+        if (literalCount > size - in || literalCount > expectedSize - out)
+        {
+            return false;
+        }
+        if (literalCount > 0)
+            memcpy(output + out, input + in, literalCount);
+        in += literalCount;
+        out += literalCount;
+        if (in == size)
+        {
+            break;
+        }
+
+        if (size - in < 2)
+        {
+            return false;
+        }
+        size_t offset = input[in] | (static_cast<size_t>(input[in + 1]) << 8);
+        in += 2;
+        size_t length = token & 0x0f;
+        if (length == 15 && !getLength(input, size, in, length, expectedSize))
+        {
+            return false;
+        }
+        length += MIN_MATCH;
+        if (offset == 0 || offset > out || length > expectedSize - out)
+        {
+            return false;
+        }
+
+        // Overlapping matches repeat the last `offset` bytes
+        const BYTE *match = output + out - offset;
+        if (offset >= length)
+        {
+            memcpy(output + out, match, length);
+        }
+        else
+        {
+            for (size_t i = 0; i < length; i++)
+            {
+                output[out + i] = match[i];
+            }
+        }
+        out += length;
+    }
+    return out == expectedSize;
+}
+
+bool LzCodec::looksCompressible(const BYTE *data, size_t size)
+{
+    uint32_t counts[256] = {};
+    size_t sampled = 0;
+    if (size <= SAMPLE_COUNT * SAMPLE_SIZE)
+    {
+        for (size_t i = 0; i < size; i++)
+            counts[data[i]]++;
+        sampled = size;
+    }
+    else
+    {
+        size_t stride = (size - SAMPLE_SIZE) / (SAMPLE_COUNT - 1);
+        for (size_t s = 0; s < SAMPLE_COUNT; s++)
+        {
+            const BYTE *sample = data + s * stride;
+            for (size_t i = 0; i < SAMPLE_SIZE; i++)
+                counts[sample[i]]++;
+        }
+        sampled = SAMPLE_COUNT * SAMPLE_SIZE;
+    }
+    if (sampled == 0)
+    {
+        return false;
+    }
+
+    double entropy = 0;
+    for (uint32_t count : counts)
+    {
+        if (count > 0)
+        {
+            double p = static_cast<double>(count) / sampled;
+            entropy -= p * std::log2(p);
+        }
+    }
+    return entropy < INCOMPRESSIBLE_ENTROPY;
+}
@@ -0,0 +1,38 @@
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <windows.h>
+#include <cstddef>
+#include <cstdint>
+
+// Byte-oriented LZ77 codec in the LZ4 block format: each sequence is a token
+// (literal count in the high nibble, match length - 4 in the low nibble),
+// optional length extension bytes, the literals, a 16-bit little-endian
+// offset and the match length extension. The last sequence has literals only.
+// Greedy single-probe matching keeps it at memory speed, which matters more
+// here than ratio since every chunk is compressed on the crypto workers.
+class LzCodec
+{
+public:
+    static const size_t MIN_MATCH = 4;
+    static const size_t MAX_OFFSET = 65535;
+
+    // Above this order-0 entropy (bits per byte) a sample is treated as
+    // already compressed: media, archives, ciphertext
+    static constexpr double INCOMPRESSIBLE_ENTROPY = 7.5;
+
+    // Compresses `size` bytes into at most `capacity` bytes. Returns the
+    // compressed size, or 0 when the output would not fit; callers pass a
+    // capacity below `size` to give up on data that would not shrink.
+    static size_t compress(const BYTE *input, size_t size, BYTE *output, size_t capacity);
+
+    // False unless the input decodes to exactly `expectedSize` bytes; never
+    // reads or writes outside either buffer
+    static bool decompress(const BYTE *input, size_t size, BYTE *output, size_t expectedSize);
+
+    // Cheap probe before compress(): order-0 entropy of a few spread-out
+    // samples, a few KB regardless of the chunk size
+    static bool looksCompressible(const BYTE *data, size_t size);
+};
+
+#endif
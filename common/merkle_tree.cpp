@@ -0,0 +1,437 @@
+#include "merkle_tree.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CRC_X86 1
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define SSE42_TARGET __attribute__((target("sse4.2")))
+#else
+#define SSE42_TARGET
+#endif
+
+namespace
+{
+    typedef uint32_t (*CrcKernel)(uint32_t crc, const BYTE *data, size_t size);
+
+    const uint32_t POLYNOMIAL = 0x82F63B78; // Castagnoli, bit-reversed
+
+    // crc32 has a three-cycle latency but issues every cycle, so three
+    // independent lanes keep the unit busy; they are merged with a
+    // precomputed shift over one lane's length
+    const size_t LANE_SIZE = 16 * 1024;
+
+    // GF(2) linear map on a CRC register: column i is the image of bit i
+    struct CrcOperator
+    {
+        uint32_t columns[32];
+
+        uint32_t apply(uint32_t value) const
+        {
+            uint32_t result = 0;
+            for (int i = 0; value != 0; i++, value >>= 1)
+            {
+                if (value & 1)
+                    result ^= columns[i];
+            }
+            return result;
+        }
+
+        // The map `other` followed by this one
+        CrcOperator after(const CrcOperator &other) const
+        {
+            CrcOperator result;
+            for (int i = 0; i < 32; i++)
+                result.columns[i] = apply(other.columns[i]);
+            return result;
+        }
+
+        // Feeding `size` zero bytes through the register
+        static CrcOperator zeros(uint64_t size)
+        {
+            CrcOperator bit;
+            bit.columns[0] = POLYNOMIAL;
+            for (int i = 1; i < 32; i++)
+                bit.columns[i] = 1u << (i - 1);
+            CrcOperator power = bit.after(bit);
+            power = power.after(power);
+            power = power.after(power); // one byte
+
+            CrcOperator result;
+            for (int i = 0; i < 32; i++)
+                result.columns[i] = 1u << i;
+            for (; size != 0; size >>= 1)
+            {
+                if (size & 1)
+                    result = power.after(result);
+                power = power.after(power);
+            }
+            return result;
+        }
+    };
+
+    // Slicing-by-8: table k advances a byte that sits k bytes before the end
+    struct SlicingTables
+    {
+        uint32_t entries[8][256];
+
+        SlicingTables()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++)
+                    crc = (crc >> 1) ^ (crc & 1 ? POLYNOMIAL : 0);
+                entries[0][i] = crc;
+            }
+            for (int k = 1; k < 8; k++)
+            {
+                for (uint32_t i = 0; i < 256; i++)
+                    entries[k][i] = (entries[k - 1][i] >> 8) ^ entries[0][entries[k - 1][i] & 0xff];
+            }
+        }
+    };
+
+    const SlicingTables &slicingTables()
+    {
+        static const SlicingTables tables;
+        return tables;
+    }
+
+    uint32_t crcPortable(uint32_t crc, const BYTE *data, size_t size)
+    {
+        const auto &t = slicingTables().entries;
+        for (; size > 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0; size--)
+            crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+        for (; size >= 8; data += 8, size -= 8)
+        {
+            // Little-endian words, as everywhere on the wire
+            uint32_t low, high;
+            memcpy(&low, data, sizeof(low));
+            memcpy(&high, data + 4, sizeof(high));
+            low ^= crc;
+            crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+                  t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+        }
+        for (; size > 0; size--)
+            crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+        return crc;
+    }
+
+#if defined(CRC_X86)
+    SSE42_TARGET uint32_t crcSse42(uint32_t crc, const BYTE *data, size_t size)
+    {
+        for (; size > 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0; size--)
+            crc = _mm_crc32_u8(crc, *data++);
+#if defined(__x86_64__) || defined(_M_X64)
+        static const CrcOperator laneShift = CrcOperator::zeros(LANE_SIZE);
+        for (; size >= 3 * LANE_SIZE; data += 3 * LANE_SIZE, size -= 3 * LANE_SIZE)
+        {
+            // The second and third lanes start from a zero register; by
+            // linearity the shifted earlier lanes just XOR in
+            uint64_t a = crc, b = 0, c = 0;
+            for (size_t i = 0; i < LANE_SIZE; i += 8)
+            {
+                uint64_t wa, wb, wc;
+                memcpy(&wa, data + i, 8);
+                memcpy(&wb, data + LANE_SIZE + i, 8);
+                memcpy(&wc, data + 2 * LANE_SIZE + i, 8);
+                a = _mm_crc32_u64(a, wa);
+                b = _mm_crc32_u64(b, wb);
+                c = _mm_crc32_u64(c, wc);
+            }
+            crc = laneShift.apply(laneShift.apply(static_cast<uint32_t>(a)) ^ static_cast<uint32_t>(b)) ^ static_cast<uint32_t>(c);
+        }
+        uint64_t wide = crc;
+        for (; size >= 8; data += 8, size -= 8)
+        {
+            uint64_t word;
+            memcpy(&word, data, 8);
+            wide = _mm_crc32_u64(wide, word);
+        }
+        crc = static_cast<uint32_t>(wide);
+#endif
+        for (; size >= 4; data += 4, size -= 4)
+        {
+            uint32_t word;
+            memcpy(&word, data, 4);
+            crc = _mm_crc32_u32(crc, word);
+        }
+        for (; size > 0; size--)
+            crc = _mm_crc32_u8(crc, *data++);
+        return crc;
+    }
+#endif
+
+    bool cpuHasSse42()
+    {
+#if defined(CRC_X86)
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0; // CPUID.1:ECX.SSE4_2
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2");
+#endif
+#else
+        return false;
+#endif
+    }
+
+    CrcKernel activeKernel()
+    {
+#if defined(CRC_X86)
+        static const CrcKernel kernel = cpuHasSse42() ? crcSse42 : crcPortable;
+        return kernel;
+#else
+        return crcPortable;
+#endif
+    }
+
+    uint32_t runKernel(CrcKernel kernel, const BYTE *data, size_t size, uint32_t crc = 0)
+    {
+        return ~kernel(~crc, data, size);
+    }
+
+    uint32_t nodeDigest(uint32_t left, uint32_t right)
+    {
+        BYTE children[2 * MerkleTree::DIGEST_SIZE];
+        memcpy(children, &left, sizeof(left));
+        memcpy(children + sizeof(left), &right, sizeof(right));
+        return Crc32c::compute(children, sizeof(children));
+    }
+
+    // Size of the left subtree of a range of `count` > 1 leaves
+    size_t splitPoint(size_t count)
+    {
+        size_t left = 1;
+        while (left * 2 < count)
+            left *= 2;
+        return left;
+    }
+}
+
+uint32_t Crc32c::compute(const BYTE *data, size_t size, uint32_t crc)
+{
+    return runKernel(activeKernel(), data, size, crc);
+}
+
+uint32_t Crc32c::combine(uint32_t crcA, uint32_t crcB, uint64_t sizeB)
+{
+    // The pre- and post-inversions cancel, so A's checksum only needs
+    // shifting past B's length
+    return CrcOperator::zeros(sizeB).apply(crcA) ^ crcB;
+}
+
+uint32_t Crc32c::zeros(uint64_t size, uint32_t crc)
+{
+    return ~CrcOperator::zeros(size).apply(~crc);
+}
+
+bool Crc32c::hardwareAccelerated()
+{
+    return activeKernel() != crcPortable;
+}
+
+const char *Crc32c::implementationName()
+{
+    return hardwareAccelerated() ? "SSE4.2" : "portable";
+}
+
+bool Crc32c::selfTest()
+{
+    // "123456789" and the RFC 3720 B.4 iSCSI examples
+    BYTE zeros[32] = {};
+    BYTE ones[32];
+    BYTE ascending[32];
+    BYTE descending[32];
+    for (int i = 0; i < 32; i++)
+    {
+        ones[i] = 0xff;
+        ascending[i] = static_cast<BYTE>(i);
+        descending[i] = static_cast<BYTE>(31 - i);
+    }
+    struct KnownAnswer
+    {
+        const BYTE *data;
+        size_t size;
+        uint32_t crc;
+    };
+    const KnownAnswer knownAnswers[] = {
+        {(const BYTE *)"123456789", 9, 0xE3069283},
+        {zeros, sizeof(zeros), 0x8A9136AA},
+        {ones, sizeof(ones), 0x62A8AB43},
+        {ascending, sizeof(ascending), 0x46DD794E},
+        {descending, sizeof(descending), 0x113FDB5C},
+    };
+
+    std::vector<CrcKernel> kernels(1, crcPortable);
+#if defined(CRC_X86)
+    if (cpuHasSse42())
+        kernels.push_back(crcSse42);
+#endif
+
+    // Long enough for the interleaved lanes, at an odd start
+    std::vector<BYTE> buffer(3 * 3 * LANE_SIZE + 101);
+    uint32_t state = 0x9E3779B9;
+    for (BYTE &b : buffer)
+    {
+        state = state * 1664525 + 1013904223;
+        b = static_cast<BYTE>(state >> 24);
+    }
+    const BYTE *data = buffer.data() + 1;
+    size_t size = buffer.size() - 1;
+    uint32_t reference = runKernel(crcPortable, data, size);
+
+    for (CrcKernel kernel : kernels)
+    {
+        for (const KnownAnswer &answer : knownAnswers)
+        {
+            if (runKernel(kernel, answer.data, answer.size) != answer.crc)
+                return false;
+        }
+        if (runKernel(kernel, data, size) != reference)
+            return false;
+        size_t split = size / 3 + 7;
+        uint32_t head = runKernel(kernel, data, split);
+        if (runKernel(kernel, data + split, size - split, head) != reference ||
+            combine(head, runKernel(kernel, data + split, size - split), size - split) != reference)
+            return false;
+    }
+    return Crc32c::zeros(sizeof(zeros)) == 0x8A9136AA && Crc32c::zeros(sizeof(zeros), reference) == compute(zeros, sizeof(zeros), reference);
+}
+
+MerkleTree::MerkleTree(uint64_t fileSize)
+    : size(0)
+{
+    reset(fileSize);
+}
+
+void MerkleTree::reset(uint64_t fileSize)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size = fileSize;
+    digests.assign(leafCountFor(fileSize), 0);
+    settled.assign(digests.size(), 0);
+    pending.clear();
+}
+
+size_t MerkleTree::leafCountFor(uint64_t fileSize)
+{
+    return static_cast<size_t>((fileSize + LEAF_SIZE - 1) / LEAF_SIZE);
+}
+
+uint64_t MerkleTree::leafSize(size_t index) const
+{
+    return std::min<uint64_t>(LEAF_SIZE, size - static_cast<uint64_t>(index) * LEAF_SIZE);
+}
+
+void MerkleTree::add(uint64_t offset, const BYTE *data, size_t length)
+{
+    while (length > 0)
+    {
+        size_t index = static_cast<size_t>(offset / LEAF_SIZE);
+        uint64_t leafStart = static_cast<uint64_t>(index) * LEAF_SIZE;
+        size_t part = static_cast<size_t>(std::min<uint64_t>(length, leafStart + LEAF_SIZE - offset));
+        // Hash outside the lock; only the bookkeeping is shared
+        addPiece(index, offset, part, Crc32c::compute(data, part));
+        offset += part;
+        data += part;
+        length -= part;
+    }
+}
+
+void MerkleTree::addZeros(uint64_t offset, uint64_t length)
+{
+    // Every whole leaf of a hole has the same digest
+    uint32_t fullLeaf = Crc32c::zeros(LEAF_SIZE);
+    while (length > 0)
+    {
+        size_t index = static_cast<size_t>(offset / LEAF_SIZE);
+        uint64_t leafStart = static_cast<uint64_t>(index) * LEAF_SIZE;
+        uint64_t part = std::min<uint64_t>(length, leafStart + LEAF_SIZE - offset);
+        addPiece(index, offset, part, part == LEAF_SIZE ? fullLeaf : Crc32c::zeros(part));
+        offset += part;
+        length -= part;
+    }
+}
+
+void MerkleTree::addPiece(size_t index, uint64_t offset, uint64_t part, uint32_t crc)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (index >= digests.size() || settled[index])
+    {
+        return;
+    }
+
+    uint64_t leafStart = static_cast<uint64_t>(index) * LEAF_SIZE;
+    uint64_t fullSize = leafSize(index);
+    if (offset == leafStart && part == fullSize)
+    {
+        digests[index] = crc;
+        settled[index] = 1;
+        return;
+    }
+
+    std::vector<Piece> &pieces = pending[index];
+    pieces.push_back({offset, part, crc});
+    uint64_t covered = 0;
+    for (const Piece &piece : pieces)
+        covered += piece.size;
+    if (covered >= fullSize)
+    {
+        // Overlapping pieces leave the leaf unsettled, which fails verification
+        settled[index] = foldPieces(pieces, leafStart, leafStart + fullSize, digests[index]) ? 1 : 0;
+        if (settled[index])
+            pending.erase(index);
+    }
+}
+
+bool MerkleTree::foldPieces(std::vector<Piece> pieces, uint64_t start, uint64_t end, uint32_t &crc)
+{
+    std::sort(pieces.begin(), pieces.end(), [](const Piece &a, const Piece &b) { return a.offset < b.offset; });
+    uint64_t position = start;
+    for (const Piece &piece : pieces)
+    {
+        if (position == end)
+            break;
+        if (piece.offset != position || piece.size > end - position)
+            return false;
+        crc = position == start ? piece.crc : Crc32c::combine(crc, piece.crc, piece.size);
+        position += piece.size;
+    }
+    return position == end;
+}
+
+bool MerkleTree::isComplete() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::find(settled.begin(), settled.end(), 0) == settled.end();
+}
+
+std::vector<uint32_t> MerkleTree::leaves() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return digests;
+}
+
+uint32_t MerkleTree::rootOf(const uint32_t *leaves, size_t count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    if (count == 1)
+    {
+        return leaves[0];
+    }
+    size_t left = splitPoint(count);
+    return nodeDigest(rootOf(leaves, left), rootOf(leaves + left, count - left));
+}
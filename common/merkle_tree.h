@@ -0,0 +1,90 @@
+#ifndef MERKLE_TREE_H
+#define MERKLE_TREE_H
+
+#include <windows.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+// CRC-32C (Castagnoli), as in iSCSI and ext4. Uses the SSE4.2 crc32
+// instruction when the CPU has it, picked once at runtime, and a
+// slicing-by-8 table otherwise.
+class Crc32c
+{
+public:
+    // Continues `crc`, the checksum of whatever came before `data`
+    static uint32_t compute(const BYTE *data, size_t size, uint32_t crc = 0);
+
+    // Checksum of A followed by B from the checksums of A and B and the
+    // length of B, without touching the data
+    static uint32_t combine(uint32_t crcA, uint32_t crcB, uint64_t sizeB);
+
+    // Continues `crc` over `size` zero bytes in O(log size), for file holes
+    static uint32_t zeros(uint64_t size, uint32_t crc = 0);
+
+    static bool hardwareAccelerated();
+    static const char *implementationName();
+
+    // Known answers against every available implementation
+    static bool selfTest();
+};
+
+// Checksum tree over a file cut into LEAF_SIZE leaves, the last one possibly
+// short. Each leaf digest is the CRC-32C of its bytes; a node is the CRC-32C
+// of its two children's digests. As in RFC 6962 a range of n > 1 leaves
+// splits at the largest power of two below n.
+//
+// Digests catch corruption, not tampering: CRC is linear, so anyone who can
+// alter the data can also fix up the checksums. Authentication stays with the
+// channel.
+class MerkleTree
+{
+public:
+    static const uint32_t LEAF_SIZE = 1024 * 1024;
+    static const size_t DIGEST_SIZE = sizeof(uint32_t);
+
+    explicit MerkleTree(uint64_t fileSize = 0);
+    void reset(uint64_t fileSize);
+
+    uint64_t fileSize() const { return size; }
+    size_t leafCount() const { return digests.size(); }
+    static size_t leafCountFor(uint64_t fileSize);
+
+    // Hashes file bytes [offset, offset + size). Ranges may arrive in any
+    // order and from several threads at once, but must not overlap; a leaf's
+    // digest is settled once its last byte arrives.
+    void add(uint64_t offset, const BYTE *data, size_t size);
+    // As add() for `size` zero bytes, without reading or hashing any
+    void addZeros(uint64_t offset, uint64_t size);
+
+    bool isComplete() const;
+    // Digests of every leaf; only meaningful once the tree is complete
+    std::vector<uint32_t> leaves() const;
+
+    static uint32_t rootOf(const uint32_t *leaves, size_t count);
+
+private:
+    struct Piece
+    {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t crc;
+    };
+
+    mutable std::mutex mutex;
+    uint64_t size;
+    std::vector<uint32_t> digests;
+    std::vector<BYTE> settled;
+    // Leaves that have some but not all of their bytes
+    std::unordered_map<size_t, std::vector<Piece>> pending;
+
+    uint64_t leafSize(size_t index) const;
+    // Records the checksum of leaf bytes [offset, offset + part)
+    void addPiece(size_t index, uint64_t offset, uint64_t part, uint32_t crc);
+    // Folds the pieces of a leaf in offset order; false on a gap before `end`
+    static bool foldPieces(std::vector<Piece> pieces, uint64_t start, uint64_t end, uint32_t &crc);
+};
+
+#endif
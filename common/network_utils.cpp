@@ -1,4 +1,9 @@
 #include "network_utils.h"
+#include "io_engine.h"
+#include "logger.h"
+#include <mstcpip.h>
+#include <mswsock.h>
+#include <cstring>
 
 bool NetworkUtils::initialize()
 {
@@ -6,7 +11,7 @@ bool NetworkUtils::initialize()
     int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
     if (result != 0)
     {
-        std::cout << "WSAStartup failed with error: " << result << std::endl;
+        NetworkUtils::printMessage("ERROR", "WSAStartup failed with error: " + std::to_string(result));
         return false;
     }
     return true;
@@ -17,115 +22,302 @@ void NetworkUtils::cleanup()
     WSACleanup();
 }
 
-bool NetworkUtils::sendData(SOCKET socket, const std::vector<BYTE> &data)
+void NetworkUtils::configureSocket(SOCKET socket)
 {
-    // First send the size of the data
-    uint32_t size = static_cast<uint32_t>(data.size());
-    int sent = send(socket, reinterpret_cast<const char *>(&size), sizeof(size), 0);
+    // Frames leave in a single gather write, so Nagle only adds delayed-ACK stalls
+    BOOL noDelay = TRUE;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&noDelay), sizeof(noDelay));
+}
 
-    if (sent != sizeof(size))
+SOCKET NetworkUtils::createSocket()
+{
+    if (SendEngine::getBackend() != IoBackend::Blocking)
     {
-        int error = WSAGetLastError();
-        std::cout << "Failed to send data size. Error: " << getSocketErrorString(error) << std::endl;
-        return false;
+        // Registered I/O must be requested when the socket is created
+        SOCKET socket = WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, NULL, 0, WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO);
+        if (socket != INVALID_SOCKET)
+        {
+            return socket;
+        }
+    }
+    return WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, NULL, 0, WSA_FLAG_OVERLAPPED);
+}
+
+static bool sendBuffers(SOCKET socket, WSABUF *buffers, DWORD count)
+{
+    while (count > 0)
+    {
+        DWORD sent = 0;
+        if (WSASend(socket, buffers, count, &sent, 0, NULL, NULL) == SOCKET_ERROR)
+        {
+            int error = WSAGetLastError();
+            NetworkUtils::printMessage("ERROR", "Failed to send data. Error: " + NetworkUtils::getSocketErrorString(error));
+            return false;
+        }
+
+        // Skip what went out and resume mid-buffer on a partial write
+        while (count > 0 && sent >= buffers->len)
+        {
+            sent -= buffers->len;
+            buffers++;
+            count--;
+        }
+        if (count > 0)
+        {
+            buffers->buf += sent;
+            buffers->len -= sent;
+        }
     }
+    return true;
+}
+
+bool NetworkUtils::sendData(SOCKET socket, const std::vector<BYTE> &data)
+{
+    FrameView frame = {data.data(), data.size()};
+    return sendFrames(socket, &frame, 1);
+}
+
+bool NetworkUtils::sendFrames(SOCKET socket, const FrameView *frames, size_t count)
+{
+    const size_t MAX_BATCH = 32;
+    uint32_t sizes[MAX_BATCH];
+    WSABUF buffers[2 * MAX_BATCH];
 
-    // Then send the actual data
-    if (!data.empty())
+    for (size_t first = 0; first < count; first += MAX_BATCH)
     {
-        size_t totalSent = 0;
-        while (totalSent < data.size())
+        size_t batch = count - first < MAX_BATCH ? count - first : MAX_BATCH;
+        DWORD bufferCount = 0;
+
+        for (size_t i = 0; i < batch; i++)
         {
-            sent = send(socket,
-                        reinterpret_cast<const char *>(data.data() + totalSent),
-                        static_cast<int>(data.size() - totalSent),
-                        0);
+            const FrameView &frame = frames[first + i];
+            sizes[i] = static_cast<uint32_t>(frame.size);
+            buffers[bufferCount].buf = reinterpret_cast<char *>(&sizes[i]);
+            buffers[bufferCount].len = sizeof(uint32_t);
+            bufferCount++;
 
-            if (sent == SOCKET_ERROR)
+            if (frame.size > 0)
             {
-                int error = WSAGetLastError();
-                std::cout << "Failed to send data. Error: " << getSocketErrorString(error) << std::endl;
-                return false;
+                buffers[bufferCount].buf = reinterpret_cast<char *>(const_cast<BYTE *>(frame.data));
+                buffers[bufferCount].len = static_cast<ULONG>(frame.size);
+                bufferCount++;
             }
-            totalSent += sent;
         }
-    }
 
+        if (!sendBuffers(socket, buffers, bufferCount))
+        {
+            return false;
+        }
+    }
     return true;
 }
 
-bool NetworkUtils::receiveData(SOCKET socket, std::vector<BYTE> &data)
+bool NetworkUtils::sendFileFrame(SOCKET socket, HANDLE file, uint64_t offset, uint32_t size, const FrameView *frames, size_t count)
 {
-    // First receive the size of the data
-    uint32_t size = 0;
-    int received = recv(socket, reinterpret_cast<char *>(&size), sizeof(size), 0);
+    // Leading frames and the file frame's length prefix travel as the head buffer
+    std::vector<BYTE> head;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t frameSize = static_cast<uint32_t>(frames[i].size);
+        head.insert(head.end(), (const BYTE *)&frameSize, (const BYTE *)&frameSize + sizeof(frameSize));
+        head.insert(head.end(), frames[i].data, frames[i].data + frames[i].size);
+    }
+    head.insert(head.end(), (const BYTE *)&size, (const BYTE *)&size + sizeof(size));
+
+    // Without an OVERLAPPED the call is synchronous and reads from the file
+    // pointer; it also queues no completion on a socket bound to a port
+    LARGE_INTEGER position;
+    position.QuadPart = static_cast<LONGLONG>(offset);
+    if (!SetFilePointerEx(file, position, NULL, FILE_BEGIN))
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to seek file for transmit. Error: " + std::to_string(GetLastError()));
+        return false;
+    }
 
-    if (received != sizeof(size))
+    TRANSMIT_FILE_BUFFERS buffers = {};
+    buffers.Head = head.data();
+    buffers.HeadLength = static_cast<DWORD>(head.size());
+    if (!TransmitFile(socket, file, size, 0, NULL, &buffers, 0))
     {
+        int error = WSAGetLastError();
+        NetworkUtils::printMessage("ERROR", "Failed to transmit file data. Error: " + NetworkUtils::getSocketErrorString(error));
+        return false;
+    }
+    return true;
+}
+
+// Receives exactly `size` bytes; a bare recv may return a partial read
+static bool receiveAll(SOCKET socket, BYTE *dest, size_t size, uint64_t *recvCalls = nullptr)
+{
+    size_t totalReceived = 0;
+    while (totalReceived < size)
+    {
+        int received = recv(socket,
+                            reinterpret_cast<char *>(dest + totalReceived),
+                            static_cast<int>(size - totalReceived),
+                            0);
+        if (recvCalls)
+            (*recvCalls)++;
+
         if (received == 0)
         {
-            std::cout << "Connection gracefully closed by peer" << std::endl;
+            NetworkUtils::printMessage("NETWORK", totalReceived == 0 ? "Connection gracefully closed by peer" : "Connection closed during data transfer");
+            return false;
         }
-        else if (received == SOCKET_ERROR)
+        if (received == SOCKET_ERROR)
         {
             int error = WSAGetLastError();
-            std::cout << "Failed to receive data size. Error: " << getSocketErrorString(error) << std::endl;
+            NetworkUtils::printMessage("ERROR", "Failed to receive data. Error: " + NetworkUtils::getSocketErrorString(error));
+            return false;
         }
+        totalReceived += received;
+    }
+    return true;
+}
+
+bool NetworkUtils::receiveData(SOCKET socket, std::vector<BYTE> &data)
+{
+    // First receive the size of the data
+    uint32_t size = 0;
+    if (!receiveAll(socket, reinterpret_cast<BYTE *>(&size), sizeof(size)))
+    {
         return false;
     }
 
     // Check for reasonable size to prevent memory exhaustion
-    if (size > 100 * 1024 * 1024)
-    { // 100MB limit
-        std::cout << "Data size too large: " << size << " bytes" << std::endl;
+    if (size > MAX_FRAME_SIZE)
+    {
+        NetworkUtils::printMessage("ERROR", "Data size too large: " + std::to_string(size) + " bytes");
         return false;
     }
 
     // Receive the actual data
     data.resize(size);
-    if (size > 0)
+    return receiveAll(socket, data.data(), size);
+}
+
+FrameReader::FrameReader(SOCKET socket, size_t capacity)
+    : socket(socket), buffer(capacity), head(0), tail(0), recvCalls(0)
+{
+}
+
+FrameReader::~FrameReader() = default;
+
+SendEngine &FrameReader::sendEngine()
+{
+    if (!engine)
+    {
+        engine = SendEngine::create(socket);
+    }
+    return *engine;
+}
+
+bool FrameReader::fill(size_t needed)
+{
+    if (tail - head >= needed)
     {
-        size_t totalReceived = 0;
-        while (totalReceived < size)
+        return true;
+    }
+
+    // Make room: slide unread bytes to the front, grow only for oversized frames
+    if (head + needed > buffer.size())
+    {
+        memmove(buffer.data(), buffer.data() + head, tail - head);
+        tail -= head;
+        head = 0;
+        if (needed > buffer.size())
         {
-            received = recv(socket,
-                            reinterpret_cast<char *>(data.data() + totalReceived),
-                            static_cast<int>(size - totalReceived),
+            buffer.resize(needed);
+        }
+    }
+
+    while (tail - head < needed)
+    {
+        int received = recv(socket,
+                            reinterpret_cast<char *>(buffer.data() + tail),
+                            static_cast<int>(buffer.size() - tail),
                             0);
+        recvCalls++;
 
-            if (received == 0)
-            {
-                std::cout << "Connection closed during data transfer" << std::endl;
-                return false;
-            }
-            if (received == SOCKET_ERROR)
-            {
-                int error = WSAGetLastError();
-                std::cout << "Failed to receive data. Error: " << getSocketErrorString(error) << std::endl;
-                return false;
-            }
-            totalReceived += received;
+        if (received == 0)
+        {
+            NetworkUtils::printMessage("NETWORK", tail == head ? "Connection gracefully closed by peer" : "Connection closed during data transfer");
+            return false;
+        }
+        if (received == SOCKET_ERROR)
+        {
+            int error = WSAGetLastError();
+            NetworkUtils::printMessage("ERROR", "Failed to receive data. Error: " + NetworkUtils::getSocketErrorString(error));
+            return false;
         }
+        tail += received;
     }
+    return true;
+}
 
+bool FrameReader::readFrameSize(uint32_t &size)
+{
+    if (!fill(sizeof(size)))
+    {
+        return false;
+    }
+    memcpy(&size, buffer.data() + head, sizeof(size));
+    head += sizeof(size);
+
+    if (size > NetworkUtils::MAX_FRAME_SIZE)
+    {
+        NetworkUtils::printMessage("ERROR", "Data size too large: " + std::to_string(size) + " bytes");
+        return false;
+    }
     return true;
 }
 
-std::string NetworkUtils::getTimestamp()
+bool FrameReader::next(FrameView &frame)
 {
-    auto now = std::chrono::system_clock::now();
-    auto time_t = std::chrono::system_clock::to_time_t(now);
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
+    uint32_t size = 0;
+    if (!readFrameSize(size) || !fill(size))
+    {
+        return false;
+    }
 
-    std::stringstream ss;
-    ss << std::put_time(std::localtime(&time_t), "%H:%M:%S");
-    ss << "." << std::setfill('0') << std::setw(3) << ms.count();
-    return ss.str();
+    frame.data = buffer.data() + head;
+    frame.size = size;
+    head += size;
+    return true;
+}
+
+bool FrameReader::next(std::vector<BYTE> &data)
+{
+    uint32_t size = 0;
+    if (!readFrameSize(size))
+    {
+        return false;
+    }
+    data.resize(size);
+
+    // Small frames are coalesced through the buffer; large ones take what is
+    // buffered and receive the remainder directly into the destination
+    if (size <= buffer.size() / 2)
+    {
+        if (!fill(size))
+        {
+            return false;
+        }
+        memcpy(data.data(), buffer.data() + head, size);
+        head += size;
+        return true;
+    }
+
+    size_t buffered = tail - head < size ? tail - head : size;
+    memcpy(data.data(), buffer.data() + head, buffered);
+    head += buffered;
+    return receiveAll(socket, data.data() + buffered, size - buffered, &recvCalls);
 }
 
 void NetworkUtils::printMessage(const std::string &type, const std::string &message)
 {
-    std::cout << "[" << getTimestamp() << "] " << type << ": " << message << std::endl;
+    LogLevel level = type == "ERROR" ? LogLevel::Error : type == "WARNING" ? LogLevel::Warning : LogLevel::Info;
+    Logger::log(level, type, message);
 }
 
 bool NetworkUtils::isSocketConnected(SOCKET socket)
@@ -147,6 +339,23 @@ bool NetworkUtils::isSocketConnected(SOCKET socket)
     return true;
 }
 
+uint64_t NetworkUtils::getRoundTripMicros(SOCKET socket)
+{
+#ifdef SIO_TCP_INFO
+    // Windows 10 1703+; older stacks reject the ioctl and we report 0
+    DWORD version = 0;
+    TCP_INFO_v0 info;
+    DWORD bytesReturned = 0;
+    if (WSAIoctl(socket, SIO_TCP_INFO, &version, sizeof(version), &info, sizeof(info), &bytesReturned, NULL, NULL) == 0)
+    {
+        return info.RttUs;
+    }
+#else
+    (void)socket;
+#endif
+    return 0;
+}
+
 int NetworkUtils::getLastSocketError()
 {
     return WSAGetLastError();
@@ -12,23 +12,87 @@
 #include <chrono>
 #include <iomanip>
 #include <sstream>
+#include <memory>
 
 #pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "mswsock.lib")
+
+class SendEngine;
+
+// Borrowed payload for one "DATA SIZE" frame
+struct FrameView
+{
+    const BYTE *data;
+    size_t size;
+};
 
 class NetworkUtils
 {
 public:
+    static const uint32_t MAX_FRAME_SIZE = 100 * 1024 * 1024;
+
     static bool initialize();
     static void cleanup();
+    static void configureSocket(SOCKET socket);
+    // TCP socket that can also carry Registered I/O unless the blocking
+    // backend was selected
+    static SOCKET createSocket();
     static bool sendData(SOCKET socket, const std::vector<BYTE> &data);
+    // Gather-writes header and payload of every frame with one WSASend per batch
+    static bool sendFrames(SOCKET socket, const FrameView *frames, size_t count);
+    // Sends `size` bytes of `file` at `offset` as one frame through TransmitFile,
+    // so the data goes from the file cache to the socket without a user-space
+    // copy. `frames` are sent ahead of it in the same call.
+    static bool sendFileFrame(SOCKET socket, HANDLE file, uint64_t offset, uint32_t size, const FrameView *frames = nullptr, size_t count = 0);
     static bool receiveData(SOCKET socket, std::vector<BYTE> &data);
-    static std::string getTimestamp();
+    // Queued on the asynchronous logger; "ERROR" and "WARNING" lines log at
+    // those levels, everything else at Info
     static void printMessage(const std::string &type, const std::string &message);
 
     // Helper functions for better error handling
     static std::string getSocketErrorString(int errorCode);
     static int getLastSocketError();
     static bool isSocketConnected(SOCKET socket);
+    static uint64_t getRoundTripMicros(SOCKET socket); // 0 when the stack cannot report it
+};
+
+// Per-connection buffered frame reader. Reads large blocks from the socket
+// and hands out frames from its receive buffer, so many small frames cost one
+// recv. Because it may read ahead, every read on a connection must go through
+// the same reader for the connection's lifetime.
+class FrameReader
+{
+public:
+    static const size_t DEFAULT_CAPACITY = 256 * 1024;
+
+    explicit FrameReader(SOCKET socket, size_t capacity = DEFAULT_CAPACITY);
+    ~FrameReader();
+    FrameReader(const FrameReader &) = delete;
+    FrameReader &operator=(const FrameReader &) = delete;
+
+    // View into the receive buffer, valid until the next call
+    bool next(FrameView &frame);
+    // Payload copied into caller-owned storage; large payloads skip the buffer
+    // and are received straight into `data`, which keeps its capacity
+    bool next(std::vector<BYTE> &data);
+
+    SOCKET getSocket() const { return socket; }
+    uint64_t getRecvCalls() const { return recvCalls; }
+
+    // Bulk-data sender for the same connection, created on first use and
+    // kept for the connection's lifetime
+    SendEngine &sendEngine();
+
+private:
+    SOCKET socket;
+    std::vector<BYTE> buffer;
+    size_t head; // first unread byte
+    size_t tail; // one past the last received byte
+    uint64_t recvCalls;
+    std::unique_ptr<SendEngine> engine;
+
+    bool fill(size_t needed);
+    bool readFrameSize(uint32_t &size);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,474 @@
+#include "ranged_transfer.h"
+#include "file_transfer.h"
+#include "transfer_journal.h"
+#include "file_io.h"
+#include "io_engine.h"
+#include "merkle_tree.h"
+#include "transfer_progress.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <cctype>
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    const size_t OFFSET_HEADER_SIZE = sizeof(uint64_t);
+}
+
+bool RangedTransfer::parseSpans(const std::string &text, std::vector<Span> &spans)
+{
+    spans.clear();
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ','))
+    {
+        item.erase(std::remove_if(item.begin(), item.end(), ::isspace), item.end());
+        if (item.empty())
+            continue;
+        try
+        {
+            size_t colon = item.find(':');
+            Span span;
+            if (item[0] == '-' && colon == std::string::npos)
+            {
+                span.length = std::stoull(item.substr(1));
+                span.offset = -static_cast<int64_t>(span.length);
+                if (span.length == 0)
+                    return false;
+            }
+            else if (colon != std::string::npos && item[0] != '-')
+            {
+                span.offset = static_cast<int64_t>(std::stoull(item.substr(0, colon)));
+                span.length = colon + 1 < item.size() ? std::stoull(item.substr(colon + 1)) : 0;
+                if (span.offset < 0 || (colon + 1 < item.size() && span.length == 0))
+                    return false;
+            }
+            else
+            {
+                return false;
+            }
+            spans.push_back(span);
+        }
+        catch (...)
+        {
+            return false;
+        }
+    }
+    if (spans.empty())
+    {
+        spans.push_back({0, 0});
+    }
+    return true;
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> RangedTransfer::resolveSpans(const std::vector<Span> &spans, uint64_t fileSize)
+{
+    std::vector<std::pair<uint64_t, uint64_t>> bounds;
+    for (const Span &span : spans)
+    {
+        // A tail is counted without negating INT64_MIN
+        uint64_t start = span.offset >= 0 ? std::min<uint64_t>(span.offset, fileSize)
+                                          : fileSize - std::min<uint64_t>(static_cast<uint64_t>(-(span.offset + 1)) + 1, fileSize);
+        uint64_t end = span.length == 0 ? fileSize : start + std::min(span.length, fileSize - start);
+        if (start < end)
+            bounds.push_back(std::make_pair(start, end));
+    }
+    std::sort(bounds.begin(), bounds.end());
+
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    for (const auto &range : bounds)
+    {
+        if (!ranges.empty() && ranges.back().first + ranges.back().second >= range.first)
+            ranges.back().second = std::max(ranges.back().first + ranges.back().second, range.second) - ranges.back().first;
+        else
+            ranges.push_back(std::make_pair(range.first, range.second - range.first));
+    }
+    return ranges;
+}
+
+bool RangedTransfer::sendRequest(FrameReader &stream, const CipherContext &cipher, uint64_t offset, uint64_t length)
+{
+    std::vector<BYTE> request((BYTE *)&offset, (BYTE *)&offset + sizeof(offset));
+    request.insert(request.end(), (BYTE *)&length, (BYTE *)&length + sizeof(length));
+    return NetworkUtils::sendData(stream.getSocket(), cipher.encryptMessage(request));
+}
+
+void RangedTransfer::abortStreams(const std::vector<FrameReader *> &streams)
+{
+    for (FrameReader *stream : streams)
+    {
+        shutdown(stream->getSocket(), SD_BOTH);
+    }
+}
+
+bool RangedTransfer::serve(const std::vector<FrameReader *> &streams, const CipherContext &cipher, const std::string &filePath)
+{
+    // Requests land anywhere in the file, so there is no readahead; streams
+    // without a mapping read their own handle
+    MappedFile mapped;
+    std::error_code ec;
+    uint64_t fileSize = mapped.open(filePath) ? mapped.size() : fs::file_size(filePath, ec);
+    if (ec)
+    {
+        NetworkUtils::printMessage("ERROR", "Cannot open file: " + filePath);
+        return false;
+    }
+
+    std::string fileName = fs::path(filePath).filename().string();
+    auto stamp = fs::last_write_time(filePath, ec);
+    uint64_t sourceStamp = ec ? 0 : static_cast<uint64_t>(stamp.time_since_epoch().count());
+    std::vector<BYTE> offer;
+    uint32_t nameSize = static_cast<uint32_t>(fileName.size());
+    offer.insert(offer.end(), (BYTE *)&nameSize, (BYTE *)&nameSize + sizeof(nameSize));
+    offer.insert(offer.end(), fileName.begin(), fileName.end());
+    offer.insert(offer.end(), (BYTE *)&fileSize, (BYTE *)&fileSize + sizeof(fileSize));
+    offer.insert(offer.end(), (BYTE *)&sourceStamp, (BYTE *)&sourceStamp + sizeof(sourceStamp));
+    uint64_t nonce = 0;
+    if (!NetworkUtils::sendData(streams[0]->getSocket(), cipher.encryptMessage(offer, &nonce)))
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to offer " + fileName);
+        return false;
+    }
+    NetworkUtils::printMessage("RANGES", "Serving ranges of " + fileName + " (" + std::to_string(fileSize) + " bytes) on " +
+                                             std::to_string(streams.size()) + " streams");
+
+    std::atomic<uint64_t> totalSent{0};
+    std::atomic<uint64_t> requestCount{0};
+    std::atomic<bool> failed{false};
+
+    auto serveStream = [&](size_t index)
+    {
+        FrameReader &reader = *streams[index];
+        SendEngine &engine = reader.sendEngine();
+        engine.begin(OFFSET_HEADER_SIZE + FRAME_SIZE);
+        std::ifstream file;
+        if (!mapped.isOpen())
+        {
+            file.open(filePath, std::ios::binary);
+        }
+        std::vector<BYTE> request;
+        std::vector<BYTE> frame;
+        frame.reserve(OFFSET_HEADER_SIZE + FRAME_SIZE);
+
+        while (!failed && (mapped.isOpen() || file.is_open()))
+        {
+            if (!reader.next(request) || !cipher.decryptMessage(request) || request.size() != REQUEST_SIZE)
+            {
+                NetworkUtils::printMessage("ERROR", "Bad range request on stream " + std::to_string(index));
+                break;
+            }
+            uint64_t offset = 0;
+            uint64_t length = 0;
+            memcpy(&offset, request.data(), sizeof(offset));
+            memcpy(&length, request.data() + sizeof(offset), sizeof(length));
+            if (length == 0)
+            {
+                if (!engine.end())
+                    break;
+                return;
+            }
+            if (length > PIECE_SIZE || offset > fileSize || length > fileSize - offset)
+            {
+                NetworkUtils::printMessage("ERROR", "Range " + std::to_string(offset) + "+" + std::to_string(length) + " is outside " + fileName);
+                break;
+            }
+
+            uint32_t crc = 0;
+            bool sent = true;
+            for (uint64_t position = offset; sent && position < offset + length; position += FRAME_SIZE)
+            {
+                size_t size = static_cast<size_t>(std::min<uint64_t>(FRAME_SIZE, offset + length - position));
+                frame.resize(OFFSET_HEADER_SIZE + size);
+                memcpy(frame.data(), &position, OFFSET_HEADER_SIZE);
+                BYTE *payload = frame.data() + OFFSET_HEADER_SIZE;
+                if (mapped.isOpen())
+                {
+                    crc = Crc32c::compute(mapped.data() + position, size, crc);
+                    cipher.process(mapped.data() + position, payload, size, nonce, FileTransfer::DATA_STREAM_OFFSET + position);
+                }
+                else
+                {
+                    file.seekg(position);
+                    file.read((char *)payload, size);
+                    if (static_cast<size_t>(file.gcount()) != size)
+                    {
+                        NetworkUtils::printMessage("ERROR", "Failed to read " + filePath + " at offset " + std::to_string(position));
+                        sent = false;
+                        break;
+                    }
+                    crc = Crc32c::compute(payload, size, crc);
+                    cipher.process(payload, size, nonce, FileTransfer::DATA_STREAM_OFFSET + position);
+                }
+                FrameView view = {frame.data(), frame.size()};
+                sent = engine.send(&view, 1);
+            }
+            std::vector<BYTE> trailer = cipher.encryptMessage(std::vector<BYTE>((BYTE *)&crc, (BYTE *)&crc + sizeof(crc)));
+            FrameView view = {trailer.data(), trailer.size()};
+            if (!sent || !engine.send(&view, 1))
+            {
+                NetworkUtils::printMessage("ERROR", "Failed to send range at " + std::to_string(offset) + " on stream " + std::to_string(index));
+                break;
+            }
+            totalSent += length;
+            requestCount++;
+        }
+
+        if (!failed.exchange(true))
+        {
+            abortStreams(streams);
+        }
+        engine.end();
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < streams.size(); i++)
+    {
+        threads.emplace_back(serveStream, i);
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    if (failed)
+    {
+        return false;
+    }
+    NetworkUtils::printMessage("SUCCESS", "Served " + std::to_string(totalSent.load()) + " bytes of " + fileName + " in " +
+                                              std::to_string(requestCount.load()) + " ranges");
+    return true;
+}
+
+bool RangedTransfer::receiveOffer(FrameReader &reader, const CipherContext &cipher, Offer &offer)
+{
+    std::vector<BYTE> message;
+    if (!reader.next(message) || !cipher.decryptMessage(message, &offer.nonce) || message.size() < sizeof(uint32_t))
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to receive range offer");
+        return false;
+    }
+    uint32_t nameSize = 0;
+    memcpy(&nameSize, message.data(), sizeof(nameSize));
+    if (message.size() != sizeof(nameSize) + nameSize + 2 * sizeof(uint64_t))
+    {
+        NetworkUtils::printMessage("ERROR", "Invalid range offer");
+        return false;
+    }
+    offer.fileName.assign(message.begin() + sizeof(nameSize), message.begin() + sizeof(nameSize) + nameSize);
+    memcpy(&offer.fileSize, message.data() + sizeof(nameSize) + nameSize, sizeof(offer.fileSize));
+    memcpy(&offer.stamp, message.data() + sizeof(nameSize) + nameSize + sizeof(uint64_t), sizeof(offer.stamp));
+
+    // The name becomes a local path
+    if (!FileTransfer::validFileName(offer.fileName))
+    {
+        NetworkUtils::printMessage("ERROR", "Refusing offered file name " + offer.fileName);
+        return false;
+    }
+    return true;
+}
+
+bool RangedTransfer::fetch(const std::vector<FrameReader *> &streams, const CipherContext &cipher, const Offer &offer, const std::vector<Span> &spans,
+                           const std::string &saveDir)
+{
+    fs::create_directories(saveDir);
+    std::string savePath = saveDir + "\\" + offer.fileName;
+    std::vector<std::pair<uint64_t, uint64_t>> wanted = resolveSpans(spans, offer.fileSize);
+
+    // Ranges fetched earlier from the same source are already in the part file
+    TransferJournal journal(savePath);
+    bool fresh = !journal.load(offer.fileSize, offer.stamp);
+    if (fresh)
+    {
+        journal.reset(offer.fileSize, offer.stamp);
+    }
+    std::vector<std::pair<uint64_t, uint64_t>> pieces;
+    uint64_t wantedBytes = 0;
+    uint64_t fetchBytes = 0;
+    for (const auto &range : wanted)
+    {
+        wantedBytes += range.second;
+        for (const auto &gap : journal.missing(range.first, range.first + range.second))
+        {
+            for (uint64_t offset = gap.first; offset < gap.first + gap.second; offset += PIECE_SIZE)
+            {
+                pieces.push_back(std::make_pair(offset, std::min<uint64_t>(PIECE_SIZE, gap.first + gap.second - offset)));
+                fetchBytes += pieces.back().second;
+            }
+        }
+    }
+
+    // A partial read leaves the rest of the file unallocated
+    FileWriter output;
+    bool opened = output.open(journal.getPartPath(), offer.fileSize, fresh, wantedBytes < offer.fileSize);
+    if (!opened || (fresh && !journal.save()))
+    {
+        NetworkUtils::printMessage("ERROR", "Cannot create " + journal.getPartPath());
+        for (FrameReader *stream : streams)
+        {
+            sendRequest(*stream, cipher, 0, 0);
+        }
+        return false;
+    }
+    NetworkUtils::printMessage("RANGES", "Fetching " + std::to_string(fetchBytes) + " of " + std::to_string(wantedBytes) + " wanted bytes of " +
+                                             offer.fileName + " in " + std::to_string(pieces.size()) + " pieces over " +
+                                             std::to_string(streams.size()) + " streams");
+
+    FlushPolicy flush = FileTransfer::getFlushPolicy();
+    std::mutex journalMutex;
+    uint64_t unjournaledBytes = 0;
+    std::atomic<size_t> nextPiece{0};
+    TransferProgress progress("Fetching " + offer.fileName + " (" + std::to_string(streams.size()) + " streams)", fetchBytes);
+    std::atomic<bool> failed{false};
+
+    // Each stream keeps a few requests outstanding, so the server never
+    // waits a round trip between pieces
+    auto fetchStream = [&](size_t index)
+    {
+        FrameReader &reader = *streams[index];
+        std::deque<std::pair<uint64_t, uint64_t>> inFlight;
+        std::vector<BYTE> frame;
+        frame.reserve(OFFSET_HEADER_SIZE + FRAME_SIZE);
+
+        while (!failed)
+        {
+            bool requested = true;
+            while (requested && inFlight.size() < REQUESTS_IN_FLIGHT)
+            {
+                size_t claimed = nextPiece++;
+                if (claimed >= pieces.size())
+                    break;
+                requested = sendRequest(reader, cipher, pieces[claimed].first, pieces[claimed].second);
+                inFlight.push_back(pieces[claimed]);
+            }
+            if (!requested)
+            {
+                NetworkUtils::printMessage("ERROR", "Failed to request a range on stream " + std::to_string(index));
+                break;
+            }
+            if (inFlight.empty())
+            {
+                if (sendRequest(reader, cipher, 0, 0))
+                    return;
+                break;
+            }
+
+            uint64_t offset = inFlight.front().first;
+            uint64_t end = offset + inFlight.front().second;
+            inFlight.pop_front();
+            uint32_t crc = 0;
+            bool ok = true;
+            for (uint64_t position = offset; ok && position < end; position += FRAME_SIZE)
+            {
+                size_t size = static_cast<size_t>(std::min<uint64_t>(FRAME_SIZE, end - position));
+                uint64_t frameOffset = 0;
+                ok = reader.next(frame) && frame.size() == OFFSET_HEADER_SIZE + size;
+                if (ok)
+                {
+                    memcpy(&frameOffset, frame.data(), OFFSET_HEADER_SIZE);
+                    ok = frameOffset == position;
+                }
+                if (ok)
+                {
+                    BYTE *data = frame.data() + OFFSET_HEADER_SIZE;
+                    cipher.process(data, size, offer.nonce, FileTransfer::DATA_STREAM_OFFSET + position);
+                    crc = Crc32c::compute(data, size, crc);
+                    ok = output.writeAt(position, data, size);
+                }
+            }
+            uint32_t expected = 0;
+            if (ok && (!reader.next(frame) || !cipher.decryptMessage(frame) || frame.size() != sizeof(expected)))
+            {
+                ok = false;
+            }
+            if (ok)
+            {
+                memcpy(&expected, frame.data(), sizeof(expected));
+                if (expected != crc)
+                {
+                    NetworkUtils::printMessage("ERROR", "Range at " + std::to_string(offset) + " of " + offer.fileName + " failed its checksum");
+                    break;
+                }
+            }
+            if (!ok)
+            {
+                NetworkUtils::printMessage("ERROR", "Failed to fetch range at " + std::to_string(offset) + " on stream " + std::to_string(index));
+                break;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(journalMutex);
+                journal.commit(offset, end - offset);
+                unjournaledBytes += end - offset;
+                if (unjournaledBytes >= FileTransfer::JOURNAL_INTERVAL)
+                {
+                    unjournaledBytes = 0;
+                    if (flush != FlushPolicy::Interval || output.flush())
+                    {
+                        journal.save();
+                    }
+                }
+            }
+            progress.add(end - offset);
+        }
+
+        if (!failed.exchange(true))
+        {
+            abortStreams(streams);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < streams.size(); i++)
+    {
+        threads.emplace_back(fetchStream, i);
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+
+    // Only flushed ranges may stay journaled
+    if (!failed && flush != FlushPolicy::None && !output.flush())
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to flush " + journal.getPartPath());
+        failed = true;
+    }
+    if (failed)
+    {
+        if (flush == FlushPolicy::Interval)
+        {
+            output.flush();
+        }
+        journal.save();
+        return false;
+    }
+    output.close();
+
+    if (journal.committedPrefix() == offer.fileSize)
+    {
+        if (!MoveFileExA(journal.getPartPath().c_str(), savePath.c_str(), MOVEFILE_REPLACE_EXISTING))
+        {
+            NetworkUtils::printMessage("ERROR", "Cannot rename " + journal.getPartPath() + " to " + savePath);
+            journal.save();
+            return false;
+        }
+        journal.remove();
+        NetworkUtils::printMessage("SUCCESS", "File received: " + savePath + " (" + std::to_string(fetchBytes) + " bytes fetched)");
+        return true;
+    }
+    if (!journal.save())
+    {
+        NetworkUtils::printMessage("ERROR", "Cannot write transfer journal for " + savePath);
+        return false;
+    }
+    NetworkUtils::printMessage("SUCCESS", "Ranges of " + offer.fileName + " received into " + journal.getPartPath() + " (" +
+                                              std::to_string(fetchBytes) + " bytes fetched)");
+    return true;
+}
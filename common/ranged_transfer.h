@@ -0,0 +1,71 @@
+#ifndef RANGED_TRANSFER_H
+#define RANGED_TRANSFER_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include "network_utils.h"
+#include "crypto_utils.h"
+
+// Reads of arbitrary byte ranges of a served file. The serving side offers
+// the file, then every stream of the session answers the fetching side's
+// range requests until that stream asks for nothing more. The fetcher splits
+// what it wants into pieces, keeps a few requests in flight on each stream
+// and writes every piece at its offset into "<name>.part", journaled like a
+// resumable download: later fetches skip the ranges already there, and the
+// file is renamed into place once every byte has arrived. Reading only the
+// index at the end of a huge archive therefore costs only that index, and a
+// whole-file fetch is a parallel download.
+class RangedTransfer
+{
+public:
+    // Requests are cut into pieces of at most this much, so streams share them
+    static const uint32_t PIECE_SIZE = 8 * 1024 * 1024;
+    // Each piece arrives as frames of [u64 offset][ciphertext] of at most
+    // this much, then an encrypted [u32 CRC-32C] of the piece
+    static const uint32_t FRAME_SIZE = 1024 * 1024;
+    static const unsigned REQUESTS_IN_FLIGHT = 2;
+
+    // Offer: [u32 name size][name][u64 file size][u64 source stamp]. Its
+    // nonce keys every piece, at DATA_STREAM_OFFSET + file offset.
+    struct Offer
+    {
+        std::string fileName;
+        uint64_t fileSize = 0;
+        uint64_t stamp = 0;
+        uint64_t nonce = 0;
+    };
+
+    // A wanted range. A negative offset counts back from the end of the
+    // file and a zero length runs to the end.
+    struct Span
+    {
+        int64_t offset;
+        uint64_t length;
+    };
+
+    // Comma-separated "offset:length", "offset:" or "-length" (the tail);
+    // empty text asks for the whole file
+    static bool parseSpans(const std::string &text, std::vector<Span> &spans);
+
+    // Serving side; `streams` starts with the main connection. Returns once
+    // every stream has ended its requests.
+    static bool serve(const std::vector<FrameReader *> &streams, const CipherContext &cipher, const std::string &filePath);
+
+    // Fetching side: receiveOffer() on the main connection, then fetch() the
+    // spans over every stream. Every stream is ended, even with no spans.
+    static bool receiveOffer(FrameReader &reader, const CipherContext &cipher, Offer &offer);
+    static bool fetch(const std::vector<FrameReader *> &streams, const CipherContext &cipher, const Offer &offer, const std::vector<Span> &spans,
+                      const std::string &saveDir = "received_files");
+
+private:
+    // Request: [u64 offset][u64 length]; length 0 ends the stream
+    static const size_t REQUEST_SIZE = 2 * sizeof(uint64_t);
+
+    // Sorted, merged [offset, length) ranges inside the file
+    static std::vector<std::pair<uint64_t, uint64_t>> resolveSpans(const std::vector<Span> &spans, uint64_t fileSize);
+    static bool sendRequest(FrameReader &stream, const CipherContext &cipher, uint64_t offset, uint64_t length);
+    static void abortStreams(const std::vector<FrameReader *> &streams);
+};
+
+#endif
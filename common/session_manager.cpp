@@ -1,83 +1,405 @@
 #include "session_manager.h"
+#include "network_utils.h"
+#include <algorithm>
+#include <cstring>
 
-std::string SessionManager::createSession(const std::string &clientUUID, const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV)
+std::atomic<int64_t> SessionManager::timeouts[static_cast<size_t>(SessionClass::COUNT)] = {{30 * 60}, {30 * 60}};
+
+namespace
 {
-    std::lock_guard<std::mutex> lock(sessionMutex);
+    // Where the 32 hex digits of the 8-4-4-4-12 form sit
+    const unsigned char DIGIT_POSITIONS[32] = {0, 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 12, 14, 15, 16, 17,
+                                               19, 20, 21, 22, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35};
 
-    Session session;
-    session.sessionId = CryptoUtils::generateUUID();
-    session.clientUUID = clientUUID;
-    session.aesKey = aesKey;
-    session.aesIV = aesIV;
-    session.createdAt = std::chrono::steady_clock::now();
-    session.lastActivity = std::chrono::steady_clock::now();
+    // Digit value by character, 0xFF for anything that is not a hex digit
+    struct HexDigits
+    {
+        unsigned char values[256];
+
+        HexDigits()
+        {
+            memset(values, 0xFF, sizeof(values));
+            for (int i = 0; i < 10; i++)
+                values['0' + i] = static_cast<unsigned char>(i);
+            for (int i = 0; i < 6; i++)
+                values['a' + i] = values['A' + i] = static_cast<unsigned char>(10 + i);
+        }
+    };
+    const HexDigits HEX_DIGITS;
+}
+
+// Every session lookup starts here, so no branch per character
+bool BinaryUuid::parse(const std::string &text, BinaryUuid &uuid)
+{
+    if (text.size() != 36 || text[8] != '-' || text[13] != '-' || text[18] != '-' || text[23] != '-')
+    {
+        return false;
+    }
+    const unsigned char *chars = reinterpret_cast<const unsigned char *>(text.data());
+    unsigned invalid = 0;
+    uint64_t halves[2] = {0, 0};
+    for (size_t half = 0; half < 2; half++)
+    {
+        for (size_t digit = half * 16; digit < half * 16 + 16; digit++)
+        {
+            unsigned char value = HEX_DIGITS.values[chars[DIGIT_POSITIONS[digit]]];
+            invalid |= value;
+            halves[half] = (halves[half] << 4) | (value & 0xF);
+        }
+    }
+    if (invalid & 0xF0)
+    {
+        return false;
+    }
+    uuid.high = halves[0];
+    uuid.low = halves[1];
+    return true;
+}
+
+std::string BinaryUuid::toString() const
+{
+    static const char HEX[] = "0123456789abcdef";
+    std::string text(36, '-');
+    for (size_t digit = 0; digit < 32; digit++)
+    {
+        uint64_t half = digit < 16 ? high : low;
+        text[DIGIT_POSITIONS[digit]] = HEX[(half >> (4 * (15 - digit % 16))) & 0xF];
+    }
+    return text;
+}
+
+uint64_t SessionManager::hashOf(const BinaryUuid &sessionId)
+{
+    // SplitMix64 finalizer; the shard comes from the low bits, the index
+    // slot from the high ones
+    uint64_t x = sessionId.high ^ (sessionId.low * 0x9E3779B97F4A7C15ull);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+uint32_t SessionManager::Shard::find(const BinaryUuid &sessionId) const
+{
+    if (index.empty())
+    {
+        return SlabAllocator<SessionRecord>::NONE;
+    }
+    size_t mask = index.size() - 1;
+    for (size_t i = (hashOf(sessionId) >> 32) & mask;; i = (i + 1) & mask)
+    {
+        uint32_t slot = index[i];
+        if (slot == SlabAllocator<SessionRecord>::NONE || records[slot].sessionId == sessionId)
+        {
+            return slot;
+        }
+    }
+}
+
+void SessionManager::Shard::insert(uint32_t slot)
+{
+    if ((records.size() + 1) * 2 > index.size())
+    {
+        grow();
+    }
+    size_t mask = index.size() - 1;
+    size_t i = (hashOf(records[slot].sessionId) >> 32) & mask;
+    while (index[i] != SlabAllocator<SessionRecord>::NONE)
+    {
+        i = (i + 1) & mask;
+    }
+    index[i] = slot;
+}
+
+void SessionManager::Shard::erase(const BinaryUuid &sessionId)
+{
+    size_t mask = index.size() - 1;
+    size_t hole = (hashOf(sessionId) >> 32) & mask;
+    while (!(records[index[hole]].sessionId == sessionId))
+    {
+        hole = (hole + 1) & mask;
+    }
+    records.release(index[hole]);
+
+    // Backward shift: later entries of the same run move into the hole
+    // unless that would put them before their home slot, so probes never
+    // need tombstones
+    for (size_t i = (hole + 1) & mask; index[i] != SlabAllocator<SessionRecord>::NONE; i = (i + 1) & mask)
+    {
+        size_t home = (hashOf(records[index[i]].sessionId) >> 32) & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            index[hole] = index[i];
+            hole = i;
+        }
+    }
+    index[hole] = SlabAllocator<SessionRecord>::NONE;
+}
+
+void SessionManager::Shard::grow()
+{
+    std::vector<uint32_t> old(std::max<size_t>(64, index.size() * 2), SlabAllocator<SessionRecord>::NONE);
+    old.swap(index);
+    size_t mask = index.size() - 1;
+    for (uint32_t slot : old)
+    {
+        if (slot == SlabAllocator<SessionRecord>::NONE)
+        {
+            continue;
+        }
+        size_t i = (hashOf(records[slot].sessionId) >> 32) & mask;
+        while (index[i] != SlabAllocator<SessionRecord>::NONE)
+        {
+            i = (i + 1) & mask;
+        }
+        index[i] = slot;
+    }
+}
+
+uint32_t SessionManager::packTime(std::chrono::steady_clock::time_point when) const
+{
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(when - epoch).count();
+    return static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(seconds, 0), UINT32_MAX));
+}
 
-    sessions[session.sessionId] = session;
-    return session.sessionId;
+std::chrono::steady_clock::time_point SessionManager::deadlineOf(const SessionRecord &record) const
+{
+    return unpackTime(record.lastActivity.load(std::memory_order_relaxed)) + getTimeout(record.sessionClass);
+}
+
+void SessionManager::copyOut(const SessionRecord &record, Session &session) const
+{
+    session.sessionId = record.sessionId.toString();
+    session.clientUUID = record.clientUUID.toString();
+    session.aesKey.assign(record.aesKey, record.aesKey + sizeof(record.aesKey));
+    session.aesIV.assign(record.aesIV, record.aesIV + sizeof(record.aesIV));
+    session.sessionClass = record.sessionClass;
+    session.createdAt = unpackTime(record.createdAt);
+    session.lastActivity = unpackTime(record.lastActivity.load(std::memory_order_relaxed));
+}
+
+std::string SessionManager::createSession(const std::string &clientUUID, const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV,
+                                          SessionClass sessionClass)
+{
+    BinaryUuid client;
+    if (!BinaryUuid::parse(clientUUID, client) || aesKey.size() != 16 || aesIV.size() != 16)
+    {
+        return "";
+    }
+    auto now = std::chrono::steady_clock::now();
+
+    BinaryUuid sessionId;
+    BinaryUuid::parse(CryptoUtils::generateUUID(), sessionId);
+    Shard &shard = shardFor(sessionId);
+    {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        uint32_t slot = shard.records.allocate();
+        if (slot == SlabAllocator<SessionRecord>::NONE)
+        {
+            return "";
+        }
+        SessionRecord &record = shard.records[slot];
+        record.sessionId = sessionId;
+        record.clientUUID = client;
+        memcpy(record.aesKey, aesKey.data(), sizeof(record.aesKey));
+        memcpy(record.aesIV, aesIV.data(), sizeof(record.aesIV));
+        record.createdAt = packTime(now);
+        record.lastActivity.store(record.createdAt, std::memory_order_relaxed);
+        record.sessionClass = sessionClass;
+        shard.insert(slot);
+    }
+    sessionCount.fetch_add(1, std::memory_order_relaxed);
+    scheduleExpiry(sessionId, unpackTime(packTime(now)) + getTimeout(sessionClass));
+    return sessionId.toString();
+}
+
+bool SessionManager::getSession(const std::string &sessionId, Session &session)
+{
+    BinaryUuid id;
+    return BinaryUuid::parse(sessionId, id) && getSession(id, session);
 }
 
-Session *SessionManager::getSession(const std::string &sessionId)
+bool SessionManager::getSession(const BinaryUuid &sessionId, Session &session)
 {
-    std::lock_guard<std::mutex> lock(sessionMutex);
-    auto it = sessions.find(sessionId);
-    if (it != sessions.end())
+    Shard &shard = shardFor(sessionId);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    uint32_t slot = shard.find(sessionId);
+    if (slot == SlabAllocator<SessionRecord>::NONE)
     {
-        return &it->second;
+        return false;
     }
-    return nullptr;
+    copyOut(shard.records[slot], session);
+    return true;
 }
 
 bool SessionManager::validateSession(const std::string &sessionId)
 {
-    std::lock_guard<std::mutex> lock(sessionMutex);
-    auto it = sessions.find(sessionId);
-    if (it != sessions.end())
+    BinaryUuid id;
+    if (!BinaryUuid::parse(sessionId, id))
     {
-        // Check if session expired (30 minutes)
-        auto now = std::chrono::steady_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::minutes>(now - it->second.lastActivity);
-        return duration.count() < 30;
+        return false;
     }
-    return false;
+    Shard &shard = shardFor(id);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    uint32_t slot = shard.find(id);
+    return slot != SlabAllocator<SessionRecord>::NONE && deadlineOf(shard.records[slot]) > std::chrono::steady_clock::now();
 }
 
 void SessionManager::updateActivity(const std::string &sessionId)
 {
-    std::lock_guard<std::mutex> lock(sessionMutex);
-    auto it = sessions.find(sessionId);
-    if (it != sessions.end())
+    BinaryUuid id;
+    if (BinaryUuid::parse(sessionId, id))
     {
-        it->second.lastActivity = std::chrono::steady_clock::now();
+        touch(id, std::chrono::steady_clock::now());
     }
 }
 
-void SessionManager::removeSession(const std::string &sessionId)
+void SessionManager::touch(const BinaryUuid &sessionId, std::chrono::steady_clock::time_point when)
 {
-    std::lock_guard<std::mutex> lock(sessionMutex);
-    sessions.erase(sessionId);
+    Shard &shard = shardFor(sessionId);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    uint32_t slot = shard.find(sessionId);
+    if (slot != SlabAllocator<SessionRecord>::NONE)
+    {
+        shard.records[slot].lastActivity.store(packTime(when), std::memory_order_relaxed);
+    }
 }
 
-void SessionManager::cleanupExpiredSessions(int timeoutMinutes)
+void SessionManager::removeSession(const std::string &sessionId)
 {
-    std::lock_guard<std::mutex> lock(sessionMutex);
-    auto now = std::chrono::steady_clock::now();
+    BinaryUuid id;
+    if (BinaryUuid::parse(sessionId, id))
+    {
+        removeSession(id);
+    }
+}
 
-    for (auto it = sessions.begin(); it != sessions.end();)
+void SessionManager::removeSession(const BinaryUuid &sessionId)
+{
+    Shard &shard = shardFor(sessionId);
     {
-        auto duration = std::chrono::duration_cast<std::chrono::minutes>(now - it->second.lastActivity);
-        if (duration.count() > timeoutMinutes)
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        if (shard.find(sessionId) == SlabAllocator<SessionRecord>::NONE)
         {
-            it = sessions.erase(it);
+            return;
         }
-        else
+        shard.erase(sessionId);
+    }
+    sessionCount.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool SessionManager::expireSession(const Session &session)
+{
+    BinaryUuid id;
+    return BinaryUuid::parse(session.sessionId, id) && expireSession(id, packTime(session.lastActivity));
+}
+
+// The stamp is compared in the same critical section that erases, so a
+// touch either lands first and keeps the session or finds it gone. Stamps
+// are whole seconds, but a due session's stamp is at least one timeout old,
+// so any touch since changes it.
+bool SessionManager::expireSession(const BinaryUuid &sessionId, uint32_t seenActivity)
+{
+    Shard &shard = shardFor(sessionId);
+    {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        uint32_t slot = shard.find(sessionId);
+        if (slot == SlabAllocator<SessionRecord>::NONE || shard.records[slot].lastActivity.load(std::memory_order_relaxed) != seenActivity)
         {
-            ++it;
+            return false;
         }
+        shard.erase(sessionId);
+    }
+    sessionCount.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+uint64_t SessionManager::expiryTick(std::chrono::steady_clock::time_point when)
+{
+    return static_cast<uint64_t>(when.time_since_epoch() / EXPIRY_TICK);
+}
+
+void SessionManager::scheduleExpiry(const BinaryUuid &sessionId, std::chrono::steady_clock::time_point deadline)
+{
+    // The tick after the one holding the deadline, so it has passed when the entry fires
+    uint64_t tick = expiryTick(deadline) + 1;
+    std::lock_guard<std::mutex> lock(expiryMutex);
+    wheel.schedule(tick, sessionId);
+}
+
+void SessionManager::startExpiry(ExpiryHandler handler)
+{
+    std::lock_guard<std::mutex> lock(expiryMutex);
+    if (expiryRunning)
+    {
+        return;
+    }
+    expiryHandler = std::move(handler);
+    expiryRunning = true;
+    expiryThread = std::thread(&SessionManager::expiryLoop, this);
+}
+
+void SessionManager::stopExpiry()
+{
+    {
+        std::lock_guard<std::mutex> lock(expiryMutex);
+        expiryRunning = false;
     }
+    expiryWake.notify_all();
+    if (expiryThread.joinable())
+    {
+        expiryThread.join();
+    }
+    expiryHandler = nullptr;
 }
 
-size_t SessionManager::getActiveSessionCount()
+void SessionManager::expiryLoop()
 {
-    std::lock_guard<std::mutex> lock(sessionMutex);
-    return sessions.size();
-}
\ No newline at end of file
+    std::vector<BinaryUuid> due;
+    Session session;
+    std::unique_lock<std::mutex> lock(expiryMutex);
+    while (true)
+    {
+        expiryWake.wait_for(lock, EXPIRY_TICK);
+        if (!expiryRunning)
+        {
+            break;
+        }
+        auto now = std::chrono::steady_clock::now();
+        due.clear();
+        wheel.advance(expiryTick(now), due);
+
+        // Due sessions are checked without the wheel lock, so new sessions
+        // and reschedules go ahead meanwhile
+        lock.unlock();
+        for (const BinaryUuid &sessionId : due)
+        {
+            if (!getSession(sessionId, session))
+            {
+                continue; // removed since
+            }
+            auto deadline = session.lastActivity + getTimeout(session.sessionClass);
+            if (deadline > now)
+            {
+                scheduleExpiry(sessionId, deadline); // active since it was scheduled
+                continue;
+            }
+            if (expiryHandler && !expiryHandler(session))
+            {
+                touch(sessionId, now);
+                scheduleExpiry(sessionId, now + getTimeout(session.sessionClass));
+                continue;
+            }
+            // The handler may have expired it already; otherwise it goes
+            // now unless it was touched after the copy
+            Session current;
+            if (!expireSession(sessionId, packTime(session.lastActivity)) && getSession(sessionId, current))
+            {
+                scheduleExpiry(sessionId, current.lastActivity + getTimeout(current.sessionClass));
+                continue;
+            }
+            NetworkUtils::printMessage("SESSION", "Session of client " + session.clientUUID + " expired after " +
+                                                      std::to_string(getTimeout(session.sessionClass).count()) + " s idle");
+        }
+        lock.lock();
+    }
+}
@@ -2,35 +2,161 @@
 #define SESSION_MANAGER_H
 
 #include <string>
-#include <unordered_map>
-#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <shared_mutex>
+#include <atomic>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 #include "crypto_utils.h"
+#include "timer_wheel.h"
+#include "slab_allocator.h"
+
+// Sessions of each class share an idle timeout
+enum class SessionClass : uint8_t
+{
+    Standard,
+    IntegrityOnly, // file data travels unencrypted, MAC-checked
+    COUNT
+};
+
+// The 128 bits behind a UUID string from CryptoUtils::generateUUID
+struct BinaryUuid
+{
+    uint64_t high = 0;
+    uint64_t low = 0;
 
+    bool operator==(const BinaryUuid &other) const { return high == other.high && low == other.low; }
+
+    // Accepts the 8-4-4-4-12 hex form only
+    static bool parse(const std::string &text, BinaryUuid &uuid);
+    std::string toString() const;
+};
+
+// A copy of a session's state, as handed out by the manager
 struct Session
 {
     std::string sessionId;
     std::string clientUUID;
     std::vector<BYTE> aesKey;
     std::vector<BYTE> aesIV;
+    SessionClass sessionClass = SessionClass::Standard;
     std::chrono::steady_clock::time_point createdAt;
     std::chrono::steady_clock::time_point lastActivity;
 };
 
+// Session table split into SHARD_COUNT shards by session ID hash, each with
+// its own reader-writer lock on its own cache line. Lookups and activity
+// updates take only a shard's shared lock, so they run in parallel with each
+// other; inserts and removals lock one shard exclusively.
+//
+// A session is an 80-byte record with no pointers in it: binary IDs, the key
+// and IV inline, and times packed into whole seconds since the manager was
+// made. Each shard keeps its records in a slab allocator and finds them
+// through an open-addressing index of slot numbers keyed by binary session
+// ID, so a session costs no allocation of its own and a lookup touches an
+// index slot and then the record.
+//
+// Idle sessions expire through a timing wheel of EXPIRY_TICK ticks that a
+// background thread turns. Every session has one wheel entry at its last known
+// deadline. Activity only stores a timestamp; when an entry comes due, a
+// session that was active since is simply rescheduled at its new deadline. So
+// a re-arm is O(1), a tick costs the entries that come due, and lookups never
+// wait for expiry.
 class SessionManager
 {
-private:
-    std::unordered_map<std::string, Session> sessions;
-    std::mutex sessionMutex;
-
 public:
-    std::string createSession(const std::string &clientUUID, const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV);
-    Session *getSession(const std::string &sessionId);
+    static const size_t SHARD_COUNT = 64;
+    static constexpr std::chrono::seconds EXPIRY_TICK{1};
+
+    // Decides whether an idle session may go; false keeps it for another
+    // timeout, e.g. while a transfer is running. A handler that tears down
+    // what the session serves should do so only once expireSession has
+    // succeeded. Runs on the expiry thread.
+    using ExpiryHandler = std::function<bool(const Session &)>;
+
+    ~SessionManager() { stopExpiry(); }
+
+    // Process-wide idle timeout per class, read whenever a session is checked
+    static void setTimeout(SessionClass sessionClass, std::chrono::seconds timeout) { timeouts[static_cast<size_t>(sessionClass)] = timeout.count(); }
+    static std::chrono::seconds getTimeout(SessionClass sessionClass) { return std::chrono::seconds(timeouts[static_cast<size_t>(sessionClass)].load()); }
+
+    // Empty if the client UUID is not in UUID form or the key or IV is not 16 bytes
+    std::string createSession(const std::string &clientUUID, const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV,
+                              SessionClass sessionClass = SessionClass::Standard);
+    bool getSession(const std::string &sessionId, Session &session);
     bool validateSession(const std::string &sessionId);
     void updateActivity(const std::string &sessionId);
     void removeSession(const std::string &sessionId);
-    void cleanupExpiredSessions(int timeoutMinutes = 30);
-    size_t getActiveSessionCount();
+    // Removes the session only if it has seen no activity since `session`
+    // was copied out; false if it has, or if it is already gone
+    bool expireSession(const Session &session);
+    size_t getActiveSessionCount() const { return sessionCount.load(std::memory_order_relaxed); }
+
+    // Expired sessions are removed once `handler` (if any) lets them go
+    void startExpiry(ExpiryHandler handler = nullptr);
+    // Returns once the expiry thread, and any handler call, has finished
+    void stopExpiry();
+
+private:
+    struct SessionRecord
+    {
+        BinaryUuid sessionId;
+        BinaryUuid clientUUID;
+        BYTE aesKey[16];
+        BYTE aesIV[16];
+        uint32_t createdAt; // seconds since `epoch`
+        // Written under the shard's shared lock by any thread
+        std::atomic<uint32_t> lastActivity;
+        SessionClass sessionClass;
+    };
+
+    struct alignas(64) Shard
+    {
+        std::shared_mutex mutex;
+        SlabAllocator<SessionRecord> records;
+        // Record slots by session ID hash, linear probing, a power of two
+        // in size and at most half full
+        std::vector<uint32_t> index;
+
+        uint32_t find(const BinaryUuid &sessionId) const;
+        void insert(uint32_t slot);
+        void erase(const BinaryUuid &sessionId);
+        void grow();
+    };
+
+    static std::atomic<int64_t> timeouts[static_cast<size_t>(SessionClass::COUNT)];
+
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    Shard shards[SHARD_COUNT];
+    std::atomic<size_t> sessionCount{0};
+
+    std::mutex expiryMutex;
+    std::condition_variable expiryWake;
+    TimerWheel<BinaryUuid> wheel{expiryTick(std::chrono::steady_clock::now())};
+    std::thread expiryThread;
+    bool expiryRunning = false;
+    ExpiryHandler expiryHandler;
+
+    static uint64_t hashOf(const BinaryUuid &sessionId);
+    Shard &shardFor(const BinaryUuid &sessionId) { return shards[hashOf(sessionId) % SHARD_COUNT]; }
+
+    uint32_t packTime(std::chrono::steady_clock::time_point when) const;
+    std::chrono::steady_clock::time_point unpackTime(uint32_t seconds) const { return epoch + std::chrono::seconds(seconds); }
+    std::chrono::steady_clock::time_point deadlineOf(const SessionRecord &record) const;
+    void copyOut(const SessionRecord &record, Session &session) const;
+
+    bool getSession(const BinaryUuid &sessionId, Session &session);
+    void touch(const BinaryUuid &sessionId, std::chrono::steady_clock::time_point when);
+    void removeSession(const BinaryUuid &sessionId);
+    bool expireSession(const BinaryUuid &sessionId, uint32_t seenActivity);
+
+    static uint64_t expiryTick(std::chrono::steady_clock::time_point when);
+    void scheduleExpiry(const BinaryUuid &sessionId, std::chrono::steady_clock::time_point deadline);
+    void expiryLoop();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,206 @@
+#include "session_ticket.h"
+#include "striped_transfer.h"
+#include "network_utils.h"
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+    // Tickets issued by a process whose clock runs slightly ahead still open
+    const uint64_t MAX_CLOCK_SKEW_SECONDS = 60;
+
+    uint64_t unixSeconds()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+}
+
+std::mutex SessionTicket::keyMutex;
+std::shared_ptr<const SessionTicket::TicketKey> SessionTicket::key;
+std::atomic<int64_t> SessionTicket::lifetimeSeconds{24 * 60 * 60};
+
+void SessionTicket::installKey(const std::vector<BYTE> &material)
+{
+    auto ticketKey = std::make_shared<TicketKey>();
+    ticketKey->cipher.reset(std::vector<BYTE>(material.begin(), material.begin() + 16), std::vector<BYTE>(material.begin() + 16, material.begin() + 32));
+    ticketKey->macKey.assign(material.begin() + 32, material.begin() + KEY_SIZE);
+
+    std::lock_guard<std::mutex> lock(keyMutex);
+    key = ticketKey;
+}
+
+std::shared_ptr<const SessionTicket::TicketKey> SessionTicket::currentKey()
+{
+    std::lock_guard<std::mutex> lock(keyMutex);
+    return key;
+}
+
+bool SessionTicket::hasKey()
+{
+    return currentKey() != nullptr;
+}
+
+bool SessionTicket::randomKey(std::vector<BYTE> &material)
+{
+    material.resize(KEY_SIZE);
+    return CryptoUtils::randomBytes(material.data(), material.size());
+}
+
+bool SessionTicket::generateKey()
+{
+    std::vector<BYTE> material;
+    if (!randomKey(material))
+    {
+        return false;
+    }
+    installKey(material);
+    return true;
+}
+
+bool SessionTicket::loadKey(const std::string &path)
+{
+    std::vector<BYTE> material(KEY_SIZE);
+    std::ifstream in(path, std::ios::binary);
+    if (in)
+    {
+        if (!in.read((char *)material.data(), KEY_SIZE))
+        {
+            NetworkUtils::printMessage("ERROR", "Ticket key file " + path + " is shorter than " + std::to_string(KEY_SIZE) + " bytes");
+            return false;
+        }
+        installKey(material);
+        return true;
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!randomKey(material) || !out.write((const char *)material.data(), KEY_SIZE) || !out.flush())
+    {
+        NetworkUtils::printMessage("ERROR", "Cannot create ticket key file " + path);
+        return false;
+    }
+    installKey(material);
+    NetworkUtils::printMessage("TICKET", "Created ticket key file " + path);
+    return true;
+}
+
+bool SessionTicket::computeMac(const TicketKey &ticketKey, const BYTE *data, size_t size, std::vector<BYTE> &mac)
+{
+    HmacSha256 hmac(ticketKey.macKey);
+    return hmac.update(data, size) && hmac.finish(mac);
+}
+
+std::vector<BYTE> SessionTicket::issue(const Contents &contents)
+{
+    std::shared_ptr<const TicketKey> ticketKey = currentKey();
+    if (!ticketKey || contents.aesKey.size() != 16 || contents.aesIV.size() != 16)
+    {
+        return {};
+    }
+
+    // Plain ticket: [version][flags][u64 issued at][u32 uuid size][uuid][16 key][16 IV]
+    std::vector<BYTE> plain;
+    plain.push_back(VERSION);
+    plain.push_back(contents.integrityOnly ? StripedTransfer::HELLO_OPTION_INTEGRITY_ONLY : 0);
+    uint64_t issuedAt = unixSeconds();
+    plain.insert(plain.end(), (BYTE *)&issuedAt, (BYTE *)&issuedAt + sizeof(issuedAt));
+    uint32_t uuidSize = static_cast<uint32_t>(contents.clientUUID.size());
+    plain.insert(plain.end(), (BYTE *)&uuidSize, (BYTE *)&uuidSize + sizeof(uuidSize));
+    plain.insert(plain.end(), contents.clientUUID.begin(), contents.clientUUID.end());
+    plain.insert(plain.end(), contents.aesKey.begin(), contents.aesKey.end());
+    plain.insert(plain.end(), contents.aesIV.begin(), contents.aesIV.end());
+
+    // Encrypt, then MAC the nonce and ciphertext
+    std::vector<BYTE> ticket = ticketKey->cipher.encryptMessage(plain);
+    std::vector<BYTE> mac;
+    if (!computeMac(*ticketKey, ticket.data(), ticket.size(), mac))
+    {
+        return {};
+    }
+    ticket.insert(ticket.end(), mac.begin(), mac.end());
+    return ticket;
+}
+
+bool SessionTicket::open(const std::vector<BYTE> &ticket, Contents &contents)
+{
+    std::shared_ptr<const TicketKey> ticketKey = currentKey();
+    if (!ticketKey || ticket.size() < CipherContext::NONCE_SIZE + HmacSha256::MAC_SIZE || ticket.size() > MAX_TICKET_SIZE)
+    {
+        return false;
+    }
+
+    size_t sealedSize = ticket.size() - HmacSha256::MAC_SIZE;
+    std::vector<BYTE> mac;
+    if (!computeMac(*ticketKey, ticket.data(), sealedSize, mac))
+    {
+        return false;
+    }
+    BYTE difference = 0;
+    for (size_t i = 0; i < HmacSha256::MAC_SIZE; i++)
+    {
+        difference |= mac[i] ^ ticket[sealedSize + i];
+    }
+    std::vector<BYTE> plain(ticket.begin(), ticket.begin() + sealedSize);
+    if (difference != 0 || !ticketKey->cipher.decryptMessage(plain))
+    {
+        return false;
+    }
+
+    const size_t fixedSize = 2 + sizeof(uint64_t) + sizeof(uint32_t);
+    if (plain.size() < fixedSize || plain[0] != VERSION)
+    {
+        return false;
+    }
+    uint32_t uuidSize = 0;
+    memcpy(&contents.issuedAt, plain.data() + 2, sizeof(contents.issuedAt));
+    memcpy(&uuidSize, plain.data() + 2 + sizeof(uint64_t), sizeof(uuidSize));
+    if (plain.size() != fixedSize + uuidSize + 32)
+    {
+        return false;
+    }
+    contents.integrityOnly = (plain[1] & StripedTransfer::HELLO_OPTION_INTEGRITY_ONLY) != 0;
+    contents.clientUUID.assign(plain.begin() + fixedSize, plain.begin() + fixedSize + uuidSize);
+    contents.aesKey.assign(plain.begin() + fixedSize + uuidSize, plain.begin() + fixedSize + uuidSize + 16);
+    contents.aesIV.assign(plain.begin() + fixedSize + uuidSize + 16, plain.end());
+
+    uint64_t now = unixSeconds();
+    return contents.issuedAt <= now + MAX_CLOCK_SKEW_SECONDS && now - std::min(now, contents.issuedAt) <= static_cast<uint64_t>(lifetimeSeconds.load());
+}
+
+std::vector<BYTE> SessionTicket::resumeHello(const std::vector<BYTE> &ticket, BYTE options, const std::vector<BYTE> &challenge,
+                                             const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV)
+{
+    std::vector<BYTE> hello = {StripedTransfer::HELLO_RESUME_SESSION, options};
+    uint32_t ticketSize = static_cast<uint32_t>(ticket.size());
+    hello.insert(hello.end(), (BYTE *)&ticketSize, (BYTE *)&ticketSize + sizeof(ticketSize));
+    hello.insert(hello.end(), ticket.begin(), ticket.end());
+
+    std::vector<BYTE> proof = StripedTransfer::sessionProof("resume", challenge, ticket, aesKey, aesIV);
+    hello.insert(hello.end(), proof.begin(), proof.end());
+    return hello;
+}
+
+bool SessionTicket::parseResumeHello(const std::vector<BYTE> &hello, BYTE &options, std::vector<BYTE> &ticket, std::vector<BYTE> &proof)
+{
+    const size_t headerSize = 2 + sizeof(uint32_t);
+    if (hello.size() < headerSize || hello[0] != StripedTransfer::HELLO_RESUME_SESSION)
+    {
+        return false;
+    }
+    options = hello[1];
+    uint32_t ticketSize = 0;
+    memcpy(&ticketSize, hello.data() + 2, sizeof(ticketSize));
+    if (ticketSize > MAX_TICKET_SIZE || hello.size() < headerSize + ticketSize)
+    {
+        return false;
+    }
+    ticket.assign(hello.begin() + headerSize, hello.begin() + headerSize + ticketSize);
+    proof.assign(hello.begin() + headerSize + ticketSize, hello.end());
+    return true;
+}
+
+bool SessionTicket::verifyResumeProof(const std::vector<BYTE> &proof, const std::vector<BYTE> &ticket, const std::vector<BYTE> &challenge,
+                                      const Contents &contents)
+{
+    return StripedTransfer::verifySessionProof(proof, "resume", challenge, ticket, contents.aesKey, contents.aesIV);
+}
@@ -0,0 +1,91 @@
+#ifndef SESSION_TICKET_H
+#define SESSION_TICKET_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include "crypto_utils.h"
+
+// Server-issued resumption tickets. A ticket carries the session's client
+// UUID, keys and options, encrypted and authenticated under a ticket key only
+// servers know, so a server restores the session from the ticket alone and
+// keeps no per-ticket state. Every server process that loads the same key
+// file accepts the tickets of the others.
+//
+// A returning client answers the connection's challenge with its ticket and
+// an HMAC, keyed with the session key, of the challenge and the ticket. It
+// gets back either a fresh ticket, encrypted under the session key, or a
+// brand new session. Either way that takes one round trip after the
+// challenge. Partial transfers then resume from their journals as after any
+// reconnect.
+//
+// Being stateless, a ticket can be presented again until it expires, but only
+// with the session key: every connection gets a new challenge, so a recorded
+// resume hello proves nothing on another connection.
+class SessionTicket
+{
+public:
+    // Ticket key file: [16 AES key][16 AES IV][32 HMAC key]
+    static const size_t KEY_SIZE = 64;
+    static const uint32_t MAX_TICKET_SIZE = 1024;
+
+    // First byte of the server's answer to a resume hello. Accepted is
+    // followed by a session-encrypted new ticket; refused by the key data of a
+    // new session, as sent to a new client.
+    static constexpr BYTE RESUME_ACCEPTED = 0;
+    static constexpr BYTE RESUME_REFUSED = 1;
+
+    struct Contents
+    {
+        std::string clientUUID;
+        std::vector<BYTE> aesKey;
+        std::vector<BYTE> aesIV;
+        bool integrityOnly = false;
+        uint64_t issuedAt = 0; // seconds since the epoch
+    };
+
+    // Process-wide. Without a key, tickets are neither issued nor accepted.
+    static bool generateKey();
+    // Reads the key from `path`, creating it with a random key if missing
+    static bool loadKey(const std::string &path);
+    static bool hasKey();
+    static void setLifetime(std::chrono::seconds lifetime) { lifetimeSeconds = lifetime.count(); }
+    static std::chrono::seconds getLifetime() { return std::chrono::seconds(lifetimeSeconds.load()); }
+
+    // Empty when there is no key
+    static std::vector<BYTE> issue(const Contents &contents);
+    // False for tickets that are forged, damaged, expired or from another key
+    static bool open(const std::vector<BYTE> &ticket, Contents &contents);
+
+    // Resume hello: [kind][options][u32 ticket size][ticket][proof], the proof
+    // being StripedTransfer::sessionProof("resume", challenge, ticket)
+    static std::vector<BYTE> resumeHello(const std::vector<BYTE> &ticket, BYTE options, const std::vector<BYTE> &challenge,
+                                         const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV);
+    static bool parseResumeHello(const std::vector<BYTE> &hello, BYTE &options, std::vector<BYTE> &ticket, std::vector<BYTE> &proof);
+    // Checks the proof against the session key from the opened ticket
+    static bool verifyResumeProof(const std::vector<BYTE> &proof, const std::vector<BYTE> &ticket, const std::vector<BYTE> &challenge,
+                                  const Contents &contents);
+
+private:
+    struct TicketKey
+    {
+        CipherContext cipher;
+        std::vector<BYTE> macKey;
+    };
+
+    static constexpr BYTE VERSION = 1;
+
+    static std::mutex keyMutex;
+    static std::shared_ptr<const TicketKey> key;
+    static std::atomic<int64_t> lifetimeSeconds;
+
+    static bool randomKey(std::vector<BYTE> &material);
+    static void installKey(const std::vector<BYTE> &material);
+    static std::shared_ptr<const TicketKey> currentKey();
+    static bool computeMac(const TicketKey &ticketKey, const BYTE *data, size_t size, std::vector<BYTE> &mac);
+};
+
+#endif
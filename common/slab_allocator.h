@@ -0,0 +1,75 @@
+#ifndef SLAB_ALLOCATOR_H
+#define SLAB_ALLOCATOR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+// Fixed-size objects carved out of slabs of SLAB_SIZE, named by a 32-bit
+// slot number instead of a pointer. Slabs are allocated as slots run out and
+// kept for good, so objects never move; freed slots are handed out again
+// before new ones. Only for trivially destructible types, so freeing runs no
+// destructor. Not thread-safe.
+template <typename T, size_t SLAB_SIZE = 256>
+class SlabAllocator
+{
+    static_assert(std::is_trivially_destructible<T>::value, "slots are reused without destruction");
+
+public:
+    static const uint32_t NONE = UINT32_MAX;
+
+    SlabAllocator() = default;
+    SlabAllocator(const SlabAllocator &) = delete;
+    SlabAllocator &operator=(const SlabAllocator &) = delete;
+
+    // A value-initialized object, or NONE once 2^32 - 1 slots are in use
+    uint32_t allocate()
+    {
+        uint32_t slot;
+        if (!freeSlots.empty())
+        {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            if (nextSlot == NONE)
+            {
+                return NONE;
+            }
+            if (nextSlot == slabs.size() * SLAB_SIZE)
+            {
+                slabs.emplace_back(new Storage[SLAB_SIZE]);
+            }
+            slot = nextSlot++;
+        }
+        new (&storageOf(slot)) T();
+        return slot;
+    }
+
+    void release(uint32_t slot) { freeSlots.push_back(slot); }
+
+    T &operator[](uint32_t slot) { return *std::launder(reinterpret_cast<T *>(&storageOf(slot))); }
+    const T &operator[](uint32_t slot) const { return *std::launder(reinterpret_cast<const T *>(&storageOf(slot))); }
+
+    size_t size() const { return nextSlot - freeSlots.size(); }
+    size_t memoryUsage() const { return slabs.size() * SLAB_SIZE * sizeof(Storage) + freeSlots.capacity() * sizeof(uint32_t); }
+
+private:
+    struct alignas(T) Storage
+    {
+        unsigned char bytes[sizeof(T)];
+    };
+
+    std::vector<std::unique_ptr<Storage[]>> slabs;
+    std::vector<uint32_t> freeSlots;
+    uint32_t nextSlot = 0; // slots from here on were never handed out
+
+    Storage &storageOf(uint32_t slot) { return slabs[slot / SLAB_SIZE][slot % SLAB_SIZE]; }
+    const Storage &storageOf(uint32_t slot) const { return slabs[slot / SLAB_SIZE][slot % SLAB_SIZE]; }
+};
+
+#endif
@@ -0,0 +1,325 @@
+#include "striped_transfer.h"
+#include "file_transfer.h"
+#include "transfer_pipeline.h"
+#include "file_io.h"
+#include "io_engine.h"
+#include "transfer_progress.h"
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <fstream>
+#include <cstring>
+#include <filesystem>
+
+namespace
+{
+    const size_t OFFSET_HEADER_SIZE = sizeof(uint64_t);
+
+    std::string progressLabel(const char *verb, const std::string &path, size_t streams)
+    {
+        return std::string(verb) + " " + std::filesystem::path(path).filename().string() + " (" + std::to_string(streams) + " streams)";
+    }
+}
+
+std::vector<BYTE> StripedTransfer::joinHello(const std::string &clientUUID, const std::vector<BYTE> &challenge, const std::vector<BYTE> &aesKey,
+                                             const std::vector<BYTE> &aesIV)
+{
+    std::vector<BYTE> hello(1, HELLO_JOIN_STREAM);
+    uint32_t uuidSize = static_cast<uint32_t>(clientUUID.size());
+    hello.insert(hello.end(), (BYTE *)&uuidSize, (BYTE *)&uuidSize + sizeof(uuidSize));
+    hello.insert(hello.end(), clientUUID.begin(), clientUUID.end());
+
+    std::vector<BYTE> proof = sessionProof("join", challenge, CryptoUtils::stringToVector(clientUUID), aesKey, aesIV);
+    hello.insert(hello.end(), proof.begin(), proof.end());
+    return hello;
+}
+
+bool StripedTransfer::parseJoinHello(const std::vector<BYTE> &hello, std::string &clientUUID, std::vector<BYTE> &proof)
+{
+    if (hello.size() < 1 + sizeof(uint32_t) || hello[0] != HELLO_JOIN_STREAM)
+    {
+        return false;
+    }
+    uint32_t uuidSize = 0;
+    memcpy(&uuidSize, hello.data() + 1, sizeof(uuidSize));
+    size_t offset = 1 + sizeof(uuidSize);
+    if (hello.size() < offset + uuidSize)
+    {
+        return false;
+    }
+    clientUUID.assign(hello.begin() + offset, hello.begin() + offset + uuidSize);
+    proof.assign(hello.begin() + offset + uuidSize, hello.end());
+    return true;
+}
+
+bool StripedTransfer::verifyJoinProof(const std::vector<BYTE> &proof, const std::string &clientUUID, const std::vector<BYTE> &challenge,
+                                      const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV)
+{
+    return verifySessionProof(proof, "join", challenge, CryptoUtils::stringToVector(clientUUID), aesKey, aesIV);
+}
+
+std::vector<BYTE> StripedTransfer::sessionProof(const char *label, const std::vector<BYTE> &challenge, const std::vector<BYTE> &data,
+                                                const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV)
+{
+    std::vector<BYTE> key(aesKey);
+    key.insert(key.end(), aesIV.begin(), aesIV.end());
+    HmacSha256 hmac(key);
+    SecureZeroMemory(key.data(), key.size());
+
+    // The label includes its terminator so one label is never a prefix of another
+    std::vector<BYTE> mac;
+    if (challenge.size() != CHALLENGE_SIZE || !hmac.update((const BYTE *)label, strlen(label) + 1) ||
+        !hmac.update(challenge.data(), challenge.size()) || !hmac.update(data.data(), data.size()) || !hmac.finish(mac))
+    {
+        return {};
+    }
+    return mac;
+}
+
+bool StripedTransfer::verifySessionProof(const std::vector<BYTE> &proof, const char *label, const std::vector<BYTE> &challenge,
+                                         const std::vector<BYTE> &data, const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV)
+{
+    std::vector<BYTE> expected = sessionProof(label, challenge, data, aesKey, aesIV);
+    if (expected.empty() || proof.size() != expected.size())
+    {
+        return false;
+    }
+    BYTE difference = 0;
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        difference |= expected[i] ^ proof[i];
+    }
+    return difference == 0;
+}
+
+void StripedTransfer::abortStreams(const std::vector<FrameReader *> &streams)
+{
+    for (FrameReader *stream : streams)
+    {
+        shutdown(stream->getSocket(), SD_BOTH);
+    }
+}
+
+bool StripedTransfer::send(const std::vector<FrameReader *> &streams, const CipherContext &cipher, uint64_t nonce, const std::string &filePath,
+                           MerkleTree &tree, uint64_t startOffset, uint64_t fileSize, uint32_t maxChunkSize)
+{
+    std::atomic<uint64_t> nextOffset{startOffset};
+    TransferProgress progress(progressLabel("Sending", filePath, streams.size()), fileSize, startOffset);
+    std::atomic<bool> failed{false};
+
+    // One mapping serves every stream. Ranges are claimed in file order, so a
+    // single readahead window stays in front of the shared cursor. Streams
+    // fall back to their own stream reads when the file cannot be mapped.
+    MappedFile mapped;
+    if (mapped.open(filePath) && mapped.size() != fileSize)
+    {
+        mapped.close();
+    }
+    std::atomic<uint64_t> prefetchedTo{startOffset};
+
+    auto sendStream = [&](size_t index)
+    {
+        SOCKET socket = streams[index]->getSocket();
+        SendEngine &engine = streams[index]->sendEngine();
+        engine.begin(OFFSET_HEADER_SIZE + maxChunkSize);
+        std::ifstream file;
+        if (!mapped.isOpen())
+        {
+            file.open(filePath, std::ios::binary);
+        }
+        AdaptiveChunkSizer sizer(FileTransfer::MIN_CHUNK_SIZE, maxChunkSize, 4 * FileTransfer::MIN_CHUNK_SIZE);
+        std::vector<BYTE> frame;
+        frame.reserve(OFFSET_HEADER_SIZE + maxChunkSize);
+        uint64_t rttMicros = 0;
+        uint32_t chunksSent = 0;
+
+        if (!mapped.isOpen() && !file.is_open())
+        {
+            NetworkUtils::printMessage("ERROR", "Cannot open file: " + filePath);
+        }
+        while (!failed && (mapped.isOpen() || file.is_open()))
+        {
+            size_t wanted = sizer.nextSize();
+            uint64_t offset = nextOffset.fetch_add(wanted);
+            if (offset >= fileSize)
+            {
+                // An empty frame tells the receiver this stream is finished
+                FrameView end = {nullptr, 0};
+                if (!engine.send(&end, 1) || !engine.end())
+                    break;
+                return;
+            }
+
+            size_t size = static_cast<size_t>(std::min<uint64_t>(wanted, fileSize - offset));
+            uint64_t ahead = prefetchedTo.load();
+            if (mapped.isOpen() && offset + MappedFile::PREFETCH_WINDOW / 2 >= ahead &&
+                prefetchedTo.compare_exchange_strong(ahead, ahead + MappedFile::PREFETCH_WINDOW))
+            {
+                mapped.prefetch(ahead, MappedFile::PREFETCH_WINDOW);
+            }
+            frame.resize(OFFSET_HEADER_SIZE + size);
+            memcpy(frame.data(), &offset, OFFSET_HEADER_SIZE);
+            if (mapped.isOpen())
+            {
+                tree.add(offset, mapped.data() + offset, size);
+                cipher.process(mapped.data() + offset, frame.data() + OFFSET_HEADER_SIZE, size, nonce, FileTransfer::DATA_STREAM_OFFSET + offset);
+            }
+            else
+            {
+                file.seekg(offset);
+                file.read((char *)frame.data() + OFFSET_HEADER_SIZE, size);
+                if (static_cast<size_t>(file.gcount()) != size)
+                {
+                    NetworkUtils::printMessage("ERROR", "Failed to read " + filePath + " at offset " + std::to_string(offset));
+                    break;
+                }
+                tree.add(offset, frame.data() + OFFSET_HEADER_SIZE, size);
+                cipher.process(frame.data() + OFFSET_HEADER_SIZE, size, nonce, FileTransfer::DATA_STREAM_OFFSET + offset);
+            }
+
+            FrameView view = {frame.data(), frame.size()};
+            auto start = std::chrono::steady_clock::now();
+            if (!engine.send(&view, 1))
+            {
+                NetworkUtils::printMessage("ERROR", "Failed to send range at " + std::to_string(offset) + " on stream " + std::to_string(index));
+                break;
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            if (chunksSent++ % 16 == 0)
+            {
+                rttMicros = NetworkUtils::getRoundTripMicros(socket);
+            }
+            sizer.recordSend(size, elapsed.count(), rttMicros);
+
+            progress.add(size);
+        }
+
+        if (!failed.exchange(true))
+        {
+            abortStreams(streams);
+        }
+        // Sends still in flight fail fast on the shut-down socket
+        engine.end();
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < streams.size(); i++)
+    {
+        threads.emplace_back(sendStream, i);
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    return !failed;
+}
+
+bool StripedTransfer::receive(const std::vector<FrameReader *> &streams, const CipherContext &cipher, uint64_t nonce, TransferJournal &journal,
+                              MerkleTree &tree, uint64_t startOffset, uint64_t fileSize, uint32_t maxChunkSize)
+{
+    // Ranges land out of order into a file reserved at its full size
+    FileWriter output;
+    if (!output.open(journal.getPartPath(), fileSize, startOffset == 0))
+    {
+        NetworkUtils::printMessage("ERROR", "Cannot create " + std::to_string(fileSize) + " byte file " + journal.getPartPath());
+        return false;
+    }
+    FlushPolicy flush = FileTransfer::getFlushPolicy();
+
+    std::mutex journalMutex;
+    uint64_t unjournaledBytes = 0;
+    // The part file is "<name>.part"
+    TransferProgress progress(progressLabel("Receiving", std::filesystem::path(journal.getPartPath()).stem().string(), streams.size()), fileSize,
+                              startOffset);
+    std::atomic<bool> failed{false};
+
+    auto receiveStream = [&](size_t index)
+    {
+        FrameReader &reader = *streams[index];
+        std::vector<BYTE> frame;
+        frame.reserve(OFFSET_HEADER_SIZE + maxChunkSize);
+
+        while (!failed)
+        {
+            if (!reader.next(frame))
+            {
+                NetworkUtils::printMessage("ERROR", "Stream " + std::to_string(index) + " closed during transfer");
+                break;
+            }
+            if (frame.empty())
+            {
+                return;
+            }
+
+            uint64_t offset = 0;
+            size_t size = frame.size() - OFFSET_HEADER_SIZE;
+            if (frame.size() > OFFSET_HEADER_SIZE)
+            {
+                memcpy(&offset, frame.data(), OFFSET_HEADER_SIZE);
+            }
+            if (frame.size() <= OFFSET_HEADER_SIZE || size > maxChunkSize || offset < startOffset || offset > fileSize || size > fileSize - offset)
+            {
+                NetworkUtils::printMessage("ERROR", "Invalid range on stream " + std::to_string(index));
+                break;
+            }
+
+            BYTE *data = frame.data() + OFFSET_HEADER_SIZE;
+            cipher.process(data, size, nonce, FileTransfer::DATA_STREAM_OFFSET + offset);
+            tree.add(offset, data, size);
+            if (!output.writeAt(offset, data, size))
+            {
+                NetworkUtils::printMessage("ERROR", "Failed to write " + journal.getPartPath() + " at offset " + std::to_string(offset));
+                break;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(journalMutex);
+                journal.commit(offset, size);
+                unjournaledBytes += size;
+                if (unjournaledBytes >= FileTransfer::JOURNAL_INTERVAL)
+                {
+                    unjournaledBytes = 0;
+                    if (flush != FlushPolicy::Interval || output.flush())
+                    {
+                        journal.save();
+                    }
+                }
+            }
+            progress.add(size);
+        }
+
+        if (!failed.exchange(true))
+        {
+            abortStreams(streams);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < streams.size(); i++)
+    {
+        threads.emplace_back(receiveStream, i);
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+
+    // Every stream ended cleanly; the ranges must also tile the whole file
+    if (!failed && journal.committedPrefix() != fileSize)
+    {
+        NetworkUtils::printMessage("ERROR", "Striped transfer left gaps, " + std::to_string(journal.committedPrefix()) + " of " +
+                                                std::to_string(fileSize) + " bytes contiguous");
+        failed = true;
+    }
+    if (!failed && flush != FlushPolicy::None && !output.flush())
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to flush " + journal.getPartPath());
+        failed = true;
+    }
+    if (failed && flush == FlushPolicy::Interval)
+    {
+        // The caller saves the journal next; it must not describe unflushed data
+        output.flush();
+    }
+    return !failed;
+}
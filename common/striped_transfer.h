@@ -0,0 +1,64 @@
+#ifndef STRIPED_TRANSFER_H
+#define STRIPED_TRANSFER_H
+
+#include <string>
+#include <vector>
+#include "network_utils.h"
+#include "crypto_utils.h"
+#include "transfer_journal.h"
+#include "merkle_tree.h"
+
+// Splits one transfer across several connections of the same session. Every
+// stream runs its own read -> encrypt -> send loop and claims the next byte
+// range from a shared cursor, so faster streams simply carry more ranges.
+// Frames are [u64 file offset][ciphertext]; an empty frame ends a stream.
+// The receiver decrypts on each stream and writes every range at its offset
+// into a preallocated file, journaling ranges as they land. Both ends feed
+// the plain bytes of every range into the transfer's checksum tree.
+class StripedTransfer
+{
+public:
+    // First frame of every client connection, sent in the clear
+    static const BYTE HELLO_NEW_CLIENT = 0;
+    static const BYTE HELLO_JOIN_STREAM = 1;
+    static const BYTE HELLO_RESUME_SESSION = 2; // see SessionTicket
+    // Optional second byte of a new-client or resume hello
+    static const BYTE HELLO_OPTION_INTEGRITY_ONLY = 1;
+
+    // The server opens every connection with a frame of this many random
+    // bytes, which the hello has to answer; hellos are capped at MAX_HELLO_SIZE
+    static const size_t CHALLENGE_SIZE = 16;
+    static const uint32_t MAX_HELLO_SIZE = 2048;
+
+    static const unsigned MAX_STREAMS = 16;
+    // Below this, connection fan-out costs more than it gains
+    static const uint64_t MIN_STRIPED_SIZE = 16 * 1024 * 1024;
+
+    // Join hello: [kind][u32 uuid size][uuid][proof], the proof being
+    // sessionProof("join", challenge, uuid)
+    static std::vector<BYTE> joinHello(const std::string &clientUUID, const std::vector<BYTE> &challenge, const std::vector<BYTE> &aesKey,
+                                       const std::vector<BYTE> &aesIV);
+    static bool parseJoinHello(const std::vector<BYTE> &hello, std::string &clientUUID, std::vector<BYTE> &proof);
+    static bool verifyJoinProof(const std::vector<BYTE> &proof, const std::string &clientUUID, const std::vector<BYTE> &challenge,
+                                const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV);
+
+    // HMAC-SHA256 keyed with the session key and IV over label || challenge ||
+    // data. The challenge is fresh per connection, so a recorded proof is
+    // worthless on any other connection. Empty on failure.
+    static std::vector<BYTE> sessionProof(const char *label, const std::vector<BYTE> &challenge, const std::vector<BYTE> &data,
+                                          const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV);
+    // Constant-time check of a proof made by sessionProof
+    static bool verifySessionProof(const std::vector<BYTE> &proof, const char *label, const std::vector<BYTE> &challenge,
+                                   const std::vector<BYTE> &data, const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV);
+
+    static bool send(const std::vector<FrameReader *> &streams, const CipherContext &cipher, uint64_t nonce, const std::string &filePath,
+                     MerkleTree &tree, uint64_t startOffset, uint64_t fileSize, uint32_t maxChunkSize);
+    static bool receive(const std::vector<FrameReader *> &streams, const CipherContext &cipher, uint64_t nonce, TransferJournal &journal,
+                        MerkleTree &tree, uint64_t startOffset, uint64_t fileSize, uint32_t maxChunkSize);
+
+private:
+    // Unblocks every stream after a failure; the caller then drops the session
+    static void abortStreams(const std::vector<FrameReader *> &streams);
+};
+
+#endif
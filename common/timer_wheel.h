@@ -0,0 +1,100 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <utility>
+
+// Hierarchical timing wheel over an abstract tick count. LEVELS wheels of
+// SLOTS slots each, every level's slot spanning a whole turn of the level
+// below, cover SLOTS^LEVELS ticks ahead; later deadlines park in the top
+// level and are placed again as it turns. Scheduling is O(1), and advancing
+// costs one step per tick plus every item it cascades or hands back, never a
+// scan of everything scheduled. Not thread-safe.
+template <typename T>
+class TimerWheel
+{
+public:
+    static const unsigned SLOT_BITS = 6;
+    static const unsigned LEVELS = 3;
+    static const uint64_t SLOTS = uint64_t(1) << SLOT_BITS;
+
+    explicit TimerWheel(uint64_t now = 0) : current(now) {}
+
+    uint64_t now() const { return current; }
+    size_t size() const { return count; }
+
+    // Deadlines at or before now() fire on the next tick
+    void schedule(uint64_t deadline, T item)
+    {
+        place(Entry{deadline > current ? deadline : current + 1, std::move(item)});
+        count++;
+    }
+
+    // Moves the wheel to `target`, appending every item whose deadline it
+    // passes to `due`
+    void advance(uint64_t target, std::vector<T> &due)
+    {
+        while (current < target)
+        {
+            current++;
+            // Higher levels turn first, so their items reach the level below
+            // before its slot for this tick is emptied
+            for (unsigned level = LEVELS - 1; level > 0; level--)
+            {
+                if ((current & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) == 0)
+                {
+                    cascade(level);
+                }
+            }
+            std::vector<Entry> &slot = slots[0][current % SLOTS];
+            for (Entry &entry : slot)
+            {
+                due.push_back(std::move(entry.item));
+            }
+            count -= slot.size();
+            slot.clear();
+        }
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t deadline;
+        T item;
+    };
+
+    std::vector<Entry> slots[LEVELS][SLOTS];
+    uint64_t current;
+    size_t count = 0;
+
+    // Lowest level whose slot for the deadline is still ahead of the cursor
+    // within one turn; deadlines past the top level's reach wait in its last slot
+    void place(Entry entry)
+    {
+        for (unsigned level = 0; level < LEVELS; level++)
+        {
+            unsigned shift = SLOT_BITS * level;
+            if ((entry.deadline >> shift) - (current >> shift) < SLOTS)
+            {
+                slots[level][(entry.deadline >> shift) % SLOTS].push_back(std::move(entry));
+                return;
+            }
+        }
+        unsigned shift = SLOT_BITS * (LEVELS - 1);
+        slots[LEVELS - 1][((current >> shift) + SLOTS - 1) % SLOTS].push_back(std::move(entry));
+    }
+
+    void cascade(unsigned level)
+    {
+        std::vector<Entry> moving;
+        moving.swap(slots[level][(current >> (SLOT_BITS * level)) % SLOTS]);
+        for (Entry &entry : moving)
+        {
+            place(std::move(entry));
+        }
+    }
+};
+
+#endif
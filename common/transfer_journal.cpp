@@ -0,0 +1,175 @@
+#include "transfer_journal.h"
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <iterator>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    const uint32_t JOURNAL_MAGIC = 0x314A5446; // "FTJ1"
+    const uint32_t MAX_RANGES = 1 << 16;
+}
+
+TransferJournal::TransferJournal(const std::string &targetPath)
+    : journalPath(targetPath + ".journal"), partPath(targetPath + ".part"), fileSize(0), sourceStamp(0)
+{
+}
+
+bool TransferJournal::load(uint64_t expectedSize, uint64_t expectedStamp)
+{
+    reset(expectedSize, expectedStamp);
+
+    std::ifstream in(journalPath, std::ios::binary);
+    if (!in.is_open())
+    {
+        return false;
+    }
+
+    uint32_t magic = 0;
+    uint64_t storedSize = 0;
+    uint64_t storedStamp = 0;
+    uint32_t rangeCount = 0;
+    in.read((char *)&magic, sizeof(magic));
+    in.read((char *)&storedSize, sizeof(storedSize));
+    in.read((char *)&storedStamp, sizeof(storedStamp));
+    in.read((char *)&rangeCount, sizeof(rangeCount));
+    if (!in || magic != JOURNAL_MAGIC || storedSize != expectedSize || storedStamp != expectedStamp || rangeCount > MAX_RANGES)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < rangeCount; i++)
+    {
+        uint64_t start = 0;
+        uint64_t end = 0;
+        in.read((char *)&start, sizeof(start));
+        in.read((char *)&end, sizeof(end));
+        if (!in || start >= end || end > fileSize)
+        {
+            ranges.clear();
+            return false;
+        }
+        commit(start, end - start);
+    }
+
+    // Never trust ranges beyond what actually reached the partial file
+    std::error_code ec;
+    uint64_t partSize = fs::file_size(partPath, ec);
+    if (ec)
+    {
+        ranges.clear();
+        return false;
+    }
+    truncate(partSize);
+    return true;
+}
+
+void TransferJournal::reset(uint64_t newSize, uint64_t newStamp)
+{
+    fileSize = newSize;
+    sourceStamp = newStamp;
+    ranges.clear();
+}
+
+void TransferJournal::commit(uint64_t offset, uint64_t size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+
+    uint64_t start = offset;
+    uint64_t end = offset + size;
+    auto it = std::lower_bound(ranges.begin(), ranges.end(), std::make_pair(start, end));
+
+    // Absorb a touching predecessor, then every successor we overlap or touch
+    if (it != ranges.begin() && std::prev(it)->second >= start)
+    {
+        --it;
+        start = it->first;
+        end = std::max(end, it->second);
+        it = ranges.erase(it);
+    }
+    while (it != ranges.end() && it->first <= end)
+    {
+        end = std::max(end, it->second);
+        it = ranges.erase(it);
+    }
+    ranges.insert(it, std::make_pair(start, end));
+}
+
+uint64_t TransferJournal::committedPrefix() const
+{
+    return !ranges.empty() && ranges.front().first == 0 ? ranges.front().second : 0;
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> TransferJournal::missing(uint64_t start, uint64_t end) const
+{
+    std::vector<std::pair<uint64_t, uint64_t>> gaps;
+    for (const auto &range : ranges)
+    {
+        if (range.second <= start)
+            continue;
+        if (range.first >= end)
+            break;
+        if (range.first > start)
+            gaps.push_back(std::make_pair(start, range.first - start));
+        start = range.second;
+    }
+    if (end > start)
+    {
+        gaps.push_back(std::make_pair(start, end - start));
+    }
+    return gaps;
+}
+
+void TransferJournal::truncate(uint64_t end)
+{
+    while (!ranges.empty() && ranges.back().first >= end)
+    {
+        ranges.pop_back();
+    }
+    if (!ranges.empty())
+    {
+        ranges.back().second = std::min(ranges.back().second, end);
+    }
+}
+
+bool TransferJournal::save() const
+{
+    std::string tempPath = journalPath + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+        {
+            return false;
+        }
+
+        uint32_t rangeCount = static_cast<uint32_t>(std::min<size_t>(ranges.size(), MAX_RANGES));
+        out.write((const char *)&JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        out.write((const char *)&fileSize, sizeof(fileSize));
+        out.write((const char *)&sourceStamp, sizeof(sourceStamp));
+        out.write((const char *)&rangeCount, sizeof(rangeCount));
+        for (uint32_t i = 0; i < rangeCount; i++)
+        {
+            out.write((const char *)&ranges[i].first, sizeof(ranges[i].first));
+            out.write((const char *)&ranges[i].second, sizeof(ranges[i].second));
+        }
+        if (!out.flush())
+        {
+            return false;
+        }
+    }
+
+    // A crash mid-save leaves either the old journal or the new one, never a torn file
+    return MoveFileExA(tempPath.c_str(), journalPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+
+void TransferJournal::remove() const
+{
+    std::error_code ec;
+    fs::remove(journalPath, ec);
+    fs::remove(journalPath + ".tmp", ec);
+}
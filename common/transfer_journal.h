@@ -0,0 +1,44 @@
+#ifndef TRANSFER_JOURNAL_H
+#define TRANSFER_JOURNAL_H
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+// Tracks which byte ranges of a partial download are safely on disk. Data
+// goes to "<target>.part" and the journal to "<target>.journal"; the journal
+// is bound to the sender's file size and modification stamp so a changed
+// source never resumes onto stale data.
+class TransferJournal
+{
+public:
+    explicit TransferJournal(const std::string &targetPath);
+
+    // False when there is no usable journal for this source file
+    bool load(uint64_t fileSize, uint64_t sourceStamp);
+    void reset(uint64_t fileSize, uint64_t sourceStamp);
+
+    // Records [offset, offset + size) as written; adjacent ranges merge
+    void commit(uint64_t offset, uint64_t size);
+    uint64_t committedPrefix() const;
+    // [offset, length) pieces of [start, end) that are not committed yet
+    std::vector<std::pair<uint64_t, uint64_t>> missing(uint64_t start, uint64_t end) const;
+    // Forgets everything at or beyond `end`
+    void truncate(uint64_t end);
+
+    // Replaces the journal file atomically; call after flushing the data it covers
+    bool save() const;
+    void remove() const;
+
+    const std::string &getPartPath() const { return partPath; }
+
+private:
+    std::string journalPath;
+    std::string partPath;
+    uint64_t fileSize;
+    uint64_t sourceStamp;
+    std::vector<std::pair<uint64_t, uint64_t>> ranges; // sorted, disjoint [start, end)
+};
+
+#endif
@@ -0,0 +1,203 @@
+#include "transfer_pipeline.h"
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <algorithm>
+
+namespace
+{
+    uint64_t nowNanos()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    int busyPercent(const StageCounters &counters)
+    {
+        uint64_t busy = counters.busyNanos.load();
+        uint64_t total = busy + counters.waitNanos.load();
+        return total == 0 ? 0 : static_cast<int>(busy * 100 / total);
+    }
+}
+
+AdaptiveChunkSizer::AdaptiveChunkSizer(size_t minSize, size_t maxSize, size_t initialSize)
+    : minSize(minSize), maxSize(maxSize), currentSize(std::min(std::max(initialSize, minSize), maxSize)), smoothedRate(0)
+{
+}
+
+void AdaptiveChunkSizer::recordSend(size_t bytes, uint64_t nanos, uint64_t rttMicros)
+{
+    const uint64_t MIN_INTERVAL_NANOS = 5000000; // 5 ms
+
+    double sample = static_cast<double>(bytes) / static_cast<double>(std::max<uint64_t>(nanos, 1));
+    smoothedRate = smoothedRate == 0 ? sample : 0.75 * smoothedRate + 0.25 * sample;
+
+    uint64_t interval = std::max(MIN_INTERVAL_NANOS, 2 * rttMicros * 1000);
+    double desired = smoothedRate * static_cast<double>(interval);
+
+    // At most double or halve per step so one noisy sample cannot swing the size
+    size_t current = currentSize.load(std::memory_order_relaxed);
+    double bounded = std::min(std::max(desired, current / 2.0), current * 2.0);
+    size_t next = static_cast<size_t>(std::min(std::max(bounded, static_cast<double>(minSize)), static_cast<double>(maxSize)));
+    next -= next % minSize;
+    currentSize.store(std::max(next, minSize), std::memory_order_relaxed);
+}
+
+ChunkPipeline::ChunkPipeline(size_t chunkCapacity, unsigned workers, size_t depth)
+    : chunkCapacity(chunkCapacity), workers(std::max(1u, workers)), depth(depth)
+{
+    if (this->depth == 0)
+    {
+        this->depth = 2 * this->workers + 4;
+    }
+}
+
+unsigned ChunkPipeline::defaultWorkerCount()
+{
+    // Leave a core each for the source and sink stages
+    unsigned cores = std::thread::hardware_concurrency();
+    return cores > 2 ? cores - 2 : 1;
+}
+
+bool ChunkPipeline::run(const Source &source, const Stage &transform, const Stage &sink)
+{
+    std::vector<std::unique_ptr<PipelineChunk>> pool;
+    BoundedQueue<PipelineChunk *> freeChunks(depth);
+    BoundedQueue<PipelineChunk *> pending(depth);
+    for (size_t i = 0; i < depth; i++)
+    {
+        pool.push_back(std::make_unique<PipelineChunk>());
+        pool.back()->data.reserve(chunkCapacity);
+        freeChunks.push(pool.back().get());
+    }
+
+    // Reorder slots: at most `depth` chunks are in flight, so index % depth is unique
+    std::vector<PipelineChunk *> ready(depth, nullptr);
+    std::mutex readyMutex;
+    std::condition_variable readyChanged;
+    uint64_t produced = 0;
+    bool sourceDone = false;
+    std::atomic<bool> failed{false};
+
+    auto abort = [&]
+    {
+        failed = true;
+        freeChunks.close();
+        pending.close();
+        std::lock_guard<std::mutex> lock(readyMutex);
+        readyChanged.notify_all();
+    };
+
+    std::vector<std::thread> workerThreads;
+    for (unsigned w = 0; w < workers; w++)
+    {
+        workerThreads.emplace_back([&]
+                                   {
+            while (true)
+            {
+                PipelineChunk *chunk = nullptr;
+                uint64_t start = nowNanos();
+                if (!pending.pop(chunk))
+                    break;
+                uint64_t popped = nowNanos();
+                counters->transform.waitNanos.fetch_add(popped - start, std::memory_order_relaxed);
+
+                bool ok = transform(*chunk);
+                counters->transform.busyNanos.fetch_add(nowNanos() - popped, std::memory_order_relaxed);
+                counters->transform.items.fetch_add(1, std::memory_order_relaxed);
+                if (!ok)
+                {
+                    abort();
+                    break;
+                }
+
+                std::lock_guard<std::mutex> lock(readyMutex);
+                ready[chunk->index % depth] = chunk;
+                readyChanged.notify_all();
+            } });
+    }
+
+    std::thread sinkThread([&]
+                           {
+        for (uint64_t next = 0;; next++)
+        {
+            PipelineChunk *chunk = nullptr;
+            uint64_t start = nowNanos();
+            {
+                std::unique_lock<std::mutex> lock(readyMutex);
+                readyChanged.wait(lock, [&]
+                                  { return failed || ready[next % depth] != nullptr || (sourceDone && next == produced); });
+                if (failed || ready[next % depth] == nullptr)
+                    break;
+                chunk = ready[next % depth];
+                ready[next % depth] = nullptr;
+            }
+            uint64_t acquired = nowNanos();
+            counters->sink.waitNanos.fetch_add(acquired - start, std::memory_order_relaxed);
+
+            bool ok = sink(*chunk);
+            counters->sink.busyNanos.fetch_add(nowNanos() - acquired, std::memory_order_relaxed);
+            counters->sink.items.fetch_add(1, std::memory_order_relaxed);
+            if (!ok)
+            {
+                abort();
+                break;
+            }
+            freeChunks.push(chunk);
+        } });
+
+    // Source stage runs on the calling thread
+    while (!failed)
+    {
+        PipelineChunk *chunk = nullptr;
+        uint64_t start = nowNanos();
+        if (!freeChunks.pop(chunk))
+            break;
+        uint64_t acquired = nowNanos();
+        counters->source.waitNanos.fetch_add(acquired - start, std::memory_order_relaxed);
+
+        chunk->index = produced;
+        PipelineStatus status = source(*chunk);
+        counters->source.busyNanos.fetch_add(nowNanos() - acquired, std::memory_order_relaxed);
+
+        if (status == PipelineStatus::Failed)
+        {
+            abort();
+            break;
+        }
+        if (status == PipelineStatus::Done)
+            break;
+
+        counters->source.items.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(readyMutex);
+            produced++;
+        }
+        if (!pending.push(chunk))
+            break;
+    }
+
+    pending.close();
+    {
+        std::lock_guard<std::mutex> lock(readyMutex);
+        sourceDone = true;
+        readyChanged.notify_all();
+    }
+
+    for (auto &t : workerThreads)
+    {
+        t.join();
+    }
+    sinkThread.join();
+    return !failed;
+}
+
+std::string ChunkPipeline::occupancyReport() const
+{
+    std::stringstream ss;
+    ss << "source " << busyPercent(counters->source) << "% busy, "
+       << workers << " crypto workers " << busyPercent(counters->transform) << "% busy, "
+       << "sink " << busyPercent(counters->sink) << "% busy ("
+       << counters->sink.items.load() << " chunks)";
+    return ss.str();
+}
\ No newline at end of file
@@ -0,0 +1,142 @@
+#ifndef TRANSFER_PIPELINE_H
+#define TRANSFER_PIPELINE_H
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    // Blocks while full; returns false once the queue is closed
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this]
+                     { return closed || items.size() < capacity; });
+        if (closed)
+            return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // Blocks while empty; returns false once closed and drained
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this]
+                      { return closed || !items.empty(); });
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+private:
+    size_t capacity;
+    std::deque<T> items;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+};
+
+struct PipelineChunk
+{
+    uint64_t index = 0;  // position in the stream, defines sink order
+    uint64_t offset = 0; // file offset of the first byte
+    std::vector<BYTE> data;
+    const BYTE *source = nullptr; // when set, input bytes that the transform writes into `data`
+    std::vector<BYTE> scratch;    // second pooled buffer for transforms that change the size
+};
+
+enum class PipelineStatus
+{
+    Continue,
+    Done,
+    Failed
+};
+
+// Time a stage spent working versus blocked on its neighbours
+struct StageCounters
+{
+    std::atomic<uint64_t> busyNanos{0};
+    std::atomic<uint64_t> waitNanos{0};
+    std::atomic<uint64_t> items{0};
+};
+
+struct PipelineCounters
+{
+    StageCounters source;
+    StageCounters transform;
+    StageCounters sink;
+};
+
+// Sizes outgoing chunks from measured send throughput so each frame carries
+// about one target interval of data (at least two RTTs), clamped to
+// [minSize, maxSize] in minSize steps. recordSend is called by the sink only.
+class AdaptiveChunkSizer
+{
+public:
+    AdaptiveChunkSizer(size_t minSize, size_t maxSize, size_t initialSize);
+
+    size_t nextSize() const { return currentSize.load(std::memory_order_relaxed); }
+    void recordSend(size_t bytes, uint64_t nanos, uint64_t rttMicros);
+
+private:
+    size_t minSize;
+    size_t maxSize;
+    std::atomic<size_t> currentSize;
+    double smoothedRate; // bytes per nanosecond
+};
+
+// Three-stage chunk pipeline: a source on the calling thread, N transform
+// workers processing chunks independently, and a sink thread that consumes
+// chunks strictly in source order. A fixed pool of `depth` chunk buffers caps
+// memory at depth * chunk size and is recycled, so steady state allocates nothing.
+class ChunkPipeline
+{
+public:
+    using Source = std::function<PipelineStatus(PipelineChunk &)>;
+    using Stage = std::function<bool(PipelineChunk &)>;
+
+    ChunkPipeline(size_t chunkCapacity, unsigned workers = defaultWorkerCount(), size_t depth = 0);
+
+    bool run(const Source &source, const Stage &transform, const Stage &sink);
+    std::string occupancyReport() const;
+
+    // Counts stage times into `shared` instead of the pipeline's own
+    // counters, e.g. a TransferProgress's; must outlive run()
+    void publishCounters(PipelineCounters &shared) { counters = &shared; }
+
+    static unsigned defaultWorkerCount();
+
+private:
+    size_t chunkCapacity;
+    unsigned workers;
+    size_t depth;
+
+    PipelineCounters ownCounters;
+    PipelineCounters *counters = &ownCounters;
+};
+
+#endif
\ No newline at end of file
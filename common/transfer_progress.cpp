@@ -0,0 +1,198 @@
+#include "transfer_progress.h"
+#include "network_utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+namespace
+{
+    // Time constant of the smoothed rate, independent of the refresh interval
+    const double SMOOTHING_SECONDS = 5.0;
+
+    std::string formatBytes(double bytes)
+    {
+        static const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+        size_t unit = 0;
+        while (bytes >= 1024 && unit + 1 < sizeof(units) / sizeof(units[0]))
+        {
+            bytes /= 1024;
+            unit++;
+        }
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << bytes << " " << units[unit];
+        return text.str();
+    }
+
+    std::string formatDuration(double seconds)
+    {
+        uint64_t total = static_cast<uint64_t>(seconds + 0.5);
+        std::ostringstream text;
+        if (total >= 3600)
+        {
+            text << total / 3600 << ":" << std::setw(2) << std::setfill('0') << total / 60 % 60;
+        }
+        else
+        {
+            text << total / 60;
+        }
+        text << ":" << std::setw(2) << std::setfill('0') << total % 60;
+        return text.str();
+    }
+}
+
+std::atomic<unsigned> ProgressMonitor::refreshMillis{1000};
+std::atomic<unsigned> ProgressMonitor::stallSeconds{10};
+std::mutex ProgressMonitor::mutex;
+std::vector<TransferProgress *> ProgressMonitor::transfers;
+bool ProgressMonitor::running = false;
+
+TransferProgress::TransferProgress(const std::string &label, uint64_t totalBytes, uint64_t doneBytes)
+    : label(label), totalBytes(totalBytes), bytes(doneBytes), lastNanos(ProgressMonitor::nowNanos()), lastBytes(doneBytes),
+      lastMovedNanos(lastNanos)
+{
+    ProgressMonitor::add(this);
+}
+
+TransferProgress::~TransferProgress()
+{
+    ProgressMonitor::remove(this);
+}
+
+bool TransferProgress::sample(uint64_t nowNanos, uint64_t stallNanos, std::string &line)
+{
+    uint64_t done = bytes.load(std::memory_order_relaxed);
+    uint64_t chunkCount = chunks.load(std::memory_order_relaxed);
+    double seconds = (nowNanos - lastNanos) / 1e9;
+    if (seconds <= 0)
+    {
+        return false;
+    }
+
+    uint64_t moved = done - lastBytes;
+    uint64_t movedChunks = chunkCount - lastChunks;
+    double rate = moved / seconds;
+    double weight = 1.0 - std::exp(-seconds / SMOOTHING_SECONDS);
+    smoothedRate = smoothedRate < 0 ? rate : smoothedRate + weight * (rate - smoothedRate);
+    std::string stage = busiestStage();
+    lastNanos = nowNanos;
+    lastBytes = done;
+    lastChunks = chunkCount;
+
+    std::ostringstream text;
+    if (moved == 0)
+    {
+        if (stalled || stallNanos == 0 || done >= totalBytes || nowNanos - lastMovedNanos < stallNanos)
+        {
+            return false;
+        }
+        stalled = true;
+        text << label << ": STALLED at " << formatBytes(static_cast<double>(done)) << ", nothing for "
+             << formatDuration((nowNanos - lastMovedNanos) / 1e9);
+        line = text.str();
+        return true;
+    }
+    lastMovedNanos = nowNanos;
+    stalled = false;
+
+    int percent = totalBytes == 0 ? 100 : static_cast<int>(std::min(done, totalBytes) * 100 / totalBytes);
+    text << label << ": " << formatBytes(static_cast<double>(done)) << " of " << formatBytes(static_cast<double>(totalBytes)) << " ("
+         << percent << "%), " << formatBytes(rate) << "/s, avg " << formatBytes(smoothedRate) << "/s";
+    if (done < totalBytes && smoothedRate > 0)
+    {
+        text << ", ETA " << formatDuration((totalBytes - done) / smoothedRate);
+    }
+    if (movedChunks > 0)
+    {
+        text << ", " << formatBytes(static_cast<double>(moved) / movedChunks) << " chunks";
+    }
+    if (!stage.empty())
+    {
+        text << ", " << stage;
+    }
+    line = text.str();
+    return true;
+}
+
+std::string TransferProgress::busiestStage()
+{
+    static const char *names[] = {"source", "transform", "sink"};
+    const StageCounters *counters[] = {&stages.source, &stages.transform, &stages.sink};
+
+    int busiest = -1;
+    uint64_t busiestPercent = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        uint64_t busy = counters[i]->busyNanos.load(std::memory_order_relaxed);
+        uint64_t total = busy + counters[i]->waitNanos.load(std::memory_order_relaxed);
+        uint64_t busyDelta = busy - lastBusy[i];
+        uint64_t totalDelta = total - lastTotal[i];
+        lastBusy[i] = busy;
+        lastTotal[i] = total;
+        if (totalDelta > 0 && (busiest < 0 || busyDelta * 100 / totalDelta > busiestPercent))
+        {
+            busiest = i;
+            busiestPercent = busyDelta * 100 / totalDelta;
+        }
+    }
+    return busiest < 0 ? std::string() : std::string(names[busiest]) + " " + std::to_string(busiestPercent) + "% busy";
+}
+
+uint64_t ProgressMonitor::nowNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ProgressMonitor::add(TransferProgress *progress)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    transfers.push_back(progress);
+    if (!running)
+    {
+        running = true;
+        std::thread(run).detach();
+    }
+}
+
+void ProgressMonitor::remove(TransferProgress *progress)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    transfers.erase(std::remove(transfers.begin(), transfers.end(), progress), transfers.end());
+}
+
+void ProgressMonitor::run()
+{
+    std::vector<std::string> lines;
+    while (true)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(refreshMillis.load()));
+
+        // Lines are built under the lock, which keeps every sampled transfer
+        // alive, and printed after it so no transfer waits on the console
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (transfers.empty())
+            {
+                running = false;
+                return;
+            }
+            uint64_t now = nowNanos();
+            uint64_t stallNanos = static_cast<uint64_t>(stallSeconds.load()) * 1000000000ull;
+            lines.clear();
+            for (TransferProgress *progress : transfers)
+            {
+                std::string line;
+                if (progress->sample(now, stallNanos, line))
+                {
+                    lines.push_back(line);
+                }
+            }
+        }
+        for (const std::string &line : lines)
+        {
+            NetworkUtils::printMessage("PROGRESS", line);
+        }
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef TRANSFER_PROGRESS_H
+#define TRANSFER_PROGRESS_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include "transfer_pipeline.h"
+
+// Live counters of one transfer. The threads that move the data only add to
+// them with relaxed atomics; ProgressMonitor samples them on its own thread
+// and does all the formatting and printing.
+class TransferProgress
+{
+public:
+    // Registered with the monitor for the object's lifetime. `doneBytes` is
+    // where a resumed transfer starts.
+    TransferProgress(const std::string &label, uint64_t totalBytes, uint64_t doneBytes = 0);
+    ~TransferProgress();
+
+    TransferProgress(const TransferProgress &) = delete;
+    TransferProgress &operator=(const TransferProgress &) = delete;
+
+    void add(uint64_t size)
+    {
+        bytes.fetch_add(size, std::memory_order_relaxed);
+        chunks.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Stage times of the pipeline moving this transfer's data, if any
+    PipelineCounters stages;
+
+private:
+    friend class ProgressMonitor;
+
+    std::string label;
+    uint64_t totalBytes;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> chunks{0};
+
+    // Sampler state, only touched by the monitor thread
+    uint64_t lastNanos;
+    uint64_t lastBytes;
+    uint64_t lastChunks = 0;
+    uint64_t lastMovedNanos;
+    uint64_t lastBusy[3] = {0, 0, 0};
+    uint64_t lastTotal[3] = {0, 0, 0};
+    double smoothedRate = -1; // bytes per second
+    bool stalled = false;
+
+    // False when there is nothing new to show
+    bool sample(uint64_t nowNanos, uint64_t stallNanos, std::string &line);
+    std::string busiestStage();
+};
+
+// Samples every live TransferProgress on one background thread, started with
+// the first transfer and gone once none are left. Each refresh prints a line
+// per transfer that moved: bytes and percent, the rate over the last
+// interval, a smoothed rate and the ETA it gives, the average chunk size and
+// the busiest pipeline stage. A transfer that has not moved for the stall
+// timeout gets one STALLED line.
+class ProgressMonitor
+{
+public:
+    // Process-wide; take effect at the next refresh
+    static void setRefreshInterval(unsigned milliseconds) { refreshMillis = milliseconds < 100 ? 100 : milliseconds; }
+    static unsigned getRefreshInterval() { return refreshMillis; }
+    // Zero turns stall warnings off
+    static void setStallTimeout(unsigned seconds) { stallSeconds = seconds; }
+    static unsigned getStallTimeout() { return stallSeconds; }
+
+    static uint64_t nowNanos();
+
+private:
+    friend class TransferProgress;
+
+    static std::atomic<unsigned> refreshMillis;
+    static std::atomic<unsigned> stallSeconds;
+    static std::mutex mutex;
+    static std::vector<TransferProgress *> transfers;
+    static bool running;
+
+    static void add(TransferProgress *progress);
+    static void remove(TransferProgress *progress);
+    static void run();
+};
+
+#endif
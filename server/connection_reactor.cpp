@@ -0,0 +1,734 @@
+#include "connection_reactor.h"
+#include "../common/striped_transfer.h"
+
+namespace
+{
+    const ULONG_PTR SHUTDOWN_KEY = 1;
+    const ULONG MAX_COMPLETIONS = 64;
+    // I/O threads wake at least this often to drop overdue hellos
+    const DWORD GREETING_SWEEP_MS = 1000;
+}
+
+Connection::~Connection()
+{
+    if (socket != INVALID_SOCKET)
+    {
+        closesocket(socket);
+    }
+    for (const auto &stripe : stripes)
+    {
+        closesocket(stripe->getSocket());
+    }
+}
+
+ConnectionReactor::ConnectionReactor(SessionManager &sessionManager)
+    : sessionManager(sessionManager), completionPort(NULL)
+{
+}
+
+ConnectionReactor::~ConnectionReactor()
+{
+    stop();
+}
+
+bool ConnectionReactor::start(unsigned ioThreadCount, unsigned transferThreadCount, HelloHandler handler)
+{
+    helloHandler = std::move(handler);
+    completionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, ioThreadCount);
+    if (completionPort == NULL)
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to create completion port: " + std::to_string(GetLastError()));
+        return false;
+    }
+
+    running = true;
+    for (unsigned i = 0; i < ioThreadCount; i++)
+    {
+        ioThreads.emplace_back(&ConnectionReactor::ioWorker, this);
+    }
+    for (unsigned i = 0; i < transferThreadCount; i++)
+    {
+        transferThreads.emplace_back(&ConnectionReactor::transferWorker, this);
+    }
+
+    NetworkUtils::printMessage("REACTOR", "Started " + std::to_string(ioThreadCount) + " I/O threads and " +
+                                              std::to_string(transferThreadCount) + " transfer threads");
+    sessionManager.startExpiry([this](const Session &session)
+                               { return onSessionExpired(session); });
+    return true;
+}
+
+void ConnectionReactor::stop()
+{
+    if (!running.exchange(false))
+    {
+        return;
+    }
+    sessionManager.stopExpiry();
+    transferReady.notify_all();
+
+    // Cancelled operations queue their completions ahead of the shutdown keys
+    std::vector<std::shared_ptr<Connection>> remaining;
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        for (const auto &[uuid, conn] : connections)
+        {
+            remaining.push_back(conn);
+        }
+    }
+    for (const auto &conn : remaining)
+    {
+        closeConnection(conn);
+    }
+    sweepGreetings(true);
+
+    for (size_t i = 0; i < ioThreads.size(); i++)
+    {
+        PostQueuedCompletionStatus(completionPort, 0, SHUTDOWN_KEY, NULL);
+    }
+    for (auto &t : ioThreads)
+    {
+        t.join();
+    }
+    for (auto &t : transferThreads)
+    {
+        t.join();
+    }
+    ioThreads.clear();
+    transferThreads.clear();
+
+    // Completions the I/O threads left behind still hold their connections
+    OVERLAPPED_ENTRY entries[MAX_COMPLETIONS];
+    ULONG count = 0;
+    while (GetQueuedCompletionStatusEx(completionPort, entries, MAX_COMPLETIONS, &count, 0, FALSE))
+    {
+        for (ULONG i = 0; i < count; i++)
+        {
+            if (entries[i].lpCompletionKey != SHUTDOWN_KEY)
+            {
+                reinterpret_cast<IoContext *>(entries[i].lpOverlapped)->owner.reset();
+            }
+        }
+    }
+
+    CloseHandle(completionPort);
+    completionPort = NULL;
+}
+
+bool ConnectionReactor::acceptConnection(SOCKET socket, const std::string &address)
+{
+    if (CreateIoCompletionPort(reinterpret_cast<HANDLE>(socket), completionPort, 0, 0) == NULL)
+    {
+        NetworkUtils::printMessage("ERROR", "Failed to associate socket with completion port: " + std::to_string(GetLastError()));
+        closesocket(socket);
+        return false;
+    }
+
+    auto conn = std::make_shared<Connection>();
+    conn->socket = socket;
+    conn->address = address;
+    conn->challenge.resize(StripedTransfer::CHALLENGE_SIZE);
+    conn->helloBuffer.resize(sizeof(uint32_t));
+    conn->sendContext.operation = IoOperation::Send;
+    conn->recvContext.operation = IoOperation::Recv;
+    if (!CryptoUtils::randomBytes(conn->challenge.data(), conn->challenge.size()))
+    {
+        // The connection owns the socket now and closes it
+        NetworkUtils::printMessage("ERROR", "Cannot draw a hello challenge for " + address);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(greetingMutex);
+        greeting.emplace_back(std::chrono::steady_clock::now() + std::chrono::milliseconds(HELLO_TIMEOUT_MS), conn);
+    }
+
+    bool ok;
+    {
+        std::lock_guard<std::mutex> lock(conn->stateMutex);
+        queueFrame(*conn, conn->challenge);
+        ok = postSend(conn);
+    }
+    if (!ok)
+    {
+        closeConnection(conn);
+    }
+    return ok;
+}
+
+bool ConnectionReactor::addConnection(const std::shared_ptr<Connection> &conn, const std::string &clientUUID, const std::string &sessionId,
+                                      const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV, const std::vector<BYTE> &handshake,
+                                      bool integrityOnly)
+{
+    conn->clientUUID = clientUUID;
+    conn->sessionId = sessionId;
+    conn->aesKey = aesKey;
+    conn->aesIV = aesIV;
+    conn->cipher.reset(aesKey, aesIV);
+    conn->integrityOnly = integrityOnly;
+    conn->reader = std::make_unique<FrameReader>(conn->socket);
+
+    // A resumed client replaces the connection it dropped, which the server
+    // may not have noticed yet
+    std::shared_ptr<Connection> superseded;
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        std::shared_ptr<Connection> &entry = connections[clientUUID];
+        superseded = entry;
+        entry = conn;
+    }
+    if (superseded)
+    {
+        closeConnection(superseded);
+    }
+
+    bool ok;
+    {
+        std::lock_guard<std::mutex> lock(conn->stateMutex);
+        conn->state = ConnectionState::Handshake;
+        queueFrame(*conn, handshake);
+        ok = postSend(conn);
+    }
+    if (!ok)
+    {
+        closeConnection(conn);
+    }
+    return ok;
+}
+
+bool ConnectionReactor::attachStream(const std::shared_ptr<Connection> &stream, const std::string &clientUUID, const std::vector<BYTE> &proof)
+{
+    std::shared_ptr<Connection> conn;
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        auto it = connections.find(clientUUID);
+        if (it != connections.end())
+        {
+            conn = it->second;
+        }
+    }
+
+    if (!conn || !StripedTransfer::verifyJoinProof(proof, clientUUID, stream->challenge, conn->aesKey, conn->aesIV))
+    {
+        NetworkUtils::printMessage("ERROR", "Rejected stream join for unknown or unverified client " + clientUUID);
+        rejectConnection(stream);
+        return false;
+    }
+
+    // From here on the socket belongs to the client's stripes, not the reactor
+    SOCKET socket;
+    {
+        std::lock_guard<std::mutex> lock(stream->stateMutex);
+        socket = stream->socket;
+        stream->socket = INVALID_SOCKET;
+        stream->state = ConnectionState::Closing;
+    }
+
+    size_t streamCount;
+    {
+        std::lock_guard<std::mutex> stateLock(conn->stateMutex);
+        std::lock_guard<std::mutex> lock(conn->streamsMutex);
+        if (conn->state == ConnectionState::Closing || conn->stripes.size() + 1 >= StripedTransfer::MAX_STREAMS)
+        {
+            NetworkUtils::printMessage("ERROR", "Rejected stream join for client " + clientUUID);
+            closesocket(socket);
+            return false;
+        }
+        conn->stripes.push_back(std::make_unique<FrameReader>(socket));
+        streamCount = conn->stripes.size() + 1;
+    }
+
+    // The client waits for this before it counts the stream as usable
+    if (!NetworkUtils::sendData(socket, conn->cipher.encryptMessage({1})))
+    {
+        closeConnection(conn);
+        return false;
+    }
+    NetworkUtils::printMessage("SESSION", "Client " + clientUUID + " joined stream " + std::to_string(streamCount));
+    return true;
+}
+
+void ConnectionReactor::rejectConnection(const std::shared_ptr<Connection> &conn)
+{
+    closeConnection(conn);
+}
+
+std::vector<FrameReader *> ConnectionReactor::getStripes(Connection &conn)
+{
+    std::lock_guard<std::mutex> lock(conn.streamsMutex);
+    std::vector<FrameReader *> stripes;
+    for (const auto &stripe : conn.stripes)
+    {
+        stripes.push_back(stripe.get());
+    }
+    return stripes;
+}
+
+bool ConnectionReactor::submitCommand(const std::string &clientUUID, int command, TransferJob transfer)
+{
+    std::shared_ptr<Connection> conn;
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        auto it = connections.find(clientUUID);
+        if (it == connections.end())
+        {
+            return false;
+        }
+        conn = it->second;
+    }
+
+    bool ok;
+    {
+        std::lock_guard<std::mutex> lock(conn->stateMutex);
+        if (conn->state != ConnectionState::Idle)
+        {
+            NetworkUtils::printMessage("ERROR", "Client " + clientUUID + " is busy");
+            return false;
+        }
+
+        std::vector<BYTE> choiceData(sizeof(int));
+        memcpy(choiceData.data(), &command, sizeof(int));
+
+        conn->state = ConnectionState::Command;
+        conn->pendingCommand = command;
+        conn->pendingTransfer = std::move(transfer);
+        queueFrame(*conn, conn->cipher.encryptMessage(choiceData));
+        ok = postSend(conn);
+    }
+
+    if (!ok)
+    {
+        closeConnection(conn);
+        return false;
+    }
+    sessionManager.updateActivity(conn->sessionId);
+    return true;
+}
+
+std::vector<ConnectionInfo> ConnectionReactor::getConnections()
+{
+    std::vector<ConnectionInfo> result;
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    for (const auto &[uuid, conn] : connections)
+    {
+        std::lock_guard<std::mutex> stateLock(conn->stateMutex);
+        result.push_back({conn->clientUUID, conn->address, conn->state});
+    }
+    return result;
+}
+
+size_t ConnectionReactor::getConnectionCount()
+{
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    return connections.size();
+}
+
+void ConnectionReactor::ioWorker()
+{
+    OVERLAPPED_ENTRY entries[MAX_COMPLETIONS];
+
+    while (true)
+    {
+        ULONG count = 0;
+        BOOL dequeued = GetQueuedCompletionStatusEx(completionPort, entries, MAX_COMPLETIONS, &count, GREETING_SWEEP_MS, FALSE);
+        sweepGreetings(false);
+        if (!dequeued)
+        {
+            if (!running)
+                return;
+            continue;
+        }
+
+        for (ULONG i = 0; i < count; i++)
+        {
+            if (entries[i].lpCompletionKey == SHUTDOWN_KEY)
+            {
+                return;
+            }
+
+            IoContext *context = reinterpret_cast<IoContext *>(entries[i].lpOverlapped);
+            std::shared_ptr<Connection> conn = std::move(context->owner);
+            bool ok = context->overlapped.Internal == 0; // STATUS_SUCCESS
+
+            if (context->operation == IoOperation::Send)
+            {
+                onSendComplete(conn, entries[i].dwNumberOfBytesTransferred, ok);
+            }
+            else
+            {
+                onRecvComplete(conn, entries[i].dwNumberOfBytesTransferred, ok);
+            }
+        }
+    }
+}
+
+void ConnectionReactor::transferWorker()
+{
+    while (true)
+    {
+        std::shared_ptr<Connection> conn;
+        {
+            std::unique_lock<std::mutex> lock(transferMutex);
+            transferReady.wait(lock, [this]
+                               { return !running || !transferQueue.empty(); });
+            if (!running)
+                return;
+            conn = transferQueue.front();
+            transferQueue.pop_front();
+        }
+
+        TransferJob job;
+        {
+            std::lock_guard<std::mutex> lock(conn->stateMutex);
+            job = std::move(conn->pendingTransfer);
+            conn->pendingTransfer = nullptr;
+        }
+
+        // The socket stays associated with the port; blocking calls on it simply
+        // do not queue completions, so the existing FileTransfer path is reused.
+        bool ok = job ? job(*conn) : true;
+
+        bool close = !ok;
+        if (ok)
+        {
+            std::lock_guard<std::mutex> lock(conn->stateMutex);
+            if (conn->state == ConnectionState::Transfer)
+            {
+                conn->state = ConnectionState::Idle;
+                if (!conn->recvPending && !postRecv(conn))
+                {
+                    close = true;
+                }
+            }
+        }
+        sessionManager.updateActivity(conn->sessionId);
+
+        if (close)
+        {
+            closeConnection(conn);
+        }
+    }
+}
+
+void ConnectionReactor::onSendComplete(const std::shared_ptr<Connection> &conn, DWORD bytes, bool ok)
+{
+    bool close = !ok;
+    bool dispatch = false;
+
+    if (ok)
+    {
+        std::lock_guard<std::mutex> lock(conn->stateMutex);
+        conn->sendOffset += bytes;
+
+        if (conn->state == ConnectionState::Closing)
+        {
+            return;
+        }
+        if (conn->sendOffset < conn->sendBuffer.size())
+        {
+            close = !postSend(conn);
+        }
+        else if (conn->state == ConnectionState::Greeting)
+        {
+            conn->state = ConnectionState::Hello;
+            close = !postHelloRecv(conn);
+        }
+        else if (conn->state == ConnectionState::Handshake)
+        {
+            NetworkUtils::printMessage("SESSION", "Keys delivered to client " + conn->clientUUID);
+            conn->state = ConnectionState::Idle;
+            close = !postRecv(conn);
+        }
+        else if (conn->state == ConnectionState::Command)
+        {
+            if (conn->pendingCommand == 6)
+            {
+                NetworkUtils::printMessage("DISCONNECTION", "Disconnecting client: " + conn->clientUUID);
+                close = true;
+            }
+            else if (conn->pendingTransfer)
+            {
+                conn->state = ConnectionState::Transfer;
+                dispatch = true;
+            }
+            else
+            {
+                conn->state = ConnectionState::Idle;
+                if (!conn->recvPending)
+                {
+                    close = !postRecv(conn);
+                }
+            }
+        }
+    }
+
+    if (dispatch)
+    {
+        {
+            std::lock_guard<std::mutex> lock(transferMutex);
+            transferQueue.push_back(conn);
+        }
+        transferReady.notify_one();
+    }
+    if (close)
+    {
+        closeConnection(conn);
+    }
+}
+
+void ConnectionReactor::onRecvComplete(const std::shared_ptr<Connection> &conn, DWORD bytes, bool ok)
+{
+    std::vector<BYTE> hello;
+    {
+        std::lock_guard<std::mutex> lock(conn->stateMutex);
+        conn->recvPending = false;
+
+        if (conn->state == ConnectionState::Hello)
+        {
+            // A read of no bytes is the client hanging up mid-hello
+            bool complete = false;
+            bool reading = ok && bytes > 0 && advanceHello(conn, bytes, complete);
+            if (reading && !complete)
+            {
+                return;
+            }
+            if (complete)
+            {
+                // Past the hello the sweep leaves the connection alone
+                conn->state = ConnectionState::Handshake;
+                hello.assign(conn->helloBuffer.begin() + sizeof(uint32_t), conn->helloBuffer.end());
+                std::vector<BYTE>().swap(conn->helloBuffer);
+            }
+        }
+        else
+        {
+            // Once a transfer owns the socket, readiness belongs to the transfer
+            if (conn->state == ConnectionState::Command || conn->state == ConnectionState::Transfer ||
+                conn->state == ConnectionState::Closing)
+            {
+                return;
+            }
+
+            // Clients never send unsolicited data while idle: a completed zero-byte
+            // read with nothing buffered is an orderly close.
+            u_long available = 0;
+            if (ok && ioctlsocket(conn->socket, FIONREAD, &available) == 0 && available > 0)
+            {
+                NetworkUtils::printMessage("ERROR", "Unexpected data from idle client " + conn->clientUUID);
+            }
+        }
+    }
+
+    if (!hello.empty())
+    {
+        helloHandler(conn, hello);
+        return;
+    }
+    closeConnection(conn);
+}
+
+bool ConnectionReactor::advanceHello(const std::shared_ptr<Connection> &conn, DWORD bytes, bool &complete)
+{
+    conn->helloReceived += bytes;
+    if (conn->helloReceived == sizeof(uint32_t))
+    {
+        // Only now is the buffer sized, and never past the cap
+        uint32_t size = 0;
+        memcpy(&size, conn->helloBuffer.data(), sizeof(size));
+        if (size == 0 || size > StripedTransfer::MAX_HELLO_SIZE)
+        {
+            NetworkUtils::printMessage("ERROR", "Rejected a " + std::to_string(size) + " byte hello from " + conn->address);
+            return false;
+        }
+        conn->helloBuffer.resize(sizeof(uint32_t) + size);
+    }
+
+    complete = conn->helloReceived == conn->helloBuffer.size();
+    return complete || postHelloRecv(conn);
+}
+
+void ConnectionReactor::sweepGreetings(bool all)
+{
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::shared_ptr<Connection>> overdue;
+    {
+        std::lock_guard<std::mutex> lock(greetingMutex);
+        while (!greeting.empty() && (all || greeting.front().first <= now))
+        {
+            if (std::shared_ptr<Connection> conn = greeting.front().second.lock())
+            {
+                overdue.push_back(conn);
+            }
+            greeting.pop_front();
+        }
+    }
+
+    for (const auto &conn : overdue)
+    {
+        {
+            std::lock_guard<std::mutex> lock(conn->stateMutex);
+            if ((conn->state != ConnectionState::Greeting && conn->state != ConnectionState::Hello) || !beginClose(*conn))
+            {
+                continue;
+            }
+        }
+        NetworkUtils::printMessage("ERROR", "No hello from " + conn->address);
+    }
+}
+
+bool ConnectionReactor::postSend(const std::shared_ptr<Connection> &conn)
+{
+    IoContext &context = conn->sendContext;
+    ZeroMemory(&context.overlapped, sizeof(context.overlapped));
+    context.buffer.buf = reinterpret_cast<char *>(conn->sendBuffer.data() + conn->sendOffset);
+    context.buffer.len = static_cast<ULONG>(conn->sendBuffer.size() - conn->sendOffset);
+    context.owner = conn;
+
+    if (WSASend(conn->socket, &context.buffer, 1, NULL, 0, &context.overlapped, NULL) == SOCKET_ERROR &&
+        WSAGetLastError() != WSA_IO_PENDING)
+    {
+        context.owner.reset();
+        NetworkUtils::printMessage("ERROR", "WSASend failed: " + NetworkUtils::getSocketErrorString(WSAGetLastError()));
+        return false;
+    }
+    return true;
+}
+
+bool ConnectionReactor::postHelloRecv(const std::shared_ptr<Connection> &conn)
+{
+    IoContext &context = conn->recvContext;
+    ZeroMemory(&context.overlapped, sizeof(context.overlapped));
+    context.buffer.buf = reinterpret_cast<char *>(conn->helloBuffer.data() + conn->helloReceived);
+    context.buffer.len = static_cast<ULONG>(conn->helloBuffer.size() - conn->helloReceived);
+    context.owner = conn;
+
+    DWORD flags = 0;
+    if (WSARecv(conn->socket, &context.buffer, 1, NULL, &flags, &context.overlapped, NULL) == SOCKET_ERROR &&
+        WSAGetLastError() != WSA_IO_PENDING)
+    {
+        context.owner.reset();
+        return false;
+    }
+    conn->recvPending = true;
+    return true;
+}
+
+bool ConnectionReactor::postRecv(const std::shared_ptr<Connection> &conn)
+{
+    // Zero-byte read: signals readiness without pinning a buffer per idle connection
+    IoContext &context = conn->recvContext;
+    ZeroMemory(&context.overlapped, sizeof(context.overlapped));
+    context.buffer.buf = NULL;
+    context.buffer.len = 0;
+    context.owner = conn;
+
+    DWORD flags = 0;
+    if (WSARecv(conn->socket, &context.buffer, 1, NULL, &flags, &context.overlapped, NULL) == SOCKET_ERROR &&
+        WSAGetLastError() != WSA_IO_PENDING)
+    {
+        context.owner.reset();
+        return false;
+    }
+    conn->recvPending = true;
+    return true;
+}
+
+void ConnectionReactor::queueFrame(Connection &conn, const std::vector<BYTE> &payload)
+{
+    uint32_t size = static_cast<uint32_t>(payload.size());
+    conn.sendBuffer.resize(sizeof(size) + payload.size());
+    memcpy(conn.sendBuffer.data(), &size, sizeof(size));
+    if (!payload.empty())
+    {
+        memcpy(conn.sendBuffer.data() + sizeof(size), payload.data(), payload.size());
+    }
+    conn.sendOffset = 0;
+}
+
+bool ConnectionReactor::onSessionExpired(const Session &session)
+{
+    std::shared_ptr<Connection> conn;
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        auto it = connections.find(session.clientUUID);
+        if (it != connections.end() && it->second->sessionId == session.sessionId)
+        {
+            conn = it->second;
+        }
+    }
+    if (!conn)
+    {
+        return true;
+    }
+    {
+        // A running command or transfer is activity the session has not seen
+        // yet. The session is expired and the connection marked closing under
+        // one lock, so a command either starts first and keeps both, or finds
+        // the connection closing; a touch since the copy also keeps both.
+        std::lock_guard<std::mutex> lock(conn->stateMutex);
+        if (conn->state == ConnectionState::Command || conn->state == ConnectionState::Transfer ||
+            !sessionManager.expireSession(session) || !beginClose(*conn))
+        {
+            return false;
+        }
+    }
+    NetworkUtils::printMessage("SESSION", "Closed idle client " + conn->clientUUID);
+    finishClose(conn);
+    return true;
+}
+
+bool ConnectionReactor::beginClose(Connection &conn)
+{
+    if (conn.state == ConnectionState::Closing)
+    {
+        return false;
+    }
+    conn.state = ConnectionState::Closing;
+    // A transfer worker may still be using the sockets, so they are only
+    // shut down: its calls fail, pending operations complete with an error
+    // and drop their references, and the last one closes the handles
+    if (conn.socket != INVALID_SOCKET)
+    {
+        shutdown(conn.socket, SD_BOTH);
+        CancelIoEx(reinterpret_cast<HANDLE>(conn.socket), NULL);
+    }
+
+    std::lock_guard<std::mutex> streamsLock(conn.streamsMutex);
+    for (const auto &stripe : conn.stripes)
+    {
+        shutdown(stripe->getSocket(), SD_BOTH);
+    }
+    return true;
+}
+
+void ConnectionReactor::closeConnection(const std::shared_ptr<Connection> &conn)
+{
+    {
+        std::lock_guard<std::mutex> lock(conn->stateMutex);
+        if (!beginClose(*conn))
+        {
+            return;
+        }
+    }
+    finishClose(conn);
+}
+
+void ConnectionReactor::finishClose(const std::shared_ptr<Connection> &conn)
+{
+    if (conn->clientUUID.empty())
+    {
+        // Never got past its hello, so there is no session to drop
+        NetworkUtils::printMessage("DISCONNECTION", "Dropped connection from " + conn->address);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        auto it = connections.find(conn->clientUUID);
+        if (it != connections.end() && it->second == conn)
+        {
+            connections.erase(it);
+        }
+    }
+    sessionManager.removeSession(conn->sessionId);
+    NetworkUtils::printMessage("DISCONNECTION", "Client disconnected: " + conn->clientUUID);
+}
\ No newline at end of file
@@ -0,0 +1,170 @@
+#ifndef CONNECTION_REACTOR_H
+#define CONNECTION_REACTOR_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <condition_variable>
+#include "../common/network_utils.h"
+#include "../common/crypto_utils.h"
+#include "../common/session_manager.h"
+
+// Per-connection protocol phase, driven by I/O completions
+enum class ConnectionState
+{
+    Greeting,  // hello challenge in flight
+    Hello,     // reading the client's hello
+    Handshake, // session keys in flight
+    Idle,      // waiting for an operator command
+    Command,   // encrypted command frame in flight
+    Transfer,  // file transfer running on a transfer worker
+    Closing
+};
+
+enum class IoOperation
+{
+    Send,
+    Recv
+};
+
+struct Connection;
+
+struct IoContext
+{
+    OVERLAPPED overlapped; // must stay first, completions hand back this pointer
+    IoOperation operation;
+    WSABUF buffer;
+    std::shared_ptr<Connection> owner; // keeps the connection alive while the operation is pending
+};
+
+// Owns its socket and its stripes' sockets, which are closed only with the
+// last reference, so no transfer worker or pending operation can outlive
+// the handle and reach a new connection that Winsock gave the same value
+struct Connection
+{
+    ~Connection();
+
+    SOCKET socket = INVALID_SOCKET;
+    std::string address;
+    std::string clientUUID;
+    std::string sessionId;
+    std::vector<BYTE> challenge;   // sent before the hello, which has to answer it
+    std::vector<BYTE> helloBuffer; // [u32 size][hello] while it is being read
+    size_t helloReceived = 0;
+    std::vector<BYTE> aesKey;
+    std::vector<BYTE> aesIV;
+    CipherContext cipher;
+    bool integrityOnly = false; // client opted out of encrypting file data
+    std::unique_ptr<FrameReader> reader; // blocking reads during transfers, owned by the transfer worker
+
+    std::mutex streamsMutex;
+    std::vector<std::unique_ptr<FrameReader>> stripes; // extra connections joined to this session, blocking only
+
+    std::mutex stateMutex;
+    ConnectionState state = ConnectionState::Greeting;
+    IoContext sendContext;
+    IoContext recvContext;
+    std::vector<BYTE> sendBuffer; // framed message currently being written
+    size_t sendOffset = 0;
+    bool recvPending = false;
+    int pendingCommand = 0;
+    std::function<bool(Connection &)> pendingTransfer;
+};
+
+struct ConnectionInfo
+{
+    std::string clientUUID;
+    std::string address;
+    ConnectionState state;
+};
+
+// IOCP reactor: a fixed set of I/O threads drives every connection through
+// greeting -> hello -> handshake -> idle -> command -> transfer. Idle
+// connections only hold a zero-byte read, so they cost no thread and no
+// receive buffer. Blocking file transfers run on a bounded transfer pool
+// instead of a thread per client.
+class ConnectionReactor
+{
+public:
+    using TransferJob = std::function<bool(Connection &)>;
+    // Given a greeted connection and its hello; ends in addConnection,
+    // attachStream or rejectConnection. Runs on an I/O thread.
+    using HelloHandler = std::function<void(const std::shared_ptr<Connection> &conn, const std::vector<BYTE> &hello)>;
+
+    // A hello that is not complete by then drops the connection
+    static const DWORD HELLO_TIMEOUT_MS = 5000;
+
+    explicit ConnectionReactor(SessionManager &sessionManager);
+    ~ConnectionReactor();
+
+    bool start(unsigned ioThreads, unsigned transferThreads, HelloHandler helloHandler);
+    void stop();
+
+    // Takes over an accepted socket: sends its challenge and reads its hello
+    // on the I/O threads, so the caller never waits on the client
+    bool acceptConnection(SOCKET socket, const std::string &address);
+    bool addConnection(const std::shared_ptr<Connection> &conn, const std::string &clientUUID, const std::string &sessionId,
+                       const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV, const std::vector<BYTE> &handshake,
+                       bool integrityOnly = false);
+    // Moves a greeted connection into an existing client's striping streams
+    // once it proves it holds the session key
+    bool attachStream(const std::shared_ptr<Connection> &conn, const std::string &clientUUID, const std::vector<BYTE> &proof);
+    void rejectConnection(const std::shared_ptr<Connection> &conn);
+    bool submitCommand(const std::string &clientUUID, int command, TransferJob transfer = nullptr);
+    static std::vector<FrameReader *> getStripes(Connection &conn);
+    std::vector<ConnectionInfo> getConnections();
+    size_t getConnectionCount();
+
+private:
+    SessionManager &sessionManager;
+    HelloHandler helloHandler;
+    HANDLE completionPort;
+    std::atomic<bool> running{false};
+    std::vector<std::thread> ioThreads;
+    std::vector<std::thread> transferThreads;
+
+    std::mutex connectionsMutex;
+    std::map<std::string, std::shared_ptr<Connection>> connections;
+
+    // Connections still owing a hello, oldest first
+    std::mutex greetingMutex;
+    std::deque<std::pair<std::chrono::steady_clock::time_point, std::weak_ptr<Connection>>> greeting;
+
+    std::mutex transferMutex;
+    std::condition_variable transferReady;
+    std::deque<std::shared_ptr<Connection>> transferQueue;
+
+    void ioWorker();
+    void transferWorker();
+    void onSendComplete(const std::shared_ptr<Connection> &conn, DWORD bytes, bool ok);
+    void onRecvComplete(const std::shared_ptr<Connection> &conn, DWORD bytes, bool ok);
+    bool postSend(const std::shared_ptr<Connection> &conn);
+    bool postRecv(const std::shared_ptr<Connection> &conn);
+    // Reads the rest of the hello frame into helloBuffer
+    bool postHelloRecv(const std::shared_ptr<Connection> &conn);
+    // Accounts for `bytes` more of the hello; false if it is oversized or the
+    // next read cannot be posted. Sets `complete` once the whole frame is in.
+    bool advanceHello(const std::shared_ptr<Connection> &conn, DWORD bytes, bool &complete);
+    // Drops greeted connections whose hello is overdue
+    void sweepGreetings(bool all);
+    void queueFrame(Connection &conn, const std::vector<BYTE> &payload);
+    // Closes the idle connection of an expired session; false while it is
+    // busy or was active since the expiry thread looked at it
+    bool onSessionExpired(const Session &session);
+    void closeConnection(const std::shared_ptr<Connection> &conn);
+    // The two halves of closeConnection: beginClose runs under the
+    // connection's state lock and is false if it was already closing. It
+    // only shuts the sockets down and cancels their I/O; they are closed
+    // when the connection goes away.
+    bool beginClose(Connection &conn);
+    void finishClose(const std::shared_ptr<Connection> &conn);
+};
+
+#endif
\ No newline at end of file
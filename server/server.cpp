@@ -3,24 +3,58 @@
 #include <thread>
 #include <filesystem>
 #include <vector>
-#include <map>
+#include <algorithm>
 #include <atomic>
+#include <memory>
 #include "../common/network_utils.h"
 #include "../common/crypto_utils.h"
 #include "../common/file_transfer.h"
 #include "../common/session_manager.h"
+#include "../common/session_ticket.h"
+#include "../common/striped_transfer.h"
+#include "../common/batch_transfer.h"
+#include "../common/ranged_transfer.h"
+#include "../common/io_engine.h"
+#include "../common/logger.h"
+#include "../common/transfer_progress.h"
+#include "../common/chunk_store.h"
+#include "connection_reactor.h"
 
 namespace fs = std::filesystem;
 
+// A stored upload rebuilt for one command, in a directory of its own so two
+// commands restoring the same file never share a path. Removed with the last
+// reference, whether the command ran, failed or was never dispatched.
+class RestoredFile
+{
+public:
+    explicit RestoredFile(fs::path directory) : directory(std::move(directory)) {}
+    RestoredFile(const RestoredFile &) = delete;
+    RestoredFile &operator=(const RestoredFile &) = delete;
+
+    ~RestoredFile()
+    {
+        std::error_code ec;
+        fs::remove_all(directory, ec);
+    }
+
+    const fs::path &getDirectory() const { return directory; }
+
+private:
+    fs::path directory;
+};
+
 class FileServer
 {
 private:
     SOCKET serverSocket;
     SessionManager sessionManager;
-    std::map<std::string, std::string> clientUUIDs;
+    ConnectionReactor reactor{sessionManager};
     std::atomic<bool> running{true};
     std::string receivedDir = "received_files";
     std::string serverFilesDir = "server_files";
+    std::string storeDir = "chunk_store";
+    ChunkStore chunkStore;
 
 public:
     FileServer() : serverSocket(INVALID_SOCKET)
@@ -33,14 +67,20 @@ public:
     {
         if (!NetworkUtils::initialize())
         {
-            std::cout << "Failed to initialize Winsock" << std::endl;
+            Logger::console() << "Failed to initialize Winsock" << std::endl;
+            return false;
+        }
+
+        if (!CryptoUtils::selfTest())
+        {
+            Logger::console() << "Refusing to start with a broken cipher" << std::endl;
             return false;
         }
 
-        serverSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        serverSocket = NetworkUtils::createSocket();
         if (serverSocket == INVALID_SOCKET)
         {
-            std::cout << "Failed to create socket" << std::endl;
+            Logger::console() << "Failed to create socket" << std::endl;
             return false;
         }
 
@@ -51,25 +91,67 @@ public:
 
         if (bind(serverSocket, (sockaddr *)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR)
         {
-            std::cout << "Bind failed on port " << port << std::endl;
+            Logger::console() << "Bind failed on port " << port << std::endl;
             closesocket(serverSocket);
             return false;
         }
 
         if (listen(serverSocket, SOMAXCONN) == SOCKET_ERROR)
         {
-            std::cout << "Listen failed" << std::endl;
+            Logger::console() << "Listen failed" << std::endl;
             closesocket(serverSocket);
             return false;
         }
 
-        std::cout << "=== FILE TRANSFER SERVER ===" << std::endl;
-        std::cout << "Server started on port " << port << std::endl;
-        std::cout << "Waiting for client connections..." << std::endl;
+        Logger::console() << "=== FILE TRANSFER SERVER ===" << std::endl;
+        Logger::console() << "Server started on port " << port << std::endl;
+        Logger::console() << "Waiting for client connections..." << std::endl;
         return true;
     }
 
     void run()
+    {
+        unsigned cores = std::max(2u, std::thread::hardware_concurrency());
+        if (!reactor.start(std::max(2u, cores / 4), cores, [this](const std::shared_ptr<Connection> &conn, const std::vector<BYTE> &hello)
+                           { dispatchHello(conn, hello); }))
+        {
+            Logger::console() << "Failed to start connection reactor" << std::endl;
+            return;
+        }
+
+        std::thread acceptThread(&FileServer::acceptLoop, this);
+        consoleLoop();
+
+        stop();
+        acceptThread.join();
+    }
+
+    // Uploads go into a deduplicating chunk store instead of received_files
+    bool enableChunkStore()
+    {
+        if (!chunkStore.open(storeDir))
+        {
+            return false;
+        }
+        FileTransfer::setChunkStore(&chunkStore);
+        NetworkUtils::printMessage("STORE", "Storing uploads in " + storeDir + " (" + std::to_string(chunkStore.list().size()) + " files, " +
+                                                std::to_string(chunkStore.storedBytes()) + " bytes of chunks)");
+        return true;
+    }
+
+    void stop()
+    {
+        running = false;
+        if (serverSocket != INVALID_SOCKET)
+        {
+            closesocket(serverSocket);
+            serverSocket = INVALID_SOCKET;
+        }
+        reactor.stop();
+    }
+
+private:
+    void acceptLoop()
     {
         while (running)
         {
@@ -90,137 +172,254 @@ public:
             std::string clientAddress = std::string(clientIP) + ":" + std::to_string(ntohs(clientAddr.sin_port));
 
             NetworkUtils::printMessage("CONNECTION", "Client connected: " + clientAddress);
-
-            // Handle client in separate thread
-            std::thread clientThread(&FileServer::handleClient, this, clientSocket, clientAddress);
-            clientThread.detach();
+            NetworkUtils::configureSocket(clientSocket);
+            reactor.acceptConnection(clientSocket, clientAddress);
         }
     }
 
-    void stop()
+    // The first frame from the client, read by the reactor after it sent the
+    // connection's challenge, says whether this is a new client, a returning
+    // one or another stream of an existing one
+    void dispatchHello(const std::shared_ptr<Connection> &conn, const std::vector<BYTE> &hello)
     {
-        running = false;
-        closesocket(serverSocket);
+        if (hello[0] == StripedTransfer::HELLO_NEW_CLIENT)
+        {
+            bool integrityOnly = hello.size() > 1 && (hello[1] & StripedTransfer::HELLO_OPTION_INTEGRITY_ONLY);
+            registerClient(conn, integrityOnly);
+            return;
+        }
+        if (hello[0] == StripedTransfer::HELLO_RESUME_SESSION)
+        {
+            resumeClient(conn, hello);
+            return;
+        }
+
+        std::string clientUUID;
+        std::vector<BYTE> proof;
+        if (!StripedTransfer::parseJoinHello(hello, clientUUID, proof))
+        {
+            NetworkUtils::printMessage("ERROR", "Malformed hello from " + conn->address);
+            reactor.rejectConnection(conn);
+            return;
+        }
+        reactor.attachStream(conn, clientUUID, proof);
     }
 
-private:
-    void handleClient(SOCKET clientSocket, const std::string &clientAddress)
+    // A refused resumption gets the new session behind a RESUME_REFUSED byte
+    void registerClient(const std::shared_ptr<Connection> &conn, bool integrityOnly, bool resumeRefused = false)
     {
         std::string clientUUID = CryptoUtils::generateUUID();
         std::vector<BYTE> aesKey, aesIV;
         CryptoUtils::generateAESKey(aesKey, aesIV);
 
-        std::string sessionId = sessionManager.createSession(clientUUID, aesKey, aesIV);
-        clientUUIDs[std::to_string((long long)clientSocket)] = clientUUID;
+        std::string sessionId = sessionManager.createSession(clientUUID, aesKey, aesIV, integrityOnly ? SessionClass::IntegrityOnly : SessionClass::Standard);
 
-        NetworkUtils::printMessage("SESSION", "Created session for client " + clientUUID);
+        NetworkUtils::printMessage("SESSION", "Created session for client " + clientUUID + (integrityOnly ? " (integrity-only)" : ""));
 
-        try
+        // Session keys are delivered by the reactor as the handshake phase
+        std::vector<BYTE> keyData;
+        if (resumeRefused)
         {
-            // Send session keys to client
-            std::vector<BYTE> keyData;
-            keyData.insert(keyData.end(), aesKey.begin(), aesKey.end());
-            keyData.insert(keyData.end(), aesIV.begin(), aesIV.end());
+            keyData.push_back(SessionTicket::RESUME_REFUSED);
+        }
+        keyData.insert(keyData.end(), aesKey.begin(), aesKey.end());
+        keyData.insert(keyData.end(), aesIV.begin(), aesIV.end());
 
-            uint32_t uuidSize = static_cast<uint32_t>(clientUUID.size());
-            keyData.insert(keyData.end(), (BYTE *)&uuidSize, (BYTE *)&uuidSize + sizeof(uuidSize));
-            keyData.insert(keyData.end(), clientUUID.begin(), clientUUID.end());
+        uint32_t uuidSize = static_cast<uint32_t>(clientUUID.size());
+        keyData.insert(keyData.end(), (BYTE *)&uuidSize, (BYTE *)&uuidSize + sizeof(uuidSize));
+        keyData.insert(keyData.end(), clientUUID.begin(), clientUUID.end());
 
-            std::cout << "Sending encryption keys to client (size: " << keyData.size() << " bytes)..." << std::endl;
-            if (!NetworkUtils::sendData(clientSocket, keyData))
-            {
-                NetworkUtils::printMessage("ERROR", "Failed to send keys to client");
-                closesocket(clientSocket);
-                return;
-            }
-            std::cout << "Encryption keys sent successfully!" << std::endl;
+        // Followed by a resumption ticket, when tickets are enabled
+        std::vector<BYTE> ticket = SessionTicket::issue({clientUUID, aesKey, aesIV, integrityOnly});
+        if (!ticket.empty())
+        {
+            uint32_t ticketSize = static_cast<uint32_t>(ticket.size());
+            keyData.insert(keyData.end(), (BYTE *)&ticketSize, (BYTE *)&ticketSize + sizeof(ticketSize));
+            keyData.insert(keyData.end(), ticket.begin(), ticket.end());
+        }
 
-            bool clientRunning = true;
-            while (clientRunning && running)
-            {
-                showMenu(clientUUID);
-                int choice = getMenuChoice();
+        if (!reactor.addConnection(conn, clientUUID, sessionId, aesKey, aesIV, keyData, integrityOnly))
+        {
+            NetworkUtils::printMessage("ERROR", "Failed to send keys to client");
+        }
+    }
 
-                if (choice == 0)
-                    continue; // Invalid choice
+    // Restores a session from its ticket alone; any server holding the ticket
+    // key can do this, once the client proves it holds the session key.
+    void resumeClient(const std::shared_ptr<Connection> &conn, const std::vector<BYTE> &hello)
+    {
+        const std::string &clientAddress = conn->address;
+        BYTE options = 0;
+        std::vector<BYTE> ticket, proof;
+        if (!SessionTicket::parseResumeHello(hello, options, ticket, proof))
+        {
+            NetworkUtils::printMessage("ERROR", "Malformed hello from " + clientAddress);
+            reactor.rejectConnection(conn);
+            return;
+        }
 
-                std::cout << "Sending command " << choice << " to client..." << std::endl;
+        SessionTicket::Contents contents;
+        if (!SessionTicket::open(ticket, contents))
+        {
+            NetworkUtils::printMessage("SESSION", "Refused resumption ticket from " + clientAddress);
+            registerClient(conn, (options & StripedTransfer::HELLO_OPTION_INTEGRITY_ONLY) != 0, true);
+            return;
+        }
+        if (!SessionTicket::verifyResumeProof(proof, ticket, conn->challenge, contents))
+        {
+            NetworkUtils::printMessage("ERROR", "Resumption ticket from " + clientAddress + " presented without its session key");
+            reactor.rejectConnection(conn);
+            return;
+        }
 
-                // Send choice to client - FIXED: Use simple XOR encryption
-                std::vector<BYTE> choiceData(sizeof(int));
-                memcpy(choiceData.data(), &choice, sizeof(int));
+        std::string sessionId = sessionManager.createSession(contents.clientUUID, contents.aesKey, contents.aesIV,
+                                                             contents.integrityOnly ? SessionClass::IntegrityOnly : SessionClass::Standard);
+        if (sessionId.empty())
+        {
+            NetworkUtils::printMessage("ERROR", "Cannot restore the session in the ticket from " + clientAddress);
+            reactor.rejectConnection(conn);
+            return;
+        }
+        NetworkUtils::printMessage("SESSION", "Resumed session for client " + contents.clientUUID);
 
-                std::cout << "Command data size: " << choiceData.size() << " bytes" << std::endl;
+        // The renewed ticket goes under the session key, which only the client holds
+        CipherContext cipher(contents.aesKey, contents.aesIV);
+        std::vector<BYTE> handshake = {SessionTicket::RESUME_ACCEPTED};
+        std::vector<BYTE> renewed = cipher.encryptMessage(SessionTicket::issue(contents));
+        handshake.insert(handshake.end(), renewed.begin(), renewed.end());
 
-                // Use XOR encryption (always works)
-                auto encryptedChoice = CryptoUtils::aesEncrypt(aesKey, aesIV, choiceData);
+        if (!reactor.addConnection(conn, contents.clientUUID, sessionId, contents.aesKey, contents.aesIV, handshake, contents.integrityOnly))
+        {
+            NetworkUtils::printMessage("ERROR", "Failed to resume client " + contents.clientUUID);
+        }
+    }
 
-                if (encryptedChoice.empty())
-                {
-                    std::cout << "ERROR: Encryption returned empty data!" << std::endl;
-                    break;
-                }
+    void consoleLoop()
+    {
+        while (running)
+        {
+            std::string clientUUID = selectClient();
+            if (clientUUID.empty())
+                continue;
 
-                std::cout << "Encrypted command size: " << encryptedChoice.size() << " bytes" << std::endl;
+            showMenu(clientUUID);
+            int choice = getMenuChoice();
 
-                if (!NetworkUtils::sendData(clientSocket, encryptedChoice))
-                {
-                    NetworkUtils::printMessage("ERROR", "Failed to send choice to client");
-                    break;
-                }
-                std::cout << "Command sent successfully!" << std::endl;
+            if (choice == 0)
+                continue; // Invalid choice
 
-                sessionManager.updateActivity(sessionId);
+            handleCommand(clientUUID, choice);
+        }
+    }
 
-                switch (choice)
-                {
-                case 1:
-                    waitForFile(clientSocket, aesKey, aesIV, clientUUID);
-                    break;
-                case 2:
-                    sendFileToClient(clientSocket, aesKey, aesIV, clientUUID);
-                    break;
-                case 3:
-                    listReceivedFiles();
-                    break;
-                case 4:
-                    listServerFiles();
-                    break;
-                case 5:
-                    listConnectedClients();
-                    break;
-                case 6:
-                    NetworkUtils::printMessage("DISCONNECTION", "Disconnecting client: " + clientUUID);
-                    clientRunning = false;
-                    break;
-                default:
-                    std::cout << "Invalid option!" << std::endl;
-                }
+    std::string selectClient()
+    {
+        auto clients = reactor.getConnections();
+
+        Logger::console() << "\n--- Connected Clients ---" << std::endl;
+        if (clients.empty())
+        {
+            Logger::console() << "No clients connected." << std::endl;
+        }
+        for (size_t i = 0; i < clients.size(); i++)
+        {
+            Logger::console() << "  " << i + 1 << ". " << clients[i].clientUUID << " (" << clients[i].address << ")" << std::endl;
+        }
+        Logger::console() << "Select client (Enter to refresh): ";
+
+        std::string input;
+        if (!std::getline(std::cin, input))
+        {
+            running = false;
+            return "";
+        }
+
+        try
+        {
+            int clientNum = std::stoi(input);
+            if (clientNum >= 1 && clientNum <= static_cast<int>(clients.size()))
+            {
+                return clients[clientNum - 1].clientUUID;
             }
         }
-        catch (const std::exception &e)
+        catch (...)
         {
-            NetworkUtils::printMessage("ERROR", "Client handling error: " + std::string(e.what()));
+            // Refresh
         }
+        return "";
+    }
 
-        // Cleanup
-        sessionManager.removeSession(sessionId);
-        clientUUIDs.erase(std::to_string((long long)clientSocket));
-        closesocket(clientSocket);
-        NetworkUtils::printMessage("DISCONNECTION", "Client disconnected: " + clientUUID);
+    void handleCommand(const std::string &clientUUID, int choice)
+    {
+        switch (choice)
+        {
+        case 1:
+            Logger::console() << "Waiting for file from client " << clientUUID << "..." << std::endl;
+            reactor.submitCommand(clientUUID, choice, [this](Connection &conn)
+                                  { return waitForFile(conn, ConnectionReactor::getStripes(conn)); });
+            break;
+        case 2:
+        {
+            std::shared_ptr<RestoredFile> restored;
+            std::string filePath = selectServerFile(restored);
+            if (filePath.empty())
+                break;
+
+            // The job holds the restored copy, if any, until it is done with it
+            reactor.submitCommand(clientUUID, choice, [this, filePath, restored](Connection &conn)
+                                  { return sendFileToClient(conn, ConnectionReactor::getStripes(conn), filePath); });
+            break;
+        }
+        case 3:
+            reactor.submitCommand(clientUUID, choice);
+            listReceivedFiles();
+            break;
+        case 4:
+            reactor.submitCommand(clientUUID, choice);
+            listServerFiles();
+            break;
+        case 5:
+            reactor.submitCommand(clientUUID, choice);
+            listConnectedClients();
+            break;
+        case 6:
+            reactor.submitCommand(clientUUID, choice);
+            break;
+        case 7:
+            Logger::console() << "Waiting for folder from client " << clientUUID << "..." << std::endl;
+            reactor.submitCommand(clientUUID, choice, [this](Connection &conn)
+                                  { return waitForFolder(conn); });
+            break;
+        case 8:
+        {
+            std::shared_ptr<RestoredFile> restored;
+            std::string filePath = selectServerFile(restored);
+            if (filePath.empty())
+                break;
+
+            Logger::console() << "Serving ranges of " << filePath << " to client " << clientUUID << "..." << std::endl;
+            reactor.submitCommand(clientUUID, choice, [this, filePath, restored](Connection &conn)
+                                  { return serveFileRanges(conn, filePath); });
+            break;
+        }
+        default:
+            Logger::console() << "Invalid option!" << std::endl;
+        }
     }
 
     void showMenu(const std::string &clientUUID)
     {
-        std::cout << "\n--- Server Menu ---" << std::endl;
-        std::cout << "Client UUID: " << clientUUID << std::endl;
-        std::cout << "1. Wait for file from client" << std::endl;
-        std::cout << "2. Send file to client" << std::endl;
-        std::cout << "3. Show received files" << std::endl;
-        std::cout << "4. Show server files" << std::endl;
-        std::cout << "5. Show connected clients" << std::endl;
-        std::cout << "6. Disconnect client" << std::endl;
-        std::cout << "Choose option: ";
+        Logger::console() << "\n--- Server Menu ---" << std::endl;
+        Logger::console() << "Client UUID: " << clientUUID << std::endl;
+        Logger::console() << "1. Wait for file from client" << std::endl;
+        Logger::console() << "2. Send file to client" << std::endl;
+        Logger::console() << "3. Show received files" << std::endl;
+        Logger::console() << "4. Show server files" << std::endl;
+        Logger::console() << "5. Show connected clients" << std::endl;
+        Logger::console() << "6. Disconnect client" << std::endl;
+        Logger::console() << "7. Wait for folder from client" << std::endl;
+        Logger::console() << "8. Serve file ranges to client" << std::endl;
+        Logger::console() << "Choose option: ";
     }
 
     int getMenuChoice()
@@ -234,32 +433,42 @@ private:
         }
         catch (...)
         {
-            std::cout << "Invalid input! Please enter a number 1-6." << std::endl;
+            Logger::console() << "Invalid input! Please enter a number 1-8." << std::endl;
             return 0;
         }
     }
 
-    void waitForFile(SOCKET clientSocket, const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV, const std::string &clientUUID)
+    bool waitForFile(Connection &conn, const std::vector<FrameReader *> &stripes)
     {
-        std::cout << "Waiting for file from client " << clientUUID << "..." << std::endl;
-        std::cout << "Client should now be asking for file selection..." << std::endl;
-
-        if (FileTransfer::receiveFile(clientSocket, aesKey, aesIV, receivedDir))
+        if (FileTransfer::receiveFile(*conn.reader, conn.cipher, receivedDir, stripes, conn.integrityOnly))
         {
-            std::cout << "File received successfully from " << clientUUID << "!" << std::endl;
+            NetworkUtils::printMessage("SUCCESS", "File received successfully from " + conn.clientUUID);
+            return true;
         }
-        else
+
+        NetworkUtils::printMessage("ERROR", "Failed to receive file from " + conn.clientUUID + ", client may have cancelled");
+        return false;
+    }
+
+    // Many small files in one packed stream instead of one transfer each
+    bool waitForFolder(Connection &conn)
+    {
+        if (BatchTransfer::receive(*conn.reader, conn.cipher, receivedDir))
         {
-            std::cout << "Failed to receive file from " << clientUUID << std::endl;
-            std::cout << "Client may have cancelled or encountered an error." << std::endl;
+            NetworkUtils::printMessage("SUCCESS", "Folder received successfully from " + conn.clientUUID);
+            return true;
         }
+
+        NetworkUtils::printMessage("ERROR", "Failed to receive folder from " + conn.clientUUID + ", client may have cancelled");
+        return false;
     }
 
-    void sendFileToClient(SOCKET clientSocket, const std::vector<BYTE> &aesKey, const std::vector<BYTE> &aesIV, const std::string &clientUUID)
+    // A file picked from the chunk store is rebuilt into `restored`
+    std::string selectServerFile(std::shared_ptr<RestoredFile> &restored)
     {
         // Show available server files
         std::vector<std::string> files;
-        std::cout << "\nFiles available in 'server_files' folder:" << std::endl;
+        Logger::console() << "\nFiles available in 'server_files' folder:" << std::endl;
 
         int count = 0;
         for (const auto &entry : fs::directory_iterator(serverFilesDir))
@@ -267,18 +476,33 @@ private:
             if (entry.is_regular_file())
             {
                 files.push_back(entry.path().string());
-                std::cout << "  " << ++count << ". " << entry.path().filename().string();
-                std::cout << " (" << entry.file_size() << " bytes)" << std::endl;
+                Logger::console() << "  " << ++count << ". " << entry.path().filename().string();
+                Logger::console() << " (" << entry.file_size() << " bytes)" << std::endl;
             }
         }
 
         if (count == 0)
         {
-            std::cout << "  No files found in server_files folder." << std::endl;
-            std::cout << "  Place files there or enter full path." << std::endl;
+            Logger::console() << "  No files found in server_files folder." << std::endl;
+            Logger::console() << "  Place files there or enter full path." << std::endl;
         }
 
-        std::cout << "\nEnter file path or number: ";
+        // Stored uploads continue the numbering
+        std::vector<ChunkStore::StoredFile> stored;
+        if (chunkStore.isOpen())
+        {
+            stored = chunkStore.list();
+        }
+        if (!stored.empty())
+        {
+            Logger::console() << "\nFiles in the chunk store:" << std::endl;
+        }
+        for (size_t i = 0; i < stored.size(); i++)
+        {
+            Logger::console() << "  " << count + i + 1 << ". " << stored[i].name << " (" << stored[i].size << " bytes, " << stored[i].chunkCount << " chunks)" << std::endl;
+        }
+
+        Logger::console() << "\nEnter file path or number: ";
         std::string filePath;
         std::getline(std::cin, filePath);
 
@@ -290,6 +514,10 @@ private:
             {
                 filePath = files[fileNum - 1];
             }
+            else if (fileNum > count && fileNum <= count + static_cast<int>(stored.size()))
+            {
+                filePath = restoreStoredFile(stored[fileNum - count - 1].name, restored);
+            }
         }
         catch (...)
         {
@@ -298,81 +526,200 @@ private:
 
         if (!fs::exists(filePath))
         {
-            std::cout << "File not found: " << filePath << std::endl;
-            return;
+            Logger::console() << "File not found: " << filePath << std::endl;
+            return "";
         }
+        return filePath;
+    }
 
-        std::cout << "Sending file to client..." << std::endl;
+    fs::path restoredDir() const
+    {
+        return fs::path(storeDir) / "restored";
+    }
 
-        if (FileTransfer::sendFile(clientSocket, aesKey, aesIV, filePath))
+    // Rebuilds a stored upload from its chunks so it can be sent like any
+    // other file. The copy keeps its name, which the client receives, inside
+    // a directory unique to this restore.
+    std::string restoreStoredFile(const std::string &name, std::shared_ptr<RestoredFile> &restored)
+    {
+        restored = std::make_shared<RestoredFile>(restoredDir() / CryptoUtils::generateUUID());
+        std::error_code ec;
+        fs::create_directories(restored->getDirectory(), ec);
+        std::string path = (restored->getDirectory() / name).string();
+        if (!chunkStore.restore(name, path))
         {
-            std::cout << "File sent successfully to " << clientUUID << "!" << std::endl;
+            Logger::console() << "Cannot restore " << name << " from the chunk store" << std::endl;
+            restored.reset();
+            return "";
         }
-        else
+        return path;
+    }
+
+    bool sendFileToClient(Connection &conn, const std::vector<FrameReader *> &stripes, const std::string &filePath)
+    {
+        if (FileTransfer::sendFile(*conn.reader, conn.cipher, filePath, stripes, conn.integrityOnly))
+        {
+            NetworkUtils::printMessage("SUCCESS", "File sent successfully to " + conn.clientUUID);
+            return true;
+        }
+
+        NetworkUtils::printMessage("ERROR", "Failed to send file to " + conn.clientUUID);
+        return false;
+    }
+
+    // The client picks the ranges and fetches them over all of its streams
+    bool serveFileRanges(Connection &conn, const std::string &filePath)
+    {
+        std::vector<FrameReader *> streams(1, conn.reader.get());
+        std::vector<FrameReader *> stripes = ConnectionReactor::getStripes(conn);
+        streams.insert(streams.end(), stripes.begin(), stripes.end());
+        if (RangedTransfer::serve(streams, conn.cipher, filePath))
         {
-            std::cout << "Failed to send file to " << clientUUID << std::endl;
+            return true;
         }
+
+        NetworkUtils::printMessage("ERROR", "Failed to serve ranges to " + conn.clientUUID);
+        return false;
     }
 
     void listReceivedFiles()
     {
-        std::cout << "\n--- Received Files ---" << std::endl;
+        Logger::console() << "\n--- Received Files ---" << std::endl;
         int count = 0;
         for (const auto &entry : fs::directory_iterator(receivedDir))
         {
             if (entry.is_regular_file())
             {
-                std::cout << ++count << ". " << entry.path().filename().string();
-                std::cout << " (" << entry.file_size() << " bytes)" << std::endl;
+                Logger::console() << ++count << ". " << entry.path().filename().string();
+                Logger::console() << " (" << entry.file_size() << " bytes)" << std::endl;
+            }
+            else if (entry.is_directory())
+            {
+                Logger::console() << ++count << ". " << entry.path().filename().string() << "\\ (folder)" << std::endl;
+            }
+        }
+        if (chunkStore.isOpen())
+        {
+            for (const auto &file : chunkStore.list())
+            {
+                Logger::console() << ++count << ". " << file.name << " (" << file.size << " bytes, stored as " << file.chunkCount << " chunks)" << std::endl;
             }
         }
         if (count == 0)
         {
-            std::cout << "No files received yet." << std::endl;
+            Logger::console() << "No files received yet." << std::endl;
         }
     }
 
     void listServerFiles()
     {
-        std::cout << "\n--- Server Files ---" << std::endl;
+        Logger::console() << "\n--- Server Files ---" << std::endl;
         int count = 0;
         for (const auto &entry : fs::directory_iterator(serverFilesDir))
         {
             if (entry.is_regular_file())
             {
-                std::cout << ++count << ". " << entry.path().filename().string();
-                std::cout << " (" << entry.file_size() << " bytes)" << std::endl;
+                Logger::console() << ++count << ". " << entry.path().filename().string();
+                Logger::console() << " (" << entry.file_size() << " bytes)" << std::endl;
             }
         }
         if (count == 0)
         {
-            std::cout << "No files in server_files folder." << std::endl;
+            Logger::console() << "No files in server_files folder." << std::endl;
         }
     }
 
     void listConnectedClients()
     {
-        std::cout << "\n--- Connected Clients ---" << std::endl;
-        std::cout << "Total: " << sessionManager.getActiveSessionCount() << " clients" << std::endl;
-        for (const auto &[socketStr, uuid] : clientUUIDs)
+        Logger::console() << "\n--- Connected Clients ---" << std::endl;
+        Logger::console() << "Total: " << sessionManager.getActiveSessionCount() << " clients" << std::endl;
+        for (const auto &client : reactor.getConnections())
         {
-            std::cout << "UUID: " << uuid << std::endl;
+            Logger::console() << "UUID: " << client.clientUUID << " (" << client.address << ")" << std::endl;
         }
     }
 };
 
-int main()
+int main(int argc, char *argv[])
 {
+    // --flush none|interval|complete sets when uploads are forced to disk;
+    // --io auto|rio|blocking picks the bulk send engine;
+    // --compress offers LZ compression on downloads;
+    // --dedup keeps uploads in a deduplicating chunk store;
+    // --progress MS sets how often transfer progress is shown;
+    // --session-timeout MIN and --integrity-timeout MIN set how long standard
+    // and integrity-only sessions may sit idle;
+    // --ticket-key FILE shares the resumption ticket key between server
+    // processes, creating the file if needed (default: a key per process);
+    // --ticket-lifetime HOURS sets how long a ticket stays valid
+    bool dedup = false;
+    std::string ticketKeyPath;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--compress")
+        {
+            FileTransfer::setCompression(true);
+        }
+        else if (arg == "--dedup")
+        {
+            dedup = true;
+        }
+        else if (arg == "--flush" && i + 1 < argc)
+        {
+            FlushPolicy policy;
+            if (parseFlushPolicy(argv[++i], policy))
+                FileTransfer::setFlushPolicy(policy);
+            else
+                Logger::console() << "Unknown flush policy: " << argv[i] << std::endl;
+        }
+        else if (arg == "--io" && i + 1 < argc)
+        {
+            IoBackend backend;
+            if (SendEngine::parseBackend(argv[++i], backend))
+                SendEngine::setBackend(backend);
+            else
+                Logger::console() << "Unknown I/O backend: " << argv[i] << std::endl;
+        }
+        else if (arg == "--progress" && i + 1 < argc)
+        {
+            ProgressMonitor::setRefreshInterval(static_cast<unsigned>(std::max(0, atoi(argv[++i]))));
+        }
+        else if ((arg == "--session-timeout" || arg == "--integrity-timeout") && i + 1 < argc)
+        {
+            SessionClass sessionClass = arg == "--session-timeout" ? SessionClass::Standard : SessionClass::IntegrityOnly;
+            SessionManager::setTimeout(sessionClass, std::chrono::minutes(std::max(1, atoi(argv[++i]))));
+        }
+        else if (arg == "--ticket-key" && i + 1 < argc)
+        {
+            ticketKeyPath = argv[++i];
+        }
+        else if (arg == "--ticket-lifetime" && i + 1 < argc)
+        {
+            SessionTicket::setLifetime(std::chrono::hours(std::max(1, atoi(argv[++i]))));
+        }
+    }
+
+    if (!(ticketKeyPath.empty() ? SessionTicket::generateKey() : SessionTicket::loadKey(ticketKeyPath)))
+    {
+        Logger::console() << "Failed to set up the resumption ticket key; reconnecting clients will get new sessions" << std::endl;
+    }
+
     FileServer server;
+    if (dedup && !server.enableChunkStore())
+    {
+        Logger::console() << "Failed to open the chunk store" << std::endl;
+        return 1;
+    }
 
-    std::cout << "Starting file transfer server..." << std::endl;
+    Logger::console() << "Starting file transfer server..." << std::endl;
     if (server.start(8080))
     {
         server.run();
     }
     else
     {
-        std::cout << "Failed to start server!" << std::endl;
+        Logger::console() << "Failed to start server!" << std::endl;
     }
 
     server.stop();